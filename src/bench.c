@@ -0,0 +1,336 @@
+// Benchmark suite: runs fixed-seed scenarios over a range of particle counts
+// with each gravity solver, timing every phase of update_particles, and
+// reports the results as JSON.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "particle.h"
+#include "initial_conditions.h"
+#include "force_kernel.h"
+#include "morton.h"
+#include "collision.h"
+#include "telemetry.h"
+#include "utils.h"
+
+// World area per particle, so density stays the same at every N. Light bodies
+// (radius 4-6) keep merges rare enough that N stays close to nominal
+#define BENCH_AREA_PER_PARTICLE 10000.0f
+
+// Run parameters and their defaults
+typedef struct {
+    int minN;
+    int maxN;
+    int steps;              // Timed steps per run
+    int warmupSteps;        // Untimed steps before timing starts
+    float dt;
+    unsigned int seed;
+    int threads;            // 0 = one per logical CPU
+    int reorderInterval;    // Steps between Morton reorders, 0 = never
+    float skin;             // Collision neighbor list skin, 0 = none
+    int scenarios[INITIAL_COUNT];   // Indexed by InitialCondition, non-zero to run
+    int solvers[SOLVER_COUNT];      // Indexed by GravitySolver, non-zero to run
+    const char* outputPath; // JSON destination, NULL for stdout
+} BenchOptions;
+
+// Phase totals over the timed steps of one run
+typedef struct {
+    double gridSeconds;
+    double forceSeconds;
+    double collisionSeconds;
+    double integrationSeconds;
+    long long interactions;
+    long long forceEvaluations;
+    long long substeps;
+    int neighborRebuilds;           // Steps that rebuilt the collision neighbor list
+    double stepP50Seconds;          // Median step time
+    double stepP99Seconds;
+    int finalParticles;
+    size_t memoryBytes;
+} BenchResult;
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --min-n N         Smallest particle count (default 100)\n"
+        "  --max-n N         Largest particle count, stepping by 10x (default 1000000)\n"
+        "  --steps N         Timed steps per run (default 10)\n"
+        "  --warmup N        Untimed steps before timing (default 1)\n"
+        "  --dt SECONDS      Time step (default 0.016)\n"
+        "  --seed N          Random seed (default 1)\n"
+        "  --threads N       Worker threads, 0 = all CPUs (default 0)\n"
+        "  --reorder-every N Steps between Morton reorders, 0 = never (default %d)\n"
+        "  --skin F          Collision neighbor list skin, 0 = none (default %.0f)\n"
+        "  --scenarios LIST  Comma-separated: uniform,plummer,disk,clustered (default all)\n"
+        "  --solvers LIST    Comma-separated: grid,bh,pm (default all)\n"
+        "  --output PATH     Write JSON here instead of stdout\n"
+        "  --help            Show this message\n",
+        program, MORTON_DEFAULT_INTERVAL, COLLISION_DEFAULT_SKIN);
+}
+
+// Enable the scenarios named in a comma-separated list
+static int parse_scenarios(const char* list, int* enabled) {
+    memset(enabled, 0, INITIAL_COUNT * sizeof(int));
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    for (char* name = strtok(buffer, ","); name; name = strtok(NULL, ",")) {
+        InitialCondition scenario;
+        if (parse_initial_condition(name, &scenario) != 0) {
+            fprintf(stderr, "Unknown scenario: %s\n", name);
+            return -1;
+        }
+        enabled[scenario] = 1;
+    }
+    return 0;
+}
+
+// Enable the solvers named in a comma-separated list
+static int parse_solvers(const char* list, int* enabled) {
+    memset(enabled, 0, SOLVER_COUNT * sizeof(int));
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    for (char* name = strtok(buffer, ","); name; name = strtok(NULL, ",")) {
+        GravitySolver solver;
+        if (parse_gravity_solver(name, &solver) != 0) {
+            fprintf(stderr, "Unknown solver: %s\n", name);
+            return -1;
+        }
+        enabled[solver] = 1;
+    }
+    return 0;
+}
+
+// Parse the command line. Returns 0 on success, 1 if help was shown, -1 on error
+static int parse_options(int argc, char* argv[], BenchOptions* opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        // Every other option takes a value
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return -1;
+        }
+        const char* value = argv[++i];
+
+        if (strcmp(arg, "--min-n") == 0) {
+            opts->minN = atoi(value);
+        } else if (strcmp(arg, "--max-n") == 0) {
+            opts->maxN = atoi(value);
+        } else if (strcmp(arg, "--steps") == 0) {
+            opts->steps = atoi(value);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            opts->warmupSteps = atoi(value);
+        } else if (strcmp(arg, "--dt") == 0) {
+            opts->dt = (float)atof(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->seed = (unsigned int)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts->threads = atoi(value);
+        } else if (strcmp(arg, "--reorder-every") == 0) {
+            opts->reorderInterval = atoi(value);
+        } else if (strcmp(arg, "--skin") == 0) {
+            opts->skin = (float)atof(value);
+        } else if (strcmp(arg, "--scenarios") == 0) {
+            if (parse_scenarios(value, opts->scenarios) != 0) return -1;
+        } else if (strcmp(arg, "--solvers") == 0) {
+            if (parse_solvers(value, opts->solvers) != 0) return -1;
+        } else if (strcmp(arg, "--output") == 0) {
+            opts->outputPath = value;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return -1;
+        }
+    }
+
+    if (opts->minN < 1 || opts->maxN < opts->minN || opts->steps < 1 ||
+        opts->warmupSteps < 0 || opts->dt <= 0.0f) {
+        fprintf(stderr, "Invalid benchmark parameters\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Fill a square world of side `size` with `count` light particles laid out per scenario
+static ParticleSystem* create_scenario(InitialCondition scenario, int count, float size, unsigned int seed) {
+    InitialConditionParams params;
+    default_initial_conditions(&params, count, seed);
+    params.type = scenario;
+    params.maxX = size - SPAWN_MARGIN;
+    params.maxY = size - SPAWN_MARGIN;
+    params.minMass = 1.0f;
+    params.maxMass = 4.0f;
+    return generate_particles(&params);
+}
+
+// Run one scenario/solver/N combination
+static int run_case(const BenchOptions* opts, InitialCondition scenario, GravitySolver solver, int count,
+                    BenchResult* result) {
+    float size = sqrtf(BENCH_AREA_PER_PARTICLE * count);
+    if (size < 4.0f * SPAWN_MARGIN) size = 4.0f * SPAWN_MARGIN;
+
+    set_world_bounds(size, size);
+    set_gravity_solver(solver);
+
+    // About one particle per mesh cell, the usual Particle-Mesh resolution
+    set_pm_mesh_size((int)sqrtf((float)count));
+
+    // Restarts the reorder cycle, so the first warmup step sorts the new particles
+    set_reorder_interval(opts->reorderInterval);
+
+    ParticleSystem* ps = create_scenario(scenario, count, size, opts->seed);
+    if (!ps) {
+        fprintf(stderr, "Failed to create particles!\n");
+        return -1;
+    }
+
+    for (int step = 0; step < opts->warmupSteps; step++) {
+        update_particles(ps, opts->dt);
+    }
+
+    memset(result, 0, sizeof(*result));
+    Telemetry telemetry;
+    init_telemetry(&telemetry);
+    for (int step = 0; step < opts->steps; step++) {
+        update_particles(ps, opts->dt);
+
+        const StepStats* stats = get_step_stats();
+        telemetry_record_step(&telemetry, stats);
+        result->gridSeconds += stats->gridSeconds;
+        result->forceSeconds += stats->forceSeconds;
+        result->collisionSeconds += stats->collisionSeconds;
+        result->integrationSeconds += stats->integrationSeconds;
+        result->interactions += stats->interactions;
+        result->forceEvaluations += stats->forceEvaluations;
+        result->substeps += stats->substeps;
+        result->neighborRebuilds += stats->neighborListRebuilt;
+    }
+
+    result->stepP50Seconds = telemetry_percentile(&telemetry, TELEMETRY_PHASE_STEP, 0.50);
+    result->stepP99Seconds = telemetry_percentile(&telemetry, TELEMETRY_PHASE_STEP, 0.99);
+    result->finalParticles = get_step_stats()->activeParticles;
+    result->memoryBytes = particle_memory_usage(ps) + solver_memory_usage();
+
+    free_particles(ps);
+    return 0;
+}
+
+// Append one result object to the JSON array
+static void write_result(FILE* out, int first, const BenchOptions* opts, InitialCondition scenario,
+                         GravitySolver solver, int count, const BenchResult* result) {
+    double steps = opts->steps;
+    double total = result->gridSeconds + result->forceSeconds +
+                   result->collisionSeconds + result->integrationSeconds;
+
+    fprintf(out, "%s\n    {\n", first ? "" : ",");
+    fprintf(out, "      \"scenario\": \"%s\",\n", initial_condition_name(scenario));
+    fprintf(out, "      \"solver\": \"%s\",\n", gravity_solver_name(solver));
+    if (solver == SOLVER_PM) {
+        fprintf(out, "      \"mesh\": %d,\n", get_pm_mesh_size());
+    }
+    fprintf(out, "      \"n\": %d,\n", count);
+    fprintf(out, "      \"final_n\": %d,\n", result->finalParticles);
+    fprintf(out, "      \"steps\": %d,\n", opts->steps);
+    fprintf(out, "      \"grid_ms\": %.6f,\n", 1e3 * result->gridSeconds / steps);
+    fprintf(out, "      \"force_ms\": %.6f,\n", 1e3 * result->forceSeconds / steps);
+    fprintf(out, "      \"collision_ms\": %.6f,\n", 1e3 * result->collisionSeconds / steps);
+    fprintf(out, "      \"integration_ms\": %.6f,\n", 1e3 * result->integrationSeconds / steps);
+    fprintf(out, "      \"step_ms\": %.6f,\n", 1e3 * total / steps);
+    fprintf(out, "      \"step_p50_ms\": %.6f,\n", 1e3 * result->stepP50Seconds);
+    fprintf(out, "      \"step_p99_ms\": %.6f,\n", 1e3 * result->stepP99Seconds);
+    fprintf(out, "      \"substeps_per_step\": %.2f,\n", result->substeps / steps);
+    fprintf(out, "      \"neighbor_rebuild_fraction\": %.3f,\n", result->neighborRebuilds / steps);
+    fprintf(out, "      \"force_evaluations_per_step\": %.0f,\n", result->forceEvaluations / steps);
+    fprintf(out, "      \"interactions_per_step\": %.0f,\n", result->interactions / steps);
+    fprintf(out, "      \"interactions_per_sec\": %.6g,\n",
+            result->forceSeconds > 0.0 ? result->interactions / result->forceSeconds : 0.0);
+    fprintf(out, "      \"ns_per_particle\": %.6g,\n", 1e9 * total / (steps * count));
+    fprintf(out, "      \"memory_bytes\": %zu\n", result->memoryBytes);
+    fprintf(out, "    }");
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts = {
+        .minN = 100,
+        .maxN = 1000000,
+        .steps = 10,
+        .warmupSteps = 1,
+        .dt = 0.016f,
+        .seed = 1,
+        .threads = 0,
+        .reorderInterval = MORTON_DEFAULT_INTERVAL,
+        .skin = COLLISION_DEFAULT_SKIN,
+        .scenarios = { 1, 1, 1, 1 },
+        .solvers = { 1, 1, 1 },
+        .outputPath = NULL
+    };
+
+    int parsed = parse_options(argc, argv, &opts);
+    if (parsed != 0) {
+        if (parsed < 0) print_usage(argv[0]);
+        return parsed < 0 ? 1 : 0;
+    }
+
+    FILE* out = stdout;
+    if (opts.outputPath) {
+        out = fopen(opts.outputPath, "w");
+        if (!out) {
+            fprintf(stderr, "Failed to open %s for writing\n", opts.outputPath);
+            return 1;
+        }
+    }
+
+    set_thread_count(opts.threads);
+    set_collision_skin(opts.skin);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"kernel\": \"%s\",\n", force_kernel_isa_name(get_force_kernel_isa()));
+    fprintf(out, "  \"threads\": %d,\n", get_thread_count());
+    fprintf(out, "  \"reorder_every\": %d,\n", opts.reorderInterval);
+    fprintf(out, "  \"skin\": %g,\n", opts.skin);
+    fprintf(out, "  \"positions\": \"%s\",\n", REAL_NAME);
+    fprintf(out, "  \"seed\": %u,\n", opts.seed);
+    fprintf(out, "  \"dt\": %g,\n", opts.dt);
+    fprintf(out, "  \"results\": [");
+
+    int status = 0;
+    int first = 1;
+    for (int s = 0; s < INITIAL_COUNT && status == 0; s++) {
+        if (!opts.scenarios[s]) continue;
+
+        for (int solver = SOLVER_GRID; solver < SOLVER_COUNT && status == 0; solver++) {
+            if (!opts.solvers[solver]) continue;
+
+            for (long long n = opts.minN; n <= opts.maxN; n *= 10) {
+                BenchResult result;
+                if (run_case(&opts, (InitialCondition)s, (GravitySolver)solver, (int)n, &result) != 0) {
+                    status = 1;
+                    break;
+                }
+                write_result(out, first, &opts, (InitialCondition)s, (GravitySolver)solver, (int)n, &result);
+                first = 0;
+                fflush(out);
+
+                fprintf(stderr, "%s/%s n=%lld: %.3f ms/step\n", initial_condition_name((InitialCondition)s),
+                        gravity_solver_name((GravitySolver)solver), n,
+                        1e3 * (result.gridSeconds + result.forceSeconds +
+                               result.collisionSeconds + result.integrationSeconds) / opts.steps);
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s\n", opts.outputPath);
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,415 @@
+#define _POSIX_C_SOURCE 200809L // For mmap and fstat under -std=c99
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "checkpoint.h"
+#include "pm.h"
+#include "utils.h"
+
+// Particles gathered per write when copying the live entries of a field
+#define CHECKPOINT_CHUNK 4096
+
+#define HASH_SEED 0xcbf29ce484222325ull
+#define HASH_PRIME 0x100000001b3ull
+
+// FNV-1a style hash, fed 64-bit words at a time. Feeding a buffer in pieces gives
+// the same result as feeding it whole, as long as every piece but the last is a
+// multiple of 8 bytes
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t words = size / 8;
+
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, 8);
+        hash = (hash ^ word) * HASH_PRIME;
+    }
+    for (size_t i = words * 8; i < size; i++) {
+        hash = (hash ^ bytes[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(uint64_t)(CHECKPOINT_ALIGNMENT - 1);
+}
+
+// Size of one element of a field array, for positions and velocities of the given size
+static size_t field_size(int field, size_t positionBytes) {
+    switch (field) {
+    case CHECKPOINT_FIELD_X:
+    case CHECKPOINT_FIELD_Y:
+    case CHECKPOINT_FIELD_VX:
+    case CHECKPOINT_FIELD_VY: return positionBytes;
+    case CHECKPOINT_FIELD_COLOR: return sizeof(ParticleColor);
+    case CHECKPOINT_FIELD_STALE: return sizeof(uint8_t);
+    default: return sizeof(float);
+    }
+}
+
+// Particle system array holding a field
+static const void* field_array(const ParticleSystem* ps, int field) {
+    switch (field) {
+    case CHECKPOINT_FIELD_X: return ps->x;
+    case CHECKPOINT_FIELD_Y: return ps->y;
+    case CHECKPOINT_FIELD_VX: return ps->vx;
+    case CHECKPOINT_FIELD_VY: return ps->vy;
+    case CHECKPOINT_FIELD_MASS: return ps->mass;
+    case CHECKPOINT_FIELD_AX: return ps->ax;
+    case CHECKPOINT_FIELD_AY: return ps->ay;
+    case CHECKPOINT_FIELD_RADIUS: return ps->radius;
+    case CHECKPOINT_FIELD_COLOR: return ps->color;
+    default: return ps->stale;
+    }
+}
+
+// Header checksum, computed with the checksum field itself zeroed
+static uint64_t header_checksum(const CheckpointHeader* header) {
+    CheckpointHeader copy = *header;
+    copy.headerChecksum = 0;
+    return hash_bytes(HASH_SEED, &copy, sizeof(copy));
+}
+
+// Fill `info` with the current solver settings and world bounds, plus a step count and time
+void get_checkpoint_info(CheckpointInfo* info, uint64_t step, double time) {
+    info->step = step;
+    info->time = time;
+    get_world_bounds(&info->worldWidth, &info->worldHeight);
+    info->solver = get_gravity_solver();
+    get_barnes_hut_params(&info->theta, &info->softening);
+    info->pmMeshSize = get_pm_mesh_size();
+    get_block_timestep_params(&info->eta, &info->maxLevel);
+    info->reorderInterval = get_reorder_interval();
+    info->reorderPhase = get_reorder_phase();
+}
+
+// Apply a checkpoint's solver settings and world bounds to the simulation
+void apply_checkpoint_info(const CheckpointInfo* info) {
+    set_world_bounds(info->worldWidth, info->worldHeight);
+    set_gravity_solver(info->solver);
+    set_barnes_hut_params(info->theta, info->softening);
+    set_pm_mesh_size(info->pmMeshSize);
+    set_block_timestep_params(info->eta, info->maxLevel);
+    set_reorder_interval(info->reorderInterval);
+    set_reorder_phase(info->reorderPhase);
+}
+
+// Write the live entries of one field after padding to an aligned offset, and hash them
+static int write_field(FILE* file, const ParticleSystem* ps, int field, uint64_t* hash) {
+    static const unsigned char zeros[CHECKPOINT_ALIGNMENT];
+    unsigned char buffer[CHECKPOINT_CHUNK * sizeof(Real)];
+    size_t size = field_size(field, sizeof(Real));
+    const unsigned char* source = (const unsigned char*)field_array(ps, field);
+
+    // Padding up to the aligned start of the field
+    long position = ftell(file);
+    size_t padding = (size_t)(align_offset((uint64_t)position) - (uint64_t)position);
+    if (padding > 0 && fwrite(zeros, 1, padding, file) != padding) return -1;
+
+    *hash = HASH_SEED;
+    int i = 0;
+    while (i < ps->count) {
+        int n = 0;
+        for (; i < ps->count && n < CHECKPOINT_CHUNK; i++) {
+            if (!ps->active[i]) continue;
+            memcpy(buffer + (size_t)n * size, source + (size_t)i * size, size);
+            n++;
+        }
+        if (n == 0) break;
+
+        if (fwrite(buffer, size, (size_t)n, file) != (size_t)n) return -1;
+        *hash = hash_bytes(*hash, buffer, (size_t)n * size);
+    }
+
+    return 0;
+}
+
+// Write the live particles and run state to `path`
+int save_checkpoint(const char* path, const ParticleSystem* ps, const CheckpointInfo* info) {
+    int live = ps->count - ps->deadCount;
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.byteOrder = CHECKPOINT_BYTE_ORDER;
+    header.solver = (uint32_t)info->solver;
+    header.positionBytes = sizeof(Real);
+    header.pmMeshSize = (uint32_t)info->pmMeshSize;
+    header.reorderInterval = (uint32_t)info->reorderInterval;
+    header.reorderPhase = (uint32_t)info->reorderPhase;
+    header.particleCount = (uint64_t)live;
+    header.step = info->step;
+    header.time = info->time;
+    header.worldWidth = info->worldWidth;
+    header.worldHeight = info->worldHeight;
+    header.theta = info->theta;
+    header.softening = info->softening;
+    header.eta = info->eta;
+    header.maxLevel = (uint32_t)info->maxLevel;
+
+    uint64_t offset = align_offset(sizeof(CheckpointHeader));
+    for (int f = 0; f < CHECKPOINT_FIELD_COUNT; f++) {
+        header.fieldOffset[f] = offset;
+        offset += (uint64_t)live * field_size(f, sizeof(Real));
+        if (f + 1 < CHECKPOINT_FIELD_COUNT) offset = align_offset(offset);
+    }
+    header.fileSize = offset;
+
+    // Write everything under a temporary name first
+    size_t pathLength = strlen(path);
+    char* tempPath = (char*)malloc(pathLength + 5);
+    if (tempPath == NULL) {
+        fprintf(stderr, "Failed to allocate memory for checkpoint path\n");
+        return -1;
+    }
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", 5);
+
+    FILE* file = fopen(tempPath, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing\n", tempPath);
+        free(tempPath);
+        return -1;
+    }
+
+    // Header goes in last, once the payload checksum is known
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    uint64_t payloadHash = HASH_SEED;
+    for (int f = 0; f < CHECKPOINT_FIELD_COUNT && !failed; f++) {
+        uint64_t fieldHash;
+        failed = write_field(file, ps, f, &fieldHash) != 0;
+        payloadHash = hash_bytes(payloadHash, &fieldHash, sizeof(fieldHash));
+    }
+
+    header.payloadChecksum = payloadHash;
+    header.headerChecksum = header_checksum(&header);
+
+    if (!failed) {
+        failed = fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1;
+    }
+    if (fclose(file) != 0) failed = 1;
+
+    if (!failed) {
+#ifdef _WIN32
+        remove(path); // rename does not replace existing files on Windows
+#endif
+        failed = rename(tempPath, path) != 0;
+    }
+
+    if (failed) {
+        fprintf(stderr, "Failed to write checkpoint %s\n", path);
+        remove(tempPath);
+    }
+    free(tempPath);
+    return failed ? -1 : 0;
+}
+
+// Map (or, without mmap, read) a whole file
+static int map_file(const char* path, void** base, size_t* size) {
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    int failed = fseek(file, 0, SEEK_END) != 0;
+    long length = failed ? -1 : ftell(file);
+    if (length <= 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    *base = aligned_malloc((size_t)length, CHECKPOINT_ALIGNMENT);
+    if (*base == NULL || fread(*base, 1, (size_t)length, file) != (size_t)length) {
+        aligned_free(*base);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    return 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return -1;
+
+    *base = mapping;
+    *size = (size_t)info.st_size;
+    return 0;
+#endif
+}
+
+static void unmap_file(void* base, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    aligned_free(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+// Check the header and payload of a mapped file. Returns an error message, or NULL if valid
+static const char* validate_checkpoint(const void* base, size_t size) {
+    if (size < sizeof(CheckpointHeader)) return "file is truncated";
+
+    const CheckpointHeader* header = (const CheckpointHeader*)base;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        return "not a checkpoint file";
+    }
+    if (header->byteOrder != CHECKPOINT_BYTE_ORDER) return "written with a different byte order";
+    if (header->version != CHECKPOINT_VERSION) return "unsupported version";
+    if (header->headerSize != sizeof(CheckpointHeader)) return "unexpected header size";
+    if (header->headerChecksum != header_checksum(header)) return "header checksum mismatch";
+    if (header->fileSize > size) return "file is truncated";
+    if (header->particleCount > INT_MAX) return "too many particles";
+    if (header->positionBytes != sizeof(float) && header->positionBytes != sizeof(double)) {
+        return "unsupported position precision";
+    }
+
+    uint64_t count = header->particleCount;
+    uint64_t payloadHash = HASH_SEED;
+    for (int f = 0; f < CHECKPOINT_FIELD_COUNT; f++) {
+        uint64_t offset = header->fieldOffset[f];
+        uint64_t bytes = count * field_size(f, header->positionBytes);
+        if (offset % CHECKPOINT_ALIGNMENT != 0 || offset < sizeof(CheckpointHeader) ||
+            offset + bytes > header->fileSize) {
+            return "bad field offset";
+        }
+
+        uint64_t fieldHash = hash_bytes(HASH_SEED, (const unsigned char*)base + offset, (size_t)bytes);
+        payloadHash = hash_bytes(payloadHash, &fieldHash, sizeof(fieldHash));
+    }
+    if (header->payloadChecksum != payloadHash) return "payload checksum mismatch";
+
+    return NULL;
+}
+
+// Map a checkpoint and validate its header, size and checksums
+int map_checkpoint(const char* path, MappedCheckpoint* map) {
+    memset(map, 0, sizeof(*map));
+
+    void* base;
+    size_t size;
+    if (map_file(path, &base, &size) != 0) {
+        fprintf(stderr, "Failed to open checkpoint %s\n", path);
+        return -1;
+    }
+
+    const char* error = validate_checkpoint(base, size);
+    if (error) {
+        fprintf(stderr, "Failed to load checkpoint %s: %s\n", path, error);
+        unmap_file(base, size);
+        return -1;
+    }
+
+    const CheckpointHeader* header = (const CheckpointHeader*)base;
+    const unsigned char* bytes = (const unsigned char*)base;
+    map->base = base;
+    map->size = size;
+    map->header = header;
+    map->count = (int)header->particleCount;
+    map->positionBytes = (int)header->positionBytes;
+    map->x = bytes + header->fieldOffset[CHECKPOINT_FIELD_X];
+    map->y = bytes + header->fieldOffset[CHECKPOINT_FIELD_Y];
+    map->vx = bytes + header->fieldOffset[CHECKPOINT_FIELD_VX];
+    map->vy = bytes + header->fieldOffset[CHECKPOINT_FIELD_VY];
+    map->mass = (const float*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_MASS]);
+    map->ax = (const float*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_AX]);
+    map->ay = (const float*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_AY]);
+    map->radius = (const float*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_RADIUS]);
+    map->color = (const ParticleColor*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_COLOR]);
+    map->stale = (const uint8_t*)(bytes + header->fieldOffset[CHECKPOINT_FIELD_STALE]);
+    return 0;
+}
+
+// Release a mapping made by map_checkpoint
+void unmap_checkpoint(MappedCheckpoint* map) {
+    if (map->base) unmap_file(map->base, map->size);
+    memset(map, 0, sizeof(*map));
+}
+
+// Copy a position or velocity field, converting it if it was written in the other precision
+static void copy_real_field(Real* dst, const void* src, int count, int positionBytes) {
+    if (positionBytes == (int)sizeof(Real)) {
+        memcpy(dst, src, (size_t)count * sizeof(Real));
+    } else if (positionBytes == (int)sizeof(float)) {
+        const float* values = (const float*)src;
+        for (int i = 0; i < count; i++) dst[i] = (Real)values[i];
+    } else {
+        const double* values = (const double*)src;
+        for (int i = 0; i < count; i++) dst[i] = (Real)values[i];
+    }
+}
+
+// Create a particle system from a checkpoint file
+ParticleSystem* load_checkpoint(const char* path, CheckpointInfo* info) {
+    MappedCheckpoint map;
+    if (map_checkpoint(path, &map) != 0) return NULL;
+
+    int count = map.count;
+    ParticleSystem* ps = create_particles(0);
+    if (!ps || reserve_particles(ps, count > 0 ? count : 1) != 0) {
+        free_particles(ps);
+        unmap_checkpoint(&map);
+        return NULL;
+    }
+
+    copy_real_field(ps->x, map.x, count, map.positionBytes);
+    copy_real_field(ps->y, map.y, count, map.positionBytes);
+    copy_real_field(ps->vx, map.vx, count, map.positionBytes);
+    copy_real_field(ps->vy, map.vy, count, map.positionBytes);
+    memcpy(ps->mass, map.mass, (size_t)count * sizeof(float));
+    memcpy(ps->ax, map.ax, (size_t)count * sizeof(float));
+    memcpy(ps->ay, map.ay, (size_t)count * sizeof(float));
+    memcpy(ps->radius, map.radius, (size_t)count * sizeof(float));
+    memcpy(ps->color, map.color, (size_t)count * sizeof(ParticleColor));
+    memcpy(ps->stale, map.stale, (size_t)count * sizeof(uint8_t));
+    memset(ps->active, 1, (size_t)count);
+    ps->count = count;
+    ps->deadCount = 0;
+
+    if (reset_particle_handles(ps) != 0) {
+        free_particles(ps);
+        unmap_checkpoint(&map);
+        return NULL;
+    }
+
+    if (info) {
+        const CheckpointHeader* header = map.header;
+        info->step = header->step;
+        info->time = header->time;
+        info->worldWidth = header->worldWidth;
+        info->worldHeight = header->worldHeight;
+        info->solver = header->solver < SOLVER_COUNT ? (GravitySolver)header->solver : SOLVER_GRID;
+        info->theta = header->theta;
+        info->softening = header->softening;
+        info->eta = header->eta > 0.0f ? header->eta : BLOCK_DEFAULT_ETA;
+        info->maxLevel = header->maxLevel <= BLOCK_MAX_LEVEL ? (int)header->maxLevel : BLOCK_MAX_LEVEL;
+        info->pmMeshSize = header->pmMeshSize > 0 ? (int)header->pmMeshSize : PM_DEFAULT_MESH_SIZE;
+        info->reorderInterval = header->reorderInterval <= INT_MAX ? (int)header->reorderInterval : 0;
+        info->reorderPhase = header->reorderPhase <= INT_MAX ? (int)header->reorderPhase : 0;
+    }
+
+    unmap_checkpoint(&map);
+    return ps;
+}
@@ -0,0 +1,121 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "particle.h"
+
+// Binary snapshot of a simulation, laid out so it can be mapped straight into memory:
+//
+//   CheckpointHeader, zero-padded to CHECKPOINT_ALIGNMENT
+//   x, y, vx, vy (float or double[particleCount], see positionBytes),
+//   mass, ax, ay, radius (float[particleCount]),
+//   color (ParticleColor[particleCount]), stale (uint8_t[particleCount]),
+//   each starting on a CHECKPOINT_ALIGNMENT boundary at the offset given in the header
+//
+// Only live particles are stored. Values are in the writer's byte order; files from a
+// machine with the other byte order are rejected rather than converted. Positions and
+// velocities are stored in the writer's precision (precision.h) and converted on load
+// if the reader was built with the other one.
+#define CHECKPOINT_MAGIC "NBODYCK"
+#define CHECKPOINT_VERSION 5
+#define CHECKPOINT_ALIGNMENT 64
+#define CHECKPOINT_BYTE_ORDER 0x01020304u
+
+// Field arrays, in file order
+typedef enum {
+    CHECKPOINT_FIELD_X,
+    CHECKPOINT_FIELD_Y,
+    CHECKPOINT_FIELD_VX,
+    CHECKPOINT_FIELD_VY,
+    CHECKPOINT_FIELD_MASS,
+    CHECKPOINT_FIELD_AX,
+    CHECKPOINT_FIELD_AY,
+    CHECKPOINT_FIELD_RADIUS,
+    CHECKPOINT_FIELD_COLOR,
+    CHECKPOINT_FIELD_STALE,
+    CHECKPOINT_FIELD_COUNT
+} CheckpointField;
+
+// On-disk header. Every member is naturally aligned, so the layout has no padding
+typedef struct {
+    char magic[8];              // CHECKPOINT_MAGIC, NUL-terminated
+    uint32_t version;           // CHECKPOINT_VERSION
+    uint32_t headerSize;        // sizeof(CheckpointHeader) when written
+    uint32_t byteOrder;         // CHECKPOINT_BYTE_ORDER as the writer stored it
+    uint32_t solver;            // GravitySolver
+    uint32_t positionBytes;     // Size of one x, y, vx or vy value: 4 (float) or 8 (double)
+    uint32_t pmMeshSize;        // Particle-Mesh nodes per axis, 0 for the default
+    uint32_t reorderInterval;   // Steps between Morton reorders, 0 = never
+    uint32_t reorderPhase;      // Steps since the last Morton reorder
+    uint64_t particleCount;
+    uint64_t step;              // Steps taken since the run started
+    double time;                // Simulated time since the run started
+    float worldWidth;
+    float worldHeight;
+    float theta;
+    float softening;
+    float eta;                  // Block timestep accuracy
+    uint32_t maxLevel;          // Finest block timestep level
+    uint64_t fieldOffset[CHECKPOINT_FIELD_COUNT]; // Byte offset of each field array
+    uint64_t fileSize;          // Total file size, to catch truncation
+    uint64_t payloadChecksum;   // Hash of the field arrays
+    uint64_t headerChecksum;    // Hash of this header with headerChecksum = 0
+} CheckpointHeader;
+
+// Run state stored alongside the particles
+typedef struct {
+    uint64_t step;
+    double time;
+    float worldWidth;
+    float worldHeight;
+    GravitySolver solver;
+    float theta;
+    float softening;
+    int pmMeshSize;
+    float eta;
+    int maxLevel;
+    int reorderInterval;
+    int reorderPhase;
+} CheckpointInfo;
+
+// Read-only view of a checkpoint file mapped into memory
+typedef struct {
+    void* base;                 // Start of the mapping
+    size_t size;
+    const CheckpointHeader* header;
+    int count;                  // Number of particles
+    int positionBytes;          // Element size of x, y, vx and vy (4 or 8)
+    const void* x;
+    const void* y;
+    const void* vx;
+    const void* vy;
+    const float* mass;
+    const float* ax;
+    const float* ay;
+    const float* radius;
+    const ParticleColor* color;
+    const uint8_t* stale;
+} MappedCheckpoint;
+
+// Fill `info` with the current solver settings and world bounds, plus a step count and time
+void get_checkpoint_info(CheckpointInfo* info, uint64_t step, double time);
+
+// Apply a checkpoint's solver settings and world bounds to the simulation
+void apply_checkpoint_info(const CheckpointInfo* info);
+
+// Write the live particles and run state to `path`. The file is written under a
+// temporary name and renamed into place, so a crash never leaves a half-written
+// checkpoint behind. Returns 0 on success, -1 on failure
+int save_checkpoint(const char* path, const ParticleSystem* ps, const CheckpointInfo* info);
+
+// Map a checkpoint and validate its header, size and checksums. Returns 0 on success, -1 on failure
+int map_checkpoint(const char* path, MappedCheckpoint* map);
+
+// Release a mapping made by map_checkpoint
+void unmap_checkpoint(MappedCheckpoint* map);
+
+// Create a particle system from a checkpoint file. `info` (optional) receives the run state
+ParticleSystem* load_checkpoint(const char* path, CheckpointInfo* info);
+
+#endif // CHECKPOINT_H
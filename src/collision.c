@@ -0,0 +1,547 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "collision.h"
+
+// Grid cells per work item for the broad phase
+#define COLLISION_CELL_CHUNK 64
+
+// Oversized particles per work item
+#define COLLISION_OVERSIZED_CHUNK 4
+
+// Groups per work item for merging
+#define MERGE_CHUNK 256
+
+// Slots per work item for the neighbor list checks, candidate pairs per item for re-testing them
+#define NEIGHBOR_SLOT_CHUNK 4096
+#define NEIGHBOR_PAIR_CHUNK 4096
+
+static inline int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static inline int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+// Initialize empty scratch buffers
+void init_collision_scratch(CollisionScratch* scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+    scratch->neighbors.slotCount = -1;
+}
+
+// Append a pair, growing the buffer as needed. Returns -1 if out of memory
+static int push_pair(PairBuffer* buffer, int i, int j) {
+    if (buffer->count == buffer->capacity) {
+        int capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        CollisionPair* grown = (CollisionPair*)realloc(buffer->pairs, capacity * sizeof(CollisionPair));
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate memory for collision pairs\n");
+            return -1;
+        }
+        buffer->pairs = grown;
+        buffer->capacity = capacity;
+    }
+
+    CollisionPair* pair = &buffer->pairs[buffer->count++];
+    pair->a = i < j ? i : j;
+    pair->b = i < j ? j : i;
+    return 0;
+}
+
+// Whether two live particles are no further than `margin` apart (0 = overlapping)
+static inline int within(const ParticleSystem* ps, int i, int j, float margin) {
+    float dx = REAL_OFFSET(ps->x[j], ps->x[i]);
+    float dy = REAL_OFFSET(ps->y[j], ps->y[i]);
+    float radii = ps->radius[i] + ps->radius[j] + margin;
+    return dx * dx + dy * dy <= radii * radii;
+}
+
+typedef struct {
+    CollisionScratch* scratch;
+    const SpatialGrid* grid;
+    ParticleSystem* ps;
+    int firstGhost;         // Ghost slots from here on never collide
+    float margin;           // Broad phase collects pairs up to this far apart
+    int reach;              // Cells searched around a regular particle (1 = the 3x3 block)
+    float halfSkin;         // Largest drift the neighbor list tolerates
+} CollisionContext;
+
+// Broad phase over regular neighbors: each particle against the higher-indexed
+// particles of its own and the adjacent cells (more of them with a skin), one
+// grid cell per item
+static void find_pairs_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    const SpatialGrid* grid = ctx->grid;
+    const ParticleSystem* ps = ctx->ps;
+    PairBuffer* buffer = &ctx->scratch->buffers[worker];
+    int reach = ctx->reach;
+
+    for (int cell = start; cell < end; cell++) {
+        int cellX = cell % grid->cellsX;
+        int cellY = cell / grid->cellsX;
+        int minX = max_int(0, cellX-reach), maxX = min_int(grid->cellsX-1, cellX+reach);
+        int minY = max_int(0, cellY-reach), maxY = min_int(grid->cellsY-1, cellY+reach);
+
+        for (int k = grid->cellStart[cell]; k < grid->cellStart[cell + 1]; k++) {
+            int i = grid->particleIndices[k];
+            if (i >= ctx->firstGhost) continue;
+
+            // Rows of the block are contiguous runs of cells in the CSR arrays
+            for (int nCellY = minY; nCellY <= maxY; nCellY++) {
+                int row = nCellY * grid->cellsX;
+                for (int n = grid->cellStart[row + minX]; n < grid->cellStart[row + maxX + 1]; n++) {
+                    int j = grid->particleIndices[n];
+                    if (j > i && j < ctx->firstGhost && within(ps, i, j, ctx->margin) &&
+                        push_pair(buffer, i, j) != 0) return;
+                }
+            }
+        }
+    }
+}
+
+// Broad phase for oversized particles: every cell within reach of a regular
+// partner outside the block the regular search covers, then every later
+// oversized particle directly. Testing the oversized list against itself keeps
+// one huge body from widening everybody's cell search. Pairs found twice are
+// dropped after sorting
+static void find_oversized_pairs_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    const SpatialGrid* grid = ctx->grid;
+    const ParticleSystem* ps = ctx->ps;
+    PairBuffer* buffer = &ctx->scratch->buffers[worker];
+
+    for (int o = start; o < end; o++) {
+        int i = grid->oversized[o];
+        if (i >= ctx->firstGhost) continue;
+        int reach = (int)ceilf((ps->radius[i] + grid->maxRegularRadius + ctx->margin) / grid->cellSize);
+        int cellX, cellY;
+        grid_cell_coords(grid, ps->x[i], ps->y[i], &cellX, &cellY);
+
+        for (int nCellY = max_int(0, cellY-reach); nCellY <= min_int(grid->cellsY-1, cellY+reach); nCellY++) {
+            for (int nCellX = max_int(0, cellX-reach); nCellX <= min_int(grid->cellsX-1, cellX+reach); nCellX++) {
+                if (abs(nCellX - cellX) <= ctx->reach && abs(nCellY - cellY) <= ctx->reach) continue;
+
+                int cell = nCellY * grid->cellsX + nCellX;
+                for (int n = grid->cellStart[cell]; n < grid->cellStart[cell + 1]; n++) {
+                    int j = grid->particleIndices[n];
+                    if (j < ctx->firstGhost && within(ps, i, j, ctx->margin) && push_pair(buffer, i, j) != 0) return;
+                }
+            }
+        }
+
+        for (int p = o + 1; p < grid->oversizedCount; p++) {
+            int j = grid->oversized[p];
+            if (j < ctx->firstGhost && within(ps, i, j, ctx->margin) && push_pair(buffer, i, j) != 0) return;
+        }
+    }
+}
+
+// Narrow phase over the neighbor list: re-test the candidate pairs [start, end)
+static void test_candidates_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    const CollisionPair* candidates = ctx->scratch->neighbors.pairs;
+    const ParticleSystem* ps = ctx->ps;
+    PairBuffer* buffer = &ctx->scratch->buffers[worker];
+
+    for (int p = start; p < end; p++) {
+        int a = candidates[p].a;
+        int b = candidates[p].b;
+        if (ps->active[a] && ps->active[b] && within(ps, a, b, 0.0f) &&
+            push_pair(buffer, a, b) != 0) return;
+    }
+}
+
+// Remember where slots [start, end) were when the neighbor list was built
+static void record_slots_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    NeighborList* list = &ctx->scratch->neighbors;
+    const ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        list->refX[i] = ps->x[i];
+        list->refY[i] = ps->y[i];
+        list->refRadius[i] = ps->active[i] ? ps->radius[i] : -1.0f;
+        list->refHandle[i] = ps->handle[i];
+        list->refGeneration[i] = ps->handle[i] >= 0 ? ps->handleGeneration[ps->handle[i]] : 0;
+    }
+}
+
+// Flag the worker if a live slot in [start, end) drifted (moved plus grew)
+// more than half the skin, was inactive when the list was built, or now holds
+// another particle (compaction, reordering, migration)
+static void check_slots_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    NeighborList* list = &ctx->scratch->neighbors;
+    const ParticleSystem* ps = ctx->ps;
+    float halfSkin = ctx->halfSkin;
+
+    for (int i = start; i < end; i++) {
+        if (!ps->active[i]) continue;
+        int handle = ps->handle[i];
+        if (handle != list->refHandle[i] || (handle >= 0 && ps->handleGeneration[handle] != list->refGeneration[i])) {
+            list->workerMoved[worker] = 1;
+            return;
+        }
+        float growth = ps->radius[i] - list->refRadius[i];
+        float dx = REAL_OFFSET(ps->x[i], list->refX[i]);
+        float dy = REAL_OFFSET(ps->y[i], list->refY[i]);
+        float allowed = halfSkin - growth;
+        if (list->refRadius[i] < 0.0f || allowed < 0.0f || dx * dx + dy * dy > allowed * allowed) {
+            list->workerMoved[worker] = 1;
+            return;
+        }
+    }
+}
+
+static int compare_pairs(const void* left, const void* right) {
+    const CollisionPair* a = (const CollisionPair*)left;
+    const CollisionPair* b = (const CollisionPair*)right;
+    if (a->a != b->a) return a->a < b->a ? -1 : 1;
+    if (a->b != b->b) return a->b < b->b ? -1 : 1;
+    return 0;
+}
+
+// Whether particle i outranks particle j as a survivor: heavier, or as heavy with a lower index
+static inline int outranks(const ParticleSystem* ps, int i, int j) {
+    return ps->mass[i] > ps->mass[j] || (ps->mass[i] == ps->mass[j] && i < j);
+}
+
+// Merge every group into its survivor at the group's center of mass, one group per item
+static void merge_groups_task(void* context, int start, int end, int worker) {
+    CollisionContext* ctx = (CollisionContext*)context;
+    const CollisionScratch* scratch = ctx->scratch;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int g = start; g < end; g++) {
+        const int* members = &scratch->members[scratch->groupStart[g]];
+        int size = scratch->groupStart[g + 1] - scratch->groupStart[g];
+        int survivor = scratch->target[members[0]];
+
+        // Members are in ascending index order. Positions are summed as offsets
+        // from the survivor, which every member touches
+        float totalMass = 0.0f;
+        float offsetX = 0.0f;
+        float offsetY = 0.0f;
+        Real momentumX = 0.0f;
+        Real momentumY = 0.0f;
+        for (int k = 0; k < size; k++) {
+            int i = members[k];
+            totalMass += ps->mass[i];
+            offsetX += ps->mass[i] * REAL_OFFSET(ps->x[i], ps->x[survivor]);
+            offsetY += ps->mass[i] * REAL_OFFSET(ps->y[i], ps->y[survivor]);
+            momentumX += ps->mass[i] * ps->vx[i];
+            momentumY += ps->mass[i] * ps->vy[i];
+        }
+
+        ps->x[survivor] += offsetX / totalMass;
+        ps->y[survivor] += offsetY / totalMass;
+        ps->vx[survivor] = momentumX / totalMass;
+        ps->vy[survivor] = momentumY / totalMass;
+        ps->mass[survivor] = totalMass;
+        ps->radius[survivor] = calculate_radius(totalMass);
+        ps->color[survivor] = calculate_color(totalMass);
+        ps->stale[survivor] = 1;
+
+        for (int k = 0; k < size; k++) {
+            if (members[k] != survivor) ps->active[members[k]] = 0;
+        }
+    }
+}
+
+// Make room for per-worker buffers and per-particle arrays
+static int reserve_collision_scratch(CollisionScratch* scratch, int workers, int particles) {
+    if (workers > scratch->bufferCount) {
+        PairBuffer* buffers = (PairBuffer*)realloc(scratch->buffers, workers * sizeof(PairBuffer));
+        if (buffers == NULL) {
+            fprintf(stderr, "Failed to allocate memory for collision buffers\n");
+            return -1;
+        }
+        memset(buffers + scratch->bufferCount, 0, (workers - scratch->bufferCount) * sizeof(PairBuffer));
+        scratch->buffers = buffers;
+        scratch->bufferCount = workers;
+    }
+
+    if (particles > scratch->particleCapacity) {
+        int* target = (int*)realloc(scratch->target, particles * sizeof(int));
+        if (target) scratch->target = target;
+        int* members = (int*)realloc(scratch->members, particles * sizeof(int));
+        if (members) scratch->members = members;
+        int* groupStart = (int*)realloc(scratch->groupStart, (particles + 1) * sizeof(int));
+        if (groupStart) scratch->groupStart = groupStart;
+
+        if (!target || !members || !groupStart) {
+            fprintf(stderr, "Failed to allocate memory for collision groups\n");
+            return -1;
+        }
+        scratch->particleCapacity = particles;
+    }
+
+    return 0;
+}
+
+// Make room for the neighbor list's per-slot and per-worker arrays
+static int reserve_neighbor_list(NeighborList* list, int workers, int slots) {
+    if (workers > list->workerCapacity) {
+        int* moved = (int*)realloc(list->workerMoved, workers * sizeof(int));
+        if (moved == NULL) {
+            fprintf(stderr, "Failed to allocate memory for neighbor lists\n");
+            return -1;
+        }
+        list->workerMoved = moved;
+        list->workerCapacity = workers;
+    }
+
+    if (slots > list->slotCapacity) {
+        Real* refX = (Real*)realloc(list->refX, slots * sizeof(Real));
+        if (refX) list->refX = refX;
+        Real* refY = (Real*)realloc(list->refY, slots * sizeof(Real));
+        if (refY) list->refY = refY;
+        float* refRadius = (float*)realloc(list->refRadius, slots * sizeof(float));
+        if (refRadius) list->refRadius = refRadius;
+        int* refHandle = (int*)realloc(list->refHandle, slots * sizeof(int));
+        if (refHandle) list->refHandle = refHandle;
+        uint32_t* refGeneration = (uint32_t*)realloc(list->refGeneration, slots * sizeof(uint32_t));
+        if (refGeneration) list->refGeneration = refGeneration;
+
+        if (!refX || !refY || !refRadius || !refHandle || !refGeneration) {
+            fprintf(stderr, "Failed to allocate memory for neighbor lists\n");
+            return -1;
+        }
+        list->slotCapacity = slots;
+    }
+
+    return 0;
+}
+
+// Collect the workers' pairs into one sorted array without duplicates
+static int gather_pairs(CollisionScratch* scratch, int workers, CollisionPair** pairs, int* pairCount,
+                        int* pairCapacity) {
+    int total = 0;
+    for (int w = 0; w < workers; w++) {
+        total += scratch->buffers[w].count;
+    }
+
+    if (total > *pairCapacity) {
+        CollisionPair* grown = (CollisionPair*)realloc(*pairs, total * sizeof(CollisionPair));
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate memory for collision pairs\n");
+            return -1;
+        }
+        *pairs = grown;
+        *pairCapacity = total;
+    }
+
+    int count = 0;
+    for (int w = 0; w < workers; w++) {
+        PairBuffer* buffer = &scratch->buffers[w];
+        memcpy(*pairs + count, buffer->pairs, buffer->count * sizeof(CollisionPair));
+        count += buffer->count;
+    }
+
+    qsort(*pairs, count, sizeof(CollisionPair), compare_pairs);
+
+    int unique = 0;
+    for (int p = 0; p < count; p++) {
+        if (unique > 0 && compare_pairs(&(*pairs)[unique - 1], &(*pairs)[p]) == 0) continue;
+        (*pairs)[unique++] = (*pairs)[p];
+    }
+    *pairCount = unique;
+    return 0;
+}
+
+// Drop the last group if it holds only its survivor, whose partners all went
+// to other survivors
+static void drop_lone_group(CollisionScratch* scratch, int* memberCount) {
+    int last = scratch->groupCount - 1;
+    if (last >= 0 && *memberCount - scratch->groupStart[last] == 1) {
+        scratch->groupCount--;
+        (*memberCount)--;
+    }
+}
+
+// Turn the pairs into groups, listed by survivor then index. A survivor is a
+// particle that outranks everything it touches; its group is itself and the
+// particles whose highest-ranked touching partner it is
+static int build_groups(CollisionScratch* scratch, const ParticleSystem* ps) {
+    if (2 * scratch->pairCount > scratch->sortKeyCapacity) {
+        int capacity = 2 * scratch->pairCount;
+        CollisionPair* sortKeys = (CollisionPair*)realloc(scratch->sortKeys, capacity * sizeof(CollisionPair));
+        if (sortKeys == NULL) {
+            fprintf(stderr, "Failed to allocate memory for collision pairs\n");
+            return -1;
+        }
+        scratch->sortKeys = sortKeys;
+        scratch->sortKeyCapacity = capacity;
+    }
+
+    int* target = scratch->target;
+    CollisionPair* keys = scratch->sortKeys;
+
+    for (int p = 0; p < scratch->pairCount; p++) {
+        target[scratch->pairs[p].a] = scratch->pairs[p].a;
+        target[scratch->pairs[p].b] = scratch->pairs[p].b;
+    }
+    for (int p = 0; p < scratch->pairCount; p++) {
+        int a = scratch->pairs[p].a;
+        int b = scratch->pairs[p].b;
+        if (outranks(ps, b, target[a])) target[a] = b;
+        if (outranks(ps, a, target[b])) target[b] = a;
+    }
+
+    // (survivor, index) for the particles that merge this step, sorted, without
+    // duplicates. Particles whose partner is itself absorbed elsewhere wait
+    int keyCount = 0;
+    for (int p = 0; p < scratch->pairCount; p++) {
+        int ends[2] = { scratch->pairs[p].a, scratch->pairs[p].b };
+        for (int e = 0; e < 2; e++) {
+            int i = ends[e];
+            int survivor = target[i];
+            if (target[survivor] != survivor) continue;
+            keys[keyCount].a = survivor;
+            keys[keyCount++].b = i;
+        }
+    }
+    qsort(keys, keyCount, sizeof(CollisionPair), compare_pairs);
+
+    int memberCount = 0;
+    scratch->groupCount = 0;
+    for (int k = 0; k < keyCount; k++) {
+        if (k > 0 && keys[k].b == keys[k - 1].b) continue;
+        if (k == 0 || keys[k].a != keys[k - 1].a) {
+            drop_lone_group(scratch, &memberCount);
+            scratch->groupStart[scratch->groupCount++] = memberCount;
+        }
+        scratch->members[memberCount++] = keys[k].b;
+    }
+    drop_lone_group(scratch, &memberCount);
+    scratch->groupStart[scratch->groupCount] = memberCount;
+    return 0;
+}
+
+// Whether the candidate list still holds every pair that can touch
+int neighbor_list_valid(CollisionScratch* scratch, const ParticleSystem* ps, float skin, ThreadPool* pool) {
+    NeighborList* list = &scratch->neighbors;
+    int slots = ps->count - ps->ghostCount;
+    if (list->slotCount != slots || list->skin != skin || skin <= 0.0f) return 0;
+
+    int workers = thread_pool_size(pool);
+    if (reserve_neighbor_list(list, workers, slots) != 0) return 0;
+    memset(list->workerMoved, 0, workers * sizeof(int));
+
+    CollisionContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.scratch = scratch;
+    ctx.ps = (ParticleSystem*)ps;
+    ctx.halfSkin = 0.5f * skin;
+    thread_pool_run(pool, check_slots_task, &ctx, slots, NEIGHBOR_SLOT_CHUNK);
+
+    for (int w = 0; w < workers; w++) {
+        if (list->workerMoved[w]) return 0;
+    }
+    return 1;
+}
+
+// Run the broad phase over the grid, collecting pairs up to `margin` apart into the worker buffers
+static void find_pairs(CollisionContext* ctx, ThreadPool* pool, float margin) {
+    const SpatialGrid* grid = ctx->grid;
+    ctx->margin = margin;
+    ctx->reach = margin > 0.0f ? (int)ceilf((2.0f * grid->maxRegularRadius + margin) / grid->cellSize) : 1;
+    if (ctx->reach < 1) ctx->reach = 1;
+
+    thread_pool_run(pool, find_pairs_task, ctx, grid->cellCount, COLLISION_CELL_CHUNK);
+    thread_pool_run(pool, find_oversized_pairs_task, ctx, grid->oversizedCount, COLLISION_OVERSIZED_CHUNK);
+}
+
+// Find and merge all touching particles
+int resolve_collisions(CollisionScratch* scratch, const SpatialGrid* grid, ParticleSystem* ps,
+                       ThreadPool* pool, float skin) {
+    int workers = thread_pool_size(pool);
+    if (reserve_collision_scratch(scratch, workers, ps->count) != 0) return 0;
+
+    for (int w = 0; w < workers; w++) {
+        scratch->buffers[w].count = 0;
+    }
+
+    CollisionContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.scratch = scratch;
+    ctx.grid = grid;
+    ctx.ps = ps;
+    ctx.firstGhost = ps->count - ps->ghostCount;
+
+    NeighborList* list = &scratch->neighbors;
+    if (skin <= 0.0f) {
+        // Touching pairs straight from the grid
+        list->slotCount = -1;
+        find_pairs(&ctx, pool, 0.0f);
+    } else {
+        // Collect the candidates within the skin, then re-test them
+        if (grid) {
+            list->slotCount = -1;
+            if (reserve_neighbor_list(list, workers, ctx.firstGhost) != 0) return 0;
+            find_pairs(&ctx, pool, skin);
+            if (gather_pairs(scratch, workers, &list->pairs, &list->pairCount, &list->pairCapacity) != 0) return 0;
+            thread_pool_run(pool, record_slots_task, &ctx, ctx.firstGhost, NEIGHBOR_SLOT_CHUNK);
+            list->slotCount = ctx.firstGhost;
+            list->skin = skin;
+
+            for (int w = 0; w < workers; w++) {
+                scratch->buffers[w].count = 0;
+            }
+        }
+        if (list->slotCount != ctx.firstGhost) return 0;
+        thread_pool_run(pool, test_candidates_task, &ctx, list->pairCount, NEIGHBOR_PAIR_CHUNK);
+    }
+
+    if (gather_pairs(scratch, workers, &scratch->pairs, &scratch->pairCount, &scratch->pairCapacity) != 0 ||
+        scratch->pairCount == 0) return 0;
+
+    if (build_groups(scratch, ps) != 0) return 0;
+    thread_pool_run(pool, merge_groups_task, &ctx, scratch->groupCount, MERGE_CHUNK);
+
+    // Every group keeps exactly one member
+    int merged = scratch->groupStart[scratch->groupCount] - scratch->groupCount;
+    ps->deadCount += merged;
+    return merged;
+}
+
+// Bytes held by the scratch buffers
+size_t collision_memory_usage(const CollisionScratch* scratch) {
+    size_t bytes = (size_t)scratch->bufferCount * sizeof(PairBuffer);
+    for (int w = 0; w < scratch->bufferCount; w++) {
+        bytes += (size_t)scratch->buffers[w].capacity * sizeof(CollisionPair);
+    }
+    bytes += (size_t)(scratch->pairCapacity + scratch->sortKeyCapacity) * sizeof(CollisionPair);
+    bytes += (size_t)scratch->particleCapacity * 3 * sizeof(int);
+
+    const NeighborList* list = &scratch->neighbors;
+    bytes += (size_t)list->pairCapacity * sizeof(CollisionPair);
+    bytes += (size_t)list->slotCapacity * (2 * sizeof(Real) + sizeof(float) + sizeof(int) + sizeof(uint32_t));
+    bytes += (size_t)list->workerCapacity * sizeof(int);
+    return bytes;
+}
+
+// Release the scratch buffers
+void free_collision_scratch(CollisionScratch* scratch) {
+    for (int w = 0; w < scratch->bufferCount; w++) {
+        free(scratch->buffers[w].pairs);
+    }
+    free(scratch->buffers);
+    free(scratch->pairs);
+    free(scratch->target);
+    free(scratch->members);
+    free(scratch->groupStart);
+    free(scratch->sortKeys);
+    free(scratch->neighbors.pairs);
+    free(scratch->neighbors.refX);
+    free(scratch->neighbors.refY);
+    free(scratch->neighbors.refRadius);
+    free(scratch->neighbors.refHandle);
+    free(scratch->neighbors.refGeneration);
+    free(scratch->neighbors.workerMoved);
+    init_collision_scratch(scratch);
+}
@@ -0,0 +1,111 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <stddef.h>
+#include "particle.h"
+#include "grid.h"
+#include "threadpool.h"
+
+// Collision phase, run after forces and integration:
+//
+//   1. Broad phase: workers scan the grid cells (and the oversized particles'
+//      wider reach) and collect touching pairs into per-worker buffers.
+//   2. The pairs are sorted, so the result does not depend on which worker
+//      found what. Every particle picks the heaviest particle it touches
+//      (lowest index on ties). A particle heavier than everything it touches
+//      absorbs the particles that picked it; the others wait. Each group is
+//      one survivor and particles touching it directly, so a touching chain
+//      (A-B, B-C) merges over several steps instead of all at once.
+//   3. Each group merges into its survivor at the group's center of mass, with
+//      mass, position and momentum summed in index order. Groups are disjoint,
+//      so they are merged in parallel.
+//
+// The outcome is identical for any thread count and any traversal order.
+//
+// With a skin distance > 0, the broad phase is not run every step. It instead
+// collects every pair closer than their radii plus the skin into a candidate
+// list (a Verlet neighbor list), and later steps only re-test those pairs. The
+// list stays complete until some particle has moved (or grown, by merging)
+// more than half the skin since it was built, so neighbor_list_valid checks
+// that and the caller rebuilds the grid and the list only when it fails.
+// Sorting, compacting or migrating moves particles to other slots; the list
+// remembers each slot's handle, so that invalidates it as well.
+
+// Default skin distance of the candidate list (world units)
+#define COLLISION_DEFAULT_SKIN 4.0f
+
+// Two touching particles, a < b
+typedef struct {
+    int a;
+    int b;
+} CollisionPair;
+
+// Touching pairs found by one worker
+typedef struct {
+    CollisionPair* pairs;
+    int count;
+    int capacity;
+} PairBuffer;
+
+// Candidate pairs of the skin-distance neighbor list, and what every slot
+// looked like when they were collected
+typedef struct {
+    CollisionPair* pairs;   // Pairs within their radii plus the skin, sorted and unique
+    int pairCount;
+    int pairCapacity;
+
+    Real* refX;             // Position of every non-ghost slot at build time
+    Real* refY;
+    float* refRadius;       // Radius at build time, -1 for slots that were inactive
+    int* refHandle;         // Handle table entry and its generation at build time, so
+    uint32_t* refGeneration; // a slot that now holds another particle is noticed
+    int slotCount;          // Non-ghost slots at build time, -1 when there is no list
+    int slotCapacity;
+    float skin;             // Skin the list was built with
+
+    int* workerMoved;       // Per worker: found a slot that moved too far
+    int workerCapacity;
+} NeighborList;
+
+// Reusable buffers of the collision phase
+typedef struct {
+    PairBuffer* buffers;    // One per worker
+    int bufferCount;
+
+    CollisionPair* pairs;   // All pairs, sorted and unique
+    int pairCount;
+    int pairCapacity;
+    CollisionPair* sortKeys; // (root, particle) for both ends of every pair
+    int sortKeyCapacity;
+
+    int* target;            // Heaviest particle each particle of a pair touches (itself if none is heavier)
+    int* members;           // Particles of all groups, grouped by root and sorted by index
+    int* groupStart;        // groupCount + 1 offsets into members
+    int groupCount;
+    int particleCapacity;
+
+    NeighborList neighbors;
+} CollisionScratch;
+
+// Initialize empty scratch buffers
+void init_collision_scratch(CollisionScratch* scratch);
+
+// Whether the candidate list built with `skin` still holds every pair that
+// can touch, i.e. no slot moved or grew by more than half the skin since
+int neighbor_list_valid(CollisionScratch* scratch, const ParticleSystem* ps, float skin, ThreadPool* pool);
+
+// Find and merge all touching particles. Merged survivors are marked stale.
+// With skin <= 0 the touching pairs come straight from `grid`. Otherwise they
+// come from the candidate list, which is first rebuilt from `grid` unless
+// `grid` is NULL (pass NULL only when neighbor_list_valid says so).
+// Returns the number of particles merged away
+int resolve_collisions(CollisionScratch* scratch, const SpatialGrid* grid, ParticleSystem* ps,
+                       ThreadPool* pool, float skin);
+
+// Bytes held by the scratch buffers
+size_t collision_memory_usage(const CollisionScratch* scratch);
+
+// Release the scratch buffers
+void free_collision_scratch(CollisionScratch* scratch);
+
+#endif // COLLISION_H
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "diagnostics.h"
+#include "pm.h"
+#include "threadpool.h"
+
+// Particles per work item; every chunk has its own partial sums
+#define DIAGNOSTICS_CHUNK 1024
+
+// Tuning steps: how far one adjustment moves a setting
+#define TIGHTEN_ETA 0.7f
+#define RELAX_ETA 1.15f
+#define TIGHTEN_THETA 0.85f
+#define RELAX_THETA 1.1f
+#define SOFTENING_STEP 1.25f
+
+// Sums over one chunk of slots
+typedef struct {
+    int particles;
+    int sampled;
+    double mass;
+    double kinetic;
+    double potential;           // Of the sampled particles only
+    double momentumX;
+    double momentumY;
+    double angularMomentum;
+    double momentumScale;
+    double angularScale;
+} DiagnosticsPartial;
+
+// Shared state of the measurement
+typedef struct {
+    DiagnosticsScratch* scratch;
+    const ParticleSystem* ps;
+    int slots;                  // Non-ghost slots
+    int stride;                 // Sample the particles whose handle entry is a multiple of this
+    double centerX;
+    double centerY;
+    float softening;
+} DiagnosticsContext;
+
+// Initialize empty scratch buffers
+void init_diagnostics(DiagnosticsScratch* scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+    init_quadtree(&scratch->tree);
+}
+
+// Potential of particle i in the field of all others, per unit mass
+static double particle_potential(const DiagnosticsContext* ctx, int i, InteractionList* list) {
+    gather_tree_interactions(&ctx->scratch->tree, ctx->ps, i, DIAGNOSTICS_THETA, list);
+
+    double eps_sq = (double)ctx->softening * ctx->softening;
+    double phi = 0.0;
+    for (int k = 0; k < list->count; k++) {
+        double r_sq = (double)list->x[k] * list->x[k] + (double)list->y[k] * list->y[k];
+        phi -= list->mass[k] / sqrt(r_sq + eps_sq);
+    }
+    return G * phi;
+}
+
+// Sums over slots [start, end), into the partials of the chunks they belong to
+static void measure_task(void* context, int start, int end, int worker) {
+    DiagnosticsContext* ctx = (DiagnosticsContext*)context;
+    const ParticleSystem* ps = ctx->ps;
+    DiagnosticsPartial* partials = (DiagnosticsPartial*)ctx->scratch->partials;
+    InteractionList* list = &ctx->scratch->lists[worker];
+
+    for (int i = start; i < end; i++) {
+        if (!ps->active[i]) continue;
+        DiagnosticsPartial* sum = &partials[i / DIAGNOSTICS_CHUNK];
+
+        double m = ps->mass[i];
+        double vx = (double)ps->vx[i], vy = (double)ps->vy[i];
+        double rx = (double)ps->x[i] - ctx->centerX, ry = (double)ps->y[i] - ctx->centerY;
+        double lz = m * (rx * vy - ry * vx);
+
+        sum->particles++;
+        sum->mass += m;
+        sum->kinetic += 0.5 * m * (vx * vx + vy * vy);
+        sum->momentumX += m * vx;
+        sum->momentumY += m * vy;
+        sum->angularMomentum += lz;
+        sum->momentumScale += m * sqrt(vx * vx + vy * vy);
+        sum->angularScale += fabs(lz);
+
+        if (ps->handle[i] < 0 || ps->handle[i] % ctx->stride == 0) {
+            sum->potential += 0.5 * m * particle_potential(ctx, i, list);
+            sum->sampled++;
+        }
+    }
+}
+
+// Make room for the per-worker lists and per-chunk sums
+static int reserve_diagnostics(DiagnosticsScratch* scratch, int workers, int chunks) {
+    if (workers > scratch->listCount) {
+        InteractionList* lists = (InteractionList*)realloc(scratch->lists, workers * sizeof(InteractionList));
+        if (lists == NULL) {
+            fprintf(stderr, "Failed to allocate memory for diagnostics\n");
+            return -1;
+        }
+        for (int w = scratch->listCount; w < workers; w++) {
+            init_interaction_list(&lists[w]);
+        }
+        scratch->lists = lists;
+        scratch->listCount = workers;
+    }
+
+    if (chunks > scratch->partialCapacity) {
+        void* partials = realloc(scratch->partials, chunks * sizeof(DiagnosticsPartial));
+        if (partials == NULL) {
+            fprintf(stderr, "Failed to allocate memory for diagnostics\n");
+            return -1;
+        }
+        scratch->partials = partials;
+        scratch->partialCapacity = chunks;
+    }
+    return 0;
+}
+
+// Measure the live particles
+int measure_diagnostics(DiagnosticsScratch* scratch, const ParticleSystem* ps, int sample, Diagnostics* out) {
+    ThreadPool* pool = get_thread_pool();
+    int slots = ps->count - ps->ghostCount;
+    int chunks = (slots + DIAGNOSTICS_CHUNK - 1) / DIAGNOSTICS_CHUNK;
+    if (reserve_diagnostics(scratch, thread_pool_size(pool), chunks) != 0) return -1;
+    memset(scratch->partials, 0, chunks * sizeof(DiagnosticsPartial));
+
+    float width, height, theta;
+    DiagnosticsContext ctx;
+    get_world_bounds(&width, &height);
+    get_barnes_hut_params(&theta, &ctx.softening);
+    ctx.scratch = scratch;
+    ctx.ps = ps;
+    ctx.slots = slots;
+    ctx.centerX = 0.5 * width;
+    ctx.centerY = 0.5 * height;
+
+    // Handle entries are handed out densely, so every stride-th one is about
+    // one particle in `stride`
+    int live = slots - ps->deadCount;
+    ctx.stride = sample > 0 && sample < live ? live / sample : 1;
+
+    build_quadtree(&scratch->tree, ps);
+    thread_pool_run(pool, measure_task, &ctx, slots, DIAGNOSTICS_CHUNK);
+
+    // Add the chunks up in order
+    DiagnosticsPartial total;
+    memset(&total, 0, sizeof(total));
+    const DiagnosticsPartial* partials = (const DiagnosticsPartial*)scratch->partials;
+    for (int c = 0; c < chunks; c++) {
+        total.particles += partials[c].particles;
+        total.sampled += partials[c].sampled;
+        total.mass += partials[c].mass;
+        total.kinetic += partials[c].kinetic;
+        total.potential += partials[c].potential;
+        total.momentumX += partials[c].momentumX;
+        total.momentumY += partials[c].momentumY;
+        total.angularMomentum += partials[c].angularMomentum;
+        total.momentumScale += partials[c].momentumScale;
+        total.angularScale += partials[c].angularScale;
+    }
+
+    out->particles = total.particles;
+    out->sampled = total.sampled;
+    out->mass = total.mass;
+    out->kinetic = total.kinetic;
+    out->potential = total.sampled > 0 ? total.potential * total.particles / total.sampled : 0.0;
+    out->energy = out->kinetic + out->potential;
+    out->momentumX = total.momentumX;
+    out->momentumY = total.momentumY;
+    out->angularMomentum = total.angularMomentum;
+    out->momentumScale = total.momentumScale;
+    out->angularScale = total.angularScale;
+    out->softening = ctx.softening;
+    return 0;
+}
+
+// Release the scratch buffers
+void free_diagnostics(DiagnosticsScratch* scratch) {
+    free_quadtree(&scratch->tree);
+    for (int w = 0; w < scratch->listCount; w++) {
+        free_interaction_list(&scratch->lists[w]);
+    }
+    free(scratch->lists);
+    free(scratch->partials);
+    init_diagnostics(scratch);
+}
+
+static inline float clamp_float(float value, float lo, float hi) {
+    return value < lo ? lo : (value > hi ? hi : value);
+}
+
+// Limits around the current settings
+void default_auto_tune_limits(AutoTuneLimits* limits) {
+    float eta, theta, softening;
+    int maxLevel;
+    get_block_timestep_params(&eta, &maxLevel);
+    get_barnes_hut_params(&theta, &softening);
+    int mesh = get_pm_mesh_size();
+
+    memset(limits, 0, sizeof(*limits));
+    limits->minEta = eta * 0.1f;
+    limits->maxEta = eta * 10.0f < 0.5f ? eta * 10.0f : 0.5f;
+    limits->minTheta = clamp_float(theta * 0.5f, 0.1f, theta);
+    limits->maxTheta = clamp_float(theta * 2.0f, theta, 1.2f);
+    limits->maxSoftening = softening * 4.0f;
+    limits->minMesh = mesh / 4 > PM_MIN_MESH_SIZE ? mesh / 4 : PM_MIN_MESH_SIZE;
+    limits->maxMesh = mesh * 4 < PM_MAX_MESH_SIZE ? mesh * 4 : PM_MAX_MESH_SIZE;
+}
+
+// Start tracking drift
+void init_auto_tuner(AutoTuner* tuner, const AutoTuneLimits* limits, int adjust) {
+    float theta;
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->limits = *limits;
+    tuner->adjust = adjust;
+    get_barnes_hut_params(&theta, &tuner->baseSoftening);
+    tuner->energyDrift = tuner->momentumDrift = tuner->angularDrift = -1.0;
+}
+
+// Add what one update_particles call did
+void auto_tuner_record_step(AutoTuner* tuner, const StepStats* stats) {
+    tuner->steps++;
+    tuner->merged += stats->mergedParticles;
+    tuner->wallEnergy += stats->wallEnergy;
+    tuner->wallMomentumX += stats->wallMomentumX;
+    tuner->wallMomentumY += stats->wallMomentumY;
+    tuner->wallAngularMomentum += stats->wallAngularMomentum;
+}
+
+// Make `now` the reference of the next interval
+static void restart_interval(AutoTuner* tuner, const Diagnostics* now) {
+    tuner->reference = *now;
+    tuner->haveReference = 1;
+    tuner->steps = 0;
+    tuner->merged = 0;
+    tuner->wallEnergy = 0.0;
+    tuner->wallMomentumX = 0.0;
+    tuner->wallMomentumY = 0.0;
+    tuner->wallAngularMomentum = 0.0;
+}
+
+// Tighten the settings that control energy drift. Returns 1 if one changed
+static int tighten_energy(const AutoTuneLimits* limits, float* eta, float* theta, float* softening) {
+    if (*eta > limits->minEta) {
+        *eta = clamp_float(*eta * TIGHTEN_ETA, limits->minEta, limits->maxEta);
+    } else if (get_gravity_solver() == SOLVER_BARNES_HUT && *theta > limits->minTheta) {
+        *theta = clamp_float(*theta * TIGHTEN_THETA, limits->minTheta, limits->maxTheta);
+    } else if (*softening < limits->maxSoftening) {
+        *softening = *softening * SOFTENING_STEP < limits->maxSoftening ? *softening * SOFTENING_STEP
+                                                                         : limits->maxSoftening;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Tighten the force solver. Returns 1 if a setting changed
+static int tighten_forces(const AutoTuneLimits* limits, float* theta, int* mesh) {
+    GravitySolver solver = get_gravity_solver();
+    if (solver == SOLVER_BARNES_HUT && *theta > limits->minTheta) {
+        *theta = clamp_float(*theta * TIGHTEN_THETA, limits->minTheta, limits->maxTheta);
+        return 1;
+    }
+    if (solver == SOLVER_PM && *mesh < limits->maxMesh) {
+        *mesh *= 2;
+        return 1;
+    }
+    return 0;
+}
+
+// Relax the most expensive setting that has room. Returns 1 if one changed
+static int relax(const AutoTuneLimits* limits, float baseSoftening, float* eta, float* theta,
+                 float* softening, int* mesh) {
+    GravitySolver solver = get_gravity_solver();
+    if (*softening > baseSoftening) {
+        *softening = *softening / SOFTENING_STEP > baseSoftening ? *softening / SOFTENING_STEP : baseSoftening;
+    } else if (solver == SOLVER_BARNES_HUT && *theta < limits->maxTheta) {
+        *theta = clamp_float(*theta * RELAX_THETA, limits->minTheta, limits->maxTheta);
+    } else if (solver == SOLVER_PM && *mesh > limits->minMesh) {
+        *mesh /= 2;
+    } else if (*eta < limits->maxEta) {
+        *eta = clamp_float(*eta * RELAX_ETA, limits->minEta, limits->maxEta);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Take a new measurement
+int auto_tune(AutoTuner* tuner, const Diagnostics* now) {
+    const Diagnostics* ref = &tuner->reference;
+
+    // Merges lose energy on purpose, a new softening changes the potential,
+    // and added or removed particles change everything
+    if (!tuner->haveReference || tuner->steps == 0 || tuner->merged > 0 ||
+        ref->particles != now->particles || ref->softening != now->softening) {
+        if (tuner->haveReference && tuner->steps > 0) tuner->skippedIntervals++;
+        restart_interval(tuner, now);
+        return 0;
+    }
+
+    // Change per step beyond what the walls account for, relative to the system's scale
+    int periodic = get_gravity_solver() == SOLVER_PM;
+    double energyScale = ref->kinetic + fabs(ref->potential);
+    double dE = now->energy - ref->energy - tuner->wallEnergy;
+    double dPx = now->momentumX - ref->momentumX - tuner->wallMomentumX;
+    double dPy = now->momentumY - ref->momentumY - tuner->wallMomentumY;
+    double dL = now->angularMomentum - ref->angularMomentum - tuner->wallAngularMomentum;
+
+    tuner->energyDrift = !periodic && energyScale > 0.0 ? fabs(dE) / energyScale / tuner->steps : -1.0;
+    tuner->momentumDrift = ref->momentumScale > 0.0 ? sqrt(dPx * dPx + dPy * dPy) / ref->momentumScale / tuner->steps
+                                                    : -1.0;
+    tuner->angularDrift = !periodic && ref->angularScale > 0.0 ? fabs(dL) / ref->angularScale / tuner->steps : -1.0;
+    if (tuner->energyDrift > tuner->maxEnergyDrift) tuner->maxEnergyDrift = tuner->energyDrift;
+    double momentumDrift = tuner->momentumDrift > tuner->angularDrift ? tuner->momentumDrift : tuner->angularDrift;
+    if (momentumDrift > tuner->maxMomentumDrift) tuner->maxMomentumDrift = momentumDrift;
+    tuner->intervals++;
+    restart_interval(tuner, now);
+    if (!tuner->adjust) return 0;
+
+    const AutoTuneLimits* limits = &tuner->limits;
+    float eta, theta, softening;
+    int maxLevel;
+    get_block_timestep_params(&eta, &maxLevel);
+    get_barnes_hut_params(&theta, &softening);
+    int mesh = get_pm_mesh_size();
+
+    int energyOver = limits->energyBudget > 0.0 && tuner->energyDrift > limits->energyBudget;
+    int momentumOver = limits->momentumBudget > 0.0 && momentumDrift > limits->momentumBudget;
+    int changed = 0;
+    if (energyOver) changed |= tighten_energy(limits, &eta, &theta, &softening);
+    if (momentumOver) changed |= tighten_forces(limits, &theta, &mesh);
+
+    if (!energyOver && !momentumOver &&
+        (limits->energyBudget <= 0.0 || tuner->energyDrift < AUTOTUNE_HEADROOM * limits->energyBudget) &&
+        (limits->momentumBudget <= 0.0 || momentumDrift < AUTOTUNE_HEADROOM * limits->momentumBudget)) {
+        changed = relax(limits, tuner->baseSoftening, &eta, &theta, &softening, &mesh);
+    }
+
+    if (!changed) return 0;
+    set_block_timestep_params(eta, maxLevel);
+    set_barnes_hut_params(theta, softening);
+    if (mesh != get_pm_mesh_size()) set_pm_mesh_size(mesh);
+    tuner->adjustments++;
+    return 1;
+}
@@ -0,0 +1,134 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "particle.h"
+#include "quadtree.h"
+#include "force_kernel.h"
+
+// Conservation diagnostics and an accuracy/cost auto-tuner.
+//
+// measure_diagnostics sums the kinetic energy, momentum and angular momentum
+// (about the world center) of the live particles exactly, and estimates the
+// potential energy by walking a Barnes-Hut tree of its own for every particle,
+// or for a fixed subset picked by handle (so the same bodies are sampled from
+// one measurement to the next) scaled up to the whole system. Sums run over
+// fixed chunks in order, so the result does not depend on the thread count.
+//
+// Gravity conserves all three quantities; what the integrator and the force
+// approximations do not conserve is error. The auto-tuner compares each
+// measurement with the previous one, takes out what wall bounces exchanged
+// (see StepStats), and turns the rest into drift per step relative to the
+// system's scale. Intervals with merges are skipped, since merging is meant to
+// lose energy. Then, against a user-given budget:
+//
+//   - energy drift too high: shrink the block timestep parameter eta; once it
+//     is at its floor, tighten the Barnes-Hut opening angle, then raise the
+//     softening
+//   - momentum or angular momentum drift too high: tighten the force solver
+//     (smaller Barnes-Hut theta, finer Particle-Mesh mesh)
+//   - everything well inside the budget: relax one knob, the most expensive
+//     first (softening back to where it started, then theta or the mesh,
+//     then eta), to get back to the cheapest settings that still fit
+//
+// The tree potential ignores the periodic images of the Particle-Mesh world
+// and wrapping moves angular momentum around, so with that solver only the
+// momentum drift is used.
+
+// Opening angle of the potential estimate's tree walk
+#define DIAGNOSTICS_THETA 0.4f
+
+// Steps between measurements unless asked otherwise
+#define DIAGNOSTICS_DEFAULT_INTERVAL 10
+
+// Drift below this fraction of every budget lets the tuner relax a knob
+#define AUTOTUNE_HEADROOM 0.25
+
+// Conserved quantities of the live, non-ghost particles
+typedef struct {
+    int particles;
+    int sampled;                // Particles whose potential was evaluated
+    double mass;
+    double kinetic;
+    double potential;           // Estimated, see above
+    double energy;              // kinetic + potential
+    double momentumX;
+    double momentumY;
+    double angularMomentum;     // About the world center
+    double momentumScale;       // Sum of m |v|, the scale momentum drift is measured against
+    double angularScale;        // Sum of m |r x v|, the same for angular momentum
+    float softening;            // Softening the potential was computed with
+} Diagnostics;
+
+// Reusable buffers of measure_diagnostics
+typedef struct {
+    QuadTree tree;
+    InteractionList* lists;     // One per worker
+    int listCount;
+    void* partials;             // Per-chunk sums
+    int partialCapacity;
+} DiagnosticsScratch;
+
+// What the tuner may change, and the drift it has to stay under
+typedef struct {
+    double energyBudget;        // Largest energy drift per step, relative to K + |W| (0 = ignore)
+    double momentumBudget;      // Largest momentum and angular momentum drift per step (0 = ignore)
+    float minEta, maxEta;
+    float minTheta, maxTheta;
+    float maxSoftening;         // The softening never drops below where it started
+    int minMesh, maxMesh;
+} AutoTuneLimits;
+
+typedef struct {
+    AutoTuneLimits limits;
+    int adjust;                 // 0 = only measure drift
+
+    Diagnostics reference;      // Previous measurement
+    int haveReference;
+    float baseSoftening;        // Softening when the tuner started
+
+    // Since the previous measurement
+    int steps;
+    int merged;
+    double wallEnergy;
+    double wallMomentumX;
+    double wallMomentumY;
+    double wallAngularMomentum;
+
+    // Drift per step of the last interval that was measured, -1 if unused
+    double energyDrift;
+    double momentumDrift;
+    double angularDrift;
+    double maxEnergyDrift;      // Largest drifts seen
+    double maxMomentumDrift;
+
+    int intervals;              // Intervals measured
+    int skippedIntervals;       // Intervals thrown away because of merges or a new softening
+    int adjustments;            // Parameter changes made
+} AutoTuner;
+
+// Initialize empty scratch buffers
+void init_diagnostics(DiagnosticsScratch* scratch);
+
+// Measure the live particles, evaluating the potential of about `sample`
+// particles (0 = all of them). Returns 0 on success, -1 if out of memory
+int measure_diagnostics(DiagnosticsScratch* scratch, const ParticleSystem* ps, int sample, Diagnostics* out);
+
+// Release the scratch buffers
+void free_diagnostics(DiagnosticsScratch* scratch);
+
+// Limits around the current settings: eta and theta may move a factor of 10
+// and 2 either way (within sensible bounds), the softening may grow 4x and
+// the mesh may halve or double twice. Budgets are 0
+void default_auto_tune_limits(AutoTuneLimits* limits);
+
+// Start tracking drift; with `adjust`, also tune the settings within `limits`
+void init_auto_tuner(AutoTuner* tuner, const AutoTuneLimits* limits, int adjust);
+
+// Add what one update_particles call did
+void auto_tuner_record_step(AutoTuner* tuner, const StepStats* stats);
+
+// Take a new measurement: update the drift figures and, if tuning, change the
+// solver settings. Returns 1 if a setting changed, 0 otherwise
+int auto_tune(AutoTuner* tuner, const Diagnostics* now);
+
+#endif // DIAGNOSTICS_H
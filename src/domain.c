@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "domain.h"
+
+// Everything a rank needs to take over a particle (or to use it as a ghost)
+typedef struct {
+    Real x;
+    Real y;
+    Real vx;
+    Real vy;
+    float mass;
+    float ax;
+    float ay;
+    float radius;
+    ParticleColor color;
+    uint8_t stale;
+} ParticleRecord;
+
+// Set up the decomposition of a run over `transport`'s ranks
+int init_domain(Domain* domain, Transport* transport, float halo, int rebalanceInterval) {
+    memset(domain, 0, sizeof(*domain));
+    domain->transport = transport;
+    domain->rank = transport->rank;
+    domain->ranks = transport->size;
+    domain->halo = halo > 0.0f ? halo : 0.0f;
+    domain->rebalanceInterval = rebalanceInterval > 0 ? rebalanceInterval : 0;
+
+    domain->edges = (double*)malloc((size_t)(domain->ranks + 1) * sizeof(double));
+    domain->outgoing = (DomainBuffer*)calloc(domain->ranks, sizeof(DomainBuffer));
+    domain->histogram = (double*)malloc(DOMAIN_BALANCE_BINS * sizeof(double));
+    domain->summary = (double*)malloc((size_t)DOMAIN_SUMMARY_CELLS * DOMAIN_SUMMARY_CELLS * 5 * sizeof(double));
+    if (!domain->edges || !domain->outgoing || !domain->histogram || !domain->summary) {
+        fprintf(stderr, "Failed to allocate memory for the domain decomposition\n");
+        free_domain(domain);
+        return -1;
+    }
+
+    // Equal slabs until the first balancing pass; the outer edges are open
+    float width, height;
+    get_world_bounds(&width, &height);
+    for (int r = 0; r <= domain->ranks; r++) {
+        domain->edges[r] = (double)width * r / domain->ranks;
+    }
+    domain->edges[0] = -HUGE_VAL;
+    domain->edges[domain->ranks] = HUGE_VAL;
+    return 0;
+}
+
+// Rank that owns position x
+int domain_owner(const Domain* domain, Real x) {
+    int low = 0;
+    int high = domain->ranks - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if ((double)x >= domain->edges[mid]) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+// Append `count` records to a buffer
+static int append_records(DomainBuffer* buffer, const ParticleRecord* records, int count) {
+    size_t needed = buffer->size + (size_t)count * sizeof(ParticleRecord);
+    if (needed > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < needed) capacity *= 2;
+        void* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate memory for a domain message\n");
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy((char*)buffer->data + buffer->size, records, (size_t)count * sizeof(ParticleRecord));
+    buffer->size = needed;
+    return 0;
+}
+
+// Record of the particle in slot i
+static ParticleRecord make_record(const ParticleSystem* ps, int i) {
+    ParticleRecord record;
+    memset(&record, 0, sizeof(record));
+    record.x = ps->x[i];
+    record.y = ps->y[i];
+    record.vx = ps->vx[i];
+    record.vy = ps->vy[i];
+    record.mass = ps->mass[i];
+    record.ax = ps->ax[i];
+    record.ay = ps->ay[i];
+    record.radius = ps->radius[i];
+    record.color = ps->color[i];
+    record.stale = ps->stale[i];
+    return record;
+}
+
+// Append received records to a system as new particles, keeping their state
+static int add_records(ParticleSystem* ps, const void* data, size_t bytes) {
+    int count = (int)(bytes / sizeof(ParticleRecord));
+    if (reserve_particles(ps, ps->count + count) != 0) return -1;
+
+    for (int k = 0; k < count; k++) {
+        ParticleRecord record;
+        memcpy(&record, (const char*)data + (size_t)k * sizeof(record), sizeof(record));
+
+        int i = add_particle(ps, record.x, record.y, record.vx, record.vy, record.mass);
+        if (i < 0) return -1;
+        ps->ax[i] = record.ax;
+        ps->ay[i] = record.ay;
+        ps->radius[i] = record.radius;
+        ps->color[i] = record.color;
+        ps->stale[i] = record.stale;
+    }
+    return count;
+}
+
+// Send every peer its outgoing message and append what comes back to `ps`, peers
+// in rank order. Pairs are visited in one global order (see transport.h).
+// Returns the number of particles received, or -1 on failure
+static int exchange_records(Domain* domain, ParticleSystem* ps) {
+    int received = 0;
+    for (int peer = 0; peer < domain->ranks; peer++) {
+        if (peer == domain->rank) continue;
+
+        DomainBuffer* out = &domain->outgoing[peer];
+        long long bytes = transport_exchange(domain->transport, peer, out->data, out->size,
+                                             &domain->incoming.data, &domain->incoming.capacity);
+        if (bytes < 0) return -1;
+
+        int added = add_records(ps, domain->incoming.data, (size_t)bytes);
+        if (added < 0) return -1;
+        received += added;
+    }
+    return received;
+}
+
+// Empty every outgoing message
+static void clear_outgoing(Domain* domain) {
+    for (int r = 0; r < domain->ranks; r++) {
+        domain->outgoing[r].size = 0;
+    }
+}
+
+// Far-field summary cell of a position, clamped to the world
+static int summary_cell(Real x, Real y, float width, float height) {
+    int cellX = (int)floor((double)x / width * DOMAIN_SUMMARY_CELLS);
+    int cellY = (int)floor((double)y / height * DOMAIN_SUMMARY_CELLS);
+    if (cellX < 0) cellX = 0;
+    if (cellX >= DOMAIN_SUMMARY_CELLS) cellX = DOMAIN_SUMMARY_CELLS - 1;
+    if (cellY < 0) cellY = 0;
+    if (cellY >= DOMAIN_SUMMARY_CELLS) cellY = DOMAIN_SUMMARY_CELLS - 1;
+    return cellY * DOMAIN_SUMMARY_CELLS + cellX;
+}
+
+// Build the ghosts this rank sends to `peer`: its particles near the peer's
+// slab, plus (for the long-range solvers) one summary particle per far cell
+static int build_ghosts(Domain* domain, const ParticleSystem* ps, int peer, int longRange,
+                        float width, float height, double reach) {
+    DomainBuffer* out = &domain->outgoing[peer];
+    double low = domain->edges[peer];
+    double high = domain->edges[peer + 1];
+    double cellWidth = (double)width / DOMAIN_SUMMARY_CELLS;
+    int cells = DOMAIN_SUMMARY_CELLS * DOMAIN_SUMMARY_CELLS;
+
+    if (longRange) memset(domain->summary, 0, (size_t)cells * 5 * sizeof(double));
+
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+
+        double x = (double)ps->x[i];
+        int near = x >= low - domain->halo && x < high + domain->halo;
+        int cell = 0;
+        if (!near && longRange) {
+            // Summarize the whole cell only if all of it is out of reach of the slab
+            cell = summary_cell(ps->x[i], ps->y[i], width, height);
+            double cellLow = (cell % DOMAIN_SUMMARY_CELLS) * cellWidth;
+            double cellHigh = cellLow + cellWidth;
+            if (cell % DOMAIN_SUMMARY_CELLS == 0) cellLow = -HUGE_VAL;
+            if (cell % DOMAIN_SUMMARY_CELLS == DOMAIN_SUMMARY_CELLS - 1) cellHigh = HUGE_VAL;
+            double gap = cellLow > high ? cellLow - high : (low > cellHigh ? low - cellHigh : 0.0);
+            near = gap < reach;
+        }
+
+        if (near) {
+            ParticleRecord record = make_record(ps, i);
+            record.stale = 0;
+            if (append_records(out, &record, 1) != 0) return -1;
+        } else if (longRange) {
+            double m = ps->mass[i];
+            double* sums = &domain->summary[(size_t)cell * 5];
+            sums[0] += m;
+            sums[1] += m * (double)ps->x[i];
+            sums[2] += m * (double)ps->y[i];
+            sums[3] += m * (double)ps->vx[i];
+            sums[4] += m * (double)ps->vy[i];
+        }
+    }
+
+    if (!longRange) return 0;
+
+    // Summary particles are point masses: no radius, so they neither collide
+    // nor stretch the grid, and no acceleration of their own
+    for (int cell = 0; cell < cells; cell++) {
+        const double* sums = &domain->summary[(size_t)cell * 5];
+        if (sums[0] <= 0.0) continue;
+
+        ParticleRecord record;
+        memset(&record, 0, sizeof(record));
+        record.mass = (float)sums[0];
+        record.x = (Real)(sums[1] / sums[0]);
+        record.y = (Real)(sums[2] / sums[0]);
+        record.vx = (Real)(sums[3] / sums[0]);
+        record.vy = (Real)(sums[4] / sums[0]);
+        record.color = calculate_color(record.mass);
+        if (append_records(out, &record, 1) != 0) return -1;
+    }
+    return 0;
+}
+
+// Swap ghosts with every other rank and append the received ones as the
+// trailing ghost slots
+static int exchange_ghosts(Domain* domain, ParticleSystem* ps) {
+    float width, height, theta, softening;
+    get_world_bounds(&width, &height);
+    get_barnes_hut_params(&theta, &softening);
+    int longRange = get_gravity_solver() != SOLVER_GRID;
+
+    // A summary cell passes Barnes-Hut's test for the whole slab once it is
+    // size / theta away; with theta = 0 nothing is summarized
+    double cellSize = (double)(width > height ? width : height) / DOMAIN_SUMMARY_CELLS;
+    double reach = theta > 0.0f ? cellSize / theta : HUGE_VAL;
+    if (reach < domain->halo) reach = domain->halo;
+
+    clear_outgoing(domain);
+    for (int peer = 0; peer < domain->ranks; peer++) {
+        if (peer == domain->rank) continue;
+        if (build_ghosts(domain, ps, peer, longRange, width, height, reach) != 0) return -1;
+    }
+
+    int received = exchange_records(domain, ps);
+    if (received < 0) return -1;
+    ps->ghostCount = received;
+    domain->ghostsReceived = received;
+    return 0;
+}
+
+// Hand particles that left this rank's slab to their new owners
+static int migrate_particles(Domain* domain, ParticleSystem* ps) {
+    clear_outgoing(domain);
+    domain->particlesSent = 0;
+
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+
+        int owner = domain_owner(domain, ps->x[i]);
+        if (owner == domain->rank) continue;
+
+        ParticleRecord record = make_record(ps, i);
+        if (append_records(&domain->outgoing[owner], &record, 1) != 0) return -1;
+        remove_particle(ps, get_particle_handle(ps, i));
+        domain->particlesSent++;
+    }
+
+    int received = exchange_records(domain, ps);
+    if (received < 0) return -1;
+    domain->particlesReceived = received;
+    return 0;
+}
+
+// Move the slab edges so every rank owns about the same number of particles
+static int rebalance(Domain* domain, const ParticleSystem* ps) {
+    float width, height;
+    get_world_bounds(&width, &height);
+
+    memset(domain->histogram, 0, DOMAIN_BALANCE_BINS * sizeof(double));
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        int bin = (int)floor((double)ps->x[i] / width * DOMAIN_BALANCE_BINS);
+        if (bin < 0) bin = 0;
+        if (bin >= DOMAIN_BALANCE_BINS) bin = DOMAIN_BALANCE_BINS - 1;
+        domain->histogram[bin] += 1.0;
+    }
+    if (transport_allreduce_sum(domain->transport, domain->histogram, DOMAIN_BALANCE_BINS) != 0) {
+        return -1;
+    }
+
+    double total = 0.0;
+    for (int b = 0; b < DOMAIN_BALANCE_BINS; b++) {
+        total += domain->histogram[b];
+    }
+
+    // Edge r goes to the first bin boundary with r / ranks of the particles below it
+    double below = 0.0;
+    int r = 1;
+    for (int b = 0; b < DOMAIN_BALANCE_BINS && r < domain->ranks; b++) {
+        below += domain->histogram[b];
+        while (r < domain->ranks && below >= total * r / domain->ranks) {
+            domain->edges[r++] = (double)width * (b + 1) / DOMAIN_BALANCE_BINS;
+        }
+    }
+    while (r < domain->ranks) {
+        domain->edges[r++] = width;
+    }
+    return 0;
+}
+
+// Split an initial state between the ranks
+int distribute_particles(Domain* domain, ParticleSystem* ps) {
+    // Keep an equal share of the slots, then let balancing and migration sort them out
+    int first = (int)((long long)ps->count * domain->rank / domain->ranks);
+    int last = (int)((long long)ps->count * (domain->rank + 1) / domain->ranks);
+    for (int i = 0; i < ps->count; i++) {
+        if ((i < first || i >= last) && ps->active[i]) {
+            remove_particle(ps, get_particle_handle(ps, i));
+        }
+    }
+    compact_particles(ps);
+
+    if (rebalance(domain, ps) != 0 || migrate_particles(domain, ps) != 0) return -1;
+    compact_particles(ps);
+    return 0;
+}
+
+// Advance this rank's particles by dt
+int domain_step(Domain* domain, ParticleSystem* ps, float dt) {
+    if (exchange_ghosts(domain, ps) != 0) return -1;
+
+    update_particles(ps, dt);
+
+    truncate_particles(ps, ps->count - ps->ghostCount);
+    ps->ghostCount = 0;
+    domain->steps++;
+
+    if (domain->rebalanceInterval > 0 && domain->steps % domain->rebalanceInterval == 0 &&
+        rebalance(domain, ps) != 0) {
+        return -1;
+    }
+    return migrate_particles(domain, ps);
+}
+
+// Live particles over all ranks
+long long domain_particle_count(Domain* domain, const ParticleSystem* ps) {
+    double count = (double)(ps->count - ps->deadCount - ps->ghostCount);
+    if (transport_allreduce_sum(domain->transport, &count, 1) != 0) return -1;
+    return (long long)count;
+}
+
+// Collect every rank's live particles on rank 0
+int gather_particles(Domain* domain, const ParticleSystem* ps, ParticleSystem* all) {
+    DomainBuffer* out = &domain->outgoing[0];
+    out->size = 0;
+    for (int i = 0; i < ps->count - ps->ghostCount; i++) {
+        if (!ps->active[i]) continue;
+        ParticleRecord record = make_record(ps, i);
+        if (append_records(out, &record, 1) != 0) return -1;
+    }
+
+    if (domain->rank != 0) {
+        return transport_exchange(domain->transport, 0, out->data, out->size,
+                                  &domain->incoming.data, &domain->incoming.capacity) < 0 ? -1 : 0;
+    }
+
+    if (add_records(all, out->data, out->size) < 0) return -1;
+    for (int peer = 1; peer < domain->ranks; peer++) {
+        long long bytes = transport_exchange(domain->transport, peer, NULL, 0,
+                                             &domain->incoming.data, &domain->incoming.capacity);
+        if (bytes < 0 || add_records(all, domain->incoming.data, (size_t)bytes) < 0) return -1;
+    }
+    return 0;
+}
+
+// Release the decomposition's buffers
+void free_domain(Domain* domain) {
+    if (domain->outgoing) {
+        for (int r = 0; r < domain->ranks; r++) {
+            free(domain->outgoing[r].data);
+        }
+    }
+    free(domain->outgoing);
+    free(domain->incoming.data);
+    free(domain->edges);
+    free(domain->histogram);
+    free(domain->summary);
+    memset(domain, 0, sizeof(*domain));
+}
@@ -0,0 +1,98 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <stddef.h>
+#include "particle.h"
+#include "transport.h"
+
+// Domain decomposition of one simulation over several processes (ranks).
+//
+// The world is cut into vertical slabs, one per rank, and each rank owns and
+// integrates the particles in its slab. Before every step the ranks swap
+// ghosts: read-only copies of the particles within reach of a neighbor's slab,
+// appended to the receiving system as its trailing `ghostCount` slots. The
+// grid solver only needs the particles within `halo` of the slab. The
+// long-range solvers also get every other rank's remaining particles summarized
+// per cell of a coarse DOMAIN_SUMMARY_CELLS x DOMAIN_SUMMARY_CELLS mesh (total
+// mass at the center of mass); a cell is only summarized if it is far enough
+// from the slab for Barnes-Hut's opening angle, otherwise its particles are
+// sent in full. After the step the ghosts are dropped and particles that left
+// the slab migrate to their new owner.
+//
+// Every DOMAIN_DEFAULT_REBALANCE steps (see `rebalanceInterval`) the slab edges
+// are moved so every rank owns about the same number of particles, from a
+// histogram of x positions summed over all ranks.
+//
+// Ghosts are not integrated (they only drift) and do not collide: particles
+// touching across a slab edge merge once they end up on the same rank. A
+// decomposed run is deterministic for a given rank and thread count, but
+// differs slightly from a single-process run.
+
+// Default width of the strip around a slab whose particles are sent in full
+#define DOMAIN_DEFAULT_HALO 64.0f
+
+// Default steps between load balancing passes
+#define DOMAIN_DEFAULT_REBALANCE 10
+
+// Cells per axis of the far-field summary
+#define DOMAIN_SUMMARY_CELLS 64
+
+// Bins of the x histogram the slab edges are placed on
+#define DOMAIN_BALANCE_BINS 4096
+
+// Message buffer for one peer
+typedef struct {
+    void* data;
+    size_t size;
+    size_t capacity;
+} DomainBuffer;
+
+// Decomposition state of one rank
+typedef struct {
+    Transport* transport;
+    int rank;
+    int ranks;
+    float halo;
+    int rebalanceInterval;      // Steps between load balancing passes, 0 = never
+    int steps;                  // Steps taken so far
+
+    double* edges;              // ranks + 1 slab edges along x; slab r is [edges[r], edges[r + 1])
+    DomainBuffer* outgoing;     // One message being built per peer
+    DomainBuffer incoming;
+
+    double* histogram;          // DOMAIN_BALANCE_BINS counts for load balancing
+    double* summary;            // Far-field cells for one peer: m, m x, m y, m vx, m vy per cell
+
+    // Counters of the most recent step on this rank
+    int ghostsReceived;
+    int particlesSent;          // Migrated to other ranks
+    int particlesReceived;      // Migrated from other ranks
+} Domain;
+
+// Set up the decomposition of a run over `transport`'s ranks. Returns 0 on success, -1 on failure
+int init_domain(Domain* domain, Transport* transport, float halo, int rebalanceInterval);
+
+// Split an initial state between the ranks. Every rank passes the same full
+// system; each keeps an equal share of the particles and the slabs are then
+// balanced. Returns 0 on success, -1 on failure
+int distribute_particles(Domain* domain, ParticleSystem* ps);
+
+// Advance this rank's particles by dt: swap ghosts, run update_particles,
+// drop the ghosts, migrate particles to their new owners and rebalance when
+// due. Every rank must call it. Returns 0 on success, -1 on failure
+int domain_step(Domain* domain, ParticleSystem* ps, float dt);
+
+// Live particles over all ranks, or -1 on failure
+long long domain_particle_count(Domain* domain, const ParticleSystem* ps);
+
+// Collect every rank's live particles into `all` on rank 0 (in rank order);
+// the other ranks only send. Returns 0 on success, -1 on failure
+int gather_particles(Domain* domain, const ParticleSystem* ps, ParticleSystem* all);
+
+// Rank that owns position x
+int domain_owner(const Domain* domain, Real x);
+
+// Release the decomposition's buffers (not the transport)
+void free_domain(Domain* domain);
+
+#endif // DOMAIN_H
@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L // For pthreads under -std=c99
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "export.h"
+
+// Kind of output a stream writes
+typedef enum {
+    EXPORT_FRAMES_Y4M,
+    EXPORT_FRAMES_PPM,
+    EXPORT_TRAJECTORY
+} ExportKind;
+
+// One buffer of the ring
+typedef struct {
+    unsigned char* data;
+    size_t size;                // Bytes in use
+    size_t capacity;
+    uint64_t sequence;          // Frame number, for PPM file names
+} ExportBuffer;
+
+struct ExportStream {
+    ExportKind kind;
+    ExportPolicy policy;
+    char* path;
+    FILE* file;                 // Video or trajectory file; PPM frames open their own
+    int width;
+    int height;
+    unsigned char* planes;      // Writer's conversion scratch: 3 bytes per pixel
+
+    ExportBuffer* buffers;
+    int bufferCount;
+    int claimed;                // A frame buffer is handed out by acquire_frame
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // Signals the writer: a buffer was queued (or closing)
+    pthread_cond_t freed;       // Signals the producer: a buffer was written
+
+    // Guarded by `lock`
+    int head;                   // Oldest queued buffer
+    int queued;                 // Buffers waiting for the writer
+    int closing;
+    int failed;                 // Writing failed; later items are refused
+    ExportStats stats;
+};
+
+// Make room for `size` bytes in a buffer. Returns -1 if out of memory
+static int reserve_buffer(ExportBuffer* buffer, size_t size) {
+    if (size <= buffer->capacity) return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < size) capacity *= 2;
+
+    unsigned char* data = (unsigned char*)realloc(buffer->data, capacity);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for export buffers\n");
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+// Clamp and round to a byte
+static inline unsigned char to_byte(float value) {
+    if (value <= 0.0f) return 0;
+    if (value >= 255.0f) return 255;
+    return (unsigned char)(value + 0.5f);
+}
+
+// Write one y4m frame: studio-range BT.601 Y, Cb and Cr planes at full resolution
+static int write_y4m_frame(ExportStream* stream, const uint32_t* pixels) {
+    size_t count = (size_t)stream->width * stream->height;
+    unsigned char* luma = stream->planes;
+    unsigned char* cb = luma + count;
+    unsigned char* cr = cb + count;
+
+    for (size_t p = 0; p < count; p++) {
+        float r = (float)((pixels[p] >> 16) & 0xFF);
+        float g = (float)((pixels[p] >> 8) & 0xFF);
+        float b = (float)(pixels[p] & 0xFF);
+        luma[p] = to_byte(16.0f + 0.257f * r + 0.504f * g + 0.098f * b);
+        cb[p] = to_byte(128.0f - 0.148f * r - 0.291f * g + 0.439f * b);
+        cr[p] = to_byte(128.0f + 0.439f * r - 0.368f * g - 0.071f * b);
+    }
+
+    if (fputs("FRAME\n", stream->file) < 0) return -1;
+    return fwrite(stream->planes, 1, 3 * count, stream->file) == 3 * count ? 0 : -1;
+}
+
+// Write one frame as a binary PPM file named by the path pattern
+static int write_ppm_frame(ExportStream* stream, const uint32_t* pixels, uint64_t sequence) {
+    size_t count = (size_t)stream->width * stream->height;
+    for (size_t p = 0; p < count; p++) {
+        stream->planes[3 * p] = (unsigned char)((pixels[p] >> 16) & 0xFF);
+        stream->planes[3 * p + 1] = (unsigned char)((pixels[p] >> 8) & 0xFF);
+        stream->planes[3 * p + 2] = (unsigned char)(pixels[p] & 0xFF);
+    }
+
+    char name[4096];
+    snprintf(name, sizeof(name), stream->path, (int)sequence);
+    FILE* file = fopen(name, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open frame file: %s\n", name);
+        return -1;
+    }
+    int ok = fprintf(file, "P6\n%d %d\n255\n", stream->width, stream->height) > 0 &&
+             fwrite(stream->planes, 1, 3 * count, file) == 3 * count;
+    if (fclose(file) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+// Write one queued buffer to the output
+static int write_buffer(ExportStream* stream, const ExportBuffer* buffer) {
+    switch (stream->kind) {
+    case EXPORT_FRAMES_Y4M: return write_y4m_frame(stream, (const uint32_t*)buffer->data);
+    case EXPORT_FRAMES_PPM: return write_ppm_frame(stream, (const uint32_t*)buffer->data, buffer->sequence);
+    default: return fwrite(buffer->data, 1, buffer->size, stream->file) == buffer->size ? 0 : -1;
+    }
+}
+
+// Writer thread: empty the ring in order until the stream closes
+static void* writer_main(void* arg) {
+    ExportStream* stream = (ExportStream*)arg;
+
+    pthread_mutex_lock(&stream->lock);
+    for (;;) {
+        while (stream->queued == 0 && !stream->closing) {
+            pthread_cond_wait(&stream->filled, &stream->lock);
+        }
+        if (stream->queued == 0) break;
+
+        // The producer never touches a queued buffer, so it is written unlocked
+        ExportBuffer* buffer = &stream->buffers[stream->head];
+        int failed = stream->failed;
+        pthread_mutex_unlock(&stream->lock);
+
+        int status = failed ? 0 : write_buffer(stream, buffer);
+        if (status != 0) fprintf(stderr, "Failed to write export: %s\n", stream->path);
+
+        pthread_mutex_lock(&stream->lock);
+        if (status != 0) stream->failed = 1;
+        else if (!failed) stream->stats.written++;
+        stream->head = (stream->head + 1) % stream->bufferCount;
+        stream->queued--;
+        pthread_cond_signal(&stream->freed);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+// Allocate a stream and its ring, without an output or writer yet
+static ExportStream* create_stream(ExportKind kind, const char* path, int buffers, ExportPolicy policy) {
+    ExportStream* stream = (ExportStream*)calloc(1, sizeof(ExportStream));
+    if (!stream) {
+        fprintf(stderr, "Failed to allocate memory for export stream\n");
+        return NULL;
+    }
+    stream->kind = kind;
+    stream->policy = policy;
+    stream->bufferCount = buffers > 0 ? buffers : EXPORT_DEFAULT_BUFFERS;
+    stream->buffers = (ExportBuffer*)calloc(stream->bufferCount, sizeof(ExportBuffer));
+    stream->path = (char*)malloc(strlen(path) + 1);
+    if (!stream->buffers || !stream->path) {
+        fprintf(stderr, "Failed to allocate memory for export stream\n");
+        free(stream->buffers);
+        free(stream->path);
+        free(stream);
+        return NULL;
+    }
+    strcpy(stream->path, path);
+    return stream;
+}
+
+// Release everything a stream holds; the writer must not be running
+static void free_stream(ExportStream* stream) {
+    for (int b = 0; b < stream->bufferCount; b++) {
+        free(stream->buffers[b].data);
+    }
+    free(stream->buffers);
+    free(stream->planes);
+    free(stream->path);
+    free(stream);
+}
+
+// Start the writer thread. Returns -1 on failure
+static int start_writer(ExportStream* stream) {
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->filled, NULL);
+    pthread_cond_init(&stream->freed, NULL);
+    if (pthread_create(&stream->thread, NULL, writer_main, stream) != 0) {
+        fprintf(stderr, "Failed to start export writer thread\n");
+        pthread_cond_destroy(&stream->freed);
+        pthread_cond_destroy(&stream->filled);
+        pthread_mutex_destroy(&stream->lock);
+        return -1;
+    }
+    return 0;
+}
+
+// Whether a path ends with the given extension
+static int has_extension(const char* path, const char* extension) {
+    size_t length = strlen(path), extLength = strlen(extension);
+    return length >= extLength && strcmp(path + length - extLength, extension) == 0;
+}
+
+// Whether a path holds exactly one integer printf conversion, for PPM names
+static int is_frame_pattern(const char* path) {
+    int conversions = 0;
+    for (const char* c = path; *c; c++) {
+        if (*c != '%') continue;
+        if (c[1] == '%') {
+            c++;
+            continue;
+        }
+        c++;
+        while (*c == '0' || *c == '-' || *c == '+' || *c == ' ' || (*c >= '1' && *c <= '9')) c++;
+        if (*c != 'd' && *c != 'i' && *c != 'u') return 0;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Start writing frames
+ExportStream* open_frame_export(const char* path, int width, int height, int buffers, ExportPolicy policy) {
+    ExportKind kind = has_extension(path, ".y4m") ? EXPORT_FRAMES_Y4M : EXPORT_FRAMES_PPM;
+    if (kind == EXPORT_FRAMES_PPM && !is_frame_pattern(path)) {
+        fprintf(stderr, "Frame path needs a .y4m extension or a frame number pattern such as frame%%05d.ppm: %s\n",
+                path);
+        return NULL;
+    }
+    if (width <= 0 || height <= 0) return NULL;
+
+    ExportStream* stream = create_stream(kind, path, buffers, policy);
+    if (!stream) return NULL;
+    stream->width = width;
+    stream->height = height;
+
+    size_t pixels = (size_t)width * height;
+    stream->planes = (unsigned char*)malloc(3 * pixels);
+    int ok = stream->planes != NULL;
+    for (int b = 0; ok && b < stream->bufferCount; b++) {
+        ok = reserve_buffer(&stream->buffers[b], pixels * sizeof(uint32_t)) == 0;
+        if (ok) stream->buffers[b].size = pixels * sizeof(uint32_t);
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate memory for export buffers\n");
+        free_stream(stream);
+        return NULL;
+    }
+
+    if (kind == EXPORT_FRAMES_Y4M) {
+        stream->file = fopen(path, "wb");
+        if (!stream->file || fprintf(stream->file, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", width, height) < 0) {
+            fprintf(stderr, "Failed to open frame file: %s\n", path);
+            if (stream->file) fclose(stream->file);
+            free_stream(stream);
+            return NULL;
+        }
+    }
+
+    if (start_writer(stream) != 0) {
+        if (stream->file) fclose(stream->file);
+        free_stream(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+// Start writing trajectory records
+ExportStream* open_trajectory_export(const char* path, int buffers, ExportPolicy policy) {
+    ExportStream* stream = create_stream(EXPORT_TRAJECTORY, path, buffers, policy);
+    if (!stream) return NULL;
+
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+    header.version = TRAJECTORY_VERSION;
+    header.byteOrder = TRAJECTORY_BYTE_ORDER;
+    header.positionBytes = (uint32_t)sizeof(Real);
+
+    stream->file = fopen(path, "wb");
+    if (!stream->file || fwrite(&header, sizeof(header), 1, stream->file) != 1) {
+        fprintf(stderr, "Failed to open trajectory file: %s\n", path);
+        if (stream->file) fclose(stream->file);
+        free_stream(stream);
+        return NULL;
+    }
+
+    if (start_writer(stream) != 0) {
+        fclose(stream->file);
+        free_stream(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+// Wait for (or give up on) a free buffer. Returns its index, -1 if the item is
+// dropped or the stream has failed. Called with the lock held
+static int claim_buffer(ExportStream* stream) {
+    while (!stream->failed && stream->queued == stream->bufferCount) {
+        if (stream->policy == EXPORT_DROP) {
+            stream->stats.dropped++;
+            return -1;
+        }
+        pthread_cond_wait(&stream->freed, &stream->lock);
+    }
+    if (stream->failed) return -1;
+    return (stream->head + stream->queued) % stream->bufferCount;
+}
+
+// Hand the claimed buffer to the writer. Called with the lock held
+static void queue_buffer(ExportStream* stream) {
+    stream->queued++;
+    stream->stats.submitted++;
+    pthread_cond_signal(&stream->filled);
+}
+
+// Claim the next frame buffer
+uint32_t* acquire_frame(ExportStream* stream) {
+    if (!stream || stream->kind == EXPORT_TRAJECTORY || stream->claimed) return NULL;
+
+    pthread_mutex_lock(&stream->lock);
+    int index = claim_buffer(stream);
+    pthread_mutex_unlock(&stream->lock);
+    if (index < 0) return NULL;
+
+    stream->claimed = 1;
+    return (uint32_t*)stream->buffers[index].data;
+}
+
+// Queue the claimed frame
+void submit_frame(ExportStream* stream) {
+    if (!stream || !stream->claimed) return;
+    stream->claimed = 0;
+
+    pthread_mutex_lock(&stream->lock);
+    ExportBuffer* buffer = &stream->buffers[(stream->head + stream->queued) % stream->bufferCount];
+    buffer->sequence = stream->stats.submitted;
+    queue_buffer(stream);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Give back the claimed frame; the next acquire_frame hands out the same buffer
+void discard_frame(ExportStream* stream) {
+    if (stream) stream->claimed = 0;
+}
+
+// Append `count` elements of `size` bytes gathered from the live, non-ghost slots
+static unsigned char* pack_field(unsigned char* out, const ParticleSystem* ps, int slots,
+                                 const void* field, size_t size) {
+    const unsigned char* in = (const unsigned char*)field;
+    for (int i = 0; i < slots; i++) {
+        if (!ps->active[i]) continue;
+        memcpy(out, in + (size_t)i * size, size);
+        out += size;
+    }
+    return out;
+}
+
+// Copy the live particles into the ring and queue them
+int export_trajectory(ExportStream* stream, const ParticleSystem* ps, uint64_t step, double time) {
+    if (!stream || stream->kind != EXPORT_TRAJECTORY) return -1;
+
+    pthread_mutex_lock(&stream->lock);
+    int index = claim_buffer(stream);
+    int failed = stream->failed;
+    pthread_mutex_unlock(&stream->lock);
+    if (index < 0) return failed ? -1 : 1;
+
+    int slots = ps->count - ps->ghostCount;
+    uint64_t count = 0;
+    for (int i = 0; i < slots; i++) {
+        if (ps->active[i]) count++;
+    }
+
+    // Record header, then the fields back to back
+    size_t particleBytes = 4 * sizeof(Real) + 2 * sizeof(float) + sizeof(int32_t) + sizeof(uint32_t);
+    ExportBuffer* buffer = &stream->buffers[index];
+    if (reserve_buffer(buffer, sizeof(TrajectoryRecord) + count * particleBytes) != 0) {
+        pthread_mutex_lock(&stream->lock);
+        stream->failed = 1;
+        pthread_mutex_unlock(&stream->lock);
+        return -1;
+    }
+
+    TrajectoryRecord record = { step, time, count };
+    memcpy(buffer->data, &record, sizeof(record));
+    unsigned char* out = buffer->data + sizeof(record);
+    out = pack_field(out, ps, slots, ps->x, sizeof(Real));
+    out = pack_field(out, ps, slots, ps->y, sizeof(Real));
+    out = pack_field(out, ps, slots, ps->vx, sizeof(Real));
+    out = pack_field(out, ps, slots, ps->vy, sizeof(Real));
+    out = pack_field(out, ps, slots, ps->mass, sizeof(float));
+    out = pack_field(out, ps, slots, ps->radius, sizeof(float));
+    out = pack_field(out, ps, slots, ps->handle, sizeof(int32_t));
+    for (int i = 0; i < slots; i++) {
+        if (!ps->active[i]) continue;
+        uint32_t generation = ps->handle[i] >= 0 ? ps->handleGeneration[ps->handle[i]] : 0;
+        memcpy(out, &generation, sizeof(generation));
+        out += sizeof(generation);
+    }
+    buffer->size = (size_t)(out - buffer->data);
+
+    pthread_mutex_lock(&stream->lock);
+    queue_buffer(stream);
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+// Counters of the stream so far
+void get_export_stats(ExportStream* stream, ExportStats* stats) {
+    pthread_mutex_lock(&stream->lock);
+    *stats = stream->stats;
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Drain, stop the writer and close the output
+int close_export(ExportStream* stream) {
+    if (!stream) return 0;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->closing = 1;
+    pthread_cond_signal(&stream->filled);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    int status = stream->failed ? -1 : 0;
+    if (stream->file && fclose(stream->file) != 0) {
+        fprintf(stderr, "Failed to write export: %s\n", stream->path);
+        status = -1;
+    }
+
+    pthread_cond_destroy(&stream->freed);
+    pthread_cond_destroy(&stream->filled);
+    pthread_mutex_destroy(&stream->lock);
+    free_stream(stream);
+    return status;
+}
+
+// Look up a policy by name
+int parse_export_policy(const char* name, ExportPolicy* policy) {
+    if (strcmp(name, "block") == 0) {
+        *policy = EXPORT_BLOCK;
+    } else if (strcmp(name, "drop") == 0) {
+        *policy = EXPORT_DROP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Lowercase name of a policy
+const char* export_policy_name(ExportPolicy policy) {
+    return policy == EXPORT_DROP ? "drop" : "block";
+}
@@ -0,0 +1,108 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include "particle.h"
+
+// Recorded output, written on a background thread so the simulation never
+// waits on the disk.
+//
+// The caller copies each frame or particle state into one of a fixed ring of
+// buffers and moves on; the writer thread empties the ring in order. When the
+// ring is full the export policy decides: EXPORT_BLOCK waits for a free buffer,
+// EXPORT_DROP skips the item (and counts it), so a slow disk never slows
+// stepping. One thread produces and the writer consumes; a stream is not meant
+// to be fed from several threads.
+//
+// Frames (ARGB8888 pixels) go to a YUV4MPEG2 video when the path ends in
+// ".y4m" (4:4:4 chroma, BT.601), otherwise to one binary PPM per frame, named
+// by a printf pattern in the path such as "frames/%05d.ppm".
+//
+// Trajectories go to one binary file:
+//
+//   TrajectoryHeader
+//   per exported step: TrajectoryRecord, then
+//     x, y, vx, vy (float or double[count], see positionBytes),
+//     mass, radius (float[count]), handle (int32_t[count]), generation (uint32_t[count])
+//
+// Only live, non-ghost particles are stored, in slot order. A particle's handle
+// entry and generation (see ParticleHandle) identify it across records even
+// though compaction and reordering move it between slots; copies without a
+// handle table (the demo's snapshots) store -1 and 0. Values are in the
+// writer's byte order.
+#define TRAJECTORY_MAGIC "NBODYTR"
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_BYTE_ORDER 0x01020304u
+
+// Buffers in the ring unless asked otherwise
+#define EXPORT_DEFAULT_BUFFERS 8
+
+// What to do with a new item while every buffer is waiting to be written
+typedef enum {
+    EXPORT_BLOCK,       // Wait for the writer to free a buffer
+    EXPORT_DROP         // Skip the item
+} ExportPolicy;
+
+// On-disk header of a trajectory file
+typedef struct {
+    char magic[8];              // TRAJECTORY_MAGIC, NUL-terminated
+    uint32_t version;           // TRAJECTORY_VERSION
+    uint32_t byteOrder;         // TRAJECTORY_BYTE_ORDER as the writer stored it
+    uint32_t positionBytes;     // Size of one x, y, vx or vy value: 4 (float) or 8 (double)
+    uint32_t reserved;
+} TrajectoryHeader;
+
+// On-disk header of one exported step
+typedef struct {
+    uint64_t step;
+    double time;
+    uint64_t count;             // Particles in this record
+} TrajectoryRecord;
+
+// Counters of a stream
+typedef struct {
+    uint64_t submitted;         // Items queued for writing
+    uint64_t written;           // Items the writer finished
+    uint64_t dropped;           // Items skipped because the ring was full (EXPORT_DROP)
+} ExportStats;
+
+typedef struct ExportStream ExportStream;
+
+// Start writing width x height frames to `path` through `buffers` preallocated
+// frame buffers (0 = EXPORT_DEFAULT_BUFFERS). Returns NULL on failure
+ExportStream* open_frame_export(const char* path, int width, int height, int buffers, ExportPolicy policy);
+
+// Start writing trajectory records to `path` through `buffers` ring buffers
+// (0 = EXPORT_DEFAULT_BUFFERS); each grows to the largest state it has held.
+// Returns NULL on failure
+ExportStream* open_trajectory_export(const char* path, int buffers, ExportPolicy policy);
+
+// Claim the next frame buffer: width * height ARGB8888 pixels, rows packed.
+// Fill it and hand it over with submit_frame. Returns NULL if the frame is
+// dropped or the stream has failed
+uint32_t* acquire_frame(ExportStream* stream);
+
+// Queue the frame claimed by acquire_frame for writing
+void submit_frame(ExportStream* stream);
+
+// Give back the frame claimed by acquire_frame without writing it
+void discard_frame(ExportStream* stream);
+
+// Copy the live particles into the ring and queue them as one record.
+// Returns 0 if queued, 1 if dropped, -1 on failure
+int export_trajectory(ExportStream* stream, const ParticleSystem* ps, uint64_t step, double time);
+
+// Counters of the stream so far
+void get_export_stats(ExportStream* stream, ExportStats* stats);
+
+// Write everything still queued, stop the writer and close the output.
+// Returns 0 on success, -1 if anything failed to write
+int close_export(ExportStream* stream);
+
+// Look up a policy by name ("block" or "drop"). Returns 0 on success, -1 if unknown
+int parse_export_policy(const char* name, ExportPolicy* policy);
+
+// Lowercase name of a policy
+const char* export_policy_name(ExportPolicy policy);
+
+#endif // EXPORT_H
@@ -0,0 +1,76 @@
+#ifndef FORCE_KERNEL_H
+#define FORCE_KERNEL_H
+
+// Batched gravity kernels: one target against a list of sources.
+//
+// All kernels compute  a = G * sum_j m_j * d_j / (|d_j|^2 + eps^2)^(3/2)
+// where d_j is the vector from the target to source j. A source at the
+// target's own position contributes nothing as long as eps_sq > 0.
+
+// Sources gathered for one or more targets, stored as separate arrays
+typedef struct {
+    float* x;
+    float* y;
+    float* mass;
+    int count;
+    int capacity;
+} InteractionList;
+
+// Signature shared by the scalar and SIMD kernels
+typedef void (*ForceKernel)(float px, float py,
+                            const float* sx, const float* sy, const float* sm, int n,
+                            float eps_sq, float* ax, float* ay);
+
+// Instruction sets a kernel can be built for, from slowest to fastest
+typedef enum {
+    FORCE_ISA_SCALAR,
+    FORCE_ISA_AVX2,
+    FORCE_ISA_AVX512
+} ForceKernelIsa;
+
+// Portable reference kernel
+void force_kernel_scalar(float px, float py,
+                         const float* sx, const float* sy, const float* sm, int n,
+                         float eps_sq, float* ax, float* ay);
+
+// SIMD kernels, or NULL when the compiler could not build them
+extern const ForceKernel force_kernel_avx2;
+extern const ForceKernel force_kernel_avx512;
+
+// Pick the fastest kernel this CPU supports; called lazily by get_force_kernel
+void init_force_kernel(void);
+
+// Get the selected kernel
+ForceKernel get_force_kernel(void);
+
+// Get the instruction set of the selected kernel
+ForceKernelIsa get_force_kernel_isa(void);
+
+// Human-readable name of an instruction set
+const char* force_kernel_isa_name(ForceKernelIsa isa);
+
+// Force a specific kernel. Returns 0 on success, -1 if unavailable on this CPU
+int set_force_kernel_isa(ForceKernelIsa isa);
+
+// Compare a kernel against the scalar reference on a fixed pseudo-random batch.
+// Returns the largest relative error found
+float validate_force_kernel(ForceKernel kernel);
+
+// Initialize an empty interaction list
+void init_interaction_list(InteractionList* list);
+
+// Make room for at least `capacity` sources. Returns 0 on success
+int reserve_interaction_list(InteractionList* list, int capacity);
+
+// Append one source (the list must have room, see reserve_interaction_list)
+static inline void push_interaction(InteractionList* list, float x, float y, float mass) {
+    list->x[list->count] = x;
+    list->y[list->count] = y;
+    list->mass[list->count] = mass;
+    list->count++;
+}
+
+// Release the list's memory
+void free_interaction_list(InteractionList* list);
+
+#endif // FORCE_KERNEL_H
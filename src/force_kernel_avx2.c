@@ -0,0 +1,75 @@
+// AVX2 + FMA force kernel. This file is compiled with -mavx2 -mfma and is only
+// called after init_force_kernel has confirmed the CPU supports it.
+#include <stddef.h>
+#include "force_kernel.h"
+#include "particle.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+// Sum the 8 lanes of a vector
+static inline float horizontal_sum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+// One target against 8 sources per iteration, using rsqrt plus one Newton step
+static void kernel_avx2(float px, float py,
+                        const float* sx, const float* sy, const float* sm, int n,
+                        float eps_sq, float* ax, float* ay) {
+    const __m256 vpx = _mm256_set1_ps(px);
+    const __m256 vpy = _mm256_set1_ps(py);
+    const __m256 veps = _mm256_set1_ps(eps_sq);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    __m256 sum_x = _mm256_setzero_ps();
+    __m256 sum_y = _mm256_setzero_ps();
+
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(sx + j), vpx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(sy + j), vpy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, veps));
+
+        // y = rsqrt(r2) refined: y * (1.5 - 0.5 * r2 * y * y)
+        __m256 y = _mm256_rsqrt_ps(r2);
+        __m256 hr2 = _mm256_mul_ps(half, r2);
+        y = _mm256_mul_ps(y, _mm256_fnmadd_ps(_mm256_mul_ps(hr2, y), y, three_halves));
+
+        __m256 s = _mm256_mul_ps(_mm256_loadu_ps(sm + j), _mm256_mul_ps(_mm256_mul_ps(y, y), y));
+        sum_x = _mm256_fmadd_ps(s, dx, sum_x);
+        sum_y = _mm256_fmadd_ps(s, dy, sum_y);
+    }
+
+    if (j < n) {
+        // Masked tail; lanes past n are cleared so they cannot add NaNs
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - j), lane);
+        __m256 fmask = _mm256_castsi256_ps(mask);
+
+        __m256 dx = _mm256_sub_ps(_mm256_maskload_ps(sx + j, mask), vpx);
+        __m256 dy = _mm256_sub_ps(_mm256_maskload_ps(sy + j, mask), vpy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, veps));
+
+        __m256 y = _mm256_rsqrt_ps(r2);
+        __m256 hr2 = _mm256_mul_ps(half, r2);
+        y = _mm256_mul_ps(y, _mm256_fnmadd_ps(_mm256_mul_ps(hr2, y), y, three_halves));
+
+        __m256 s = _mm256_mul_ps(_mm256_maskload_ps(sm + j, mask), _mm256_mul_ps(_mm256_mul_ps(y, y), y));
+        s = _mm256_and_ps(s, fmask);
+        sum_x = _mm256_fmadd_ps(s, dx, sum_x);
+        sum_y = _mm256_fmadd_ps(s, dy, sum_y);
+    }
+
+    *ax = (float)G * horizontal_sum(sum_x);
+    *ay = (float)G * horizontal_sum(sum_y);
+}
+
+const ForceKernel force_kernel_avx2 = kernel_avx2;
+#else
+const ForceKernel force_kernel_avx2 = NULL;
+#endif
@@ -0,0 +1,47 @@
+// AVX-512 force kernel. This file is compiled with -mavx512f and is only
+// called after init_force_kernel has confirmed the CPU supports it.
+#include <stddef.h>
+#include "force_kernel.h"
+#include "particle.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+
+// One target against 16 sources per iteration, using rsqrt14 plus one Newton step
+static void kernel_avx512(float px, float py,
+                          const float* sx, const float* sy, const float* sm, int n,
+                          float eps_sq, float* ax, float* ay) {
+    const __m512 vpx = _mm512_set1_ps(px);
+    const __m512 vpy = _mm512_set1_ps(py);
+    const __m512 veps = _mm512_set1_ps(eps_sq);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    __m512 sum_x = _mm512_setzero_ps();
+    __m512 sum_y = _mm512_setzero_ps();
+
+    for (int j = 0; j < n; j += 16) {
+        // Full mask except on the last, partial iteration
+        __mmask16 mask = (n - j >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - j)) - 1u);
+
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, sx + j), vpx);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, sy + j), vpy);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, veps));
+
+        // y = rsqrt(r2) refined: y * (1.5 - 0.5 * r2 * y * y)
+        __m512 y = _mm512_rsqrt14_ps(r2);
+        __m512 hr2 = _mm512_mul_ps(half, r2);
+        y = _mm512_mul_ps(y, _mm512_fnmadd_ps(_mm512_mul_ps(hr2, y), y, three_halves));
+
+        __m512 s = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, sm + j), _mm512_mul_ps(_mm512_mul_ps(y, y), y));
+        sum_x = _mm512_mask3_fmadd_ps(s, dx, sum_x, mask);
+        sum_y = _mm512_mask3_fmadd_ps(s, dy, sum_y, mask);
+    }
+
+    *ax = (float)G * _mm512_reduce_add_ps(sum_x);
+    *ay = (float)G * _mm512_reduce_add_ps(sum_y);
+}
+
+const ForceKernel force_kernel_avx512 = kernel_avx512;
+#else
+const ForceKernel force_kernel_avx512 = NULL;
+#endif
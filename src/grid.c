@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "grid.h"
+
+// Initialize an empty grid
+void init_grid(SpatialGrid* grid) {
+    grid->originX = 0.0f;
+    grid->originY = 0.0f;
+    grid->cellSize = 1.0f;
+    grid->cellsX = 0;
+    grid->cellsY = 0;
+    grid->cellCount = 0;
+    grid->cellStart = NULL;
+    grid->particleIndices = NULL;
+    grid->particleCell = NULL;
+    grid->indexedCount = 0;
+    grid->oversized = NULL;
+    grid->oversizedCount = 0;
+    grid->maxRegularRadius = 0.0f;
+    grid->cellCapacity = 0;
+    grid->particleCapacity = 0;
+}
+
+// Grow the per-particle and per-cell arrays as needed
+static int reserve_grid(SpatialGrid* grid, int particles, int cells) {
+    if (particles > grid->particleCapacity) {
+        int* indices = (int*)realloc(grid->particleIndices, particles * sizeof(int));
+        if (indices) grid->particleIndices = indices;
+        int* cellOf = (int*)realloc(grid->particleCell, particles * sizeof(int));
+        if (cellOf) grid->particleCell = cellOf;
+        int* oversized = (int*)realloc(grid->oversized, particles * sizeof(int));
+        if (oversized) grid->oversized = oversized;
+
+        if (!indices || !cellOf || !oversized) {
+            fprintf(stderr, "Failed to allocate memory for spatial grid\n");
+            return -1;
+        }
+        grid->particleCapacity = particles;
+    }
+
+    if (cells + 1 > grid->cellCapacity) {
+        int* cellStart = (int*)realloc(grid->cellStart, (cells + 1) * sizeof(int));
+        if (cellStart == NULL) {
+            fprintf(stderr, "Failed to allocate memory for spatial grid\n");
+            return -1;
+        }
+        grid->cellStart = cellStart;
+        grid->cellCapacity = cells + 1;
+    }
+
+    return 0;
+}
+
+// Column/row of the cell containing a point, clamped to the grid
+void grid_cell_coords(const SpatialGrid* grid, Real x, Real y, int* cellX, int* cellY) {
+    // Clamped before the conversion, which is undefined for NaN or out-of-range values
+    Real fx = (x - grid->originX) / grid->cellSize;
+    Real fy = (y - grid->originY) / grid->cellSize;
+
+    *cellX = fx >= (Real)grid->cellsX ? grid->cellsX - 1 : fx > 0.0f ? (int)fx : 0;
+    *cellY = fy >= (Real)grid->cellsY ? grid->cellsY - 1 : fy > 0.0f ? (int)fy : 0;
+}
+
+// Rebuild the grid with cells of `cellSize`, or of GRID_CELL_RADIUS_FACTOR times
+// the mean radius if it is 0. Cells are widened until there are at most
+// GRID_MAX_CELLS_PER_PARTICLE per particle or `minCellLimit` in all
+static void build_cells(SpatialGrid* grid, const ParticleSystem* ps, float cellSize, double minCellLimit) {
+    int count = ps->count;
+
+    grid->indexedCount = 0;
+    grid->oversizedCount = 0;
+    grid->maxRegularRadius = 0.0f;
+
+    // Bounding box and mean radius of the live particles. Particles with a
+    // non-finite position are left out of the box and binned into a corner cell
+    int active = 0;
+    int bounded = 0;
+    Real minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    double radiusSum = 0.0;
+    for (int i = 0; i < count; i++) {
+        if (!ps->active[i]) continue;
+        radiusSum += ps->radius[i];
+        active++;
+
+        Real x = ps->x[i];
+        Real y = ps->y[i];
+        if (!isfinite(x) || !isfinite(y)) continue;
+        if (bounded == 0) {
+            minX = maxX = x;
+            minY = maxY = y;
+        } else {
+            if (x < minX) minX = x;
+            if (x > maxX) maxX = x;
+            if (y < minY) minY = y;
+            if (y > maxY) maxY = y;
+        }
+        bounded++;
+    }
+
+    if (cellSize <= 0.0f) {
+        cellSize = active > 0 ? GRID_CELL_RADIUS_FACTOR * (float)(radiusSum / active) : 1.0f;
+    }
+    if (!(cellSize > 0.0f) || !isfinite(cellSize)) cellSize = 1.0f;
+
+    // Enough cells to cover the bounding box, but never far more cells than
+    // particles. The extent is taken in double so even a box spanning the whole
+    // float range gives a finite cell count
+    double cellLimit = (double)GRID_MAX_CELLS_PER_PARTICLE * (active > 0 ? active : 1);
+    if (cellLimit < minCellLimit) cellLimit = minCellLimit;
+    double spanX = (double)maxX - (double)minX;
+    double spanY = (double)maxY - (double)minY;
+    int cellsX, cellsY;
+    for (;;) {
+        double columns = floor(spanX / cellSize) + 1.0;
+        double rows = floor(spanY / cellSize) + 1.0;
+        double cells = columns * rows;
+        if (cells <= cellLimit) {
+            cellsX = (int)columns;
+            cellsY = (int)rows;
+            break;
+        }
+        cellSize *= (float)sqrt(cells / cellLimit) * 1.01f;
+    }
+
+    if (reserve_grid(grid, count > 0 ? count : 1, cellsX * cellsY) != 0) {
+        grid->cellCount = 0;
+        return;
+    }
+
+    grid->originX = minX;
+    grid->originY = minY;
+    grid->cellSize = cellSize;
+    grid->cellsX = cellsX;
+    grid->cellsY = cellsY;
+    grid->cellCount = cellsX * cellsY;
+
+    // Counting sort: histogram of particles per cell...
+    int* cellStart = grid->cellStart;
+    for (int c = 0; c <= grid->cellCount; c++) {
+        cellStart[c] = 0;
+    }
+
+    float halfCell = cellSize * 0.5f;
+    for (int i = 0; i < count; i++) {
+        if (!ps->active[i]) {
+            grid->particleCell[i] = -1;
+            continue;
+        }
+
+        int cx, cy;
+        grid_cell_coords(grid, ps->x[i], ps->y[i], &cx, &cy);
+        int c = cy * cellsX + cx;
+        grid->particleCell[i] = c;
+        cellStart[c]++;
+
+        if (ps->radius[i] > halfCell) {
+            grid->oversized[grid->oversizedCount++] = i;
+        } else if (ps->radius[i] > grid->maxRegularRadius) {
+            grid->maxRegularRadius = ps->radius[i];
+        }
+    }
+
+    // ...turned into end offsets...
+    for (int c = 1; c < grid->cellCount; c++) {
+        cellStart[c] += cellStart[c - 1];
+    }
+    cellStart[grid->cellCount] = active;
+
+    // ...and filled backwards, which leaves cellStart[c] at the start of cell c
+    // with indices in ascending order inside each cell
+    for (int i = count - 1; i >= 0; i--) {
+        int c = grid->particleCell[i];
+        if (c < 0) continue;
+        grid->particleIndices[--cellStart[c]] = i;
+    }
+
+    grid->indexedCount = active;
+}
+
+// Rebuild the grid from the active particles, with cells sized for collisions
+void build_grid(SpatialGrid* grid, const ParticleSystem* ps) {
+    build_cells(grid, ps, 0.0f, 0.0);
+}
+
+// Rebuild the grid from the active particles with cells of a fixed size
+void build_grid_with_cell_size(SpatialGrid* grid, const ParticleSystem* ps, float cellSize) {
+    build_cells(grid, ps, cellSize, GRID_MIN_CELL_LIMIT);
+}
+
+// Summarize how many cells there are and how full they are
+void get_grid_stats(const SpatialGrid* grid, GridStats* stats) {
+    stats->cellCount = grid->cellCount;
+    stats->occupiedCells = 0;
+    stats->maxPerCell = 0;
+    stats->oversizedCount = grid->oversizedCount;
+    stats->cellSize = grid->cellSize;
+
+    for (int c = 0; c < grid->cellCount; c++) {
+        int n = grid->cellStart[c + 1] - grid->cellStart[c];
+        if (n > 0) stats->occupiedCells++;
+        if (n > stats->maxPerCell) stats->maxPerCell = n;
+    }
+
+    stats->meanPerOccupied = stats->occupiedCells > 0
+        ? (float)grid->indexedCount / stats->occupiedCells
+        : 0.0f;
+}
+
+// Release the grid's memory
+void free_grid(SpatialGrid* grid) {
+    free(grid->cellStart);
+    free(grid->particleIndices);
+    free(grid->particleCell);
+    free(grid->oversized);
+    init_grid(grid);
+}
@@ -0,0 +1,82 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "particle.h"
+
+// Cell side length as a multiple of the mean particle radius
+#define GRID_CELL_RADIUS_FACTOR 4.0f
+
+// Upper bound on cells per particle, so a few far-flung bodies cannot blow up the grid
+#define GRID_MAX_CELLS_PER_PARTICLE 4
+
+// Cell side length of the grid solver's gravity grid. Gravity reaches the same
+// and adjacent cells, so this fixes the solver's range (100-200) whatever the
+// particles' sizes; it matches the cells of the original 8x8 grid over the
+// 800-pixel window
+#define GRID_FORCE_CELL_SIZE 100.0f
+
+// Cells a fixed-size grid may always use, however few particles there are,
+// before its cells are widened
+#define GRID_MIN_CELL_LIMIT 65536
+
+// Uniform grid over the particles' bounding box, rebuilt every step with a
+// counting sort into compressed (CSR) form: the particles of cell c are
+// particleIndices[cellStart[c] .. cellStart[c + 1]).
+//
+// Cells are sized from the radius distribution, so two "regular" particles can
+// only touch if they are in the same or adjacent cells. Particles too large for
+// that guarantee are listed separately as oversized and searched with a wider
+// range; pairs of oversized particles are found by testing that list against itself.
+typedef struct SpatialGrid {
+    Real originX;           // World position of the corner of cell (0, 0)
+    Real originY;
+    float cellSize;         // Side length of a (square) cell
+    int cellsX;             // Number of columns
+    int cellsY;             // Number of rows
+    int cellCount;          // cellsX * cellsY
+
+    int* cellStart;         // cellCount + 1 offsets into particleIndices
+    int* particleIndices;   // Active particle indices, grouped by cell
+    int* particleCell;      // Cell of each particle slot, -1 for inactive ones
+    int indexedCount;       // Number of entries in particleIndices
+
+    int* oversized;         // Particles with radius > cellSize / 2
+    int oversizedCount;
+    float maxRegularRadius; // Largest radius among the non-oversized particles
+
+    int cellCapacity;
+    int particleCapacity;
+} SpatialGrid;
+
+// Occupancy summary of the most recent build
+typedef struct {
+    int cellCount;          // Total number of cells
+    int occupiedCells;      // Cells holding at least one particle
+    int maxPerCell;         // Fullest cell
+    float meanPerOccupied;  // Average particles per occupied cell
+    int oversizedCount;     // Particles searched outside the 3x3 neighborhood
+    float cellSize;
+} GridStats;
+
+// Initialize an empty grid
+void init_grid(SpatialGrid* grid);
+
+// Rebuild the grid from the active particles, with cells sized for collisions
+void build_grid(SpatialGrid* grid, const ParticleSystem* ps);
+
+// Rebuild the grid from the active particles with cells of a fixed size, as
+// long as that needs at most GRID_MAX_CELLS_PER_PARTICLE cells per particle
+// or GRID_MIN_CELL_LIMIT cells in all
+void build_grid_with_cell_size(SpatialGrid* grid, const ParticleSystem* ps, float cellSize);
+
+// Column/row of the cell containing a point, clamped to the grid. Non-finite
+// coordinates land in the first column or row
+void grid_cell_coords(const SpatialGrid* grid, Real x, Real y, int* cellX, int* cellY);
+
+// Summarize how many cells there are and how full they are
+void get_grid_stats(const SpatialGrid* grid, GridStats* stats);
+
+// Release the grid's memory
+void free_grid(SpatialGrid* grid);
+
+#endif // GRID_H
@@ -0,0 +1,556 @@
+// Headless batch runner: runs the simulation without a window, as fast as possible,
+// with all run parameters taken from the command line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "particle.h"
+#include "quadtree.h"
+#include "force_kernel.h"
+#include "checkpoint.h"
+#include "pm.h"
+#include "initial_conditions.h"
+#include "domain.h"
+#include "transport.h"
+#include "threadpool.h"
+#include "morton.h"
+#include "collision.h"
+#include "diagnostics.h"
+#include "export.h"
+#include "telemetry.h"
+#include "utils.h"
+
+// World area per particle when --width or --height is not given, so the
+// density is the same for any N. With the default masses (radius 8-22) about
+// one body in ten starts out touching another
+#define HEADLESS_AREA_PER_PARTICLE 20000.0f
+
+// Run parameters and their defaults
+typedef struct {
+    int particleCount;
+    int steps;
+    float dt;
+    unsigned int seed;
+    InitialCondition layout;  // Initial particle layout
+    GravitySolver solver;
+    float theta;
+    float softening;
+    int meshSize;           // Particle-Mesh nodes per axis
+    float eta;              // Block timestep accuracy parameter
+    int maxLevel;           // Finest block timestep level
+    int threads;            // 0 = one per logical CPU
+    int reorderInterval;    // Steps between Morton reorders of the particle storage, 0 = never
+    float skin;             // Collision neighbor list skin, 0 = search the grid every step
+    float width;            // 0 = scaled with the particle count
+    float height;
+    const char* outputPath; // Final state as CSV, NULL to skip
+    const char* checkpointPath;  // Checkpoint written during and after the run, NULL to skip
+    int checkpointInterval;      // Steps between checkpoints, 0 = only at the end
+    const char* restartPath;     // Checkpoint to resume from, NULL to start fresh
+    const char* telemetryPath;   // Per-step timings and counters (CSV or JSON lines), NULL to skip
+    const char* trajectoryPath;  // Particle states written during the run (see export.h), NULL to skip
+    int trajectoryInterval;      // Steps between trajectory records
+    ExportPolicy exportPolicy;   // Whether a full export ring blocks stepping or drops records
+    int exportBuffers;           // Buffers in the export ring
+    int diagnosticsInterval;     // Steps between conservation measurements, 0 = never
+    int diagnosticsSample;       // Particles whose potential is evaluated, 0 = all
+    double energyBudget;         // Energy drift per step the auto-tuner aims for, 0 = do not tune for it
+    double momentumBudget;       // The same for momentum and angular momentum
+    int ranks;                   // Processes the world is split between (see domain.h)
+    TransportType transport;     // How the ranks talk to each other
+    float halo;                  // Width of the strip of neighbors' particles each rank sees
+    int rebalanceInterval;       // Steps between load balancing passes, 0 = never
+    int quiet;
+} HeadlessOptions;
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --particles N     Number of particles (default 1000)\n"
+        "  --steps N         Number of simulation steps (default 1000)\n"
+        "  --dt SECONDS      Time step (default 0.016)\n"
+        "  --seed N          Random seed (default 1)\n"
+        "  --ic NAME         Initial layout: uniform, plummer, disk or clustered (default uniform)\n"
+        "  --solver NAME     Gravity solver: grid, bh or pm (default grid)\n"
+        "  --theta F         Barnes-Hut opening angle (default %.2f)\n"
+        "  --softening F     Softening length (default %.2f)\n"
+        "  --mesh N          Particle-Mesh nodes per axis, a power of two (default %d)\n"
+        "  --eta F           Block timestep accuracy, smaller = finer (default %.3f)\n"
+        "  --max-level N     Finest timestep is dt / 2^N, 0 = one shared step (default %d)\n"
+        "  --threads N       Worker threads, 0 = all CPUs (default 0)\n"
+        "  --reorder-every N Steps between sorting particles along a Morton curve,\n"
+        "                    0 = never (default %d)\n"
+        "  --skin F          Collision neighbor list skin; the grid is searched again\n"
+        "                    once a particle moves half of it, 0 = every step (default %.0f)\n"
+        "  --width F         Simulation area width (default sqrt(%.0f * N), at least %.0f)\n"
+        "  --height F        Simulation area height (default the same)\n"
+        "  --output PATH     Write the final particle state as CSV\n"
+        "  --checkpoint PATH Write a binary checkpoint at the end of the run\n"
+        "  --checkpoint-every N  Also write it every N steps\n"
+        "  --restart PATH    Resume from a checkpoint; its particles, world size, solver,\n"
+        "                    theta, softening, mesh, eta, max level and reorder interval\n"
+        "                    replace the options above. --dt, --skin and --threads are\n"
+        "                    not stored and must be passed again to continue the same run\n"
+        "  --telemetry PATH  Stream per-step timings and counters; .json for JSON lines, else CSV\n"
+        "  --trajectory PATH Write particle states to a binary trajectory file on a\n"
+        "                    background thread\n"
+        "  --trajectory-every N  Steps between trajectory records (default 1)\n"
+        "  --export-policy NAME  When the writer falls behind: block or drop (default block)\n"
+        "  --export-buffers N    Records buffered for the writer (default %d)\n"
+        "  --diagnostics-every N  Steps between measuring energy, momentum and angular\n"
+        "                    momentum drift, 0 = never (default 0)\n"
+        "  --diag-sample N   Particles whose potential energy is evaluated, 0 = all (default 0)\n"
+        "  --energy-budget F Tune eta, theta and softening to keep the energy drift per\n"
+        "                    step under F (relative to K + |W|)\n"
+        "  --momentum-budget F  Tune theta or the mesh to keep the momentum and angular\n"
+        "                    momentum drift per step under F\n"
+        "  --ranks N         Split the world into slabs run by N processes (default 1)\n"
+        "  --transport NAME  How ranks talk: socket, shm or mpi; with mpi the ranks\n"
+        "                    come from mpirun (default socket)\n"
+        "  --halo F          Width of the neighbors' strip each rank sees (default %.0f)\n"
+        "  --rebalance-every N  Steps between load balancing passes, 0 = never (default %d)\n"
+        "  --quiet           Do not print the run summary\n"
+        "  --help            Show this message\n",
+        program, BH_DEFAULT_THETA, BH_DEFAULT_SOFTENING, PM_DEFAULT_MESH_SIZE, BLOCK_DEFAULT_ETA, BLOCK_DEFAULT_MAX_LEVEL,
+        MORTON_DEFAULT_INTERVAL, COLLISION_DEFAULT_SKIN, HEADLESS_AREA_PER_PARTICLE, 4.0f * SPAWN_MARGIN, EXPORT_DEFAULT_BUFFERS,
+        DOMAIN_DEFAULT_HALO, DOMAIN_DEFAULT_REBALANCE);
+}
+
+// Parse the command line. Returns 0 on success, 1 if help was shown, -1 on error
+static int parse_options(int argc, char* argv[], HeadlessOptions* opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(arg, "--quiet") == 0) {
+            opts->quiet = 1;
+            continue;
+        }
+
+        // Every other option takes a value
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return -1;
+        }
+        const char* value = argv[++i];
+
+        if (strcmp(arg, "--particles") == 0) {
+            opts->particleCount = atoi(value);
+        } else if (strcmp(arg, "--steps") == 0) {
+            opts->steps = atoi(value);
+        } else if (strcmp(arg, "--dt") == 0) {
+            opts->dt = (float)atof(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->seed = (unsigned int)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--ic") == 0) {
+            if (parse_initial_condition(value, &opts->layout) != 0) {
+                fprintf(stderr, "Unknown initial layout: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--solver") == 0) {
+            if (parse_gravity_solver(value, &opts->solver) != 0) {
+                fprintf(stderr, "Unknown solver: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--theta") == 0) {
+            opts->theta = (float)atof(value);
+        } else if (strcmp(arg, "--softening") == 0) {
+            opts->softening = (float)atof(value);
+        } else if (strcmp(arg, "--mesh") == 0) {
+            opts->meshSize = atoi(value);
+        } else if (strcmp(arg, "--eta") == 0) {
+            opts->eta = (float)atof(value);
+        } else if (strcmp(arg, "--max-level") == 0) {
+            opts->maxLevel = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts->threads = atoi(value);
+        } else if (strcmp(arg, "--reorder-every") == 0) {
+            opts->reorderInterval = atoi(value);
+        } else if (strcmp(arg, "--skin") == 0) {
+            opts->skin = (float)atof(value);
+        } else if (strcmp(arg, "--width") == 0) {
+            opts->width = (float)atof(value);
+        } else if (strcmp(arg, "--height") == 0) {
+            opts->height = (float)atof(value);
+        } else if (strcmp(arg, "--output") == 0) {
+            opts->outputPath = value;
+        } else if (strcmp(arg, "--checkpoint") == 0) {
+            opts->checkpointPath = value;
+        } else if (strcmp(arg, "--checkpoint-every") == 0) {
+            opts->checkpointInterval = atoi(value);
+        } else if (strcmp(arg, "--restart") == 0) {
+            opts->restartPath = value;
+        } else if (strcmp(arg, "--telemetry") == 0) {
+            opts->telemetryPath = value;
+        } else if (strcmp(arg, "--trajectory") == 0) {
+            opts->trajectoryPath = value;
+        } else if (strcmp(arg, "--trajectory-every") == 0) {
+            opts->trajectoryInterval = atoi(value);
+        } else if (strcmp(arg, "--export-policy") == 0) {
+            if (parse_export_policy(value, &opts->exportPolicy) != 0) {
+                fprintf(stderr, "Unknown export policy: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--export-buffers") == 0) {
+            opts->exportBuffers = atoi(value);
+        } else if (strcmp(arg, "--diagnostics-every") == 0) {
+            opts->diagnosticsInterval = atoi(value);
+        } else if (strcmp(arg, "--diag-sample") == 0) {
+            opts->diagnosticsSample = atoi(value);
+        } else if (strcmp(arg, "--energy-budget") == 0) {
+            opts->energyBudget = atof(value);
+        } else if (strcmp(arg, "--momentum-budget") == 0) {
+            opts->momentumBudget = atof(value);
+        } else if (strcmp(arg, "--ranks") == 0) {
+            opts->ranks = atoi(value);
+        } else if (strcmp(arg, "--transport") == 0) {
+            if (parse_transport(value, &opts->transport) != 0) {
+                fprintf(stderr, "Unknown transport: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--halo") == 0) {
+            opts->halo = (float)atof(value);
+        } else if (strcmp(arg, "--rebalance-every") == 0) {
+            opts->rebalanceInterval = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return -1;
+        }
+    }
+
+    // Sides that were not given keep the density the same for any N
+    float size = sqrtf(HEADLESS_AREA_PER_PARTICLE * (opts->particleCount > 0 ? opts->particleCount : 0));
+    if (size < 4.0f * SPAWN_MARGIN) size = 4.0f * SPAWN_MARGIN;
+    if (opts->width == 0.0f) opts->width = size;
+    if (opts->height == 0.0f) opts->height = size;
+
+    if (opts->particleCount < 0 || opts->steps < 0 || opts->dt <= 0.0f || opts->checkpointInterval < 0 ||
+        opts->trajectoryInterval < 1 || opts->exportBuffers < 1 ||
+        opts->diagnosticsInterval < 0 || opts->diagnosticsSample < 0 ||
+        opts->energyBudget < 0.0 || opts->momentumBudget < 0.0 ||
+        opts->eta <= 0.0f || opts->maxLevel < 0 || opts->maxLevel > BLOCK_MAX_LEVEL ||
+        opts->width <= 2.0f * SPAWN_MARGIN || opts->height <= 2.0f * SPAWN_MARGIN) {
+        fprintf(stderr, "Invalid run parameters\n");
+        return -1;
+    }
+
+    // A budget needs measurements to act on
+    if ((opts->energyBudget > 0.0 || opts->momentumBudget > 0.0) && opts->diagnosticsInterval == 0) {
+        opts->diagnosticsInterval = DIAGNOSTICS_DEFAULT_INTERVAL;
+    }
+
+    if (opts->ranks < 1 || opts->halo < 0.0f || opts->rebalanceInterval < 0) {
+        fprintf(stderr, "Invalid decomposition parameters\n");
+        return -1;
+    }
+    if ((opts->ranks > 1 || opts->transport == TRANSPORT_MPI) &&
+        (opts->checkpointPath || opts->restartPath || opts->telemetryPath || opts->trajectoryPath ||
+         opts->diagnosticsInterval > 0)) {
+        fprintf(stderr, "Checkpoints, telemetry, trajectories and diagnostics are not supported with several ranks\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Write the live particles as CSV
+static int write_state_csv(const char* path, const ParticleSystem* ps) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return -1;
+    }
+
+    fprintf(file, "x,y,vx,vy,mass,radius\n");
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        fprintf(file, "%.*g,%.*g,%.*g,%.*g,%.9g,%.9g\n",
+                REAL_DIGITS, (double)ps->x[i], REAL_DIGITS, (double)ps->y[i],
+                REAL_DIGITS, (double)ps->vx[i], REAL_DIGITS, (double)ps->vy[i],
+                ps->mass[i], ps->radius[i]);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    HeadlessOptions opts = {
+        .particleCount = 1000,
+        .steps = 1000,
+        .dt = 0.016f,
+        .seed = 1,
+        .layout = INITIAL_UNIFORM,
+        .solver = SOLVER_GRID,
+        .theta = BH_DEFAULT_THETA,
+        .softening = BH_DEFAULT_SOFTENING,
+        .meshSize = PM_DEFAULT_MESH_SIZE,
+        .eta = BLOCK_DEFAULT_ETA,
+        .maxLevel = BLOCK_DEFAULT_MAX_LEVEL,
+        .threads = 0,
+        .reorderInterval = MORTON_DEFAULT_INTERVAL,
+        .skin = COLLISION_DEFAULT_SKIN,
+        .width = 0.0f,
+        .height = 0.0f,
+        .outputPath = NULL,
+        .checkpointPath = NULL,
+        .checkpointInterval = 0,
+        .restartPath = NULL,
+        .telemetryPath = NULL,
+        .trajectoryPath = NULL,
+        .trajectoryInterval = 1,
+        .exportPolicy = EXPORT_BLOCK,
+        .exportBuffers = EXPORT_DEFAULT_BUFFERS,
+        .diagnosticsInterval = 0,
+        .diagnosticsSample = 0,
+        .energyBudget = 0.0,
+        .momentumBudget = 0.0,
+        .ranks = 1,
+        .transport = TRANSPORT_SOCKET,
+        .halo = DOMAIN_DEFAULT_HALO,
+        .rebalanceInterval = DOMAIN_DEFAULT_REBALANCE,
+        .quiet = 0
+    };
+
+    int parsed = parse_options(argc, argv, &opts);
+    if (parsed != 0) {
+        if (parsed < 0) print_usage(argv[0]);
+        return parsed < 0 ? 1 : 0;
+    }
+
+    // Start the other ranks before any worker threads exist; each continues from here
+    Transport* transport = NULL;
+    if (opts.ranks > 1 || opts.transport == TRANSPORT_MPI) {
+        transport = create_transport(opts.transport, opts.ranks);
+        if (!transport) return 1;
+
+        // Ranks on one machine share its CPUs
+        if (opts.threads == 0 && opts.transport != TRANSPORT_MPI) {
+            opts.threads = get_cpu_count() / transport->size;
+            if (opts.threads < 1) opts.threads = 1;
+        }
+    }
+    int rank = transport ? transport->rank : 0;
+
+    // Configure the simulation
+    seed_random(opts.seed);
+    set_world_bounds(opts.width, opts.height);
+    set_gravity_solver(opts.solver);
+    set_barnes_hut_params(opts.theta, opts.softening);
+    set_pm_mesh_size(opts.meshSize);
+    set_block_timestep_params(opts.eta, opts.maxLevel);
+    set_reorder_interval(opts.reorderInterval);
+    set_collision_skin(opts.skin);
+    set_thread_count(opts.threads);
+
+    // Start fresh or pick up where a checkpoint left off
+    ParticleSystem* particles;
+    CheckpointInfo run = { 0 };
+    if (opts.restartPath) {
+        particles = load_checkpoint(opts.restartPath, &run);
+        if (particles) apply_checkpoint_info(&run);
+    } else {
+        InitialConditionParams initial;
+        default_initial_conditions(&initial, opts.particleCount, opts.seed);
+        initial.type = opts.layout;
+        particles = generate_particles(&initial);
+    }
+    if (!particles) {
+        fprintf(stderr, "Failed to create particles!\n");
+        close_transport(transport);
+        return 1;
+    }
+    int initialCount = particles->count;
+
+    int status = 0;
+    Domain domain;
+    if (transport && (init_domain(&domain, transport, opts.halo, opts.rebalanceInterval) != 0 ||
+                      distribute_particles(&domain, particles) != 0)) {
+        free_particles(particles);
+        close_transport(transport);
+        return 1;
+    }
+    long long ghosts = 0;
+    long long migrations = 0;
+
+    long long forceEvaluations = 0;
+    long long substeps = 0;
+    Telemetry telemetry;
+    init_telemetry(&telemetry);
+    TelemetryStream stream = { NULL, TELEMETRY_CSV };
+    if (opts.telemetryPath && open_telemetry_stream(&stream, opts.telemetryPath) != 0) {
+        status = 1;
+    }
+    ExportStream* trajectory = NULL;
+    if (opts.trajectoryPath) {
+        trajectory = open_trajectory_export(opts.trajectoryPath, opts.exportBuffers, opts.exportPolicy);
+        if (!trajectory) status = 1;
+    }
+
+    // Measure the starting point; the tuner's limits are set around the starting settings
+    DiagnosticsScratch diagnostics;
+    AutoTuner tuner;
+    Diagnostics measured;
+    init_diagnostics(&diagnostics);
+    if (opts.diagnosticsInterval > 0) {
+        AutoTuneLimits limits;
+        default_auto_tune_limits(&limits);
+        limits.energyBudget = opts.energyBudget;
+        limits.momentumBudget = opts.momentumBudget;
+        init_auto_tuner(&tuner, &limits, opts.energyBudget > 0.0 || opts.momentumBudget > 0.0);
+        if (measure_diagnostics(&diagnostics, particles, opts.diagnosticsSample, &measured) != 0) {
+            status = 1;
+        } else {
+            auto_tune(&tuner, &measured);
+        }
+    }
+
+    double start = get_time_seconds();
+    for (int step = 0; step < opts.steps; step++) {
+        if (transport) {
+            if (domain_step(&domain, particles, opts.dt) != 0) {
+                status = 1;
+                break;
+            }
+            ghosts += domain.ghostsReceived;
+            migrations += domain.particlesSent;
+        } else {
+            update_particles(particles, opts.dt);
+        }
+        forceEvaluations += get_step_stats()->forceEvaluations;
+        substeps += get_step_stats()->substeps;
+        telemetry_record_step(&telemetry, get_step_stats());
+        run.step++;
+        run.time += opts.dt;
+        write_telemetry_record(&stream, &telemetry, run.step, run.time);
+
+        if (opts.diagnosticsInterval > 0) {
+            auto_tuner_record_step(&tuner, get_step_stats());
+            if ((step + 1) % opts.diagnosticsInterval == 0) {
+                if (measure_diagnostics(&diagnostics, particles, opts.diagnosticsSample, &measured) != 0) {
+                    status = 1;
+                } else {
+                    auto_tune(&tuner, &measured);
+                }
+            }
+        }
+
+        if (trajectory && (step + 1) % opts.trajectoryInterval == 0 &&
+            export_trajectory(trajectory, particles, run.step, run.time) < 0) {
+            status = 1;
+        }
+
+        if (opts.checkpointPath && opts.checkpointInterval > 0 &&
+            (step + 1) % opts.checkpointInterval == 0 && step + 1 < opts.steps) {
+            get_checkpoint_info(&run, run.step, run.time);
+            if (save_checkpoint(opts.checkpointPath, particles, &run) != 0) status = 1;
+        }
+    }
+    double elapsed = get_time_seconds() - start;
+
+    long long activeCount = 0;
+    if (transport) {
+        activeCount = status == 0 ? domain_particle_count(&domain, particles) : -1;
+        if (activeCount < 0) status = 1;
+    } else {
+        for (int i = 0; i < particles->count; i++) {
+            if (particles->active[i]) activeCount++;
+        }
+    }
+
+    if (!opts.quiet && rank == 0 && status == 0) {
+        float worldWidth, worldHeight;
+        get_world_bounds(&worldWidth, &worldHeight);
+        printf("particles: %d -> %lld (world %.0f x %.0f)\n", initialCount, activeCount, worldWidth, worldHeight);
+        printf("steps: %d (dt %.4g, solver %s, kernel %s, threads %d, positions %s)\n",
+               opts.steps, opts.dt,
+               gravity_solver_name(get_gravity_solver()),
+               force_kernel_isa_name(get_force_kernel_isa()),
+               get_thread_count(), REAL_NAME);
+        if (transport) {
+            printf("ranks: %d (%s transport), rank 0 received %.0f ghosts and sent %.1f particles per step\n",
+                   transport->size, transport_name(transport->type),
+                   opts.steps > 0 ? (double)ghosts / opts.steps : 0.0,
+                   opts.steps > 0 ? (double)migrations / opts.steps : 0.0);
+        }
+        printf("elapsed: %.3f s (%.1f steps/s)\n",
+               elapsed, elapsed > 0.0 ? opts.steps / elapsed : 0.0);
+        if (opts.steps > 0) {
+            printf("block timesteps: %.1f substeps and %.0f force evaluations per step\n",
+                   (double)substeps / opts.steps, (double)forceEvaluations / opts.steps);
+            if (get_collision_skin() > 0.0f) {
+                printf("neighbor lists: rebuilt on %lld of %d steps (skin %.3g)\n",
+                       telemetry.totalNeighborRebuilds, opts.steps, get_collision_skin());
+            }
+            if (trajectory) {
+                ExportStats exported;
+                get_export_stats(trajectory, &exported);
+                printf("trajectory: %llu records queued, %llu dropped (%s)\n",
+                       (unsigned long long)exported.submitted, (unsigned long long)exported.dropped,
+                       export_policy_name(opts.exportPolicy));
+            }
+            if (opts.diagnosticsInterval > 0) {
+                printf("drift per step: energy %.3g (max %.3g), momentum %.3g, angular momentum %.3g (max %.3g)\n",
+                       tuner.energyDrift, tuner.maxEnergyDrift, tuner.momentumDrift, tuner.angularDrift,
+                       tuner.maxMomentumDrift);
+                printf("diagnostics: %d intervals measured, %d skipped (merges or new softening), "
+                       "%d of %d potentials sampled\n",
+                       tuner.intervals, tuner.skippedIntervals, measured.sampled, measured.particles);
+                if (tuner.adjust) {
+                    float eta, theta, softening;
+                    int maxLevel;
+                    get_block_timestep_params(&eta, &maxLevel);
+                    get_barnes_hut_params(&theta, &softening);
+                    printf("auto-tune: %d adjustments, now eta %.4g, theta %.3g, softening %.3g, mesh %d\n",
+                           tuner.adjustments, eta, theta, softening, get_pm_mesh_size());
+                }
+            }
+            printf("step time p50/p99 (ms):");
+            for (int p = TELEMETRY_PHASE_GRID; p <= TELEMETRY_PHASE_STEP; p++) {
+                printf(" %s %.3f/%.3f", telemetry_phase_name((TelemetryPhase)p),
+                       telemetry_percentile(&telemetry, (TelemetryPhase)p, 0.50) * 1e3,
+                       telemetry_percentile(&telemetry, (TelemetryPhase)p, 0.99) * 1e3);
+            }
+            printf("\n");
+        }
+    }
+
+    if (opts.outputPath && status == 0) {
+        if (transport) {
+            // Rank 0 writes everybody's particles, in rank order
+            ParticleSystem* all = create_particles(0);
+            if (!all || gather_particles(&domain, particles, all) != 0 ||
+                (rank == 0 && write_state_csv(opts.outputPath, all) != 0)) {
+                status = 1;
+            }
+            free_particles(all);
+        } else if (write_state_csv(opts.outputPath, particles) != 0) {
+            status = 1;
+        }
+    }
+    if (opts.checkpointPath) {
+        get_checkpoint_info(&run, run.step, run.time);
+        if (save_checkpoint(opts.checkpointPath, particles, &run) != 0) status = 1;
+    }
+
+    if (close_telemetry_stream(&stream) != 0) {
+        status = 1;
+    }
+    if (close_export(trajectory) != 0) {
+        status = 1;
+    }
+
+    free_diagnostics(&diagnostics);
+    free_particles(particles);
+    if (transport) {
+        free_domain(&domain);
+        if (close_transport(transport) != 0) status = 1;
+    }
+    return status;
+}
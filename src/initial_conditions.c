@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "initial_conditions.h"
+#include "threadpool.h"
+#include "rng.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Particles per work item
+#define INITIAL_CHUNK 1024
+
+// Attempts before a rejection sampler gives up and takes its last candidate
+#define INITIAL_MAX_TRIES 64
+
+// Independent random streams drawn from the same seed
+enum {
+    STREAM_PARTICLE = 1,    // One per particle
+    STREAM_CLUSTER = 2      // One per cluster of the clustered layout
+};
+
+static const char* initialNames[INITIAL_COUNT] = { "uniform", "plummer", "disk", "clustered" };
+
+// Shared, read-only inputs of the generator tasks
+typedef struct {
+    const InitialConditionParams* params;
+    ParticleSystem* ps;
+    Real centerX;
+    Real centerY;
+    float halfSize;         // Half the region's shorter side
+    float totalMass;        // Expected total mass, so no task depends on another's draws
+    float clusterX[INITIAL_CLUSTERS];
+    float clusterY[INITIAL_CLUSTERS];
+    float clusterSigma[INITIAL_CLUSTERS];
+} GeneratorContext;
+
+// Defaults: uniform layout over the world bounds minus SPAWN_MARGIN, masses 10-100
+void default_initial_conditions(InitialConditionParams* params, int count, uint64_t seed) {
+    float width, height;
+    get_world_bounds(&width, &height);
+
+    params->type = INITIAL_UNIFORM;
+    params->count = count;
+    params->seed = seed;
+    params->minX = SPAWN_MARGIN;
+    params->minY = SPAWN_MARGIN;
+    params->maxX = width - SPAWN_MARGIN;
+    params->maxY = height - SPAWN_MARGIN;
+    params->minMass = 10.0f;
+    params->maxMass = 100.0f;
+}
+
+// Random direction in 3D, projected onto the plane
+static void random_projected_direction(RandomStream* stream, float* dx, float* dy) {
+    float cosTheta = random_stream_float(stream, -1.0f, 1.0f);
+    float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+    float phi = random_stream_float(stream, 0.0f, 2.0f * (float)M_PI);
+    *dx = sinTheta * cosf(phi);
+    *dy = sinTheta * sinf(phi);
+}
+
+// Plummer sphere with scale radius `a` (Aarseth, Henon & Wielen 1974): radius
+// from the inverse cumulative mass, speed by rejection from the isotropic
+// distribution function, both truncated at `maxRadius`
+static void sample_plummer(const GeneratorContext* ctx, RandomStream* stream, Real* x, Real* y,
+                           Real* vx, Real* vy) {
+    float a = ctx->halfSize * 0.2f;
+    float maxRadius = ctx->halfSize * 0.95f;
+
+    float r = maxRadius;
+    for (int t = 0; t < INITIAL_MAX_TRIES; t++) {
+        float u = 1.0f - random_stream_float(stream, 0.0f, 1.0f);
+        float candidate = a / sqrtf(powf(u, -2.0f / 3.0f) - 1.0f);
+        if (candidate < maxRadius) {
+            r = candidate;
+            break;
+        }
+    }
+
+    float q = 0.0f;
+    for (int t = 0; t < INITIAL_MAX_TRIES; t++) {
+        q = random_stream_float(stream, 0.0f, 1.0f);
+        float g = random_stream_float(stream, 0.0f, 0.1f);
+        if (g < q * q * powf(1.0f - q * q, 3.5f)) break;
+    }
+    float escapeSpeed = sqrtf(2.0f * (float)G * ctx->totalMass / sqrtf(r * r + a * a));
+
+    float dx, dy;
+    random_projected_direction(stream, &dx, &dy);
+    *x = ctx->centerX + r * dx;
+    *y = ctx->centerY + r * dy;
+
+    random_projected_direction(stream, &dx, &dy);
+    *vx = q * escapeSpeed * dx;
+    *vy = q * escapeSpeed * dy;
+}
+
+// Disk of uniform surface density around a central hole, each particle on a
+// circular orbit around the mass inside its radius, with 5% velocity dispersion
+static void sample_disk(const GeneratorContext* ctx, RandomStream* stream, Real* x, Real* y,
+                        Real* vx, Real* vy) {
+    float inner = ctx->halfSize * 0.05f;
+    float outer = ctx->halfSize * 0.9f;
+
+    float r = sqrtf(random_stream_float(stream, inner * inner, outer * outer));
+    float angle = random_stream_float(stream, 0.0f, 2.0f * (float)M_PI);
+    float enclosed = ctx->totalMass * (r * r - inner * inner) / (outer * outer - inner * inner);
+    float speed = sqrtf((float)G * enclosed / r);
+
+    *x = ctx->centerX + r * cosf(angle);
+    *y = ctx->centerY + r * sinf(angle);
+    *vx = -speed * sinf(angle) + 0.05f * speed * random_stream_gaussian(stream);
+    *vy = speed * cosf(angle) + 0.05f * speed * random_stream_gaussian(stream);
+}
+
+// Fill particles [start, end), each from its own stream
+static void generate_task(void* context, int start, int end, int worker) {
+    const GeneratorContext* ctx = (const GeneratorContext*)context;
+    const InitialConditionParams* params = ctx->params;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        RandomStream stream;
+        init_random_stream(&stream, params->seed, (uint64_t)i, STREAM_PARTICLE);
+
+        float mass = random_stream_float(&stream, params->minMass, params->maxMass);
+        Real x, y, vx, vy;
+
+        switch (params->type) {
+        case INITIAL_PLUMMER:
+            sample_plummer(ctx, &stream, &x, &y, &vx, &vy);
+            break;
+        case INITIAL_DISK:
+            sample_disk(ctx, &stream, &x, &y, &vx, &vy);
+            break;
+        case INITIAL_CLUSTERED: {
+            int c = i % INITIAL_CLUSTERS;
+            x = ctx->clusterX[c] + ctx->clusterSigma[c] * random_stream_gaussian(&stream);
+            y = ctx->clusterY[c] + ctx->clusterSigma[c] * random_stream_gaussian(&stream);
+            vx = random_stream_float(&stream, -1.0f, 1.0f);
+            vy = random_stream_float(&stream, -1.0f, 1.0f);
+            break;
+        }
+        default:
+            x = random_stream_float(&stream, params->minX, params->maxX);
+            y = random_stream_float(&stream, params->minY, params->maxY);
+            vx = random_stream_float(&stream, -1.0f, 1.0f);
+            vy = random_stream_float(&stream, -1.0f, 1.0f);
+            break;
+        }
+
+        // Keep Gaussian and Plummer tails inside the region
+        if (x < params->minX) x = params->minX;
+        if (x > params->maxX) x = params->maxX;
+        if (y < params->minY) y = params->minY;
+        if (y > params->maxY) y = params->maxY;
+
+        ps->x[i] = x;
+        ps->y[i] = y;
+        ps->vx[i] = vx;
+        ps->vy[i] = vy;
+        ps->mass[i] = mass;
+        ps->ax[i] = 0.0f;
+        ps->ay[i] = 0.0f;
+        ps->radius[i] = calculate_radius(mass);
+        ps->color[i] = calculate_color(mass);
+        ps->active[i] = 1;
+        ps->stale[i] = 1;
+    }
+}
+
+// Create a particle system laid out as described
+ParticleSystem* generate_particles(const InitialConditionParams* params) {
+    if (params->count < 0 || params->maxX < params->minX || params->maxY < params->minY ||
+        params->maxMass < params->minMass || params->type < 0 || params->type >= INITIAL_COUNT) {
+        fprintf(stderr, "Invalid initial conditions\n");
+        return NULL;
+    }
+
+    ParticleSystem* ps = (ParticleSystem*)calloc(1, sizeof(ParticleSystem));
+    if (ps == NULL || reserve_particles(ps, params->count) != 0) {
+        fprintf(stderr, "Failed to allocate memory for particles\n");
+        free_particles(ps);
+        return NULL;
+    }
+
+    GeneratorContext ctx;
+    ctx.params = params;
+    ctx.ps = ps;
+    ctx.centerX = 0.5f * (params->minX + params->maxX);
+    ctx.centerY = 0.5f * (params->minY + params->maxY);
+    float width = params->maxX - params->minX;
+    float height = params->maxY - params->minY;
+    ctx.halfSize = 0.5f * (width < height ? width : height);
+    ctx.totalMass = 0.5f * (params->minMass + params->maxMass) * params->count;
+
+    // Cluster centers and spreads come from their own streams
+    for (int c = 0; c < INITIAL_CLUSTERS; c++) {
+        RandomStream stream;
+        init_random_stream(&stream, params->seed, (uint64_t)c, STREAM_CLUSTER);
+        ctx.clusterX[c] = params->minX + width * random_stream_float(&stream, 0.2f, 0.8f);
+        ctx.clusterY[c] = params->minY + height * random_stream_float(&stream, 0.2f, 0.8f);
+        ctx.clusterSigma[c] = ctx.halfSize * random_stream_float(&stream, 0.06f, 0.12f);
+    }
+
+    if (params->count > 0) {
+        thread_pool_run(get_thread_pool(), generate_task, &ctx, params->count, INITIAL_CHUNK);
+    }
+
+    ps->count = params->count;
+    if (reset_particle_handles(ps) != 0) {
+        free_particles(ps);
+        return NULL;
+    }
+    return ps;
+}
+
+// Name of a layout
+const char* initial_condition_name(InitialCondition type) {
+    return type >= 0 && type < INITIAL_COUNT ? initialNames[type] : "unknown";
+}
+
+// Layout with the given name
+int parse_initial_condition(const char* name, InitialCondition* type) {
+    for (int t = 0; t < INITIAL_COUNT; t++) {
+        if (strcmp(name, initialNames[t]) == 0) {
+            *type = (InitialCondition)t;
+            return 0;
+        }
+    }
+    return -1;
+}
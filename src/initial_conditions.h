@@ -0,0 +1,49 @@
+#ifndef INITIAL_CONDITIONS_H
+#define INITIAL_CONDITIONS_H
+
+#include <stdint.h>
+#include "particle.h"
+
+// Seeded initial-condition generators. Every particle is drawn from its own
+// counter-based random stream (see rng.h), so particle i depends only on the
+// seed and i: the result is the same for any thread count, and generating N
+// bodies is spread over update_particles' worker threads.
+
+// Initial layouts
+typedef enum {
+    INITIAL_UNIFORM,    // Even spread over the region, small random velocities
+    INITIAL_PLUMMER,    // Plummer sphere (3D equilibrium model) projected onto the plane
+    INITIAL_DISK,       // Disk rotating at the circular speed of its enclosed mass
+    INITIAL_CLUSTERED,  // A handful of Gaussian blobs
+    INITIAL_COUNT
+} InitialCondition;
+
+// Clusters of the clustered layout
+#define INITIAL_CLUSTERS 8
+
+// What to generate and where
+typedef struct {
+    InitialCondition type;
+    int count;
+    uint64_t seed;
+    float minX;             // Region the particles are placed in
+    float minY;
+    float maxX;
+    float maxY;
+    float minMass;          // Masses are uniform in [minMass, maxMass)
+    float maxMass;
+} InitialConditionParams;
+
+// Defaults: uniform layout over the world bounds minus SPAWN_MARGIN, masses 10-100
+void default_initial_conditions(InitialConditionParams* params, int count, uint64_t seed);
+
+// Create a particle system laid out as described. Returns NULL on failure
+ParticleSystem* generate_particles(const InitialConditionParams* params);
+
+// Name of a layout ("uniform", "plummer", "disk", "clustered")
+const char* initial_condition_name(InitialCondition type);
+
+// Layout with the given name. Returns 0 on success, -1 if the name is unknown
+int parse_initial_condition(const char* name, InitialCondition* type);
+
+#endif // INITIAL_CONDITIONS_H
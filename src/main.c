@@ -1,9 +1,15 @@
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>  // For sqrtf
 #include "renderer.h"
 #include "particle.h"
+#include "grid.h"
+#include "simulation.h"
+#include "telemetry.h"
+#include "export.h"
 #include "utils.h"
 
 // Make sure SDL_main is defined properly for Windows
@@ -13,70 +19,41 @@
 
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 600
-#define MAX_PARTICLES 500
-#define SIMULATION_SPEED 1.0f
+#define SPRAY_RATE 20         // Particles injected per frame while the right button is held (at most SIM_COMMAND_MAX_PARTICLES)
+#define SPRAY_RADIUS 20.0f     // Spread of injected particles around the cursor
+#define SPRAY_MASS 10.0f
+#define CHECKPOINT_FILE "checkpoint.nbody"
+#define TELEMETRY_BAR_SECONDS 0.020   // Time that fills a whole bar of the telemetry overlay
+#define TELEMETRY_BAR_WIDTH 200
 
 // Visualization options
 typedef struct {
     bool showGrid;           // Show spatial partitioning grid
     bool showForceLines;     // Show gravity force lines between particles
     bool showVelocityVectors; // Show velocity vectors
+    bool showTelemetry;      // Show per-phase timing bars
+    bool showDensity;        // Draw a density image instead of individual particles
     bool pauseSimulation;    // Pause physics simulation
     float timeScale;         // Time scale for simulation speed
 } VisualizationOptions;
 
-// Function to draw force lines between particles
-void draw_force_lines(SDL_Renderer *renderer, Particle *particles, int count) {
-    for (int i = 0; i < count; i++) {
-        if (!particles[i].active) continue;
-        
-        for (int j = i + 1; j < count; j++) {
-            if (!particles[j].active) continue;
-            
-            // Calculate distance
-            float dx = particles[j].x - particles[i].x;
-            float dy = particles[j].y - particles[i].y;
-            float distance_sq = dx * dx + dy * dy;
-            
-            // Only draw lines for particles within a reasonable distance
-            if (distance_sq < 100 * 100) {
-                float force = G * particles[i].mass * particles[j].mass / distance_sq;
-                
-                // Scale the alpha value based on force strength
-                Uint8 alpha = (Uint8)(force * 5000.0f);
-                if (alpha > 100) alpha = 100;
-                
-                // Set color based on force strength
-                SDL_SetRenderDrawColor(renderer, 255, 255, 0, alpha);
-                
-                // Draw line between centers of particles
-                SDL_RenderDrawLine(renderer, 
-                                  (int)particles[i].x, 
-                                  (int)particles[i].y, 
-                                  (int)particles[j].x, 
-                                  (int)particles[j].y);
-            }
-        }
-    }
-}
-
 // Function to draw velocity vectors for particles
-void draw_velocity_vectors(SDL_Renderer *renderer, Particle *particles, int count) {
-    for (int i = 0; i < count; i++) {
-        if (!particles[i].active) continue;
+void draw_velocity_vectors(SDL_Renderer *renderer, const ParticleSystem *ps) {
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
         
         // Scale velocity for visualization
         float scale = 5.0f;
-        int endX = (int)(particles[i].x + particles[i].vx * scale);
-        int endY = (int)(particles[i].y + particles[i].vy * scale);
+        int endX = (int)(ps->x[i] + ps->vx[i] * scale);
+        int endY = (int)(ps->y[i] + ps->vy[i] * scale);
         
         // Set color for velocity vector (cyan)
         SDL_SetRenderDrawColor(renderer, 0, 255, 255, 200);
         
         // Draw velocity vector
         SDL_RenderDrawLine(renderer, 
-                          (int)particles[i].x, 
-                          (int)particles[i].y, 
+                          (int)ps->x[i], 
+                          (int)ps->y[i], 
                           endX, endY);
                           
         // Draw a small tip at the end of the vector
@@ -86,26 +63,99 @@ void draw_velocity_vectors(SDL_Renderer *renderer, Particle *particles, int coun
 }
 
 // Function to draw spatial grid for debugging
-void draw_grid(SDL_Renderer *renderer, int width, int height) {
-    float cellWidth = (float)width / GRID_SIZE;
-    float cellHeight = (float)height / GRID_SIZE;
+void draw_grid(SDL_Renderer *renderer, const SimulationSnapshot *snapshot) {
+    if (snapshot->gridStats.cellCount == 0) return;
+    
+    float cellSize = snapshot->gridStats.cellSize;
+    int left = (int)snapshot->gridOriginX;
+    int top = (int)snapshot->gridOriginY;
+    int right = (int)(snapshot->gridOriginX + snapshot->gridCellsX * cellSize);
+    int bottom = (int)(snapshot->gridOriginY + snapshot->gridCellsY * cellSize);
     
     SDL_SetRenderDrawColor(renderer, 50, 50, 50, 100);
     
     // Draw vertical lines
-    for (int i = 1; i < GRID_SIZE; i++) {
-        int x = (int)(i * cellWidth);
-        SDL_RenderDrawLine(renderer, x, 0, x, height);
+    for (int i = 0; i <= snapshot->gridCellsX; i++) {
+        int x = (int)(snapshot->gridOriginX + i * cellSize);
+        SDL_RenderDrawLine(renderer, x, top, x, bottom);
     }
     
     // Draw horizontal lines
-    for (int i = 1; i < GRID_SIZE; i++) {
-        int y = (int)(i * cellHeight);
-        SDL_RenderDrawLine(renderer, 0, y, width, y);
+    for (int i = 0; i <= snapshot->gridCellsY; i++) {
+        int y = (int)(snapshot->gridOriginY + i * cellSize);
+        SDL_RenderDrawLine(renderer, left, y, right, y);
+    }
+}
+
+// Function to draw one bar per phase: p50 filled, p99 as a white tick
+void draw_telemetry(SDL_Renderer *renderer, const Telemetry *telemetry) {
+    static const SDL_Color phaseColors[TELEMETRY_PHASE_COUNT] = {
+        {160, 160, 160, 255},   // events
+        {80, 160, 255, 255},    // grid
+        {255, 200, 0, 255},     // force
+        {255, 80, 80, 255},     // collision
+        {80, 220, 120, 255},    // integration
+        {255, 255, 255, 255},   // step
+        {200, 100, 255, 255},   // render
+        {0, 220, 220, 255}      // frame
+    };
+    
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_Rect panel = {5, 5, TELEMETRY_BAR_WIDTH + 10, TELEMETRY_PHASE_COUNT * 12 + 8};
+    SDL_RenderFillRect(renderer, &panel);
+    
+    for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+        double p50 = telemetry_percentile(telemetry, (TelemetryPhase)p, 0.50) / TELEMETRY_BAR_SECONDS;
+        double p99 = telemetry_percentile(telemetry, (TelemetryPhase)p, 0.99) / TELEMETRY_BAR_SECONDS;
+        if (p50 > 1.0) p50 = 1.0;
+        if (p99 > 1.0) p99 = 1.0;
+        int top = 10 + p * 12;
+        
+        // Bar background
+        SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
+        SDL_Rect track = {10, top, TELEMETRY_BAR_WIDTH, 8};
+        SDL_RenderFillRect(renderer, &track);
+        
+        // Median
+        SDL_Color color = phaseColors[p];
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+        SDL_Rect bar = {10, top, (int)(p50 * TELEMETRY_BAR_WIDTH), 8};
+        SDL_RenderFillRect(renderer, &bar);
+        
+        // 99th percentile
+        int tick = 10 + (int)(p99 * TELEMETRY_BAR_WIDTH);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderDrawLine(renderer, tick, top - 1, tick, top + 8);
     }
 }
 
 int main(int argc, char* argv[]) {
+    // Optional telemetry stream (.json for JSON lines, anything else CSV) and
+    // recordings; frames and trajectories are written on background threads
+    const char* telemetryPath = NULL;
+    const char* recordPath = NULL;
+    const char* trajectoryPath = NULL;
+    ExportPolicy exportPolicy = EXPORT_DROP;
+    int exportBuffers = EXPORT_DEFAULT_BUFFERS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetryPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc) {
+            trajectoryPath = argv[++i];
+        } else if (strcmp(argv[i], "--export-policy") == 0 && i + 1 < argc &&
+                   parse_export_policy(argv[i + 1], &exportPolicy) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--export-buffers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            exportBuffers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--telemetry PATH] [--record out.y4m|frame%%05d.ppm] [--trajectory PATH]\n"
+                            "       [--export-policy drop|block] [--export-buffers N]\n", argv[0]);
+            return -1;
+        }
+    }
+
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
@@ -137,14 +187,15 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
-    // Initialize random generator
+    // Initialize random generator and match the simulation area to the window
     init_random();
+    set_world_bounds(WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    // Create particles
+    // Create particles and start stepping them on the simulation thread
     int particleCount = 100;
-    Particle* particles = create_particles(particleCount);
-    if (!particles) {
-        fprintf(stderr, "Failed to create particles!\n");
+    Simulation* simulation = create_simulation(particleCount);
+    if (!simulation) {
+        fprintf(stderr, "Failed to create simulation!\n");
         cleanup_renderer(renderer, window);
         SDL_Quit();
         return -1;
@@ -155,6 +206,8 @@ int main(int argc, char* argv[]) {
         .showGrid = false,
         .showForceLines = false,
         .showVelocityVectors = false,
+        .showTelemetry = false,
+        .showDensity = false,
         .pauseSimulation = false,
         .timeScale = 1.0f
     };
@@ -164,18 +217,38 @@ int main(int argc, char* argv[]) {
     bool rightMouseDown = false;
     int mouseX = 0, mouseY = 0;
     float placementMass = 50.0f;  // Default mass for placed particles
-    int activeCount = particleCount;
 
-    // Timing variables
-    Uint32 lastFrameTime = get_current_time();
-    Uint32 currentTime;
-    float deltaTime;
+    // Frame timings of this thread; step timings come with each snapshot
+    Telemetry frameTelemetry;
+    init_telemetry(&frameTelemetry);
+    TelemetryStream telemetryStream = { NULL, TELEMETRY_CSV };
+    if (telemetryPath && open_telemetry_stream(&telemetryStream, telemetryPath) != 0) {
+        telemetryPath = NULL;
+    }
+    uint64_t streamedSteps = 0;
+
+    // Recordings; a full ring drops (or waits, with --export-policy block)
+    ExportStream* recording = NULL;
+    int frameWidth = WINDOW_WIDTH, frameHeight = WINDOW_HEIGHT;
+    if (recordPath) {
+        SDL_GetRendererOutputSize(renderer, &frameWidth, &frameHeight);
+        recording = open_frame_export(recordPath, frameWidth, frameHeight, exportBuffers, exportPolicy);
+    }
+    ExportStream* trajectory = trajectoryPath ? open_trajectory_export(trajectoryPath, exportBuffers, exportPolicy) : NULL;
+    uint64_t exportedSteps = 0;
+    double frameStart = get_time_seconds();
 
-    // Main loop
+    // Main loop: handle input and draw the latest snapshot; physics runs on its own thread
     bool running = true;
     SDL_Event event;
+    SimulationCommand command;
+    const SimulationSnapshot* snapshot = acquire_snapshot(simulation);
 
     while (running) {
+        double now = get_time_seconds();
+        telemetry_record(&frameTelemetry, TELEMETRY_PHASE_FRAME, now - frameStart);
+        frameStart = now;
+
         // Handle events
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
@@ -199,47 +272,15 @@ int main(int argc, char* argv[]) {
                     if (event.button.button == SDL_BUTTON_LEFT) {
                         leftMouseDown = false;
                         
-                        // Create a new particle if there's space
-                        if (activeCount < MAX_PARTICLES) {
-                            // Find an inactive slot or the end
-                            int newIndex = -1;
-                            for (int i = 0; i < particleCount; i++) {
-                                if (!particles[i].active) {
-                                    newIndex = i;
-                                    break;
-                                }
-                            }
-                            
-                            if (newIndex == -1 && particleCount < MAX_PARTICLES) {
-                                newIndex = particleCount++;
-                            }
-                            
-                            if (newIndex != -1) {
-                                // Create particle with random velocity
-                                float vx = random_float(-0.5f, 0.5f);
-                                float vy = random_float(-0.5f, 0.5f);
-                                
-                                particles[newIndex].x = mouseX;
-                                particles[newIndex].y = mouseY;
-                                particles[newIndex].vx = vx;
-                                particles[newIndex].vy = vy;
-                                particles[newIndex].mass = placementMass;
-                                particles[newIndex].radius = calculate_radius(placementMass);
-                                particles[newIndex].active = 1;
-                                
-                                // Set color based on mass
-                                Uint8 r = (Uint8)(128 + placementMass / 100.0f * 127);
-                                Uint8 g = (Uint8)(192 - placementMass / 100.0f * 128);
-                                Uint8 b = (Uint8)(255 - placementMass / 100.0f * 128);
-                                
-                                particles[newIndex].color.r = r;
-                                particles[newIndex].color.g = g;
-                                particles[newIndex].color.b = b;
-                                particles[newIndex].color.a = 255;
-                                
-                                activeCount++;
-                            }
-                        }
+                        // Create particle with random velocity
+                        command.type = SIM_COMMAND_ADD_PARTICLES;
+                        command.count = 1;
+                        command.x[0] = (float)mouseX;
+                        command.y[0] = (float)mouseY;
+                        command.vx[0] = random_float(-0.5f, 0.5f);
+                        command.vy[0] = random_float(-0.5f, 0.5f);
+                        command.mass[0] = placementMass;
+                        send_simulation_command(simulation, &command);
                     } else if (event.button.button == SDL_BUTTON_RIGHT) {
                         rightMouseDown = false;
                     }
@@ -267,13 +308,21 @@ int main(int argc, char* argv[]) {
                             break;
                         case SDLK_r:
                             // Reset simulation
-                            for (int i = 0; i < particleCount; i++) {
-                                free_particle(&particles[i]);
-                            }
-                            free(particles);
-                            particleCount = 100;
-                            particles = create_particles(particleCount);
-                            activeCount = particleCount;
+                            command.type = SIM_COMMAND_RESET;
+                            command.count = particleCount;
+                            send_simulation_command(simulation, &command);
+                            break;
+                        case SDLK_s:
+                            // Save a checkpoint
+                            command.type = SIM_COMMAND_SAVE;
+                            command.path = CHECKPOINT_FILE;
+                            send_simulation_command(simulation, &command);
+                            break;
+                        case SDLK_l:
+                            // Restore the last checkpoint; the current state is kept if it fails
+                            command.type = SIM_COMMAND_LOAD;
+                            command.path = CHECKPOINT_FILE;
+                            send_simulation_command(simulation, &command);
                             break;
                         case SDLK_g:
                             // Toggle grid visualization
@@ -287,20 +336,44 @@ int main(int argc, char* argv[]) {
                             // Toggle velocity vectors
                             visOptions.showVelocityVectors = !visOptions.showVelocityVectors;
                             break;
+                        case SDLK_b:
+                            // Cycle through grid, Barnes-Hut and Particle-Mesh gravity
+                            command.type = SIM_COMMAND_SET_SOLVER;
+                            command.solver = (GravitySolver)((snapshot->solver + 1) % SOLVER_COUNT);
+                            send_simulation_command(simulation, &command);
+                            printf("Gravity solver: %s\n", gravity_solver_name(command.solver));
+                            break;
+                        case SDLK_d:
+                            // Toggle the density view
+                            visOptions.showDensity = !visOptions.showDensity;
+                            break;
+                        case SDLK_i:
+                            // Toggle the telemetry overlay
+                            visOptions.showTelemetry = !visOptions.showTelemetry;
+                            break;
                         case SDLK_SPACE:
                             // Toggle pause
                             visOptions.pauseSimulation = !visOptions.pauseSimulation;
+                            command.type = SIM_COMMAND_SET_PAUSED;
+                            command.paused = visOptions.pauseSimulation;
+                            send_simulation_command(simulation, &command);
                             break;
                         case SDLK_EQUALS:  // Plus key (usually +/= key)
                             // Increase simulation speed
                             visOptions.timeScale *= 1.2f;
                             if (visOptions.timeScale > 5.0f) visOptions.timeScale = 5.0f;
+                            command.type = SIM_COMMAND_SET_TIME_SCALE;
+                            command.timeScale = visOptions.timeScale;
+                            send_simulation_command(simulation, &command);
                             printf("Time scale: %.1f\n", visOptions.timeScale);
                             break;
                         case SDLK_MINUS:
                             // Decrease simulation speed
                             visOptions.timeScale /= 1.2f;
                             if (visOptions.timeScale < 0.1f) visOptions.timeScale = 0.1f;
+                            command.type = SIM_COMMAND_SET_TIME_SCALE;
+                            command.timeScale = visOptions.timeScale;
+                            send_simulation_command(simulation, &command);
                             printf("Time scale: %.1f\n", visOptions.timeScale);
                             break;
                     }
@@ -308,26 +381,43 @@ int main(int argc, char* argv[]) {
             }
         }
 
-        // Calculate delta time for physics update
-        currentTime = get_current_time();
-        deltaTime = (float)(currentTime - lastFrameTime) / 1000.0f;
-        lastFrameTime = currentTime;
-        
-        // Cap deltaTime to avoid large jumps
-        if (deltaTime > 0.05f) deltaTime = 0.05f;
-        
-        // Apply simulation speed
-        deltaTime *= SIMULATION_SPEED * visOptions.timeScale;
+        // Spray particles around the cursor while the right button is held
+        if (rightMouseDown) {
+            command.type = SIM_COMMAND_ADD_PARTICLES;
+            command.count = SPRAY_RATE;
+            for (int k = 0; k < SPRAY_RATE; k++) {
+                command.x[k] = mouseX + random_float(-SPRAY_RADIUS, SPRAY_RADIUS);
+                command.y[k] = mouseY + random_float(-SPRAY_RADIUS, SPRAY_RADIUS);
+                command.vx[k] = random_float(-5.0f, 5.0f);
+                command.vy[k] = random_float(-5.0f, 5.0f);
+                command.mass[k] = SPRAY_MASS;
+            }
+            send_simulation_command(simulation, &command);
+        }
+
+        double renderStart = get_time_seconds();
+        telemetry_record(&frameTelemetry, TELEMETRY_PHASE_EVENTS, renderStart - frameStart);
 
-        // Update all particles with calculated delta time, unless paused
-        if (!visOptions.pauseSimulation) {
-            update_particles(particles, particleCount, deltaTime);
+        // Draw the newest state the simulation thread has published
+        snapshot = acquire_snapshot(simulation);
+        const ParticleSystem* particles = snapshot->particles;
+
+        // Step timings from the simulation thread, frame timings from this one
+        Telemetry telemetry = snapshot->telemetry;
+        telemetry.phases[TELEMETRY_PHASE_EVENTS] = frameTelemetry.phases[TELEMETRY_PHASE_EVENTS];
+        telemetry.phases[TELEMETRY_PHASE_RENDER] = frameTelemetry.phases[TELEMETRY_PHASE_RENDER];
+        telemetry.phases[TELEMETRY_PHASE_FRAME] = frameTelemetry.phases[TELEMETRY_PHASE_FRAME];
+
+        // Stream a record whenever the simulation has stepped
+        if (telemetryPath && telemetry.steps != streamedSteps) {
+            write_telemetry_record(&telemetryStream, &telemetry, snapshot->step, snapshot->time);
+            streamedSteps = telemetry.steps;
         }
 
-        // Count active particles
-        activeCount = 0;
-        for (int i = 0; i < particleCount; i++) {
-            if (particles[i].active) activeCount++;
+        // Export the state whenever the simulation has stepped
+        if (trajectory && snapshot->step != exportedSteps) {
+            export_trajectory(trajectory, particles, snapshot->step, snapshot->time);
+            exportedSteps = snapshot->step;
         }
 
         // Render
@@ -336,61 +426,110 @@ int main(int argc, char* argv[]) {
         
         // Draw optional grid
         if (visOptions.showGrid) {
-            draw_grid(renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
+            draw_grid(renderer, snapshot);
         }
         
         // Draw force lines if option enabled
         if (visOptions.showForceLines) {
-            draw_force_lines(renderer, particles, particleCount);
+            render_force_lines(renderer, particles);
         }
         
-        // Render all particles
-        render_particles(renderer, particles, particleCount);
+        // Render all particles, or their density for views too crowded to draw one by one
+        if (visOptions.showDensity) {
+            render_density(renderer, particles);
+        } else {
+            render_particles(renderer, particles);
+        }
         
         // Draw velocity vectors if option enabled
         if (visOptions.showVelocityVectors) {
-            draw_velocity_vectors(renderer, particles, particleCount);
+            draw_velocity_vectors(renderer, particles);
         }
         
         // Render placement preview if mouse button is down
         if (leftMouseDown) {
             // Show a preview of the particle that will be placed
-            SDL_SetRenderDrawColor(renderer, 
+            SDL_Color previewColor = {
                 128 + (Uint8)(placementMass / 100.0f * 127),
                 192 - (Uint8)(placementMass / 100.0f * 128),
                 255 - (Uint8)(placementMass / 100.0f * 128),
-                128);
-            
-            int previewRadius = (int)calculate_radius(placementMass);
-            
-            // Draw preview circle
-            for (int dy = -previewRadius; dy <= previewRadius; dy++) {
-                int dx = (int)sqrtf(previewRadius * previewRadius - dy * dy);
-                SDL_RenderDrawLine(renderer, mouseX - dx, mouseY + dy, mouseX + dx, mouseY + dy);
-            }
+                128
+            };
+            render_disc(renderer, (float)mouseX, (float)mouseY, calculate_radius(placementMass), previewColor);
+        }
+        
+        // Draw timing bars if option enabled
+        if (visOptions.showTelemetry) {
+            draw_telemetry(renderer, &telemetry);
         }
         
         // Render info text (using printf for now, in a real app we'd use SDL_ttf)
-        char title[256];
-        sprintf(title, "N-Body Sim - Particles: %d - Mass: %.1f - [G]rid: %s - [F]orce: %s - [V]elocity: %s - [Space]: %s - Scale: %.1fx", 
-                activeCount, 
+        char title[512];
+        sprintf(title, "N-Body Sim - Particles: %d - Mass: %.1f - [G]rid: %s - [F]orce: %s - [V]elocity: %s - [D]ensity: %s - [B] Solver: %s - [Space]: %s - Scale: %.1fx", 
+                particles->count, 
                 placementMass,
                 visOptions.showGrid ? "On" : "Off",
                 visOptions.showForceLines ? "On" : "Off",
                 visOptions.showVelocityVectors ? "On" : "Off",
+                visOptions.showDensity ? "On" : "Off",
+                gravity_solver_name(snapshot->solver),
                 visOptions.pauseSimulation ? "Paused" : "Running",
                 visOptions.timeScale);
+        
+        // Append grid occupancy while the grid overlay is visible
+        if (visOptions.showGrid) {
+            const GridStats* gridStats = &snapshot->gridStats;
+            size_t len = strlen(title);
+            snprintf(title + len, sizeof(title) - len, " - Cells: %d/%d used, max %d, avg %.1f",
+                     gridStats->occupiedCells, gridStats->cellCount,
+                     gridStats->maxPerCell, gridStats->meanPerOccupied);
+        }
+        
+        // Append timings and counters while the telemetry overlay is visible
+        if (visOptions.showTelemetry) {
+            size_t len = strlen(title);
+            snprintf(title + len, sizeof(title) - len,
+                     " - Step p50/p99: %.2f/%.2f ms - Frame: %.2f/%.2f ms - Pairs: %lld - Merged: %d - Oversized: %d",
+                     telemetry_percentile(&telemetry, TELEMETRY_PHASE_STEP, 0.50) * 1e3,
+                     telemetry_percentile(&telemetry, TELEMETRY_PHASE_STEP, 0.99) * 1e3,
+                     telemetry_percentile(&telemetry, TELEMETRY_PHASE_FRAME, 0.50) * 1e3,
+                     telemetry_percentile(&telemetry, TELEMETRY_PHASE_FRAME, 0.99) * 1e3,
+                     telemetry.interactions, telemetry.mergedParticles, telemetry.oversizedParticles);
+        }
+        // Append recording progress
+        if (recording) {
+            ExportStats recorded;
+            get_export_stats(recording, &recorded);
+            size_t len = strlen(title);
+            snprintf(title + len, sizeof(title) - len, " - Recording: %llu frames, %llu dropped",
+                     (unsigned long long)recorded.submitted, (unsigned long long)recorded.dropped);
+        }
         SDL_SetWindowTitle(window, title);
+
+        // Copy the finished frame into the recording ring
+        if (recording) {
+            Uint32* pixels = acquire_frame(recording);
+            if (pixels && SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels,
+                                               frameWidth * (int)sizeof(Uint32)) == 0) {
+                submit_frame(recording);
+            } else {
+                discard_frame(recording);
+            }
+        }
         
         // Present the rendered frame
         SDL_RenderPresent(renderer);
+        telemetry_record(&frameTelemetry, TELEMETRY_PHASE_RENDER, get_time_seconds() - renderStart);
         
         // Small delay to prevent using 100% CPU
         SDL_Delay(1);
     }
 
-    // Cleanup
-    free_particles(particles, particleCount);
+    // Cleanup; the writers finish what is queued first
+    close_telemetry_stream(&telemetryStream);
+    close_export(recording);
+    close_export(trajectory);
+    destroy_simulation(simulation);
     cleanup_renderer(renderer, window);
     SDL_Quit();
     
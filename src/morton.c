@@ -0,0 +1,340 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "morton.h"
+
+// Radix sort digits and work split
+#define MORTON_DIGIT_BITS 8
+#define MORTON_DIGITS (1 << MORTON_DIGIT_BITS)
+#define MORTON_BLOCKS_PER_WORKER 4
+#define MORTON_MIN_BLOCK 4096
+#define MORTON_CHUNK 4096
+
+// Largest grid coordinate of a live particle; keeps every live key below the
+// key of inactive slots (all ones)
+#define MORTON_MAX_COORD 65534u
+
+// Shared state of the parallel phases
+typedef struct {
+    MortonScratch* scratch;
+    ParticleSystem* ps;
+    int count;              // Slots being sorted
+    int blocks;             // Radix sort blocks, each a fixed range of positions
+
+    double minX;            // Bounding square of the live particles
+    double minY;
+    double scale;           // Grid coordinates per world unit
+
+    const uint32_t* keysIn; // Current radix pass
+    uint32_t* keysOut;
+    const int* orderIn;
+    int* orderOut;
+    int shift;
+
+    void* array;            // Field being permuted
+    size_t elementSize;
+} MortonContext;
+
+// Initialize empty scratch buffers
+void init_morton_scratch(MortonScratch* scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+// Spread the low 16 bits of v out to the even bits
+static inline uint32_t spread_bits(uint32_t v) {
+    v &= 0xFFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+// Morton code of a point given as two 16-bit grid coordinates
+uint32_t morton_key(uint32_t x, uint32_t y) {
+    return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+// Positions [start, end) of radix block b
+static inline void block_range(const MortonContext* ctx, int b, int* start, int* end) {
+    *start = (int)((long long)ctx->count * b / ctx->blocks);
+    *end = (int)((long long)ctx->count * (b + 1) / ctx->blocks);
+}
+
+// Quantized position on the curve
+static inline uint32_t grid_coordinate(double value, double min, double scale) {
+    double q = (value - min) * scale;
+    if (q <= 0.0) return 0;
+    if (q >= MORTON_MAX_COORD) return MORTON_MAX_COORD;
+    return (uint32_t)q;
+}
+
+// Key of slots [start, end); inactive slots sort last
+static void key_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    const ParticleSystem* ps = ctx->ps;
+    MortonScratch* scratch = ctx->scratch;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        scratch->order[i] = i;
+        if (!ps->active[i]) {
+            scratch->keys[i] = 0xFFFFFFFFu;
+            continue;
+        }
+        scratch->keys[i] = morton_key(grid_coordinate((double)ps->x[i], ctx->minX, ctx->scale),
+                                      grid_coordinate((double)ps->y[i], ctx->minY, ctx->scale));
+    }
+}
+
+// Digit histogram of each block [start, end)
+static void histogram_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    (void)worker;
+
+    for (int b = start; b < end; b++) {
+        int* counts = ctx->scratch->digitCounts + (size_t)b * MORTON_DIGITS;
+        memset(counts, 0, MORTON_DIGITS * sizeof(int));
+
+        int first, last;
+        block_range(ctx, b, &first, &last);
+        for (int k = first; k < last; k++) {
+            counts[(ctx->keysIn[k] >> ctx->shift) & (MORTON_DIGITS - 1)]++;
+        }
+    }
+}
+
+// Stable scatter of each block [start, end) to the offsets left by the prefix sum
+static void scatter_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    (void)worker;
+
+    for (int b = start; b < end; b++) {
+        int* offsets = ctx->scratch->digitCounts + (size_t)b * MORTON_DIGITS;
+
+        int first, last;
+        block_range(ctx, b, &first, &last);
+        for (int k = first; k < last; k++) {
+            uint32_t key = ctx->keysIn[k];
+            int position = offsets[(key >> ctx->shift) & (MORTON_DIGITS - 1)]++;
+            ctx->keysOut[position] = key;
+            ctx->orderOut[position] = ctx->orderIn[k];
+        }
+    }
+}
+
+// Gather one field into the scratch buffer in sorted order
+static void gather_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    const int* order = ctx->scratch->order;
+    (void)worker;
+
+    switch (ctx->elementSize) {
+    case 1: {
+        const uint8_t* src = (const uint8_t*)ctx->array;
+        uint8_t* dst = (uint8_t*)ctx->scratch->field;
+        for (int k = start; k < end; k++) dst[k] = src[order[k]];
+        break;
+    }
+    case 4: {
+        const uint32_t* src = (const uint32_t*)ctx->array;
+        uint32_t* dst = (uint32_t*)ctx->scratch->field;
+        for (int k = start; k < end; k++) dst[k] = src[order[k]];
+        break;
+    }
+    case 8: {
+        const uint64_t* src = (const uint64_t*)ctx->array;
+        uint64_t* dst = (uint64_t*)ctx->scratch->field;
+        for (int k = start; k < end; k++) dst[k] = src[order[k]];
+        break;
+    }
+    default: {
+        const char* src = (const char*)ctx->array;
+        char* dst = (char*)ctx->scratch->field;
+        for (int k = start; k < end; k++) {
+            memcpy(dst + (size_t)k * ctx->elementSize, src + (size_t)order[k] * ctx->elementSize,
+                   ctx->elementSize);
+        }
+        break;
+    }
+    }
+}
+
+// Copy the gathered field back into place
+static void copy_back_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    (void)worker;
+    memcpy((char*)ctx->array + (size_t)start * ctx->elementSize,
+           (const char*)ctx->scratch->field + (size_t)start * ctx->elementSize,
+           (size_t)(end - start) * ctx->elementSize);
+}
+
+// Point every handle in use at its particle's new slot
+static void remap_handles_task(void* context, int start, int end, int worker) {
+    MortonContext* ctx = (MortonContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        if (ps->handle[i] >= 0) ps->handleSlot[ps->handle[i]] = i;
+    }
+}
+
+// Grow the buffers for `count` slots and `blocks` radix blocks
+static int reserve_morton_scratch(MortonScratch* scratch, int count, int blocks, size_t fieldBytes) {
+    if (count > scratch->capacity) {
+        uint32_t* keys = (uint32_t*)realloc(scratch->keys, count * sizeof(uint32_t));
+        if (keys) scratch->keys = keys;
+        uint32_t* keysSwap = (uint32_t*)realloc(scratch->keysSwap, count * sizeof(uint32_t));
+        if (keysSwap) scratch->keysSwap = keysSwap;
+        int* order = (int*)realloc(scratch->order, count * sizeof(int));
+        if (order) scratch->order = order;
+        int* orderSwap = (int*)realloc(scratch->orderSwap, count * sizeof(int));
+        if (orderSwap) scratch->orderSwap = orderSwap;
+
+        if (!keys || !keysSwap || !order || !orderSwap) {
+            fprintf(stderr, "Failed to allocate memory for particle reordering\n");
+            return -1;
+        }
+        scratch->capacity = count;
+    }
+
+    if (blocks > scratch->blockCapacity) {
+        int* counts = (int*)realloc(scratch->digitCounts, (size_t)blocks * MORTON_DIGITS * sizeof(int));
+        if (counts == NULL) {
+            fprintf(stderr, "Failed to allocate memory for particle reordering\n");
+            return -1;
+        }
+        scratch->digitCounts = counts;
+        scratch->blockCapacity = blocks;
+    }
+
+    if (fieldBytes > scratch->fieldBytes) {
+        void* field = realloc(scratch->field, fieldBytes);
+        if (field == NULL) {
+            fprintf(stderr, "Failed to allocate memory for particle reordering\n");
+            return -1;
+        }
+        scratch->field = field;
+        scratch->fieldBytes = fieldBytes;
+    }
+    return 0;
+}
+
+// Permute one field array into sorted order
+static void permute_field(MortonContext* ctx, ThreadPool* pool, void* array, size_t elementSize) {
+    ctx->array = array;
+    ctx->elementSize = elementSize;
+    thread_pool_run(pool, gather_task, ctx, ctx->count, MORTON_CHUNK);
+    thread_pool_run(pool, copy_back_task, ctx, ctx->count, MORTON_CHUNK);
+}
+
+// Sort the non-ghost slots along the Morton curve and remap the handle table
+int reorder_particles(MortonScratch* scratch, ParticleSystem* ps, ThreadPool* pool) {
+    int count = ps->count - ps->ghostCount;
+    if (count < 2) return 0;
+
+    int blocks = thread_pool_size(pool) * MORTON_BLOCKS_PER_WORKER;
+    if (blocks > count / MORTON_MIN_BLOCK) blocks = count / MORTON_MIN_BLOCK;
+    if (blocks < 1) blocks = 1;
+    if (reserve_morton_scratch(scratch, count, blocks, (size_t)count * sizeof(Real)) != 0) return -1;
+
+    MortonContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.scratch = scratch;
+    ctx.ps = ps;
+    ctx.count = count;
+    ctx.blocks = blocks;
+
+    // Bounding square of the live particles, so both axes get the same resolution
+    int live = 0;
+    double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+    for (int i = 0; i < count; i++) {
+        if (!ps->active[i]) continue;
+        double x = (double)ps->x[i];
+        double y = (double)ps->y[i];
+        if (live++ == 0) {
+            minX = maxX = x;
+            minY = maxY = y;
+        } else {
+            if (x < minX) minX = x;
+            if (x > maxX) maxX = x;
+            if (y < minY) minY = y;
+            if (y > maxY) maxY = y;
+        }
+    }
+    double extent = maxX - minX > maxY - minY ? maxX - minX : maxY - minY;
+    ctx.minX = minX;
+    ctx.minY = minY;
+    ctx.scale = extent > 0.0 ? MORTON_MAX_COORD / extent : 0.0;
+
+    thread_pool_run(pool, key_task, &ctx, count, MORTON_CHUNK);
+
+    // LSD radix sort, one 8-bit digit per pass
+    for (int shift = 0; shift < 32; shift += MORTON_DIGIT_BITS) {
+        ctx.keysIn = scratch->keys;
+        ctx.keysOut = scratch->keysSwap;
+        ctx.orderIn = scratch->order;
+        ctx.orderOut = scratch->orderSwap;
+        ctx.shift = shift;
+        thread_pool_run(pool, histogram_task, &ctx, blocks, 1);
+
+        // Turn the counts into each block's first position per digit; a digit
+        // every key shares would leave the order as it is
+        int total = 0;
+        int uniform = 0;
+        for (int d = 0; d < MORTON_DIGITS; d++) {
+            int digitTotal = 0;
+            for (int b = 0; b < blocks; b++) {
+                int* slot = &scratch->digitCounts[(size_t)b * MORTON_DIGITS + d];
+                int n = *slot;
+                *slot = total;
+                total += n;
+                digitTotal += n;
+            }
+            if (digitTotal == count) uniform = 1;
+        }
+        if (uniform) continue;
+
+        thread_pool_run(pool, scatter_task, &ctx, blocks, 1);
+
+        uint32_t* keys = scratch->keys;
+        scratch->keys = scratch->keysSwap;
+        scratch->keysSwap = keys;
+        int* order = scratch->order;
+        scratch->order = scratch->orderSwap;
+        scratch->orderSwap = order;
+    }
+
+    permute_field(&ctx, pool, ps->x, sizeof(Real));
+    permute_field(&ctx, pool, ps->y, sizeof(Real));
+    permute_field(&ctx, pool, ps->vx, sizeof(Real));
+    permute_field(&ctx, pool, ps->vy, sizeof(Real));
+    permute_field(&ctx, pool, ps->mass, sizeof(float));
+    permute_field(&ctx, pool, ps->ax, sizeof(float));
+    permute_field(&ctx, pool, ps->ay, sizeof(float));
+    permute_field(&ctx, pool, ps->radius, sizeof(float));
+    permute_field(&ctx, pool, ps->color, sizeof(ParticleColor));
+    permute_field(&ctx, pool, ps->active, sizeof(uint8_t));
+    permute_field(&ctx, pool, ps->stale, sizeof(uint8_t));
+    permute_field(&ctx, pool, ps->handle, sizeof(int));
+    thread_pool_run(pool, remap_handles_task, &ctx, count, MORTON_CHUNK);
+    return 0;
+}
+
+// Bytes held by the scratch buffers
+size_t morton_memory_usage(const MortonScratch* scratch) {
+    return (size_t)scratch->capacity * 2 * (sizeof(uint32_t) + sizeof(int)) +
+           (size_t)scratch->blockCapacity * MORTON_DIGITS * sizeof(int) + scratch->fieldBytes;
+}
+
+// Release the scratch buffers
+void free_morton_scratch(MortonScratch* scratch) {
+    free(scratch->keys);
+    free(scratch->keysSwap);
+    free(scratch->order);
+    free(scratch->orderSwap);
+    free(scratch->digitCounts);
+    free(scratch->field);
+    init_morton_scratch(scratch);
+}
@@ -0,0 +1,58 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "particle.h"
+#include "threadpool.h"
+
+// Reordering of particle storage along a Z-order (Morton) curve.
+//
+// Slots are handed out in creation order, so after a while particles that are
+// close in space sit far apart in memory and every spatial pass (grid build,
+// force gathering, collisions) jumps around the arrays. Sorting the slots by
+// the Morton code of their position puts particles of the same and nearby
+// grid cells next to each other again.
+//
+// Keys are 32-bit: 16 bits per axis over the particles' bounding square,
+// interleaved. They are sorted with a parallel LSD radix sort (8-bit digits,
+// digits shared by every key skipped) that is stable, so the result does not
+// depend on the thread count. Every field array is then permuted and the
+// handle table updated, so handles keep resolving to the same particles.
+// Ghost slots (see domain.h) stay at the end, untouched.
+
+// update_particles steps between reorders when none is set
+#define MORTON_DEFAULT_INTERVAL 16
+
+// Reusable buffers of the sort
+typedef struct {
+    uint32_t* keys;         // Key of every slot being sorted, then sorted keys
+    uint32_t* keysSwap;     // Radix sort ping-pong buffers
+    int* order;             // Slot that ends up at each position
+    int* orderSwap;
+    int capacity;
+
+    int* digitCounts;       // 256 counters per block of the radix sort
+    int blockCapacity;
+
+    void* field;            // Gather buffer for permuting one field array
+    size_t fieldBytes;
+} MortonScratch;
+
+// Initialize empty scratch buffers
+void init_morton_scratch(MortonScratch* scratch);
+
+// Morton code of a point given as two 16-bit grid coordinates
+uint32_t morton_key(uint32_t x, uint32_t y);
+
+// Sort the non-ghost slots of `ps` along the Morton curve and remap the handle
+// table. Inactive slots move behind the live ones. Returns 0 on success, -1 if out of memory
+int reorder_particles(MortonScratch* scratch, ParticleSystem* ps, ThreadPool* pool);
+
+// Bytes held by the scratch buffers
+size_t morton_memory_usage(const MortonScratch* scratch);
+
+// Release the scratch buffers
+void free_morton_scratch(MortonScratch* scratch);
+
+#endif // MORTON_H
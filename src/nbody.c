@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "nbody.h"
+#include "particle.h"
+#include "quadtree.h"
+#include "pm.h"
+#include "collision.h"
+#include "morton.h"
+
+struct NBodyWorld {
+    ParticleSystem* ps;
+    NBodyConfig config;
+    uint64_t steps;
+    double time;
+};
+
+// The one world, if it exists; it owns the solver settings and scratch
+static NBodyWorld* liveWorld = NULL;
+
+// nbody.h spells out the position type so it need not expose precision.h;
+// this fails to compile if the two disagree
+typedef char nbody_real_matches_Real[sizeof(nbody_real) == sizeof(Real) ? 1 : -1];
+
+static ParticleHandle to_handle(NBodyId id) {
+    ParticleHandle handle;
+    handle.id = id.id;
+    handle.generation = id.generation;
+    return handle;
+}
+
+static NBodyId to_id(ParticleHandle handle) {
+    NBodyId id;
+    id.id = handle.id;
+    id.generation = handle.generation;
+    return id;
+}
+
+// The defaults the command-line tools use
+void nbody_default_config(NBodyConfig* config) {
+    config->width = DEFAULT_WORLD_WIDTH;
+    config->height = DEFAULT_WORLD_HEIGHT;
+    config->dt = 0.016f;
+    config->solver = NBODY_SOLVER_GRID;
+    config->theta = BH_DEFAULT_THETA;
+    config->softening = BH_DEFAULT_SOFTENING;
+    config->meshSize = PM_DEFAULT_MESH_SIZE;
+    config->eta = BLOCK_DEFAULT_ETA;
+    config->maxLevel = BLOCK_DEFAULT_MAX_LEVEL;
+    config->collisionSkin = COLLISION_DEFAULT_SKIN;
+    config->reorderInterval = MORTON_DEFAULT_INTERVAL;
+    config->threads = 0;
+}
+
+// Create the world and hand it the solver settings
+NBodyWorld* nbody_create_world(const NBodyConfig* config) {
+    if (liveWorld != NULL) {
+        fprintf(stderr, "The world already exists; destroy it before creating another\n");
+        return NULL;
+    }
+    if (config && (config->width <= 0.0f || config->height <= 0.0f || config->dt <= 0.0f)) {
+        fprintf(stderr, "Invalid world parameters\n");
+        return NULL;
+    }
+
+    NBodyWorld* world = (NBodyWorld*)calloc(1, sizeof(NBodyWorld));
+    if (world == NULL) {
+        fprintf(stderr, "Failed to allocate memory for world\n");
+        return NULL;
+    }
+    if (config) {
+        world->config = *config;
+    } else {
+        nbody_default_config(&world->config);
+    }
+    world->ps = create_particles(0);
+    if (world->ps == NULL) {
+        free(world);
+        return NULL;
+    }
+
+    const NBodyConfig* c = &world->config;
+    switch (c->solver) {
+    case NBODY_SOLVER_BARNES_HUT: set_gravity_solver(SOLVER_BARNES_HUT); break;
+    case NBODY_SOLVER_PM: set_gravity_solver(SOLVER_PM); break;
+    default: set_gravity_solver(SOLVER_GRID); break;
+    }
+    set_world_bounds(c->width, c->height);
+    set_barnes_hut_params(c->theta, c->softening);
+    set_pm_mesh_size(c->meshSize);
+    set_block_timestep_params(c->eta, c->maxLevel);
+    set_collision_skin(c->collisionSkin);
+    set_reorder_interval(c->reorderInterval);
+    set_thread_count(c->threads);
+
+    liveWorld = world;
+    return world;
+}
+
+// Destroy the world and its bodies, and release the solver's scratch buffers
+void nbody_destroy_world(NBodyWorld* world) {
+    if (world == NULL) return;
+    free_particles(world->ps);
+    if (liveWorld == world) {
+        free_solver_scratch();
+        liveWorld = NULL;
+    }
+    free(world);
+}
+
+// Advance the world by `steps` steps
+int nbody_step(NBodyWorld* world, int steps) {
+    if (world == NULL || steps < 0) return -1;
+
+    for (int step = 0; step < steps; step++) {
+        update_particles(world->ps, world->config.dt);
+        world->steps++;
+        world->time += world->config.dt;
+    }
+    return 0;
+}
+
+// Add bodies in one go
+int nbody_add_bodies(NBodyWorld* world, int count, const nbody_real* x, const nbody_real* y,
+                     const nbody_real* vx, const nbody_real* vy, const float* mass, NBodyId* ids) {
+    if (world == NULL || count < 0) return -1;
+    if (count == 0) return 0;
+    if (!x || !y || !vx || !vy || !mass) return -1;
+
+    int first = add_particles(world->ps, count, x, y, vx, vy, mass, NULL);
+    if (first < 0) return -1;
+    if (ids) {
+        for (int k = 0; k < count; k++) {
+            ids[k] = to_id(get_particle_handle(world->ps, first + k));
+        }
+    }
+    return 0;
+}
+
+// Remove bodies; their slots are reclaimed by a later compaction
+int nbody_remove_bodies(NBodyWorld* world, const NBodyId* ids, int count) {
+    if (world == NULL || ids == NULL) return 0;
+
+    int removed = 0;
+    for (int k = 0; k < count; k++) {
+        if (remove_particle(world->ps, to_handle(ids[k])) == 0) removed++;
+    }
+    return removed;
+}
+
+// Slot of a body, or -1 if it is gone
+int nbody_find_body(const NBodyWorld* world, NBodyId id) {
+    if (world == NULL) return -1;
+    return find_particle(world->ps, to_handle(id));
+}
+
+// Id of the body in a slot, or an id that never resolves for slots out of range
+NBodyId nbody_body_id(const NBodyWorld* world, int slot) {
+    if (world == NULL || slot < 0 || slot >= world->ps->count) {
+        NBodyId invalid = { -1, 0 };
+        return invalid;
+    }
+    return to_id(get_particle_handle(world->ps, slot));
+}
+
+// Number of bodies alive
+int nbody_body_count(const NBodyWorld* world) {
+    if (world == NULL) return -1;
+    return world->ps->count - world->ps->deadCount;
+}
+
+// Point `state` at the world's arrays
+int nbody_get_state(const NBodyWorld* world, NBodyState* state) {
+    if (world == NULL || state == NULL) return -1;
+    const ParticleSystem* ps = world->ps;
+    state->slots = ps->count;
+    state->x = ps->x;
+    state->y = ps->y;
+    state->vx = ps->vx;
+    state->vy = ps->vy;
+    state->mass = ps->mass;
+    state->radius = ps->radius;
+    state->active = ps->active;
+    return 0;
+}
+
+// Steps taken since the world was created
+uint64_t nbody_step_count(const NBodyWorld* world) {
+    if (world == NULL) return 0;
+    return world->steps;
+}
+
+// Simulated time since the world was created
+double nbody_time(const NBodyWorld* world) {
+    if (world == NULL) return 0.0;
+    return world->time;
+}
+
+// Size of one nbody_real in the library
+int nbody_real_size(void) {
+    return (int)sizeof(Real);
+}
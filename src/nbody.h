@@ -0,0 +1,130 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <stdint.h>
+
+// Embedding API of the simulation library (libnbody).
+//
+// A program that wants to run the simulation in-process links the nbody
+// library and includes only this header: no SDL, no window, and none of the
+// solver internals. A world is created from a configuration, stepped, and
+// given or relieved of bodies; its state is read straight out of the
+// library's own structure-of-arrays storage, so looking at a million bodies
+// after every step costs no copy.
+//
+// The pointers in an NBodyState stay valid until the next call that changes
+// the world (nbody_step, nbody_add_bodies, nbody_remove_bodies,
+// nbody_destroy_world): stepping may compact merged bodies away, sort the
+// storage along a Morton curve or grow the arrays. Slots are only a position
+// in those arrays; to follow a body from one step to the next, keep its
+// NBodyId and look its slot up again with nbody_find_body.
+//
+// Positions and velocities are nbody_real, float unless the library was built
+// with NBODY_DOUBLE_POSITIONS. Programs must be built with the same setting;
+// nbody_real_size reports the library's.
+//
+// The world is a singleton: the solver settings and step scratch buffers are
+// shared by the whole library, so only one world can exist at a time, and
+// destroying it releases the scratch and the worker threads. A world is not
+// meant to be used from several threads at once; stepping itself runs on the
+// library's worker threads.
+//
+// Every call taking a world fails on NULL: calls returning int return -1 (a
+// count of 0 for nbody_remove_bodies), nbody_body_id an id that never
+// resolves, and the counters 0.
+
+#ifdef NBODY_DOUBLE_POSITIONS
+typedef double nbody_real;
+#else
+typedef float nbody_real;
+#endif
+
+// Opaque simulation world
+typedef struct NBodyWorld NBodyWorld;
+
+// Stable reference to a body; stays the same when the body moves to another
+// slot and never refers to another body once this one is removed or merged
+typedef struct {
+    int id;
+    uint32_t generation;
+} NBodyId;
+
+// Gravity solvers (see particle.h)
+typedef enum {
+    NBODY_SOLVER_GRID,          // Gravity between neighboring grid cells only
+    NBODY_SOLVER_BARNES_HUT,    // Full gravity through a Barnes-Hut quadtree
+    NBODY_SOLVER_PM             // Particle-Mesh FFT gravity in a periodic world
+} NBodySolver;
+
+// Everything a world is created with
+typedef struct {
+    float width;                // Size of the world; bodies bounce off its edges (wrap around with PM)
+    float height;
+    float dt;                   // Time one step advances
+    NBodySolver solver;
+    float theta;                // Barnes-Hut opening angle
+    float softening;            // Softening length of every solver
+    int meshSize;               // Particle-Mesh nodes per axis, a power of two
+    float eta;                  // Block timestep accuracy, smaller = finer
+    int maxLevel;               // Finest timestep is dt / 2^maxLevel, 0 = one shared step
+    float collisionSkin;        // Collision neighbor list skin, 0 = search for collisions every step
+    int reorderInterval;        // Steps between Morton sorts of the storage, 0 = never
+    int threads;                // Worker threads, 0 = one per logical CPU
+} NBodyConfig;
+
+// Read-only view of a world's storage
+typedef struct {
+    int slots;                  // Length of every array below
+    const nbody_real* x;        // Positions
+    const nbody_real* y;
+    const nbody_real* vx;       // Velocities
+    const nbody_real* vy;
+    const float* mass;
+    const float* radius;
+    const uint8_t* active;      // 0 for slots whose body merged away and is not yet compacted
+} NBodyState;
+
+// The defaults the command-line tools use
+void nbody_default_config(NBodyConfig* config);
+
+// Create the world (NULL config = defaults). Returns NULL if out of memory or
+// if the world already exists
+NBodyWorld* nbody_create_world(const NBodyConfig* config);
+
+// Destroy the world and its bodies, and release the solver's scratch buffers
+void nbody_destroy_world(NBodyWorld* world);
+
+// Advance the world by `steps` steps of config.dt. Returns 0 on success, -1 on
+// invalid arguments
+int nbody_step(NBodyWorld* world, int steps);
+
+// Add `count` bodies; each one's radius follows from its mass. `ids` may be
+// NULL. Returns 0 on success, -1 on invalid arguments or if out of memory
+int nbody_add_bodies(NBodyWorld* world, int count, const nbody_real* x, const nbody_real* y,
+                     const nbody_real* vx, const nbody_real* vy, const float* mass, NBodyId* ids);
+
+// Remove bodies; ids that no longer resolve are skipped. Returns how many were removed
+int nbody_remove_bodies(NBodyWorld* world, const NBodyId* ids, int count);
+
+// Slot of a body, or -1 if it has been removed or merged away
+int nbody_find_body(const NBodyWorld* world, NBodyId id);
+
+// Id of the body in a slot. Slots outside 0..slots-1 give { -1, 0 }, which
+// nbody_find_body never resolves
+NBodyId nbody_body_id(const NBodyWorld* world, int slot);
+
+// Number of bodies alive, or -1 for a NULL world
+int nbody_body_count(const NBodyWorld* world);
+
+// Point `state` at the world's arrays, valid until the world next changes.
+// Returns 0 on success, -1 on invalid arguments
+int nbody_get_state(const NBodyWorld* world, NBodyState* state);
+
+// Steps taken and simulated time since the world was created
+uint64_t nbody_step_count(const NBodyWorld* world);
+double nbody_time(const NBodyWorld* world);
+
+// Size of one nbody_real in the library: 4 (float) or 8 (double)
+int nbody_real_size(void);
+
+#endif // NBODY_H
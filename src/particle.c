@@ -1,10 +1,94 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
-#include <SDL2/SDL.h>
 #include "particle.h"
+#include "grid.h"
+#include "collision.h"
+#include "quadtree.h"
+#include "pm.h"
+#include "morton.h"
+#include "force_kernel.h"
+#include "threadpool.h"
+#include "initial_conditions.h"
 #include "utils.h"
 
+// Work counters owned by one worker, padded to their own cache line
+typedef struct {
+    long long interactions;
+    char padding[64 - sizeof(long long)];
+} WorkerCounter;
+
+// Kinetic energy, momentum and angular momentum changed by bounces off the
+// walls, summed per INTEGRATE_CHUNK slots so the totals do not depend on how
+// the chunks were spread over the workers
+typedef struct {
+    double energy;
+    double momentumX;
+    double momentumY;
+    double angularMomentum;
+} WallSums;
+
+// Particles per work item for force evaluation and integration
+#define FORCE_CHUNK 256
+#define INTEGRATE_CHUNK 4096
+
+// Grid cells per work item for grid force evaluation
+#define GRID_FORCE_CHUNK 16
+
+// Solver selection, Barnes-Hut opening angle and the softening shared by both solvers
+static GravitySolver gravitySolver = SOLVER_GRID;
+static float bhTheta = BH_DEFAULT_THETA;
+static float softening = BH_DEFAULT_SOFTENING;
+
+// Block timestep accuracy parameter and finest level
+static float blockEta = BLOCK_DEFAULT_ETA;
+static int blockMaxLevel = BLOCK_DEFAULT_MAX_LEVEL;
+
+// Simulation area; particles bounce off its edges
+static float worldWidth = DEFAULT_WORLD_WIDTH;
+static float worldHeight = DEFAULT_WORLD_HEIGHT;
+
+// Grid used for collisions, rebuilt whenever the neighbor list is, and the grid
+// solver's gravity grid with cells of GRID_FORCE_CELL_SIZE
+static SpatialGrid grid;
+static SpatialGrid forceGrid;
+
+// Buffers of the collision phase and the skin of its neighbor list (0 = none)
+static CollisionScratch collisions;
+static float collisionSkin = COLLISION_DEFAULT_SKIN;
+
+// Particle-Mesh solver state and its nodes per axis
+static ParticleMesh mesh;
+static int pmMeshSize = PM_DEFAULT_MESH_SIZE;
+
+// Morton reordering buffers, steps between reorders (0 = never) and steps since they were set
+static MortonScratch morton;
+static int reorderInterval = MORTON_DEFAULT_INTERVAL;
+static int stepsSinceReorder = 0;
+
+// Per-step scratch: quadtree, per-worker interaction lists and counters
+static QuadTree tree;
+static InteractionList* lists = NULL;
+static WorkerCounter* counters = NULL;
+static int listCount = 0;
+
+// Block timestep scratch: level of every slot, the particles due for forces in
+// the current substep (as a list and as a per-slot mask), and particles per level
+static uint8_t* levels = NULL;
+static uint8_t* dueMask = NULL;
+static int* dueIndices = NULL;
+static int blockCapacity = 0;
+static WallSums* wallSums = NULL;
+static int levelCounts[BLOCK_MAX_LEVEL + 1];
+
+// Timings and counters of the most recent step
+static StepStats stepStats;
+
+// Workers for the parallel phases, started on first use
+static ThreadPool* threadPool = NULL;
+static int threadPoolCreated = 0;
+
 // Helper functions for grid (moved to top of file)
 static inline int max_int(int a, int b) {
     return a > b ? a : b;
@@ -19,300 +103,1009 @@ float calculate_radius(float mass) {
     return 2.0f + sqrtf(mass) * 2.0f; // Simple scaling formula
 }
 
-// Create a system of particles
-Particle* create_particles(int count) {
-    Particle* particles = (Particle*)malloc(count * sizeof(Particle));
-    if (particles == NULL) {
+// Calculate the display color for a given mass
+ParticleColor calculate_color(float mass) {
+    float r = 128 + mass / 100.0f * 127; // Red increases with mass
+    float g = 192 - mass / 100.0f * 128; // Green decreases with mass
+    float b = 255 - mass / 100.0f * 128; // Blue decreases with mass
+
+    ParticleColor color;
+    color.r = (uint8_t)(r > 255.0f ? 255.0f : r);
+    color.g = (uint8_t)(g < 0.0f ? 0.0f : g);
+    color.b = (uint8_t)(b < 0.0f ? 0.0f : b);
+    color.a = 255;
+    return color;
+}
+
+// Reallocate one field array with a new capacity, keeping the first `count` elements
+static int grow_array(void** array, size_t elementSize, int count, int capacity) {
+    void* grown = aligned_malloc((size_t)capacity * elementSize, PARTICLE_ALIGNMENT);
+    if (grown == NULL) return -1;
+
+    if (*array != NULL) {
+        memcpy(grown, *array, (size_t)count * elementSize);
+        aligned_free(*array);
+    }
+    *array = grown;
+    return 0;
+}
+
+// Make room for at least `capacity` particles
+int reserve_particles(ParticleSystem* ps, int capacity) {
+    if (capacity <= ps->capacity) return 0;
+
+    int newCapacity = ps->capacity ? ps->capacity : 64;
+    while (newCapacity < capacity) newCapacity *= 2;
+
+    if (grow_array((void**)&ps->x, sizeof(Real), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->y, sizeof(Real), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->vx, sizeof(Real), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->vy, sizeof(Real), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->mass, sizeof(float), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->ax, sizeof(float), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->ay, sizeof(float), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->radius, sizeof(float), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->color, sizeof(ParticleColor), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->active, sizeof(uint8_t), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->stale, sizeof(uint8_t), ps->count, newCapacity) != 0 ||
+        grow_array((void**)&ps->handle, sizeof(int), ps->count, newCapacity) != 0) {
         fprintf(stderr, "Failed to allocate memory for particles\n");
-        return NULL;
-    }
-    
-    // Initialize particles with random values
-    for (int i = 0; i < count; i++) {
-        float mass = random_float(10.0f, 100.0f);
-        float x = random_float(50.0f, 750.0f);
-        float y = random_float(50.0f, 550.0f);
-        float vx = random_float(-1.0f, 1.0f);
-        float vy = random_float(-1.0f, 1.0f);
-        
-        particles[i].x = x;
-        particles[i].y = y;
-        particles[i].vx = vx;
-        particles[i].vy = vy;
-        particles[i].mass = mass;
-        particles[i].radius = calculate_radius(mass);
-        particles[i].active = 1;
-        
-        // Assign a color based on mass
-        Uint8 r = (Uint8)(128 + mass / 100.0f * 127); // Red increases with mass
-        Uint8 g = (Uint8)(192 - mass / 100.0f * 128); // Green decreases with mass
-        Uint8 b = (Uint8)(255 - mass / 100.0f * 128); // Blue decreases with mass
-        
-        particles[i].color.r = r;
-        particles[i].color.g = g;
-        particles[i].color.b = b;
-        particles[i].color.a = 255;
-    }
-    
-    return particles;
-}
-
-// Create a single particle with specified parameters
-Particle* create_particle(float x, float y, float vx, float vy, float mass) {
-    Particle* p = (Particle*)malloc(sizeof(Particle));
-    if (p == NULL) {
-        fprintf(stderr, "Failed to allocate memory for particle\n");
-        return NULL;
-    }
-    
-    p->x = x;
-    p->y = y;
-    p->vx = vx;
-    p->vy = vy;
-    p->mass = mass;
-    p->radius = calculate_radius(mass);
-    p->active = 1;
-    
-    // Assign a color based on mass
-    Uint8 r = (Uint8)(128 + mass / 100.0f * 127);
-    Uint8 g = (Uint8)(192 - mass / 100.0f * 128);
-    Uint8 b = (Uint8)(255 - mass / 100.0f * 128);
-    
-    p->color.r = r;
-    p->color.g = g;
-    p->color.b = b;
-    p->color.a = 255;
-    
-    return p;
-}
-
-// Initialize spatial grid for efficient collision detection and gravity calculation
-void init_grid(SpatialGrid* grid, int width, int height) {
-    grid->width = width;
-    grid->height = height;
-    grid->cellWidth = (float)width / GRID_SIZE;
-    grid->cellHeight = (float)height / GRID_SIZE;
-    
-    // Initialize all cells to empty
-    clear_grid(grid);
-}
-
-// Clear the grid for the next frame update
-void clear_grid(SpatialGrid* grid) {
-    for (int i = 0; i < GRID_SIZE; i++) {
-        for (int j = 0; j < GRID_SIZE; j++) {
-            grid->cells[i][j].count = 0;
+        return -1;
+    }
+
+    ps->capacity = newCapacity;
+    return 0;
+}
+
+// Create a system of particles spread uniformly over the world, from the current seed
+ParticleSystem* create_particles(int count) {
+    InitialConditionParams params;
+    default_initial_conditions(&params, count, get_random_seed());
+    return generate_particles(&params);
+}
+
+// Make sure `count` more handles can be issued without growing the table
+static int reserve_handles(ParticleSystem* ps, int count) {
+    int needed = ps->handleCount + (count > ps->freeHandleCount ? count - ps->freeHandleCount : 0);
+    if (needed <= ps->handleCapacity) return 0;
+
+    int newCapacity = ps->handleCapacity ? ps->handleCapacity : 64;
+    while (newCapacity < needed) newCapacity *= 2;
+
+    int* slots = (int*)realloc(ps->handleSlot, newCapacity * sizeof(int));
+    if (slots) ps->handleSlot = slots;
+    uint32_t* generations = (uint32_t*)realloc(ps->handleGeneration, newCapacity * sizeof(uint32_t));
+    if (generations) ps->handleGeneration = generations;
+    int* freeList = (int*)realloc(ps->freeHandles, newCapacity * sizeof(int));
+    if (freeList) ps->freeHandles = freeList;
+
+    if (!slots || !generations || !freeList) {
+        fprintf(stderr, "Failed to allocate memory for particle handles\n");
+        return -1;
+    }
+    ps->handleCapacity = newCapacity;
+    return 0;
+}
+
+// Issue a handle for a slot, reusing a free entry when there is one
+static void issue_handle(ParticleSystem* ps, int slot) {
+    int id;
+    if (ps->freeHandleCount > 0) {
+        id = ps->freeHandles[--ps->freeHandleCount];
+    } else {
+        id = ps->handleCount++;
+        ps->handleGeneration[id] = 0;
+    }
+    ps->handleSlot[id] = slot;
+    ps->handle[slot] = id;
+}
+
+// Return a slot's handle entry to the free stack; old handles to it stop resolving
+static void release_handle(ParticleSystem* ps, int slot) {
+    int id = ps->handle[slot];
+    ps->handleSlot[id] = -1;
+    ps->handleGeneration[id]++;
+    ps->freeHandles[ps->freeHandleCount++] = id;
+}
+
+// Fill a new slot
+static void init_particle(ParticleSystem* ps, int i, Real x, Real y, Real vx, Real vy, float mass) {
+    ps->x[i] = x;
+    ps->y[i] = y;
+    ps->vx[i] = vx;
+    ps->vy[i] = vy;
+    ps->mass[i] = mass;
+    ps->ax[i] = 0.0f;
+    ps->ay[i] = 0.0f;
+    ps->radius[i] = calculate_radius(mass);
+    ps->color[i] = calculate_color(mass);
+    ps->active[i] = 1;
+    ps->stale[i] = 1;
+    issue_handle(ps, i);
+}
+
+// Append a single particle with specified parameters
+int add_particle(ParticleSystem* ps, Real x, Real y, Real vx, Real vy, float mass) {
+    if (reserve_particles(ps, ps->count + 1) != 0 || reserve_handles(ps, 1) != 0) return -1;
+
+    int i = ps->count++;
+    init_particle(ps, i, x, y, vx, vy, mass);
+    return i;
+}
+
+// Append `count` particles at once
+int add_particles(ParticleSystem* ps, int count, const Real* x, const Real* y,
+                  const Real* vx, const Real* vy, const float* mass, ParticleHandle* handles) {
+    if (reserve_particles(ps, ps->count + count) != 0 || reserve_handles(ps, count) != 0) return -1;
+
+    int first = ps->count;
+    for (int k = 0; k < count; k++) {
+        init_particle(ps, first + k, x[k], y[k], vx[k], vy[k], mass[k]);
+        if (handles) handles[k] = get_particle_handle(ps, first + k);
+    }
+    ps->count += count;
+    return first;
+}
+
+// Handle of the particle in a slot
+ParticleHandle get_particle_handle(const ParticleSystem* ps, int index) {
+    ParticleHandle handle;
+    handle.id = ps->handle[index];
+    handle.generation = ps->handleGeneration[handle.id];
+    return handle;
+}
+
+// Current slot of a particle, or -1 if it has been removed or merged away
+int find_particle(const ParticleSystem* ps, ParticleHandle handle) {
+    if (handle.id < 0 || handle.id >= ps->handleCount) return -1;
+    if (ps->handleGeneration[handle.id] != handle.generation) return -1;
+
+    int slot = ps->handleSlot[handle.id];
+    return slot >= 0 && ps->active[slot] ? slot : -1;
+}
+
+// Remove a particle; its slot is reclaimed at the next compaction
+int remove_particle(ParticleSystem* ps, ParticleHandle handle) {
+    int slot = find_particle(ps, handle);
+    if (slot < 0) return -1;
+
+    ps->active[slot] = 0;
+    ps->deadCount++;
+    return 0;
+}
+
+// Remove many particles; invalid handles are skipped
+int remove_particles(ParticleSystem* ps, const ParticleHandle* handles, int count) {
+    int removed = 0;
+    for (int k = 0; k < count; k++) {
+        if (remove_particle(ps, handles[k]) == 0) removed++;
+    }
+    return removed;
+}
+
+// Issue fresh handles for all slots, invalidating every earlier handle
+int reset_particle_handles(ParticleSystem* ps) {
+    // Bump every entry ever issued so no old handle can match again
+    for (int id = 0; id < ps->handleCount; id++) {
+        ps->handleGeneration[id]++;
+        ps->handleSlot[id] = -1;
+        ps->freeHandles[id] = ps->handleCount - 1 - id;
+    }
+    ps->freeHandleCount = ps->handleCount;
+
+    if (reserve_handles(ps, ps->count) != 0) return -1;
+    for (int i = 0; i < ps->count; i++) {
+        issue_handle(ps, i);
+    }
+    return 0;
+}
+
+// Squeeze merged particles out of the arrays so only live bodies remain
+void compact_particles(ParticleSystem* ps) {
+    int live = 0;
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) {
+            release_handle(ps, i);
+            continue;
+        }
+
+        if (live != i) {
+            ps->x[live] = ps->x[i];
+            ps->y[live] = ps->y[i];
+            ps->vx[live] = ps->vx[i];
+            ps->vy[live] = ps->vy[i];
+            ps->mass[live] = ps->mass[i];
+            ps->ax[live] = ps->ax[i];
+            ps->ay[live] = ps->ay[i];
+            ps->radius[live] = ps->radius[i];
+            ps->color[live] = ps->color[i];
+            ps->active[live] = 1;
+            ps->stale[live] = ps->stale[i];
+            ps->handle[live] = ps->handle[i];
+            ps->handleSlot[ps->handle[live]] = live;
         }
+        live++;
     }
+
+    ps->count = live;
+    ps->deadCount = 0;
 }
 
-// Add particle to the appropriate grid cell
-void add_particle_to_grid(SpatialGrid* grid, Particle* particles, int index) {
-    Particle* p = &particles[index];
-    if (!p->active) return;
-    
-    // Calculate grid cell coordinates
-    int cellX = (int)(p->x / grid->cellWidth);
-    int cellY = (int)(p->y / grid->cellHeight);
-    
-    // Clamp to grid boundaries
-    if (cellX < 0) cellX = 0;
-    if (cellX >= GRID_SIZE) cellX = GRID_SIZE - 1;
-    if (cellY < 0) cellY = 0;
-    if (cellY >= GRID_SIZE) cellY = GRID_SIZE - 1;
-    
-    // Add particle index to cell
-    GridCell* cell = &grid->cells[cellY][cellX];
-    if (cell->count < MAX_PARTICLES_PER_CELL) {
-        cell->particleIndices[cell->count++] = index;
-    }
-}
-
-// Apply gravitational force between two particles
-void apply_gravity(Particle* p1, Particle* p2, float dt) {
-    if (!p1->active || !p2->active) return;
-    
-    // Calculate distance between particles
-    float dx = p2->x - p1->x;
-    float dy = p2->y - p1->y;
-    float distance_sq = dx * dx + dy * dy;
-    
-    // Avoid division by zero and dampen extreme forces when very close
-    if (distance_sq < 1.0f) distance_sq = 1.0f;
-    
-    // Calculate gravitational force
-    float distance = sqrtf(distance_sq);
-    float force_magnitude = G * p1->mass * p2->mass / distance_sq;
-    
-    // Calculate force components
-    float force_x = force_magnitude * dx / distance;
-    float force_y = force_magnitude * dy / distance;
-    
-    // Apply acceleration to both particles (F = ma, a = F/m)
-    p1->vx += force_x / p1->mass * dt;
-    p1->vy += force_y / p1->mass * dt;
-    p2->vx -= force_x / p2->mass * dt;
-    p2->vy -= force_y / p2->mass * dt;
+// Drop the slots from `count` on, releasing their handles
+void truncate_particles(ParticleSystem* ps, int count) {
+    for (int i = count; i < ps->count; i++) {
+        if (!ps->active[i]) ps->deadCount--;
+        release_handle(ps, i);
+    }
+    ps->count = count;
+}
+
+// Copy the live particles of `src` into `dst`, packed and in order
+int copy_live_particles(ParticleSystem* dst, const ParticleSystem* src) {
+    int live = src->count - src->deadCount;
+    if (reserve_particles(dst, live) != 0) return -1;
+
+    int n = 0;
+    for (int i = 0; i < src->count; i++) {
+        if (!src->active[i]) continue;
+
+        dst->x[n] = src->x[i];
+        dst->y[n] = src->y[i];
+        dst->vx[n] = src->vx[i];
+        dst->vy[n] = src->vy[i];
+        dst->mass[n] = src->mass[i];
+        dst->ax[n] = src->ax[i];
+        dst->ay[n] = src->ay[i];
+        dst->radius[n] = src->radius[i];
+        dst->color[n] = src->color[i];
+        dst->active[n] = 1;
+        dst->stale[n] = src->stale[i];
+        dst->handle[n] = -1;
+        n++;
+    }
+
+    dst->count = n;
+    dst->deadCount = 0;
+    dst->ghostCount = src->ghostCount; // Ghosts are live and stay at the end
+    return 0;
+}
+
+// Set the size of the simulation area
+void set_world_bounds(float width, float height) {
+    worldWidth = width;
+    worldHeight = height;
+}
+
+// Get the size of the simulation area
+void get_world_bounds(float* width, float* height) {
+    *width = worldWidth;
+    *height = worldHeight;
+}
+
+// Select the gravity solver used by update_particles
+void set_gravity_solver(GravitySolver solver) {
+    gravitySolver = solver;
+}
+
+// Get the currently selected gravity solver
+GravitySolver get_gravity_solver(void) {
+    return gravitySolver;
+}
+
+// Short name of a solver
+const char* gravity_solver_name(GravitySolver solver) {
+    switch (solver) {
+    case SOLVER_BARNES_HUT: return "bh";
+    case SOLVER_PM: return "pm";
+    default: return "grid";
+    }
+}
+
+// Solver with the given short name
+int parse_gravity_solver(const char* name, GravitySolver* solver) {
+    if (strcmp(name, "grid") == 0) {
+        *solver = SOLVER_GRID;
+    } else if (strcmp(name, "bh") == 0 || strcmp(name, "barnes-hut") == 0) {
+        *solver = SOLVER_BARNES_HUT;
+    } else if (strcmp(name, "pm") == 0) {
+        *solver = SOLVER_PM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Set the Particle-Mesh solver's nodes per axis
+void set_pm_mesh_size(int meshSize) {
+    if (meshSize < PM_MIN_MESH_SIZE) meshSize = PM_MIN_MESH_SIZE;
+    if (meshSize > PM_MAX_MESH_SIZE) meshSize = PM_MAX_MESH_SIZE;
+    int size = PM_MIN_MESH_SIZE;
+    while (size < meshSize) size *= 2;
+    pmMeshSize = size;
+}
+
+// Get the Particle-Mesh solver's nodes per axis
+int get_pm_mesh_size(void) {
+    return pmMeshSize;
+}
+
+// Set the skin distance of the collision neighbor list (0 = search the grid every step)
+void set_collision_skin(float skin) {
+    collisionSkin = skin > 0.0f ? skin : 0.0f;
+}
+
+// Get the skin distance of the collision neighbor list
+float get_collision_skin(void) {
+    return collisionSkin;
+}
+
+// Set how many steps pass between Morton reorders of the particle storage (0 = never);
+// the next step reorders
+void set_reorder_interval(int steps) {
+    reorderInterval = steps > 0 ? steps : 0;
+    stepsSinceReorder = 0;
+}
+
+// Get how many steps pass between Morton reorders
+int get_reorder_interval(void) {
+    return reorderInterval;
+}
+
+// Set how many steps have passed since the last Morton reorder
+void set_reorder_phase(int steps) {
+    stepsSinceReorder = reorderInterval > 0 && steps > 0 ? steps % reorderInterval : 0;
+}
+
+// Get how many steps have passed since the last Morton reorder
+int get_reorder_phase(void) {
+    return stepsSinceReorder;
+}
+
+// Set the Barnes-Hut opening angle and softening length
+void set_barnes_hut_params(float theta, float eps) {
+    if (theta < 0.0f) theta = 0.0f;
+    if (eps < MIN_SOFTENING) eps = MIN_SOFTENING;
+    bhTheta = theta;
+    softening = eps;
+}
+
+// Get the Barnes-Hut opening angle and the softening length
+void get_barnes_hut_params(float* theta, float* eps) {
+    *theta = bhTheta;
+    *eps = softening;
+}
+
+// Set the block timestep accuracy parameter and the finest level
+void set_block_timestep_params(float eta, int maxLevel) {
+    if (eta <= 0.0f) eta = BLOCK_DEFAULT_ETA;
+    if (maxLevel < 0) maxLevel = 0;
+    if (maxLevel > BLOCK_MAX_LEVEL) maxLevel = BLOCK_MAX_LEVEL;
+    blockEta = eta;
+    blockMaxLevel = maxLevel;
+}
+
+// Get the block timestep accuracy parameter and the finest level
+void get_block_timestep_params(float* eta, int* maxLevel) {
+    *eta = blockEta;
+    *maxLevel = blockMaxLevel;
 }
 
 // Check if two particles are colliding
-int check_collision(Particle* p1, Particle* p2) {
-    if (!p1->active || !p2->active) return 0;
-    
-    float dx = p2->x - p1->x;
-    float dy = p2->y - p1->y;
+int check_collision(const ParticleSystem* ps, int i, int j) {
+    if (!ps->active[i] || !ps->active[j]) return 0;
+
+    float dx = REAL_OFFSET(ps->x[j], ps->x[i]);
+    float dy = REAL_OFFSET(ps->y[j], ps->y[i]);
     float distance_sq = dx * dx + dy * dy;
-    float radii_sum = p1->radius + p2->radius;
-    
+    float radii_sum = ps->radius[i] + ps->radius[j];
+
     return distance_sq <= (radii_sum * radii_sum);
 }
 
 // Merge two colliding particles
-void merge_particles(Particle* p1, Particle* p2) {
-    // Ensure p1 is the larger mass (we'll keep p1 and deactivate p2)
-    if (p1->mass < p2->mass) {
-        Particle* temp = p1;
-        p1 = p2;
-        p2 = temp;
-    }
-    
+void merge_particles(ParticleSystem* ps, int i, int j) {
+    // Ensure i is the larger mass (we'll keep i and deactivate j)
+    if (ps->mass[i] < ps->mass[j]) {
+        int temp = i;
+        i = j;
+        j = temp;
+    }
+
     // Conservation of momentum
-    float total_mass = p1->mass + p2->mass;
-    p1->vx = (p1->vx * p1->mass + p2->vx * p2->mass) / total_mass;
-    p1->vy = (p1->vy * p1->mass + p2->vy * p2->mass) / total_mass;
-    
+    float total_mass = ps->mass[i] + ps->mass[j];
+    ps->vx[i] = (ps->vx[i] * ps->mass[i] + ps->vx[j] * ps->mass[j]) / total_mass;
+    ps->vy[i] = (ps->vy[i] * ps->mass[i] + ps->vy[j] * ps->mass[j]) / total_mass;
+
     // Update mass and radius
-    p1->mass = total_mass;
-    p1->radius = calculate_radius(total_mass);
-    
+    ps->mass[i] = total_mass;
+    ps->radius[i] = calculate_radius(total_mass);
+
     // Update color based on new mass
-    Uint8 r = (Uint8)(128 + p1->mass / 100.0f * 127);
-    Uint8 g = (Uint8)(192 - p1->mass / 100.0f * 128);
-    Uint8 b = (Uint8)(255 - p1->mass / 100.0f * 128);
-    if (r > 255) r = 255;
-    
-    p1->color.r = r;
-    p1->color.g = g;
-    p1->color.b = b;
-    
-    // Deactivate the second particle
-    p2->active = 0;
+    ps->color[i] = calculate_color(total_mass);
+
+    // The survivor's acceleration no longer matches its mass and position
+    ps->stale[i] = 1;
+
+    // Deactivate the second particle; it is removed at the next compaction
+    ps->active[j] = 0;
+    ps->deadCount++;
+}
+
+// Position wrapped into [0, size)
+static inline Real wrap_coordinate(Real value, float size) {
+    if (value >= 0 && value < size) return value;
+    Real wrapped = (Real)(value - size * floor((double)value / size));
+    return wrapped < size ? wrapped : 0;
 }
 
 // Update a single particle
-void update_particle(Particle* p, float dt) {
-    if (p != NULL && p->active) {
+void update_particle(ParticleSystem* ps, int index, float dt) {
+    if (ps != NULL && ps->active[index]) {
+        float radius = ps->radius[index];
+
         // Update position based on velocity
-        p->x += p->vx * dt;
-        p->y += p->vy * dt;
-        
+        ps->x[index] += ps->vx[index] * dt;
+        ps->y[index] += ps->vy[index] * dt;
+
+        // The Particle-Mesh solver's world is periodic: leave on one side, come back on the other
+        if (gravitySolver == SOLVER_PM) {
+            ps->x[index] = wrap_coordinate(ps->x[index], worldWidth);
+            ps->y[index] = wrap_coordinate(ps->y[index], worldHeight);
+            return;
+        }
+
         // Simple boundary collision - bounce off the edges
-        if (p->x - p->radius < 0) {
-            p->x = p->radius;
-            p->vx = -p->vx * 0.8f; // Lose some energy
-        } 
-        else if (p->x + p->radius > 800) {
-            p->x = 800 - p->radius;
-            p->vx = -p->vx * 0.8f;
+        if (ps->x[index] - radius < 0) {
+            ps->x[index] = radius;
+            ps->vx[index] = -ps->vx[index] * REAL(0.8); // Lose some energy
         }
-        
-        if (p->y - p->radius < 0) {
-            p->y = p->radius;
-            p->vy = -p->vy * 0.8f;
+        else if (ps->x[index] + radius > worldWidth) {
+            ps->x[index] = worldWidth - radius;
+            ps->vx[index] = -ps->vx[index] * REAL(0.8);
         }
-        else if (p->y + p->radius > 600) {
-            p->y = 600 - p->radius;
-            p->vy = -p->vy * 0.8f;
+
+        if (ps->y[index] - radius < 0) {
+            ps->y[index] = radius;
+            ps->vy[index] = -ps->vy[index] * REAL(0.8);
+        }
+        else if (ps->y[index] + radius > worldHeight) {
+            ps->y[index] = worldHeight - radius;
+            ps->vy[index] = -ps->vy[index] * REAL(0.8);
         }
     }
 }
 
-// Update all particles using spatial grid for optimization
-void update_particles(Particle* particles, int count, float dt) {
-    static SpatialGrid grid;
-    static int gridInitialized = 0;
-    
-    // Initialize grid on first call
-    if (!gridInitialized) {
-        init_grid(&grid, 800, 600); // Assuming window size is 800x600
-        gridInitialized = 1;
-    }
-    
-    // Clear grid for this frame
-    clear_grid(&grid);
-    
-    // Add all particles to the grid
-    for (int i = 0; i < count; i++) {
-        if (particles[i].active) {
-            add_particle_to_grid(&grid, particles, i);
+// Ensure the block timestep scratch arrays hold at least `count` entries
+static int reserve_block_scratch(int count) {
+    if (count <= blockCapacity) return 0;
+
+    uint8_t* newLevels = (uint8_t*)realloc(levels, count * sizeof(uint8_t));
+    if (newLevels) levels = newLevels;
+    uint8_t* newMask = (uint8_t*)realloc(dueMask, count * sizeof(uint8_t));
+    if (newMask) dueMask = newMask;
+    int* newIndices = (int*)realloc(dueIndices, count * sizeof(int));
+    if (newIndices) dueIndices = newIndices;
+    int chunks = (count + INTEGRATE_CHUNK - 1) / INTEGRATE_CHUNK;
+    WallSums* newWallSums = (WallSums*)realloc(wallSums, chunks * sizeof(WallSums));
+    if (newWallSums) wallSums = newWallSums;
+
+    if (!newLevels || !newMask || !newIndices || !newWallSums) {
+        fprintf(stderr, "Failed to allocate memory for timestep levels\n");
+        return -1;
+    }
+    blockCapacity = count;
+    return 0;
+}
+
+// Shared state for the parallel phases of update_particles
+typedef struct {
+    ParticleSystem* ps;
+    const SpatialGrid* grid;  // Gravity grid of the grid solver
+    const QuadTree* tree;
+    InteractionList* lists;  // One scratch list per worker
+    WorkerCounter* counters; // One counter per worker
+    WallSums* wallSums;      // One per INTEGRATE_CHUNK slots
+    ForceKernel kernel;
+    float eps_sq;
+    const int* due;          // Particles that get fresh forces this substep
+    int dueCount;
+    const uint8_t* dueMask;  // Non-zero for the slots listed in `due`
+    uint8_t* levels;         // Timestep level of every slot
+    float dt;                // Whole step; level k advances by dt / 2^k
+    float drift;             // Length of the current substep
+    float criterion;         // 2 * eta * softening, see timestep_level
+    int maxLevel;
+} StepContext;
+
+// Gravity from the same and neighboring cells, one grid cell per item. The sources
+// of each 3x3 block are gathered once and streamed through the batched kernel for
+// every due particle in the center cell; a particle's own entry contributes nothing
+// thanks to the softening. Positions are passed relative to the center cell's
+// corner, so the float kernels see small offsets even when Real is double.
+static void grid_force_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    const SpatialGrid* cellGrid = ctx->grid;
+    InteractionList* list = &ctx->lists[worker];
+
+    for (int cell = start; cell < end; cell++) {
+        int due = 0;
+        for (int k = cellGrid->cellStart[cell]; k < cellGrid->cellStart[cell + 1]; k++) {
+            due += ctx->dueMask[cellGrid->particleIndices[k]];
+        }
+        if (due == 0) continue;
+
+        int cellX = cell % cellGrid->cellsX;
+        int cellY = cell / cellGrid->cellsX;
+        int minX = max_int(0, cellX-1), maxX = min_int(cellGrid->cellsX-1, cellX+1);
+        int minY = max_int(0, cellY-1), maxY = min_int(cellGrid->cellsY-1, cellY+1);
+
+        // Rows of the 3x3 block are contiguous runs of cells in the CSR arrays
+        int sources = 0;
+        for (int nCellY = minY; nCellY <= maxY; nCellY++) {
+            int row = nCellY * cellGrid->cellsX;
+            sources += cellGrid->cellStart[row + maxX + 1] - cellGrid->cellStart[row + minX];
         }
+        if (reserve_interaction_list(list, sources) != 0) return;
+
+        Real anchorX = cellGrid->originX + (Real)cellX * cellGrid->cellSize;
+        Real anchorY = cellGrid->originY + (Real)cellY * cellGrid->cellSize;
+
+        list->count = 0;
+        for (int nCellY = minY; nCellY <= maxY; nCellY++) {
+            int row = nCellY * cellGrid->cellsX;
+            for (int k = cellGrid->cellStart[row + minX]; k < cellGrid->cellStart[row + maxX + 1]; k++) {
+                int j = cellGrid->particleIndices[k];
+                push_interaction(list, REAL_OFFSET(ps->x[j], anchorX), REAL_OFFSET(ps->y[j], anchorY),
+                                 ps->mass[j]);
+            }
+        }
+
+        for (int k = cellGrid->cellStart[cell]; k < cellGrid->cellStart[cell + 1]; k++) {
+            int index = cellGrid->particleIndices[k];
+            if (!ctx->dueMask[index]) continue;
+
+            ps->ax[index] = 0.0f;
+            ps->ay[index] = 0.0f;
+            ctx->kernel(REAL_OFFSET(ps->x[index], anchorX), REAL_OFFSET(ps->y[index], anchorY),
+                        list->x, list->y, list->mass, list->count,
+                        ctx->eps_sq, &ps->ax[index], &ps->ay[index]);
+        }
+        ctx->counters[worker].interactions += (long long)list->count * due;
     }
-    
-    // Process gravity and collisions using the spatial grid
-    for (int cellY = 0; cellY < GRID_SIZE; cellY++) {
-        for (int cellX = 0; cellX < GRID_SIZE; cellX++) {
-            GridCell* currentCell = &grid.cells[cellY][cellX];
-            
-            // Process particles within same cell
-            for (int i = 0; i < currentCell->count; i++) {
-                int p1Index = currentCell->particleIndices[i];
-                if (!particles[p1Index].active) continue;
-                
-                // Check against other particles in same cell
-                for (int j = i + 1; j < currentCell->count; j++) {
-                    int p2Index = currentCell->particleIndices[j];
-                    if (!particles[p2Index].active) continue;
-                    
-                    apply_gravity(&particles[p1Index], &particles[p2Index], dt);
-                    
-                    if (check_collision(&particles[p1Index], &particles[p2Index])) {
-                        merge_particles(&particles[p1Index], &particles[p2Index]);
-                    }
-                }
-                
-                // Check against particles in neighboring cells
-                for (int nCellY = max_int(0, cellY-1); nCellY <= min_int(GRID_SIZE-1, cellY+1); nCellY++) {
-                    for (int nCellX = max_int(0, cellX-1); nCellX <= min_int(GRID_SIZE-1, cellX+1); nCellX++) {
-                        // Skip current cell as we already processed it
-                        if (nCellY == cellY && nCellX == cellX) continue;
-                        
-                        GridCell* neighborCell = &grid.cells[nCellY][nCellX];
-                        
-                        for (int j = 0; j < neighborCell->count; j++) {
-                            int p2Index = neighborCell->particleIndices[j];
-                            if (!particles[p2Index].active) continue;
-                            
-                            apply_gravity(&particles[p1Index], &particles[p2Index], dt);
-                            
-                            if (check_collision(&particles[p1Index], &particles[p2Index])) {
-                                merge_particles(&particles[p1Index], &particles[p2Index]);
-                            }
-                        }
-                    }
+}
+
+// Full long-range gravity from a Barnes-Hut quadtree, one due particle per item
+static void tree_force_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+
+    for (int k = start; k < end; k++) {
+        int i = ctx->due[k];
+        ps->ax[i] = 0.0f;
+        ps->ay[i] = 0.0f;
+        compute_tree_acceleration(ctx->tree, ps, i, bhTheta, softening, &ctx->lists[worker],
+                                  &ps->ax[i], &ps->ay[i]);
+        ctx->counters[worker].interactions += ctx->lists[worker].count;
+    }
+}
+
+// Coarsest level whose step dt / 2^level is within sqrt(2 * eta * softening / |a|)
+static int timestep_level(const StepContext* ctx, float ax, float ay) {
+    float accel = sqrtf(ax * ax + ay * ay);
+    if (accel <= 0.0f) return 0;
+
+    float limit = sqrtf(ctx->criterion / accel);
+    float step = ctx->dt;
+    int level = 0;
+    while (level < ctx->maxLevel && step > limit) {
+        step *= 0.5f;
+        level++;
+    }
+    return level;
+}
+
+// Half of a particle's step on the given level
+static inline float half_step(const StepContext* ctx, int level) {
+    return ldexpf(ctx->dt, -level - 1);
+}
+
+// Start of the step: pick every particle's level and give it the opening half-kick
+static void open_step_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        if (!ps->active[i]) continue;
+
+        int level = timestep_level(ctx, ps->ax[i], ps->ay[i]);
+        float h = half_step(ctx, level);
+        ctx->levels[i] = (uint8_t)level;
+        ps->vx[i] += ps->ax[i] * h;
+        ps->vy[i] += ps->ay[i] * h;
+    }
+}
+
+// Closing half-kick of the due particles with their fresh accelerations
+static void close_kick_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int k = start; k < end; k++) {
+        int i = ctx->due[k];
+        float h = half_step(ctx, ctx->levels[i]);
+        ps->vx[i] += ps->ax[i] * h;
+        ps->vy[i] += ps->ay[i] * h;
+    }
+}
+
+// Opening half-kick of the due particles on their newly chosen levels
+static void open_kick_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int k = start; k < end; k++) {
+        int i = ctx->due[k];
+        float h = half_step(ctx, ctx->levels[i]);
+        ps->vx[i] += ps->ax[i] * h;
+        ps->vy[i] += ps->ay[i] * h;
+    }
+}
+
+// Move particles through the current substep and bounce them off the walls,
+// keeping track of what the bounces took in the sums of each slot's chunk
+static void drift_task(void* context, int start, int end, int worker) {
+    StepContext* ctx = (StepContext*)context;
+    ParticleSystem* ps = ctx->ps;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        Real x = ps->x[i], y = ps->y[i], vx = ps->vx[i], vy = ps->vy[i];
+        update_particle(ps, i, ctx->drift);
+        if (ps->vx[i] == vx && ps->vy[i] == vy) continue;
+
+        // A bounce also puts the particle back inside, so compare its angular
+        // momentum with where free flight would have taken it
+        double m = ps->mass[i];
+        double v0 = (double)vx * vx + (double)vy * vy;
+        double v1 = (double)ps->vx[i] * ps->vx[i] + (double)ps->vy[i] * ps->vy[i];
+        double rx0 = (double)x + (double)vx * ctx->drift - 0.5 * worldWidth;
+        double ry0 = (double)y + (double)vy * ctx->drift - 0.5 * worldHeight;
+        double rx1 = (double)ps->x[i] - 0.5 * worldWidth;
+        double ry1 = (double)ps->y[i] - 0.5 * worldHeight;
+        WallSums* sums = &ctx->wallSums[i / INTEGRATE_CHUNK];
+        sums->energy += 0.5 * m * (v1 - v0);
+        sums->momentumX += m * (double)(ps->vx[i] - vx);
+        sums->momentumY += m * (double)(ps->vy[i] - vy);
+        sums->angularMomentum += m * ((rx1 * ps->vy[i] - ry1 * ps->vx[i]) - (rx0 * vy - ry0 * vx));
+    }
+}
+
+// Fresh accelerations for the due particles, from the current positions of all
+// particles. The grid solver rebuilds the grid, Barnes-Hut the tree
+static void compute_due_forces(StepContext* ctx) {
+    double start = get_time_seconds();
+
+    if (gravitySolver == SOLVER_BARNES_HUT) {
+        build_quadtree(&tree, ctx->ps);
+        thread_pool_run(threadPool, tree_force_task, ctx, ctx->dueCount, FORCE_CHUNK);
+    } else if (gravitySolver == SOLVER_PM) {
+        compute_pm_forces(&mesh, ctx->ps, ctx->due, ctx->dueCount, pmMeshSize,
+                          worldWidth, worldHeight, softening, threadPool);
+    } else {
+        build_grid_with_cell_size(&forceGrid, ctx->ps, GRID_FORCE_CELL_SIZE);
+        double built = get_time_seconds();
+        stepStats.gridSeconds += built - start;
+        start = built;
+        thread_pool_run(threadPool, grid_force_task, ctx, forceGrid.cellCount, GRID_FORCE_CHUNK);
+    }
+
+    stepStats.forceSeconds += get_time_seconds() - start;
+    stepStats.forceEvaluations += ctx->dueCount;
+}
+
+// Clear the due set
+static void clear_due(StepContext* ctx) {
+    for (int k = 0; k < ctx->dueCount; k++) {
+        dueMask[dueIndices[k]] = 0;
+    }
+    ctx->dueCount = 0;
+}
+
+// Add a particle to the due set
+static inline void mark_due(StepContext* ctx, int i) {
+    dueMask[i] = 1;
+    dueIndices[ctx->dueCount++] = i;
+}
+
+// Get the collision grid built by the most recent grid rebuild
+const struct SpatialGrid* get_spatial_grid(void) {
+    return &grid;
+}
+
+// Set how many threads update_particles uses (0 = one per logical CPU)
+void set_thread_count(int threads) {
+    destroy_thread_pool(threadPool);
+    threadPool = create_thread_pool(threads);
+    threadPoolCreated = 1;
+}
+
+// Get how many threads update_particles uses
+int get_thread_count(void) {
+    if (!threadPoolCreated) set_thread_count(0);
+    return thread_pool_size(threadPool);
+}
+
+// Worker pool behind update_particles, started on first use
+ThreadPool* get_thread_pool(void) {
+    if (!threadPoolCreated) set_thread_count(0);
+    return threadPool;
+}
+
+// Advance all particles by dt with hierarchical block timesteps.
+//
+// Each particle sits on a level k and advances in kick-drift-kick steps of
+// dt / 2^k, chosen from its acceleration: quiet bodies take the whole step at
+// once, bodies in close encounters take many small ones. Everyone drifts every
+// substep, but only particles whose own step ends get fresh forces, so most of
+// the force evaluations of a clustered system are skipped. A particle may move
+// to a finer level at any of its step boundaries, and to the next coarser one
+// only where that level's steps line up. All particles are back in sync when
+// this returns; collisions are then resolved once.
+//
+// Forces land in per-particle accelerations, so every particle's result comes
+// from a single worker reading the same sources in the same order: the outcome
+// is bitwise identical for any thread count.
+//
+// Ghost slots (the trailing ps->ghostCount ones, see domain.h) are only
+// sources: they drift with their velocity but are never due for forces, never
+// kicked and never collide.
+void update_particles(ParticleSystem* ps, float dt) {
+    int workers = get_thread_count();
+    if (workers > listCount) {
+        InteractionList* grownLists = (InteractionList*)realloc(lists, workers * sizeof(InteractionList));
+        if (grownLists) lists = grownLists;
+        WorkerCounter* grownCounters = (WorkerCounter*)realloc(counters, workers * sizeof(WorkerCounter));
+        if (grownCounters) counters = grownCounters;
+        if (!grownLists || !grownCounters) {
+            fprintf(stderr, "Failed to allocate memory for interaction lists\n");
+            return;
+        }
+        for (int i = listCount; i < workers; i++) {
+            init_interaction_list(&lists[i]);
+        }
+        listCount = workers;
+    }
+    memset(counters, 0, workers * sizeof(WorkerCounter));
+    memset(&stepStats, 0, sizeof(stepStats));
+
+    // Drop merged particles once they take up a noticeable share of the arrays
+    if (ps->deadCount > 0 && ps->deadCount >= ps->count * COMPACT_DEAD_FRACTION) {
+        compact_particles(ps);
+    }
+
+    // On the first step and every few steps after, sort the slots along the
+    // Morton curve so neighbors in space are neighbors in memory; dead slots
+    // are squeezed out first
+    if (reorderInterval > 0 && stepsSinceReorder == 0) {
+        double reorderStart = get_time_seconds();
+        if (ps->deadCount > 0) compact_particles(ps);
+        reorder_particles(&morton, ps, threadPool);
+        stepStats.gridSeconds += get_time_seconds() - reorderStart;
+    }
+    if (reorderInterval > 0) stepsSinceReorder = (stepsSinceReorder + 1) % reorderInterval;
+
+    if (reserve_block_scratch(ps->count) != 0) return;
+    memset(dueMask, 0, ps->count);
+    int wallChunks = (ps->count + INTEGRATE_CHUNK - 1) / INTEGRATE_CHUNK;
+    memset(wallSums, 0, wallChunks * sizeof(WallSums));
+    int owned = ps->count - ps->ghostCount;
+
+    StepContext ctx;
+    ctx.ps = ps;
+    ctx.grid = &forceGrid;
+    ctx.tree = &tree;
+    ctx.lists = lists;
+    ctx.counters = counters;
+    ctx.wallSums = wallSums;
+    ctx.kernel = get_force_kernel();
+    ctx.eps_sq = softening * softening;
+    ctx.due = dueIndices;
+    ctx.dueCount = 0;
+    ctx.dueMask = dueMask;
+    ctx.levels = levels;
+    ctx.dt = dt;
+    ctx.drift = 0.0f;
+    ctx.criterion = 2.0f * blockEta * softening;
+    ctx.maxLevel = blockMaxLevel;
+
+    // New and merged particles need forces before their first kick
+    for (int i = 0; i < ps->count; i++) {
+        if (i < owned && ps->active[i] && ps->stale[i]) mark_due(&ctx, i);
+        ps->stale[i] = 0;
+    }
+    if (ctx.dueCount > 0) {
+        compute_due_forces(&ctx);
+        clear_due(&ctx);
+    }
+    double phaseStart = get_time_seconds();
+
+    // Opening half-kick for everybody, which also sets the levels
+    thread_pool_run(threadPool, open_step_task, &ctx, owned, INTEGRATE_CHUNK);
+
+    memset(levelCounts, 0, sizeof(levelCounts));
+    for (int i = 0; i < owned; i++) {
+        if (ps->active[i]) levelCounts[levels[i]]++;
+    }
+
+    // Time is counted in ticks of the finest possible step
+    int ticks = 1 << blockMaxLevel;
+    int tick = 0;
+    while (tick < ticks) {
+        int finest = blockMaxLevel;
+        while (finest > 0 && levelCounts[finest] == 0) finest--;
+
+        // Everybody drifts to the end of the finest level's step...
+        int stride = ticks >> finest;
+        ctx.drift = ldexpf(dt, -finest);
+        thread_pool_run(threadPool, drift_task, &ctx, ps->count, INTEGRATE_CHUNK);
+        tick += stride;
+
+        // ...where the particles whose own step ends get new forces
+        for (int i = 0; i < owned; i++) {
+            if (ps->active[i] && tick % (ticks >> levels[i]) == 0) mark_due(&ctx, i);
+        }
+        stepStats.integrationSeconds += get_time_seconds() - phaseStart;
+
+        compute_due_forces(&ctx);
+
+        phaseStart = get_time_seconds();
+        thread_pool_run(threadPool, close_kick_task, &ctx, ctx.dueCount, INTEGRATE_CHUNK);
+
+        // Mid-step, pick their next level and start the next step
+        if (tick < ticks) {
+            for (int k = 0; k < ctx.dueCount; k++) {
+                int i = dueIndices[k];
+                int level = levels[i];
+                int wanted = timestep_level(&ctx, ps->ax[i], ps->ay[i]);
+
+                // Coarsen one level at a time, and only where the coarser steps line up
+                if (wanted < level) {
+                    wanted = tick % (ticks >> (level - 1)) == 0 ? level - 1 : level;
                 }
-                
-                // Update particle position
-                update_particle(&particles[p1Index], dt);
+                levelCounts[level]--;
+                levelCounts[wanted]++;
+                levels[i] = (uint8_t)wanted;
             }
+            thread_pool_run(threadPool, open_kick_task, &ctx, ctx.dueCount, INTEGRATE_CHUNK);
         }
+
+        clear_due(&ctx);
+        stepStats.substeps++;
+    }
+    stepStats.integrationSeconds += get_time_seconds() - phaseStart;
+
+    // Collisions reuse the neighbor list while nobody has moved too far since it
+    // was built. Otherwise they need the grid at the final positions
+    phaseStart = get_time_seconds();
+    int rebuild = !neighbor_list_valid(&collisions, ps, collisionSkin, threadPool);
+    if (rebuild) {
+        build_grid(&grid, ps);
+        double now = get_time_seconds();
+        stepStats.gridSeconds += now - phaseStart;
+        phaseStart = now;
+    }
+    stepStats.neighborListRebuilt = rebuild;
+
+    // Merge colliding particles; survivors are marked stale for the next step
+    stepStats.mergedParticles = resolve_collisions(&collisions, rebuild ? &grid : NULL, ps, threadPool,
+                                                   collisionSkin);
+    stepStats.collisionSeconds = get_time_seconds() - phaseStart;
+    stepStats.oversizedParticles = grid.oversizedCount;
+
+    for (int i = 0; i < workers; i++) {
+        stepStats.interactions += counters[i].interactions;
     }
+
+    // Add the wall chunks up in order
+    for (int c = 0; c < wallChunks; c++) {
+        stepStats.wallEnergy += wallSums[c].energy;
+        stepStats.wallMomentumX += wallSums[c].momentumX;
+        stepStats.wallMomentumY += wallSums[c].momentumY;
+        stepStats.wallAngularMomentum += wallSums[c].angularMomentum;
+    }
+    stepStats.activeParticles = owned - ps->deadCount;
 }
 
-// Render all particles
-void render_particles(SDL_Renderer* renderer, Particle* particles, int count) {
-    for (int i = 0; i < count; i++) {
-        if (particles[i].active) {
-            render_particle(renderer, &particles[i]);
-        }
+// Get timings and counters of the most recent update_particles call
+const StepStats* get_step_stats(void) {
+    return &stepStats;
+}
+
+// Bytes held by a particle system's arrays
+size_t particle_memory_usage(const ParticleSystem* ps) {
+    size_t perParticle = 4 * sizeof(Real) + 4 * sizeof(float) + sizeof(ParticleColor) + 2 * sizeof(uint8_t) + sizeof(int);
+    size_t perHandle = 2 * sizeof(int) + sizeof(uint32_t);
+    return sizeof(ParticleSystem) + (size_t)ps->capacity * perParticle +
+           (size_t)ps->handleCapacity * perHandle;
+}
+
+// Bytes held by update_particles' scratch buffers (grid, tree, lists, accelerations)
+size_t solver_memory_usage(void) {
+    size_t bytes = 0;
+
+    bytes += (size_t)(grid.cellCapacity + forceGrid.cellCapacity) * sizeof(int);
+    bytes += (size_t)(grid.particleCapacity + forceGrid.particleCapacity) * 3 * sizeof(int);
+    bytes += (size_t)tree.nodeCapacity * sizeof(QuadNode);
+    bytes += (size_t)tree.indexCapacity * sizeof(int);
+    bytes += (size_t)blockCapacity * (2 * sizeof(uint8_t) + sizeof(int));
+    bytes += (size_t)((blockCapacity + INTEGRATE_CHUNK - 1) / INTEGRATE_CHUNK) * sizeof(WallSums);
+    for (int i = 0; i < listCount; i++) {
+        bytes += (size_t)lists[i].capacity * 3 * sizeof(float);
     }
+    bytes += (size_t)listCount * (sizeof(InteractionList) + sizeof(WorkerCounter));
+    bytes += collision_memory_usage(&collisions);
+    bytes += particle_mesh_memory_usage(&mesh);
+    bytes += morton_memory_usage(&morton);
+
+    return bytes;
 }
 
-// Free a particle
-void free_particle(Particle* p) {
-    free(p);
+// Release update_particles' scratch buffers and stop its worker pool
+void free_solver_scratch(void) {
+    free_grid(&grid);
+    free_grid(&forceGrid);
+    free_quadtree(&tree);
+    free_particle_mesh(&mesh);
+    free_morton_scratch(&morton);
+    free_collision_scratch(&collisions);
+
+    for (int i = 0; i < listCount; i++) {
+        free_interaction_list(&lists[i]);
+    }
+    free(lists);
+    free(counters);
+    lists = NULL;
+    counters = NULL;
+    listCount = 0;
+
+    free(levels);
+    free(dueMask);
+    free(dueIndices);
+    free(wallSums);
+    levels = NULL;
+    dueMask = NULL;
+    dueIndices = NULL;
+    wallSums = NULL;
+    blockCapacity = 0;
+
+    destroy_thread_pool(threadPool);
+    threadPool = NULL;
+    threadPoolCreated = 0;
+    memset(&stepStats, 0, sizeof(stepStats));
 }
 
-// Free all particles
-void free_particles(Particle* particles, int count) {
-    free(particles);
-}
\ No newline at end of file
+// Free the particle system
+void free_particles(ParticleSystem* ps) {
+    if (ps == NULL) return;
+
+    aligned_free(ps->x);
+    aligned_free(ps->y);
+    aligned_free(ps->vx);
+    aligned_free(ps->vy);
+    aligned_free(ps->mass);
+    aligned_free(ps->ax);
+    aligned_free(ps->ay);
+    aligned_free(ps->radius);
+    aligned_free(ps->color);
+    aligned_free(ps->active);
+    aligned_free(ps->stale);
+    aligned_free(ps->handle);
+    free(ps->handleSlot);
+    free(ps->handleGeneration);
+    free(ps->freeHandles);
+    free(ps);
+}
@@ -1,82 +1,263 @@
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
-#include <SDL2/SDL.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "precision.h"
 
 // Gravitational constant
 #define G 6.67430e-2 // Scaled for simulation
 
-// Spatial partitioning grid
-#define GRID_SIZE 8
-#define MAX_PARTICLES_PER_CELL 50
+// Default simulation area (matches the window size)
+#define DEFAULT_WORLD_WIDTH 800.0f
+#define DEFAULT_WORLD_HEIGHT 600.0f
 
+// Distance from the edges kept free when placing random particles
+#define SPAWN_MARGIN 50.0f
+
+// Alignment of every per-field particle array (one cache line)
+#define PARTICLE_ALIGNMENT 64
+
+// Smallest allowed softening length; keeps a particle's own entry in a batched
+// force evaluation from producing a division by zero
+#define MIN_SOFTENING 0.001f
+
+// Merged particles are compacted out once they make up this fraction of the slots
+#define COMPACT_DEAD_FRACTION 0.125f
+
+// Block timesteps: a particle on level k advances in steps of dt / 2^k, where
+// dt is the step passed to update_particles. Its level is the coarsest one with
+// a step below sqrt(2 * eta * softening / |a|)
+#define BLOCK_DEFAULT_ETA 0.025f
+#define BLOCK_DEFAULT_MAX_LEVEL 6
+#define BLOCK_MAX_LEVEL 16
+
+// Display color of a particle, 8 bits per channel (same layout as SDL_Color)
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+} ParticleColor;
+
+// Stable reference to a particle. Slot indices change when the arrays are
+// compacted; handles do not, and a handle to a removed or merged particle
+// never resolves to whatever takes its place (its generation no longer matches)
 typedef struct {
-    float x;          // Position X
-    float y;          // Position Y
-    float vx;         // Velocity X
-    float vy;         // Velocity Y
-    float mass;       // Mass of particle
-    float radius;     // Radius based on mass
-    SDL_Color color;  // Color for rendering
-    int active;       // Whether the particle is active (1) or not (0)
-} Particle;
+    int id;              // Entry in the handle table
+    uint32_t generation; // Generation of that entry when the handle was issued
+} ParticleHandle;
 
+// Structure-of-arrays particle storage: one aligned array per field, so the
+// physics loops only stream the fields they actually use
 typedef struct {
-    int particleIndices[MAX_PARTICLES_PER_CELL];
-    int count;
-} GridCell;
+    // Hot physics fields
+    Real* x;           // Position X (float or double, see precision.h)
+    Real* y;           // Position Y
+    Real* vx;          // Velocity X
+    Real* vy;          // Velocity Y
+    float* mass;       // Mass of particle
+    float* ax;         // Acceleration X from the particle's last force evaluation
+    float* ay;         // Acceleration Y
+
+    // Cold fields
+    float* radius;     // Radius based on mass
+    ParticleColor* color; // Color for rendering
+    uint8_t* active;   // Whether the particle is active (1) or merged away (0)
+    uint8_t* stale;    // Acceleration must be recomputed before the next step (new or merged)
+    int* handle;       // Handle table entry of each slot
+
+    int count;         // Number of used slots (live and not yet compacted)
+    int capacity;      // Allocated slots per array
+    int deadCount;     // Inactive slots waiting for compaction
+    int ghostCount;    // Trailing slots holding read-only copies of other ranks' particles (see domain.h)
 
+    // Handle table: entry -> slot, with free entries kept on a stack for O(1) reuse
+    int* handleSlot;            // Slot of each entry, -1 when free
+    uint32_t* handleGeneration; // Bumped every time an entry is freed
+    int* freeHandles;           // Stack of free entries
+    int freeHandleCount;
+    int handleCount;            // Entries ever used (in use or free)
+    int handleCapacity;
+} ParticleSystem;
+
+// Timings and work counters of one update_particles call
 typedef struct {
-    GridCell cells[GRID_SIZE][GRID_SIZE];
-    int width;
-    int height;
-    float cellWidth;
-    float cellHeight;
-} SpatialGrid;
+    double gridSeconds;         // Grid rebuild and Morton reordering
+    double forceSeconds;        // Tree build (Barnes-Hut) and force evaluation
+    double collisionSeconds;    // Collision detection and merging
+    double integrationSeconds;  // Velocity kicks, position drifts and timestep selection
+    long long interactions;     // Source/target pairs evaluated by the force kernels
+    long long forceEvaluations; // Particles that got fresh forces, summed over substeps
+    int substeps;               // Drift/force rounds needed by the finest timestep level
+    int mergedParticles;        // Particles merged away by collisions
+    int oversizedParticles;     // Grid overflows: particles too large for the 3x3 cell search
+    int neighborListRebuilt;    // 1 if the collision neighbor list was rebuilt (see collision.h)
+    int activeParticles;        // Live particles after the step
+    double wallEnergy;          // Kinetic energy the wall bounces added (negative: they take it)
+    double wallMomentumX;       // Momentum the wall bounces added
+    double wallMomentumY;
+    double wallAngularMomentum; // Angular momentum about the world center the bounces added
+} StepStats;
+
+// Gravity solver used by update_particles
+typedef enum {
+    SOLVER_GRID,        // Gravity only between particles in neighboring grid cells
+    SOLVER_BARNES_HUT,  // Full long-range gravity using a Barnes-Hut quadtree
+    SOLVER_PM,          // Particle-Mesh FFT gravity; the world wraps around (see pm.h)
+    SOLVER_COUNT
+} GravitySolver;
+
+// Spatial grid used by update_particles (see grid.h)
+struct SpatialGrid;
+struct ThreadPool;
 
 // Calculate radius based on mass
 float calculate_radius(float mass);
 
-// Create particles system with a specific count
-Particle* create_particles(int count);
+// Calculate the display color for a given mass (heavier = redder)
+ParticleColor calculate_color(float mass);
+
+// Create particles system with a specific count of random particles
+ParticleSystem* create_particles(int count);
+
+// Make room for at least `capacity` particles. Returns 0 on success, -1 on failure
+int reserve_particles(ParticleSystem* ps, int capacity);
+
+// Append a single particle, growing the arrays if needed. Returns its index or -1
+int add_particle(ParticleSystem* ps, Real x, Real y, Real vx, Real vy, float mass);
+
+// Append `count` particles at once (growing the arrays at most once). `handles`
+// may be NULL. Returns the index of the first one, or -1 if out of memory
+int add_particles(ParticleSystem* ps, int count, const Real* x, const Real* y,
+                  const Real* vx, const Real* vy, const float* mass, ParticleHandle* handles);
+
+// Handle of the particle in a slot
+ParticleHandle get_particle_handle(const ParticleSystem* ps, int index);
+
+// Current slot of a particle, or -1 if it has been removed or merged away
+int find_particle(const ParticleSystem* ps, ParticleHandle handle);
+
+// Remove a particle. Returns 0 on success, -1 if the handle is no longer valid
+int remove_particle(ParticleSystem* ps, ParticleHandle handle);
+
+// Remove many particles; invalid handles are skipped. Returns how many were removed
+int remove_particles(ParticleSystem* ps, const ParticleHandle* handles, int count);
+
+// Issue fresh handles for all slots, invalidating every earlier handle
+// (for arrays filled directly, such as a loaded checkpoint)
+int reset_particle_handles(ParticleSystem* ps);
+
+// Move all live particles to the front of the arrays, preserving their order
+void compact_particles(ParticleSystem* ps);
+
+// Drop the slots from `count` on, releasing their handles
+void truncate_particles(ParticleSystem* ps, int count);
 
-// Create a single particle
-Particle* create_particle(float x, float y, float vx, float vy, float mass);
+// Copy the live particles of `src` into `dst`, packed and in order, replacing
+// its contents. `dst` gets no handles; it is meant as a read-only copy (e.g. for
+// rendering). Returns 0 on success, -1 if out of memory
+int copy_live_particles(ParticleSystem* dst, const ParticleSystem* src);
 
 // Update particle position based on physics
-void update_particle(Particle* p, float dt);
+void update_particle(ParticleSystem* ps, int index, float dt);
 
-// Initialize spatial partitioning grid
-void init_grid(SpatialGrid* grid, int width, int height);
+// Advance all particles by dt with block timesteps and kick-drift-kick integration.
+// Ghost slots act as sources and drift, but get no forces or kicks and never collide
+void update_particles(ParticleSystem* ps, float dt);
 
-// Clear the grid for the next frame update
-void clear_grid(SpatialGrid* grid);
+// Set the size of the simulation area (particles bounce off its edges, or wrap
+// around them with the Particle-Mesh solver)
+void set_world_bounds(float width, float height);
 
-// Add particle to the appropriate grid cell
-void add_particle_to_grid(SpatialGrid* grid, Particle* particles, int index);
+// Get the size of the simulation area
+void get_world_bounds(float* width, float* height);
 
-// Update all particles, including gravity calculations
-void update_particles(Particle* particles, int count, float dt);
+// Select the gravity solver used by update_particles
+void set_gravity_solver(GravitySolver solver);
 
-// Apply gravitational force between two particles
-void apply_gravity(Particle* p1, Particle* p2, float dt);
+// Get the currently selected gravity solver
+GravitySolver get_gravity_solver(void);
 
-// Check for collision between two particles
-int check_collision(Particle* p1, Particle* p2);
+// Short name of a solver ("grid", "bh", "pm")
+const char* gravity_solver_name(GravitySolver solver);
 
-// Merge two particles that have collided
-void merge_particles(Particle* p1, Particle* p2);
+// Solver with the given short name ("barnes-hut" is accepted for "bh").
+// Returns 0 on success, -1 if the name is unknown
+int parse_gravity_solver(const char* name, GravitySolver* solver);
+
+// Set the Particle-Mesh solver's nodes per axis (rounded up to a power of two)
+void set_pm_mesh_size(int meshSize);
+
+// Get the Particle-Mesh solver's nodes per axis
+int get_pm_mesh_size(void);
+
+// Set the skin distance of the collision neighbor list: candidate pairs are
+// collected this far beyond touching and re-tested until some particle has
+// moved half of it. 0 searches the grid for collisions every step
+void set_collision_skin(float skin);
+
+// Get the skin distance of the collision neighbor list
+float get_collision_skin(void);
+
+// Set how many steps update_particles takes between sorting the particle
+// storage along a Morton curve (0 = never). Sorting moves particles to other
+// slots; handles stay valid. The next step after this call sorts
+void set_reorder_interval(int steps);
+
+// Get how many steps pass between Morton reorders
+int get_reorder_interval(void);
+
+// Set or get how many steps have passed since the last Morton reorder, so a
+// restarted run sorts on the same steps as one that never stopped
+void set_reorder_phase(int steps);
+int get_reorder_phase(void);
+
+// Set the Barnes-Hut opening angle and the softening length used by both solvers
+void set_barnes_hut_params(float theta, float softening);
+
+// Get the Barnes-Hut opening angle and the softening length
+void get_barnes_hut_params(float* theta, float* softening);
 
-// Render a single particle
-void render_particle(SDL_Renderer* renderer, Particle* p);
+// Set the block timestep accuracy parameter and the finest level (0 = one shared step)
+void set_block_timestep_params(float eta, int maxLevel);
 
-// Render all particles
-void render_particles(SDL_Renderer* renderer, Particle* particles, int count);
+// Get the block timestep accuracy parameter and the finest level
+void get_block_timestep_params(float* eta, int* maxLevel);
 
-// Free a particle
-void free_particle(Particle* p);
+// Get timings and counters of the most recent update_particles call
+const StepStats* get_step_stats(void);
+
+// Bytes held by a particle system's arrays
+size_t particle_memory_usage(const ParticleSystem* ps);
+
+// Bytes held by update_particles' scratch buffers (grid, tree, mesh, lists, timestep levels, collisions)
+size_t solver_memory_usage(void);
+
+// Release update_particles' scratch buffers and stop its worker pool. Nothing
+// carries over into the next step, which allocates them again
+void free_solver_scratch(void);
+
+// Get the collision grid built by the most recent rebuild. Steps that reuse the
+// collision neighbor list do not rebuild it
+const struct SpatialGrid* get_spatial_grid(void);
+
+// Set how many threads update_particles uses (0 = one per logical CPU)
+void set_thread_count(int threads);
+
+// Get how many threads update_particles uses
+int get_thread_count(void);
+
+// Worker pool behind update_particles, for other parallel loops over particles
+struct ThreadPool* get_thread_pool(void);
+
+// Check for collision between two particles
+int check_collision(const ParticleSystem* ps, int i, int j);
+
+// Merge two particles that have collided
+void merge_particles(ParticleSystem* ps, int i, int j);
 
-// Free all particles
-void free_particles(Particle* particles, int count);
+// Free the particle system and all of its arrays
+void free_particles(ParticleSystem* ps);
 
-#endif // PARTICLE_H
\ No newline at end of file
+#endif // PARTICLE_H
@@ -0,0 +1,419 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pm.h"
+#include "threadpool.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Mesh rows or particles per work item
+#define PM_ROW_CHUNK 4
+#define PM_PARTICLE_CHUNK 4096
+
+// Shared state of the parallel phases
+typedef struct {
+    ParticleMesh* pm;
+    ParticleSystem* ps;
+    const int* due;
+    int inverse;            // Direction of the FFT pass
+} MeshContext;
+
+// Initialize an empty mesh
+void init_particle_mesh(ParticleMesh* pm) {
+    memset(pm, 0, sizeof(*pm));
+}
+
+// Smallest power of two >= n, clamped to the supported mesh sizes
+static int mesh_size_for(int n) {
+    int size = PM_MIN_MESH_SIZE;
+    while (size < n && size < PM_MAX_MESH_SIZE) size *= 2;
+    return size;
+}
+
+// In-place radix-2 FFT of n interleaved complex values. The inverse is unnormalized
+static void fft(double* data, int n, const double* twiddles, const int* bitReverse, int inverse) {
+    for (int i = 0; i < n; i++) {
+        int j = bitReverse[i];
+        if (i < j) {
+            double re = data[2 * i], im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+
+    double sign = inverse ? 1.0 : -1.0;
+    for (int length = 2; length <= n; length *= 2) {
+        int half = length / 2;
+        int stride = n / length;
+        for (int start = 0; start < n; start += length) {
+            for (int k = 0; k < half; k++) {
+                double wr = twiddles[2 * k * stride];
+                double wi = sign * twiddles[2 * k * stride + 1];
+                double* a = &data[2 * (start + k)];
+                double* b = &data[2 * (start + k + half)];
+                double br = b[0] * wr - b[1] * wi;
+                double bi = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+}
+
+// FFT of mesh rows [start, end)
+static void row_fft_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    int n = pm->meshSize;
+    (void)worker;
+
+    for (int row = start; row < end; row++) {
+        fft(pm->field + 2 * (size_t)row * n, n, pm->twiddles, pm->bitReverse, ctx->inverse);
+    }
+}
+
+// FFT of mesh columns [start, end), each copied into the worker's buffer
+static void column_fft_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    int n = pm->meshSize;
+    double* column = pm->columns + 2 * (size_t)worker * n;
+
+    for (int c = start; c < end; c++) {
+        for (int r = 0; r < n; r++) {
+            column[2 * r] = pm->field[2 * ((size_t)r * n + c)];
+            column[2 * r + 1] = pm->field[2 * ((size_t)r * n + c) + 1];
+        }
+        fft(column, n, pm->twiddles, pm->bitReverse, ctx->inverse);
+        for (int r = 0; r < n; r++) {
+            pm->field[2 * ((size_t)r * n + c)] = column[2 * r];
+            pm->field[2 * ((size_t)r * n + c) + 1] = column[2 * r + 1];
+        }
+    }
+}
+
+// Two-dimensional FFT of the whole mesh
+static void mesh_fft(MeshContext* ctx, struct ThreadPool* pool, int inverse) {
+    ctx->inverse = inverse;
+    thread_pool_run(pool, row_fft_task, ctx, ctx->pm->meshSize, PM_ROW_CHUNK);
+    thread_pool_run(pool, column_fft_task, ctx, ctx->pm->meshSize, PM_ROW_CHUNK);
+}
+
+// Signed mode number of FFT index i on an axis of n nodes
+static inline int mode_number(int i, int n) {
+    return i <= n / 2 ? i : i - n;
+}
+
+// sin(x) / x
+static inline double sinc(double x) {
+    return fabs(x) < 1e-12 ? 1.0 : sin(x) / x;
+}
+
+// Allocate the mesh and rebuild the Green's function when the mesh size,
+// world size or softening changed
+static int prepare_mesh(ParticleMesh* pm, int meshSize, float width, float height, float softening) {
+    int n = mesh_size_for(meshSize);
+    if (n == pm->meshSize && width == pm->width && height == pm->height && softening == pm->softening) {
+        return 0;
+    }
+
+    if (n != pm->meshSize) {
+        size_t nodes = (size_t)n * n;
+        double* field = (double*)realloc(pm->field, 2 * nodes * sizeof(double));
+        if (field) pm->field = field;
+        double* green = (double*)realloc(pm->green, nodes * sizeof(double));
+        if (green) pm->green = green;
+        double* twiddles = (double*)realloc(pm->twiddles, (size_t)n * sizeof(double));
+        if (twiddles) pm->twiddles = twiddles;
+        int* bitReverse = (int*)realloc(pm->bitReverse, (size_t)n * sizeof(int));
+        if (bitReverse) pm->bitReverse = bitReverse;
+        int* nodeStart = (int*)realloc(pm->nodeStart, (nodes + 1) * sizeof(int));
+        if (nodeStart) pm->nodeStart = nodeStart;
+
+        if (!field || !green || !twiddles || !bitReverse || !nodeStart) {
+            fprintf(stderr, "Failed to allocate memory for particle mesh\n");
+            pm->meshSize = 0;
+            return -1;
+        }
+
+        for (int k = 0; k < n / 2; k++) {
+            pm->twiddles[2 * k] = cos(2.0 * M_PI * k / n);
+            pm->twiddles[2 * k + 1] = sin(2.0 * M_PI * k / n);
+        }
+        int bits = 0;
+        while ((1 << bits) < n) bits++;
+        for (int i = 0; i < n; i++) {
+            int reversed = 0;
+            for (int b = 0; b < bits; b++) {
+                if (i & (1 << b)) reversed |= 1 << (bits - 1 - b);
+            }
+            pm->bitReverse[i] = reversed;
+        }
+
+        // The column buffers are sized by the mesh, so they are redone too
+        free(pm->columns);
+        pm->columns = NULL;
+        pm->columnWorkers = 0;
+        pm->meshSize = n;
+    }
+
+    // The softened point-mass potential -G m / sqrt(r^2 + eps^2) has the plane
+    // Fourier transform -2 pi G exp(-k eps) / k. Dividing by the CIC window
+    // twice undoes the smoothing of the deposit and of the interpolation, and
+    // 1 / (width * height) normalizes the inverse FFT. The resulting force
+    // spectrum barely falls off with k, so a Gaussian of half a cell cuts off
+    // the modes near the mesh's Nyquist frequency, which would otherwise alias
+    // into ringing that swamps the force a few cells away
+    double cellX = (double)width / n;
+    double cellY = (double)height / n;
+    double cutoff = 0.5 * (cellX > cellY ? cellX : cellY);
+    double scale = -2.0 * M_PI * G / ((double)width * height);
+    for (int q = 0; q < n; q++) {
+        double ky = 2.0 * M_PI * mode_number(q, n) / height;
+        double windowY = sinc(0.5 * ky * cellY);
+        for (int p = 0; p < n; p++) {
+            double kx = 2.0 * M_PI * mode_number(p, n) / width;
+            double k = sqrt(kx * kx + ky * ky);
+            double window = windowY * sinc(0.5 * kx * cellX);
+            window *= window;
+            pm->green[(size_t)q * n + p] =
+                k > 0.0 ? scale * exp(-k * softening - k * k * cutoff * cutoff) / (k * window * window) : 0.0;
+        }
+    }
+
+    pm->width = width;
+    pm->height = height;
+    pm->softening = softening;
+    return 0;
+}
+
+// Grow the per-particle and per-worker scratch
+static int reserve_mesh_scratch(ParticleMesh* pm, int particles, int workers) {
+    if (particles > pm->particleCapacity) {
+        int* nodeParticles = (int*)realloc(pm->nodeParticles, particles * sizeof(int));
+        if (nodeParticles) pm->nodeParticles = nodeParticles;
+        int* particleNode = (int*)realloc(pm->particleNode, particles * sizeof(int));
+        if (particleNode) pm->particleNode = particleNode;
+        float* fx = (float*)realloc(pm->particleFx, particles * sizeof(float));
+        if (fx) pm->particleFx = fx;
+        float* fy = (float*)realloc(pm->particleFy, particles * sizeof(float));
+        if (fy) pm->particleFy = fy;
+
+        if (!nodeParticles || !particleNode || !fx || !fy) {
+            fprintf(stderr, "Failed to allocate memory for particle mesh\n");
+            return -1;
+        }
+        pm->particleCapacity = particles;
+    }
+
+    if (workers > pm->columnWorkers) {
+        double* columns = (double*)realloc(pm->columns, 2 * (size_t)workers * pm->meshSize * sizeof(double));
+        if (columns == NULL) {
+            fprintf(stderr, "Failed to allocate memory for particle mesh\n");
+            return -1;
+        }
+        pm->columns = columns;
+        pm->columnWorkers = workers;
+    }
+    return 0;
+}
+
+// Mesh coordinate of a position on a periodic axis of n cells of size `cell`,
+// split into the node below it and the fraction towards the next node
+static inline int locate_on_axis(Real position, double cell, int n, float* fraction) {
+    double u = (double)position / cell;
+    if (u < 0.0 || u >= n) u -= n * floor(u / n);
+    int node = (int)u;
+    if (node >= n) node = 0;     // u rounded up to exactly n
+    *fraction = (float)(u - node);
+    return node;
+}
+
+// Base node and CIC weights of particles [start, end)
+static void locate_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    const ParticleSystem* ps = ctx->ps;
+    int n = pm->meshSize;
+    double cellX = (double)pm->width / n;
+    double cellY = (double)pm->height / n;
+    (void)worker;
+
+    for (int i = start; i < end; i++) {
+        if (!ps->active[i]) {
+            pm->particleNode[i] = -1;
+            continue;
+        }
+        int nodeX = locate_on_axis(ps->x[i], cellX, n, &pm->particleFx[i]);
+        int nodeY = locate_on_axis(ps->y[i], cellY, n, &pm->particleFy[i]);
+        pm->particleNode[i] = nodeY * n + nodeX;
+    }
+}
+
+// Mass collected by the nodes of rows [start, end). Each node gathers from the
+// particles based at itself and at its left, lower and lower-left neighbors,
+// always in the same order, so the sums do not depend on the thread count
+static void deposit_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    const ParticleSystem* ps = ctx->ps;
+    int n = pm->meshSize;
+    (void)worker;
+
+    for (int row = start; row < end; row++) {
+        int below = (row + n - 1) % n;
+        for (int col = 0; col < n; col++) {
+            int left = (col + n - 1) % n;
+            int sources[4] = { row * n + col, row * n + left, below * n + col, below * n + left };
+            double mass = 0.0;
+
+            for (int s = 0; s < 4; s++) {
+                int fromLeft = s & 1;
+                int fromBelow = s >> 1;
+                for (int k = pm->nodeStart[sources[s]]; k < pm->nodeStart[sources[s] + 1]; k++) {
+                    int i = pm->nodeParticles[k];
+                    float wx = fromLeft ? pm->particleFx[i] : 1.0f - pm->particleFx[i];
+                    float wy = fromBelow ? pm->particleFy[i] : 1.0f - pm->particleFy[i];
+                    mass += (double)ps->mass[i] * wx * wy;
+                }
+            }
+
+            pm->field[2 * ((size_t)row * n + col)] = mass;
+            pm->field[2 * ((size_t)row * n + col) + 1] = 0.0;
+        }
+    }
+}
+
+// Turn the density spectrum of rows [start, end) into the spectrum of
+// ax + i ay, where a = -grad(phi) is -i k phi in Fourier space. Nyquist modes
+// get no gradient, which keeps both components real
+static void spectrum_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    int n = pm->meshSize;
+    (void)worker;
+
+    for (int q = start; q < end; q++) {
+        double ky = q == n / 2 ? 0.0 : 2.0 * M_PI * mode_number(q, n) / pm->height;
+        for (int p = 0; p < n; p++) {
+            double kx = p == n / 2 ? 0.0 : 2.0 * M_PI * mode_number(p, n) / pm->width;
+            size_t node = (size_t)q * n + p;
+            double g = pm->green[node];
+            double re = pm->field[2 * node] * g;
+            double im = pm->field[2 * node + 1] * g;
+
+            // (re + i im) * (ky - i kx)
+            pm->field[2 * node] = re * ky + im * kx;
+            pm->field[2 * node + 1] = im * ky - re * kx;
+        }
+    }
+}
+
+// Acceleration of the due particles [start, end), interpolated with the
+// deposit's weights
+static void interpolate_task(void* context, int start, int end, int worker) {
+    MeshContext* ctx = (MeshContext*)context;
+    ParticleMesh* pm = ctx->pm;
+    ParticleSystem* ps = ctx->ps;
+    int n = pm->meshSize;
+    (void)worker;
+
+    for (int k = start; k < end; k++) {
+        int i = ctx->due[k];
+        int node = pm->particleNode[i];
+        int col = node % n, row = node / n;
+        int right = (col + 1) % n, above = (row + 1) % n;
+        float fx = pm->particleFx[i], fy = pm->particleFy[i];
+
+        size_t nodes[4] = {
+            (size_t)row * n + col, (size_t)row * n + right,
+            (size_t)above * n + col, (size_t)above * n + right
+        };
+        float weights[4] = {
+            (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy),
+            (1.0f - fx) * fy, fx * fy
+        };
+
+        double ax = 0.0, ay = 0.0;
+        for (int s = 0; s < 4; s++) {
+            ax += weights[s] * pm->field[2 * nodes[s]];
+            ay += weights[s] * pm->field[2 * nodes[s] + 1];
+        }
+        ps->ax[i] = (float)ax;
+        ps->ay[i] = (float)ay;
+    }
+}
+
+// Accelerations of the due particles from the whole periodic mesh
+int compute_pm_forces(ParticleMesh* pm, ParticleSystem* ps, const int* due, int dueCount,
+                      int meshSize, float width, float height, float softening,
+                      struct ThreadPool* pool) {
+    if (prepare_mesh(pm, meshSize, width, height, softening) != 0 ||
+        reserve_mesh_scratch(pm, ps->count > 0 ? ps->count : 1, thread_pool_size(pool)) != 0) {
+        return -1;
+    }
+
+    MeshContext ctx;
+    ctx.pm = pm;
+    ctx.ps = ps;
+    ctx.due = due;
+    ctx.inverse = 0;
+    int n = pm->meshSize;
+    int nodes = n * n;
+
+    // Counting sort of the particles by base node, indices ascending in each node
+    thread_pool_run(pool, locate_task, &ctx, ps->count, PM_PARTICLE_CHUNK);
+    memset(pm->nodeStart, 0, (size_t)(nodes + 1) * sizeof(int));
+    for (int i = 0; i < ps->count; i++) {
+        if (pm->particleNode[i] >= 0) pm->nodeStart[pm->particleNode[i] + 1]++;
+    }
+    for (int c = 0; c < nodes; c++) {
+        pm->nodeStart[c + 1] += pm->nodeStart[c];
+    }
+    for (int i = 0; i < ps->count; i++) {
+        if (pm->particleNode[i] >= 0) pm->nodeParticles[pm->nodeStart[pm->particleNode[i]]++] = i;
+    }
+    for (int c = nodes; c > 0; c--) {
+        pm->nodeStart[c] = pm->nodeStart[c - 1];
+    }
+    pm->nodeStart[0] = 0;
+
+    thread_pool_run(pool, deposit_task, &ctx, n, PM_ROW_CHUNK);
+    mesh_fft(&ctx, pool, 0);
+    thread_pool_run(pool, spectrum_task, &ctx, n, PM_ROW_CHUNK);
+    mesh_fft(&ctx, pool, 1);
+    thread_pool_run(pool, interpolate_task, &ctx, dueCount, PM_PARTICLE_CHUNK);
+    return 0;
+}
+
+// Bytes held by the mesh
+size_t particle_mesh_memory_usage(const ParticleMesh* pm) {
+    size_t nodes = (size_t)pm->meshSize * pm->meshSize;
+    size_t bytes = nodes * 3 * sizeof(double) + (nodes + 1) * sizeof(int);
+    bytes += (size_t)pm->meshSize * (sizeof(double) + sizeof(int));
+    bytes += 2 * (size_t)pm->columnWorkers * pm->meshSize * sizeof(double);
+    bytes += (size_t)pm->particleCapacity * (2 * sizeof(int) + 2 * sizeof(float));
+    return bytes;
+}
+
+// Release the mesh's memory
+void free_particle_mesh(ParticleMesh* pm) {
+    free(pm->field);
+    free(pm->green);
+    free(pm->twiddles);
+    free(pm->bitReverse);
+    free(pm->columns);
+    free(pm->nodeStart);
+    free(pm->nodeParticles);
+    free(pm->particleNode);
+    free(pm->particleFx);
+    free(pm->particleFy);
+    init_particle_mesh(pm);
+}
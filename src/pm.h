@@ -0,0 +1,62 @@
+#ifndef PM_H
+#define PM_H
+
+#include <stddef.h>
+#include "particle.h"
+
+// Particle-Mesh gravity on a periodic world.
+//
+// Masses are deposited onto a regular mesh with cloud-in-cell weights, the
+// mesh is convolved with the softened 1/r potential by FFT, and the
+// acceleration field (differentiated in Fourier space) is interpolated back to
+// the particles with the same weights. The cost is O(N + M log M) for N
+// particles and M mesh nodes, independent of how the particles cluster, and
+// every particle feels every other one and all their periodic images.
+//
+// The world is the box [0, width) x [0, height) and wraps around at its
+// edges. The mesh has meshSize x meshSize nodes, so the resolution is roughly
+// one cell; structure below that is smoothed away.
+
+// Mesh nodes per axis when none is set; always a power of two
+#define PM_DEFAULT_MESH_SIZE 256
+#define PM_MIN_MESH_SIZE 8
+#define PM_MAX_MESH_SIZE 4096
+
+// Mesh, spectra and per-particle scratch, reused from step to step
+typedef struct {
+    int meshSize;           // Nodes per axis
+    float width;            // World size the Green's function was built for
+    float height;
+    float softening;
+
+    double* field;          // Complex mesh (interleaved): density, then the acceleration field
+    double* green;          // Real factor per mode: potential kernel, CIC deconvolution, normalization
+    double* twiddles;       // cos/sin of 2 pi k / meshSize for k < meshSize / 2
+    int* bitReverse;        // Bit-reversed index of every node along an axis
+    double* columns;        // Per-worker buffer for the column FFTs
+    int columnWorkers;
+
+    int* nodeStart;         // Counting sort of particles by the mesh node below-left of them
+    int* nodeParticles;
+    int* particleNode;      // Base node of each slot, -1 for inactive ones
+    float* particleFx;      // Fractional offsets from the base node, the CIC weights
+    float* particleFy;
+    int particleCapacity;
+} ParticleMesh;
+
+// Initialize an empty mesh
+void init_particle_mesh(ParticleMesh* pm);
+
+// Accelerations of the `dueCount` particles listed in `due` from all active
+// particles, written to ps->ax / ps->ay. Returns 0 on success, -1 if out of memory
+int compute_pm_forces(ParticleMesh* pm, ParticleSystem* ps, const int* due, int dueCount,
+                      int meshSize, float width, float height, float softening,
+                      struct ThreadPool* pool);
+
+// Bytes held by the mesh
+size_t particle_mesh_memory_usage(const ParticleMesh* pm);
+
+// Release the mesh's memory
+void free_particle_mesh(ParticleMesh* pm);
+
+#endif // PM_H
@@ -0,0 +1,32 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Storage precision of particle positions and velocities.
+//
+// By default they are float, like every other field. Building with
+// NBODY_DOUBLE_POSITIONS defined (CMake option of the same name, or
+// `make PRECISION=double`) stores them as double instead, so bodies far from
+// the origin keep sub-pixel resolution and small kicks and wall bounces are
+// not rounded away. Masses, accelerations and the batched force kernels stay
+// float either way: pair forces are evaluated on coordinates taken relative to
+// a nearby anchor (the target's grid cell, or the target itself for
+// Barnes-Hut), which float resolves well. Code that handles positions or
+// velocities uses Real and the macros below, so the same source builds in
+// both configurations.
+
+#ifdef NBODY_DOUBLE_POSITIONS
+typedef double Real;
+#define REAL(literal) literal       // Floating literal in Real precision, e.g. REAL(0.5)
+#define REAL_DIGITS 17              // Significant digits that print a value exactly
+#define REAL_NAME "double"
+#else
+typedef float Real;
+#define REAL(literal) literal##f
+#define REAL_DIGITS 9
+#define REAL_NAME "float"
+#endif
+
+// Offset of a position from an anchor, as the float the force kernels take
+#define REAL_OFFSET(value, anchor) ((float)((value) - (anchor)))
+
+#endif // PRECISION_H
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "quadtree.h"
+
+// Initialize an empty tree
+void init_quadtree(QuadTree* tree) {
+    tree->nodes = NULL;
+    tree->nodeCount = 0;
+    tree->nodeCapacity = 0;
+    tree->indices = NULL;
+    tree->indexCapacity = 0;
+}
+
+// Reserve four consecutive nodes and return the index of the first one
+static int alloc_children(QuadTree* tree) {
+    if (tree->nodeCount + 4 > tree->nodeCapacity) {
+        int newCapacity = tree->nodeCapacity ? tree->nodeCapacity * 2 : 256;
+        QuadNode* nodes = (QuadNode*)realloc(tree->nodes, newCapacity * sizeof(QuadNode));
+        if (nodes == NULL) {
+            fprintf(stderr, "Failed to allocate memory for quadtree nodes\n");
+            return -1;
+        }
+        tree->nodes = nodes;
+        tree->nodeCapacity = newCapacity;
+    }
+
+    int first = tree->nodeCount;
+    tree->nodeCount += 4;
+    return first;
+}
+
+// Move all indices whose particle lies below `split` on the given axis to the front,
+// returning how many were moved
+static int partition_indices(int* indices, int n, const Real* coord, Real split) {
+    int i = 0;
+    int j = n - 1;
+    while (i <= j) {
+        if (coord[indices[i]] < split) {
+            i++;
+        } else {
+            int tmp = indices[i];
+            indices[i] = indices[j];
+            indices[j] = tmp;
+            j--;
+        }
+    }
+    return i;
+}
+
+// Recursively subdivide a node and accumulate its mass moments
+static void build_node(QuadTree* tree, const ParticleSystem* ps, int nodeIndex, int depth) {
+    QuadNode node = tree->nodes[nodeIndex];
+    int* indices = tree->indices + node.start;
+
+    if (node.count <= BH_LEAF_CAPACITY || depth >= BH_MAX_DEPTH) {
+        // Leaf: sum the particles directly
+        float mass = 0.0f;
+        Real mx = 0.0f, my = 0.0f;
+        for (int i = 0; i < node.count; i++) {
+            int k = indices[i];
+            mass += ps->mass[k];
+            mx += ps->x[k] * ps->mass[k];
+            my += ps->y[k] * ps->mass[k];
+        }
+        node.mass = mass;
+        node.comX = mass > 0.0f ? mx / mass : node.minX + node.size * REAL(0.5);
+        node.comY = mass > 0.0f ? my / mass : node.minY + node.size * REAL(0.5);
+        node.firstChild = -1;
+        tree->nodes[nodeIndex] = node;
+        return;
+    }
+
+    Real half = node.size * REAL(0.5);
+    Real midX = node.minX + half;
+    Real midY = node.minY + half;
+
+    // Split into bottom/top halves, then each half into left/right
+    int bottom = partition_indices(indices, node.count, ps->y, midY);
+    int bottomLeft = partition_indices(indices, bottom, ps->x, midX);
+    int topLeft = partition_indices(indices + bottom, node.count - bottom, ps->x, midX);
+
+    int starts[4] = { 0, bottomLeft, bottom, bottom + topLeft };
+    int counts[4] = { bottomLeft, bottom - bottomLeft, topLeft, node.count - bottom - topLeft };
+
+    int first = alloc_children(tree);
+    if (first < 0) {
+        // Out of memory: degrade to a (large) leaf rather than losing particles
+        build_node(tree, ps, nodeIndex, BH_MAX_DEPTH);
+        return;
+    }
+
+    for (int q = 0; q < 4; q++) {
+        QuadNode* child = &tree->nodes[first + q];
+        child->minX = (q & 1) ? midX : node.minX;
+        child->minY = (q & 2) ? midY : node.minY;
+        child->size = half;
+        child->start = node.start + starts[q];
+        child->count = counts[q];
+        child->firstChild = -1;
+        child->mass = 0.0f;
+        child->comX = child->minX + half * REAL(0.5);
+        child->comY = child->minY + half * REAL(0.5);
+    }
+
+    for (int q = 0; q < 4; q++) {
+        if (counts[q] > 0) {
+            build_node(tree, ps, first + q, depth + 1);
+        }
+    }
+
+    // Aggregate children (the node array may have moved during recursion)
+    float mass = 0.0f;
+    Real mx = 0.0f, my = 0.0f;
+    for (int q = 0; q < 4; q++) {
+        const QuadNode* child = &tree->nodes[first + q];
+        mass += child->mass;
+        mx += child->comX * child->mass;
+        my += child->comY * child->mass;
+    }
+
+    QuadNode* self = &tree->nodes[nodeIndex];
+    self->firstChild = first;
+    self->mass = mass;
+    self->comX = mass > 0.0f ? mx / mass : midX;
+    self->comY = mass > 0.0f ? my / mass : midY;
+}
+
+// Build the tree over all active particles
+void build_quadtree(QuadTree* tree, const ParticleSystem* ps) {
+    int count = ps->count;
+    tree->nodeCount = 0;
+
+    if (count > tree->indexCapacity) {
+        int* indices = (int*)realloc(tree->indices, count * sizeof(int));
+        if (indices == NULL) {
+            fprintf(stderr, "Failed to allocate memory for quadtree indices\n");
+            return;
+        }
+        tree->indices = indices;
+        tree->indexCapacity = count;
+    }
+
+    // Collect active particles and find their bounding box
+    int active = 0;
+    Real minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    for (int i = 0; i < count; i++) {
+        if (!ps->active[i]) continue;
+
+        Real x = ps->x[i];
+        Real y = ps->y[i];
+        if (active == 0) {
+            minX = maxX = x;
+            minY = maxY = y;
+        } else {
+            if (x < minX) minX = x;
+            if (x > maxX) maxX = x;
+            if (y < minY) minY = y;
+            if (y > maxY) maxY = y;
+        }
+        tree->indices[active++] = i;
+    }
+
+    if (active == 0) return;
+
+    // Use a square root node slightly larger than the bounds
+    Real extent = maxX - minX > maxY - minY ? maxX - minX : maxY - minY;
+    Real size = extent * REAL(1.001) + REAL(1e-3);
+
+    // Reserve a block for the root and keep only its first slot
+    if (alloc_children(tree) < 0) return;
+    QuadNode* root = &tree->nodes[0];
+    root->minX = minX;
+    root->minY = minY;
+    root->size = size;
+    root->start = 0;
+    root->count = active;
+    root->firstChild = -1;
+    tree->nodeCount = 1;
+
+    build_node(tree, ps, 0, 0);
+}
+
+// Collect the sources acting on one particle by walking the tree. Positions
+// are stored relative to the particle, so they stay small enough for float
+void gather_tree_interactions(const QuadTree* tree, const ParticleSystem* ps, int index,
+                              float theta, InteractionList* list) {
+    list->count = 0;
+    if (tree->nodeCount == 0) return;
+
+    Real px = ps->x[index];
+    Real py = ps->y[index];
+    float theta_sq = theta * theta;
+
+    // Depth-first walk; each level pushes at most 4 children
+    int stack[4 * BH_MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const QuadNode* node = &tree->nodes[stack[--top]];
+        if (node->count == 0) continue;
+
+        float dx = REAL_OFFSET(node->comX, px);
+        float dy = REAL_OFFSET(node->comY, py);
+        float dist_sq = dx * dx + dy * dy;
+
+        int inside = px >= node->minX && px < node->minX + node->size &&
+                     py >= node->minY && py < node->minY + node->size;
+
+        if (list->count + node->count > list->capacity &&
+            reserve_interaction_list(list, list->count + node->count) != 0) {
+            return;
+        }
+
+        float size = (float)node->size;
+        if (node->firstChild >= 0 && (inside || size * size >= theta_sq * dist_sq)) {
+            // Too close to approximate: open the node
+            for (int q = 0; q < 4; q++) {
+                stack[top++] = node->firstChild + q;
+            }
+        } else if (node->firstChild >= 0) {
+            // Far away: treat the whole node as a single mass
+            push_interaction(list, dx, dy, node->mass);
+        } else {
+            // Leaf: use the individual particles
+            const int* indices = tree->indices + node->start;
+            for (int i = 0; i < node->count; i++) {
+                int k = indices[i];
+                if (k == index) continue;
+                push_interaction(list, REAL_OFFSET(ps->x[k], px), REAL_OFFSET(ps->y[k], py),
+                                 ps->mass[k]);
+            }
+        }
+    }
+}
+
+// Compute the gravitational acceleration on one particle by walking the tree
+void compute_tree_acceleration(const QuadTree* tree, const ParticleSystem* ps, int index,
+                               float theta, float softening, InteractionList* list,
+                               float* ax, float* ay) {
+    gather_tree_interactions(tree, ps, index, theta, list);
+    get_force_kernel()(0.0f, 0.0f, list->x, list->y, list->mass, list->count,
+                       softening * softening, ax, ay);
+}
+
+// Release the tree's memory
+void free_quadtree(QuadTree* tree) {
+    free(tree->nodes);
+    free(tree->indices);
+    init_quadtree(tree);
+}
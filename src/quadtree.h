@@ -0,0 +1,61 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "particle.h"
+#include "force_kernel.h"
+
+// Default opening angle: a node is approximated by its center of mass
+// when (node size / distance) < theta. Smaller is more accurate.
+#define BH_DEFAULT_THETA 0.5f
+
+// Default Plummer softening length, roughly matching the 1px distance clamp
+// the original pairwise force used
+#define BH_DEFAULT_SOFTENING 1.0f
+
+// Maximum number of particles stored in a leaf before it is subdivided
+#define BH_LEAF_CAPACITY 8
+
+// Depth limit so coincident particles cannot subdivide forever
+#define BH_MAX_DEPTH 32
+
+typedef struct {
+    Real comX;        // Center of mass X
+    Real comY;        // Center of mass Y
+    float mass;       // Total mass of the node
+    Real minX;        // Lower-left corner of the (square) node bounds
+    Real minY;
+    Real size;        // Side length of the node
+    int firstChild;   // Index of the first of 4 consecutive children, -1 for a leaf
+    int start;        // First entry of this node in the tree's index array
+    int count;        // Number of particles below this node
+} QuadNode;
+
+typedef struct {
+    QuadNode* nodes;  // Node 0 is the root
+    int nodeCount;
+    int nodeCapacity;
+    int* indices;     // Particle indices, grouped so each node owns a contiguous range
+    int indexCapacity;
+} QuadTree;
+
+// Initialize an empty tree
+void init_quadtree(QuadTree* tree);
+
+// Build the tree over all active particles
+void build_quadtree(QuadTree* tree, const ParticleSystem* ps);
+
+// Collect the nodes and particles acting on one particle into `list`, with
+// positions relative to that particle
+void gather_tree_interactions(const QuadTree* tree, const ParticleSystem* ps, int index,
+                              float theta, InteractionList* list);
+
+// Compute the gravitational acceleration on one particle by walking the tree,
+// using `list` as scratch space for the batched force kernel
+void compute_tree_acceleration(const QuadTree* tree, const ParticleSystem* ps, int index,
+                               float theta, float softening, InteractionList* list,
+                               float* ax, float* ay);
+
+// Release the tree's memory
+void free_quadtree(QuadTree* tree);
+
+#endif // QUADTREE_H
@@ -1,8 +1,118 @@
 #include <SDL2/SDL.h>
 #include <stdio.h>     // Added for fprintf and stderr
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>      // Added for sqrtf
 #include "renderer.h"
 #include "particle.h"
+#include "threadpool.h"
+
+// White disc with an anti-aliased rim; vertex colors tint it per particle
+static SDL_Texture *discTexture = NULL;
+
+// Vertex and index buffers reused from frame to frame, four vertices and six indices per quad
+static SDL_Vertex *vertices = NULL;
+static int *indices = NULL;
+static int quadCapacity = 0;
+
+// Strongest force line alpha; stronger attractions are drawn the same
+#define FORCE_LINE_MAX_ALPHA 100
+
+// Scratch for the force-line overlay: a uniform grid with cells at least
+// FORCE_LINE_RANGE wide, in CSR form like SpatialGrid
+static int *lineCellStart = NULL;
+static int *lineCellParticles = NULL;
+static int *lineParticleCell = NULL;
+static int lineCellCapacity = 0;
+static int lineParticleCapacity = 0;
+static int lineCellsX = 0;
+static int lineCellsY = 0;
+
+// Particles or rows per work item of the density view
+#define DENSITY_PARTICLE_CHUNK 8192
+#define DENSITY_ROW_CHUNK 16
+
+// Entries of the density colormap
+#define DENSITY_COLORMAP_SIZE 256
+
+// Density view: one accumulation buffer per worker (the first one also holds
+// the sum), the tone-mapped pixels and the streaming texture they go to
+static ThreadPool *densityPool = NULL;
+static float *densityBuffers = NULL;
+static float *densityWorkerPeak = NULL;
+static Uint32 *densityPixels = NULL;
+static SDL_Texture *densityTexture = NULL;
+static int densityWidth = 0;
+static int densityHeight = 0;
+static int densityWorkers = 0;
+static Uint32 densityColormap[DENSITY_COLORMAP_SIZE];
+
+// Shared state of the density passes
+typedef struct {
+    const ParticleSystem *ps;
+    float peak;             // Densest pixel, for the tone map
+} DensityContext;
+
+// Build the disc texture. Alpha falls off over the outermost texel, so scaled
+// discs keep a smooth edge
+static SDL_Texture *create_disc_texture(SDL_Renderer *renderer) {
+    static Uint8 pixels[DISC_TEXTURE_SIZE * DISC_TEXTURE_SIZE * 4];
+    float center = DISC_TEXTURE_SIZE * 0.5f;
+
+    for (int y = 0; y < DISC_TEXTURE_SIZE; y++) {
+        for (int x = 0; x < DISC_TEXTURE_SIZE; x++) {
+            float dx = x + 0.5f - center;
+            float dy = y + 0.5f - center;
+            float coverage = center - sqrtf(dx * dx + dy * dy);
+            if (coverage < 0.0f) coverage = 0.0f;
+            if (coverage > 1.0f) coverage = 1.0f;
+
+            Uint8 *texel = &pixels[(y * DISC_TEXTURE_SIZE + x) * 4];
+            texel[0] = 255;
+            texel[1] = 255;
+            texel[2] = 255;
+            texel[3] = (Uint8)(coverage * 255.0f + 0.5f);
+        }
+    }
+
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                                             DISC_TEXTURE_SIZE, DISC_TEXTURE_SIZE);
+    if (!texture) {
+        fprintf(stderr, "Failed to create disc texture: %s\n", SDL_GetError());
+        return NULL;
+    }
+    if (SDL_UpdateTexture(texture, NULL, pixels, DISC_TEXTURE_SIZE * 4) != 0) {
+        fprintf(stderr, "Failed to upload disc texture: %s\n", SDL_GetError());
+        SDL_DestroyTexture(texture);
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return texture;
+}
+
+// Black through purple, red and orange to white, as ARGB8888
+static void build_density_colormap(void) {
+    static const float stops[][3] = {
+        { 0.0f, 0.0f, 0.0f },
+        { 0.3f, 0.0f, 0.5f },
+        { 0.9f, 0.1f, 0.2f },
+        { 1.0f, 0.6f, 0.0f },
+        { 1.0f, 1.0f, 1.0f },
+    };
+    int segments = (int)(sizeof(stops) / sizeof(stops[0])) - 1;
+
+    for (int k = 0; k < DENSITY_COLORMAP_SIZE; k++) {
+        float t = (float)k / (DENSITY_COLORMAP_SIZE - 1) * segments;
+        int s = (int)t < segments ? (int)t : segments - 1;
+        float f = t - s;
+        Uint32 color = 0xFF000000u;
+        for (int c = 0; c < 3; c++) {
+            float value = stops[s][c] + (stops[s + 1][c] - stops[s][c]) * f;
+            color |= (Uint32)(value * 255.0f + 0.5f) << (16 - 8 * c);
+        }
+        densityColormap[k] = color;
+    }
+}
 
 // Initialize the SDL renderer
 int init_renderer(SDL_Renderer **renderer, SDL_Window **window, int width, int height) {
@@ -11,6 +121,19 @@ int init_renderer(SDL_Renderer **renderer, SDL_Window **window, int width, int h
         fprintf(stderr, "Failed to create renderer: %s\n", SDL_GetError());
         return -1;
     }
+
+    discTexture = create_disc_texture(*renderer);
+    if (!discTexture) {
+        SDL_DestroyRenderer(*renderer);
+        *renderer = NULL;
+        return -1;
+    }
+
+    // The simulation thread has its own pool; this one only splats density
+    int cpus = get_cpu_count();
+    densityPool = create_thread_pool(cpus < DENSITY_MAX_THREADS ? cpus : DENSITY_MAX_THREADS);
+    densityWorkers = thread_pool_size(densityPool);
+    build_density_colormap();
     return 0;
 }
 
@@ -20,35 +143,435 @@ void clear_renderer(SDL_Renderer *renderer) {
     SDL_RenderClear(renderer);
 }
 
-// Render a single particle
-void render_particle(SDL_Renderer *renderer, Particle *particle) {
-    if (particle != NULL && particle->active) {
-        // Set color for the particle
-        SDL_SetRenderDrawColor(renderer, 
-                              particle->color.r, 
-                              particle->color.g, 
-                              particle->color.b, 
-                              particle->color.a);
-        
-        // Draw filled circle
-        int radius = (int)particle->radius;
-        int cx = (int)particle->x;
-        int cy = (int)particle->y;
-        
-        // Draw a filled circle using multiple lines
-        for (int dy = -radius; dy <= radius; dy++) {
-            int dx = (int)sqrtf(radius * radius - dy * dy);
-            SDL_RenderDrawLine(renderer, cx - dx, cy + dy, cx + dx, cy + dy);
+// Make room for `quads` quads. The index pattern never changes, so only new
+// entries are filled in. Returns -1 if out of memory
+static int reserve_quads(int quads) {
+    if (quads <= quadCapacity) return 0;
+
+    int capacity = quadCapacity ? quadCapacity : 1024;
+    while (capacity < quads) capacity *= 2;
+
+    SDL_Vertex *grownVertices = (SDL_Vertex *)realloc(vertices, (size_t)capacity * 4 * sizeof(SDL_Vertex));
+    if (grownVertices) vertices = grownVertices;
+    int *grownIndices = (int *)realloc(indices, (size_t)capacity * 6 * sizeof(int));
+    if (grownIndices) indices = grownIndices;
+
+    if (!grownVertices || !grownIndices) {
+        fprintf(stderr, "Failed to allocate memory for particle vertices\n");
+        return -1;
+    }
+
+    for (int q = quadCapacity; q < capacity; q++) {
+        int *quad = &indices[q * 6];
+        int first = q * 4;
+        quad[0] = first;
+        quad[1] = first + 1;
+        quad[2] = first + 2;
+        quad[3] = first + 2;
+        quad[4] = first + 3;
+        quad[5] = first;
+    }
+    quadCapacity = capacity;
+    return 0;
+}
+
+// Write the four corners of a disc's quad, clockwise from the top left
+static inline void set_quad(SDL_Vertex *quad, float x, float y, float radius, SDL_Color color) {
+    quad[0].position.x = x - radius;
+    quad[0].position.y = y - radius;
+    quad[0].tex_coord.x = 0.0f;
+    quad[0].tex_coord.y = 0.0f;
+
+    quad[1].position.x = x + radius;
+    quad[1].position.y = y - radius;
+    quad[1].tex_coord.x = 1.0f;
+    quad[1].tex_coord.y = 0.0f;
+
+    quad[2].position.x = x + radius;
+    quad[2].position.y = y + radius;
+    quad[2].tex_coord.x = 1.0f;
+    quad[2].tex_coord.y = 1.0f;
+
+    quad[3].position.x = x - radius;
+    quad[3].position.y = y + radius;
+    quad[3].tex_coord.x = 0.0f;
+    quad[3].tex_coord.y = 1.0f;
+
+    quad[0].color = quad[1].color = quad[2].color = quad[3].color = color;
+}
+
+// Render all live particles with one draw call
+void render_particles(SDL_Renderer *renderer, const ParticleSystem *ps) {
+    if (ps == NULL || reserve_quads(ps->count) != 0) return;
+
+    int quads = 0;
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        ParticleColor c = ps->color[i];
+        SDL_Color color = { c.r, c.g, c.b, c.a };
+        set_quad(&vertices[quads * 4], (float)ps->x[i], (float)ps->y[i], ps->radius[i], color);
+        quads++;
+    }
+
+    if (quads > 0) {
+        SDL_RenderGeometry(renderer, discTexture, vertices, quads * 4, indices, quads * 6);
+    }
+}
+
+// Resize the density buffers and texture to the viewport. Returns -1 on failure
+static int reserve_density(SDL_Renderer *renderer, int width, int height) {
+    if (width == densityWidth && height == densityHeight && densityTexture) return 0;
+
+    size_t pixels = (size_t)width * height;
+    float *buffers = (float *)realloc(densityBuffers, pixels * densityWorkers * sizeof(float));
+    if (buffers) densityBuffers = buffers;
+    Uint32 *image = (Uint32 *)realloc(densityPixels, pixels * sizeof(Uint32));
+    if (image) densityPixels = image;
+    if (!densityWorkerPeak) densityWorkerPeak = (float *)malloc(densityWorkers * sizeof(float));
+
+    if (!buffers || !image || !densityWorkerPeak) {
+        fprintf(stderr, "Failed to allocate memory for the density view\n");
+        return -1;
+    }
+
+    if (densityTexture) SDL_DestroyTexture(densityTexture);
+    densityTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                       width, height);
+    if (!densityTexture) {
+        fprintf(stderr, "Failed to create density texture: %s\n", SDL_GetError());
+        densityWidth = densityHeight = 0;
+        return -1;
+    }
+    // Black adds nothing, so overlays drawn before it stay visible
+    SDL_SetTextureBlendMode(densityTexture, SDL_BLENDMODE_ADD);
+    densityWidth = width;
+    densityHeight = height;
+    return 0;
+}
+
+// Zero rows [start, end) of every worker's buffer
+static void clear_density_task(void *context, int start, int end, int worker) {
+    (void)context;
+    (void)worker;
+    size_t pixels = (size_t)densityWidth * densityHeight;
+    size_t offset = (size_t)start * densityWidth;
+    size_t length = (size_t)(end - start) * densityWidth * sizeof(float);
+
+    for (int w = 0; w < densityWorkers; w++) {
+        memset(densityBuffers + w * pixels + offset, 0, length);
+    }
+}
+
+// Spread the mass of particles [start, end) over the four nearest pixels of
+// the worker's own buffer (cloud-in-cell), one world unit per pixel
+static void splat_density_task(void *context, int start, int end, int worker) {
+    DensityContext *ctx = (DensityContext *)context;
+    const ParticleSystem *ps = ctx->ps;
+    float *buffer = densityBuffers + (size_t)worker * densityWidth * densityHeight;
+    int width = densityWidth, height = densityHeight;
+
+    for (int i = start; i < end; i++) {
+        if (!ps->active[i]) continue;
+        float u = (float)ps->x[i] - 0.5f;
+        float v = (float)ps->y[i] - 0.5f;
+        if (u < -1.0f || v < -1.0f || u >= width || v >= height) continue;
+
+        int px = (int)floorf(u), py = (int)floorf(v);
+        float fx = u - px, fy = v - py;
+        float mass = ps->mass[i];
+        float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+        for (int k = 0; k < 4; k++) {
+            int x = px + (k & 1), y = py + (k >> 1);
+            if (x < 0 || y < 0 || x >= width || y >= height) continue;
+            buffer[(size_t)y * width + x] += mass * weights[k];
+        }
+    }
+}
+
+// Sum the workers' buffers into the first one over rows [start, end), and
+// track the densest pixel seen by each worker
+static void reduce_density_task(void *context, int start, int end, int worker) {
+    (void)context;
+    size_t pixels = (size_t)densityWidth * densityHeight;
+    float peak = densityWorkerPeak[worker];
+
+    for (size_t p = (size_t)start * densityWidth; p < (size_t)end * densityWidth; p++) {
+        float density = densityBuffers[p];
+        for (int w = 1; w < densityWorkers; w++) {
+            density += densityBuffers[w * pixels + p];
         }
+        densityBuffers[p] = density;
+        if (density > peak) peak = density;
+    }
+    densityWorkerPeak[worker] = peak;
+}
+
+// Tone-map rows [start, end) through the log scale and the colormap
+static void tonemap_density_task(void *context, int start, int end, int worker) {
+    DensityContext *ctx = (DensityContext *)context;
+    float scale = DENSITY_DYNAMIC_RANGE / ctx->peak;
+    float norm = (DENSITY_COLORMAP_SIZE - 1) / log1pf(DENSITY_DYNAMIC_RANGE);
+    (void)worker;
+
+    for (size_t p = (size_t)start * densityWidth; p < (size_t)end * densityWidth; p++) {
+        float density = densityBuffers[p];
+        int k = density > 0.0f ? (int)(log1pf(density * scale) * norm + 0.5f) : 0;
+        densityPixels[p] = densityColormap[k < DENSITY_COLORMAP_SIZE ? k : DENSITY_COLORMAP_SIZE - 1];
     }
 }
 
+// Render the particles as a tone-mapped density image
+void render_density(SDL_Renderer *renderer, const ParticleSystem *ps) {
+    int width, height;
+    if (ps == NULL || SDL_GetRendererOutputSize(renderer, &width, &height) != 0) return;
+    if (width <= 0 || height <= 0 || reserve_density(renderer, width, height) != 0) return;
+
+    DensityContext ctx = { ps, 0.0f };
+    thread_pool_run(densityPool, clear_density_task, &ctx, height, DENSITY_ROW_CHUNK);
+    thread_pool_run(densityPool, splat_density_task, &ctx, ps->count, DENSITY_PARTICLE_CHUNK);
+
+    memset(densityWorkerPeak, 0, densityWorkers * sizeof(float));
+    thread_pool_run(densityPool, reduce_density_task, &ctx, height, DENSITY_ROW_CHUNK);
+    for (int w = 0; w < densityWorkers; w++) {
+        if (densityWorkerPeak[w] > ctx.peak) ctx.peak = densityWorkerPeak[w];
+    }
+    if (ctx.peak <= 0.0f) return;
+
+    thread_pool_run(densityPool, tonemap_density_task, &ctx, height, DENSITY_ROW_CHUNK);
+    if (SDL_UpdateTexture(densityTexture, NULL, densityPixels, width * (int)sizeof(Uint32)) != 0) {
+        fprintf(stderr, "Failed to upload density texture: %s\n", SDL_GetError());
+        return;
+    }
+    SDL_RenderCopy(renderer, densityTexture, NULL, NULL);
+}
+
+// Make room for the force-line grid. Returns -1 if out of memory
+static int reserve_line_grid(int cells, int particles) {
+    if (cells + 1 > lineCellCapacity) {
+        int *grown = (int *)realloc(lineCellStart, (size_t)(cells + 1) * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate memory for force line grid\n");
+            return -1;
+        }
+        lineCellStart = grown;
+        lineCellCapacity = cells + 1;
+    }
+
+    if (particles > lineParticleCapacity) {
+        int *cellParticles = (int *)realloc(lineCellParticles, (size_t)particles * sizeof(int));
+        if (cellParticles) lineCellParticles = cellParticles;
+        int *particleCell = (int *)realloc(lineParticleCell, (size_t)particles * sizeof(int));
+        if (particleCell) lineParticleCell = particleCell;
+
+        if (!cellParticles || !particleCell) {
+            fprintf(stderr, "Failed to allocate memory for force line grid\n");
+            return -1;
+        }
+        lineParticleCapacity = particles;
+    }
+    return 0;
+}
+
+// Alpha of the line between two particles: force * 5000, capped. 0 means invisible
+static inline int force_line_alpha(const ParticleSystem *ps, int i, int j) {
+    float dx = REAL_OFFSET(ps->x[j], ps->x[i]);
+    float dy = REAL_OFFSET(ps->y[j], ps->y[i]);
+    float distanceSq = dx * dx + dy * dy;
+    if (distanceSq >= FORCE_LINE_RANGE * FORCE_LINE_RANGE || distanceSq == 0.0f) return 0;
+
+    float alpha = (float)G * ps->mass[i] * ps->mass[j] / distanceSq * 5000.0f;
+    return alpha < FORCE_LINE_MAX_ALPHA ? (int)alpha : FORCE_LINE_MAX_ALPHA;
+}
+
+// Write the one-pixel-wide quad of a line from particle i to j
+static void set_line_quad(SDL_Vertex *quad, const ParticleSystem *ps, int i, int j, int alpha) {
+    float dx = REAL_OFFSET(ps->x[j], ps->x[i]);
+    float dy = REAL_OFFSET(ps->y[j], ps->y[i]);
+    float halfWidth = 0.5f / sqrtf(dx * dx + dy * dy);
+    float nx = -dy * halfWidth;
+    float ny = dx * halfWidth;
+    SDL_Color color = { 255, 255, 0, (Uint8)alpha };
+
+    float xi = (float)ps->x[i], yi = (float)ps->y[i];
+    float xj = (float)ps->x[j], yj = (float)ps->y[j];
+    quad[0].position.x = xi + nx;
+    quad[0].position.y = yi + ny;
+    quad[1].position.x = xj + nx;
+    quad[1].position.y = yj + ny;
+    quad[2].position.x = xj - nx;
+    quad[2].position.y = yj - ny;
+    quad[3].position.x = xi - nx;
+    quad[3].position.y = yi - ny;
+    for (int v = 0; v < 4; v++) {
+        quad[v].color = color;
+        quad[v].tex_coord.x = 0.0f;
+        quad[v].tex_coord.y = 0.0f;
+    }
+}
+
+// Visit every visible pair in range through the grid. With a histogram, only
+// count pairs per alpha. Otherwise write quads for pairs with alpha above
+// `minAlpha`, plus the first `quota` pairs with exactly `minAlpha`. Returns the
+// number of quads written
+static int scan_force_lines(const ParticleSystem *ps, int *histogram, int minAlpha, int quota) {
+    int quads = 0;
+    for (int cell = 0; cell < lineCellsX * lineCellsY; cell++) {
+        int cellX = cell % lineCellsX;
+        int cellY = cell / lineCellsX;
+        int minX = cellX > 0 ? cellX - 1 : 0, maxX = cellX < lineCellsX - 1 ? cellX + 1 : cellX;
+        int minY = cellY > 0 ? cellY - 1 : 0, maxY = cellY < lineCellsY - 1 ? cellY + 1 : cellY;
+
+        for (int k = lineCellStart[cell]; k < lineCellStart[cell + 1]; k++) {
+            int i = lineCellParticles[k];
+
+            // Rows of the 3x3 block are contiguous runs of cells in the CSR arrays
+            for (int nCellY = minY; nCellY <= maxY; nCellY++) {
+                int row = nCellY * lineCellsX;
+                for (int n = lineCellStart[row + minX]; n < lineCellStart[row + maxX + 1]; n++) {
+                    int j = lineCellParticles[n];
+                    if (j <= i) continue;
+
+                    int alpha = force_line_alpha(ps, i, j);
+                    if (alpha == 0) continue;
+
+                    if (histogram) {
+                        histogram[alpha]++;
+                    } else if (alpha > minAlpha || (alpha == minAlpha && quota-- > 0)) {
+                        set_line_quad(&vertices[quads * 4], ps, i, j, alpha);
+                        quads++;
+                    }
+                }
+            }
+        }
+    }
+    return quads;
+}
+
+// Render force lines between nearby particles with one draw call
+void render_force_lines(SDL_Renderer *renderer, const ParticleSystem *ps) {
+    if (ps == NULL || ps->count < 2) return;
+
+    // Bounding box of the live particles
+    Real minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    int live = 0;
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        if (live == 0 || ps->x[i] < minX) minX = ps->x[i];
+        if (live == 0 || ps->x[i] > maxX) maxX = ps->x[i];
+        if (live == 0 || ps->y[i] < minY) minY = ps->y[i];
+        if (live == 0 || ps->y[i] > maxY) maxY = ps->y[i];
+        live++;
+    }
+    if (live < 2) return;
+
+    // Cells no smaller than the line range, so every pair in range is in the same
+    // or adjacent cells. Far-flung particles widen the cells rather than adding
+    // more than a few cells per particle
+    float cellSize = FORCE_LINE_RANGE;
+    int cellsX, cellsY;
+    for (;;) {
+        cellsX = (int)((maxX - minX) / cellSize) + 1;
+        cellsY = (int)((maxY - minY) / cellSize) + 1;
+        if ((double)cellsX * cellsY <= 4.0 * live + 16) break;
+        cellSize *= 2.0f;
+    }
+    int cellCount = cellsX * cellsY;
+    if (reserve_line_grid(cellCount, ps->count) != 0) return;
+    lineCellsX = cellsX;
+    lineCellsY = cellsY;
+
+    // Counting sort of the live particles into cells
+    memset(lineCellStart, 0, (size_t)(cellCount + 1) * sizeof(int));
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        int cx = (int)((ps->x[i] - minX) / cellSize);
+        int cy = (int)((ps->y[i] - minY) / cellSize);
+        if (cx >= cellsX) cx = cellsX - 1;
+        if (cy >= cellsY) cy = cellsY - 1;
+        lineParticleCell[i] = cy * cellsX + cx;
+        lineCellStart[lineParticleCell[i] + 1]++;
+    }
+    for (int c = 0; c < cellCount; c++) {
+        lineCellStart[c + 1] += lineCellStart[c];
+    }
+    for (int i = 0; i < ps->count; i++) {
+        if (!ps->active[i]) continue;
+        lineCellParticles[lineCellStart[lineParticleCell[i]]++] = i;
+    }
+    for (int c = cellCount; c > 0; c--) {
+        lineCellStart[c] = lineCellStart[c - 1];
+    }
+    lineCellStart[0] = 0;
+
+    // Count lines per alpha, then keep the strongest FORCE_LINE_MAX: everything
+    // above a threshold alpha, and as many as still fit at the threshold
+    int histogram[FORCE_LINE_MAX_ALPHA + 1] = { 0 };
+    scan_force_lines(ps, histogram, 0, 0);
+
+    int minAlpha = FORCE_LINE_MAX_ALPHA;
+    int kept = 0;
+    while (minAlpha > 1 && kept + histogram[minAlpha] < FORCE_LINE_MAX) {
+        kept += histogram[minAlpha];
+        minAlpha--;
+    }
+    int quota = FORCE_LINE_MAX - kept;
+    if (reserve_quads(kept + (histogram[minAlpha] < quota ? histogram[minAlpha] : quota)) != 0) return;
+
+    int lineCount = scan_force_lines(ps, NULL, minAlpha, quota);
+    if (lineCount > 0) {
+        SDL_RenderGeometry(renderer, NULL, vertices, lineCount * 4, indices, lineCount * 6);
+    }
+}
+
+// Render a single filled disc
+void render_disc(SDL_Renderer *renderer, float x, float y, float radius, SDL_Color color) {
+    SDL_Vertex quad[4];
+    static const int quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+
+    set_quad(quad, x, y, radius, color);
+    SDL_RenderGeometry(renderer, discTexture, quad, 4, quadIndices, 6);
+}
+
 // Clean up the renderer and window
 void cleanup_renderer(SDL_Renderer *renderer, SDL_Window *window) {
+    free(vertices);
+    free(indices);
+    vertices = NULL;
+    indices = NULL;
+    quadCapacity = 0;
+
+    free(lineCellStart);
+    free(lineCellParticles);
+    free(lineParticleCell);
+    lineCellStart = NULL;
+    lineCellParticles = NULL;
+    lineParticleCell = NULL;
+    lineCellCapacity = 0;
+    lineParticleCapacity = 0;
+
+    free(densityBuffers);
+    free(densityWorkerPeak);
+    free(densityPixels);
+    densityBuffers = NULL;
+    densityWorkerPeak = NULL;
+    densityPixels = NULL;
+    densityWidth = densityHeight = 0;
+    if (densityTexture) {
+        SDL_DestroyTexture(densityTexture);
+        densityTexture = NULL;
+    }
+    destroy_thread_pool(densityPool);
+    densityPool = NULL;
+
+    if (discTexture) {
+        SDL_DestroyTexture(discTexture);
+        discTexture = NULL;
+    }
     if (renderer) {
         SDL_DestroyRenderer(renderer);
     }
     if (window) {
         SDL_DestroyWindow(window);
     }
-}
\ No newline at end of file
+}
@@ -4,16 +4,44 @@
 #include <SDL2/SDL.h>
 #include "particle.h"
 
-// Initializes the SDL renderer
+// Width and height of the generated disc texture, in texels
+#define DISC_TEXTURE_SIZE 64
+
+// Force lines connect particles closer than this many pixels
+#define FORCE_LINE_RANGE 100.0f
+
+// At most this many force lines are drawn per frame; the strongest ones are kept
+#define FORCE_LINE_MAX 20000
+
+// The density view maps log(1 + range * density / peak) onto its colormap, so
+// pixels down to 1/range of the brightest one stay visible
+#define DENSITY_DYNAMIC_RANGE 1000.0f
+
+// Workers splatting the density view; each keeps a viewport-sized buffer
+#define DENSITY_MAX_THREADS 8
+
+// Initializes the SDL renderer and the disc texture used for particles
 int init_renderer(SDL_Renderer **renderer, SDL_Window **window, int width, int height);
 
 // Clears the screen with a black background
 void clear_renderer(SDL_Renderer *renderer);
 
-// Renders a particle on the screen
-void render_particle(SDL_Renderer *renderer, Particle *particle);
+// Renders every live particle as a textured quad, in a single SDL_RenderGeometry call
+void render_particles(SDL_Renderer *renderer, const ParticleSystem *ps);
+
+// Renders the particles as a density image: mass is splatted into a
+// viewport-sized buffer in parallel, tone-mapped and uploaded as one streaming
+// texture, so the cost depends on the viewport rather than the particle count
+void render_density(SDL_Renderer *renderer, const ParticleSystem *ps);
+
+// Renders a line between every pair of particles within FORCE_LINE_RANGE, fading
+// with the strength of their attraction, in a single SDL_RenderGeometry call
+void render_force_lines(SDL_Renderer *renderer, const ParticleSystem *ps);
+
+// Renders one filled disc, e.g. a preview of a particle about to be placed
+void render_disc(SDL_Renderer *renderer, float x, float y, float radius, SDL_Color color);
 
 // Cleans up the renderer and window
 void cleanup_renderer(SDL_Renderer *renderer, SDL_Window *window);
 
-#endif // RENDERER_H
\ No newline at end of file
+#endif // RENDERER_H
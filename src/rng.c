@@ -0,0 +1,73 @@
+#include <math.h>
+#include "rng.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Philox4x32 round multipliers and Weyl key increments
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// One Philox4x32-10 block
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        uint64_t product0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t product1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+        uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Start the stream of `index` under `seed`
+void init_random_stream(RandomStream* stream, uint64_t seed, uint64_t index, uint32_t purpose) {
+    stream->key[0] = (uint32_t)seed;
+    stream->key[1] = (uint32_t)(seed >> 32);
+    stream->counter[0] = 0;
+    stream->counter[1] = (uint32_t)index;
+    stream->counter[2] = (uint32_t)(index >> 32);
+    stream->counter[3] = purpose;
+    stream->used = 4;
+}
+
+// Next 32 random bits
+uint32_t random_stream_next(RandomStream* stream) {
+    if (stream->used == 4) {
+        philox4x32(stream->counter, stream->key, stream->block);
+        stream->counter[0]++;
+        stream->used = 0;
+    }
+    return stream->block[stream->used++];
+}
+
+// Uniform float in [min, max), from the top 24 bits
+float random_stream_float(RandomStream* stream, float min, float max) {
+    float unit = (float)(random_stream_next(stream) >> 8) * (1.0f / 16777216.0f);
+    return min + unit * (max - min);
+}
+
+// Standard normal sample (Box-Muller)
+float random_stream_gaussian(RandomStream* stream) {
+    float u = 1.0f - random_stream_float(stream, 0.0f, 1.0f);  // (0, 1], safe for logf
+    float v = random_stream_float(stream, 0.0f, 1.0f);
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
@@ -0,0 +1,39 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11).
+//
+// Philox is a keyed bijection: a 128-bit counter and a 64-bit key map to 128
+// random bits, with no state carried from one call to the next. Giving every
+// particle its own counter range makes its random numbers a pure function of
+// (seed, particle index), so particles can be generated in any order, on any
+// number of threads, and a run can be replayed from its seed alone.
+
+// Random stream of one (seed, index, purpose) triple. Values are drawn four at
+// a time from consecutive counter blocks
+typedef struct {
+    uint32_t key[2];        // Seed
+    uint32_t counter[4];    // Block number, index (two words), purpose
+    uint32_t block[4];      // Current block of random words
+    int used;               // Words of `block` already handed out
+} RandomStream;
+
+// One Philox4x32-10 block: 128 random bits for a counter under a key
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+// Start the stream of `index` (e.g. a particle) under `seed`. Different
+// `purpose` values give independent streams for the same index
+void init_random_stream(RandomStream* stream, uint64_t seed, uint64_t index, uint32_t purpose);
+
+// Next 32 random bits
+uint32_t random_stream_next(RandomStream* stream);
+
+// Uniform float in [min, max)
+float random_stream_float(RandomStream* stream, float min, float max);
+
+// Standard normal sample (Box-Muller)
+float random_stream_gaussian(RandomStream* stream);
+
+#endif // RNG_H
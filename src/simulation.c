@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "simulation.h"
+#include "checkpoint.h"
+#include "initial_conditions.h"
+#include "utils.h"
+
+// The triple buffer's shared slot holds a snapshot index, plus this flag while
+// the reader has not yet taken it
+#define SNAPSHOT_INDEX_MASK 3
+#define SNAPSHOT_FRESH 4
+
+struct Simulation {
+    // Owned by the simulation thread
+    ParticleSystem* particles;
+    uint64_t step;
+    double time;
+    int paused;
+    float timeScale;
+    uint64_t resetCount;            // Each reset draws from the next seed, so it looks different
+    Telemetry telemetry;
+
+    // Triple buffer: the writer fills `back`, the reader draws `front`, and the
+    // newest complete snapshot waits in `latest`. Both sides swap their buffer
+    // with `latest` atomically, so the three indices are always distinct
+    SimulationSnapshot snapshots[3];
+    int back;                       // Simulation thread only
+    int front;                      // Render thread only
+    SDL_atomic_t latest;
+
+    // Command queue: a ring buffer guarded by `queueLock`. The simulation thread
+    // moves everything into `pending` at once and runs it outside the lock
+    SDL_mutex* queueLock;
+    SimulationCommand* queue;
+    int queueHead;
+    int queueCount;
+    SimulationCommand* pending;
+
+    SDL_Thread* thread;
+    SDL_atomic_t running;
+};
+
+// Copy the current state into the back buffer and swap it into `latest`
+static void publish_snapshot(Simulation* sim) {
+    SimulationSnapshot* snapshot = &sim->snapshots[sim->back];
+    if (copy_live_particles(snapshot->particles, sim->particles) != 0) return;
+
+    const SpatialGrid* grid = get_spatial_grid();
+    snapshot->step = sim->step;
+    snapshot->time = sim->time;
+    snapshot->solver = get_gravity_solver();
+    snapshot->telemetry = sim->telemetry;
+    snapshot->gridOriginX = (float)grid->originX;
+    snapshot->gridOriginY = (float)grid->originY;
+    snapshot->gridCellsX = grid->cellsX;
+    snapshot->gridCellsY = grid->cellsY;
+    get_grid_stats(grid, &snapshot->gridStats);
+
+    sim->back = SDL_AtomicSet(&sim->latest, sim->back | SNAPSHOT_FRESH) & SNAPSHOT_INDEX_MASK;
+}
+
+// Latest published snapshot
+const SimulationSnapshot* acquire_snapshot(Simulation* sim) {
+    // Only the writer changes `latest` between these two calls, and it can only
+    // make it fresh again, so the swap never hands back an old buffer
+    if (SDL_AtomicGet(&sim->latest) & SNAPSHOT_FRESH) {
+        sim->front = SDL_AtomicSet(&sim->latest, sim->front) & SNAPSHOT_INDEX_MASK;
+    }
+    return &sim->snapshots[sim->front];
+}
+
+// Queue a command for the simulation thread
+int send_simulation_command(Simulation* sim, const SimulationCommand* command) {
+    SDL_LockMutex(sim->queueLock);
+    if (sim->queueCount == SIM_COMMAND_QUEUE_SIZE) {
+        SDL_UnlockMutex(sim->queueLock);
+        fprintf(stderr, "Failed to queue simulation command: queue is full\n");
+        return -1;
+    }
+    int tail = (sim->queueHead + sim->queueCount) % SIM_COMMAND_QUEUE_SIZE;
+    sim->queue[tail] = *command;
+    sim->queueCount++;
+    SDL_UnlockMutex(sim->queueLock);
+    return 0;
+}
+
+// Apply one command to the simulation
+static void run_command(Simulation* sim, const SimulationCommand* command) {
+    switch (command->type) {
+        case SIM_COMMAND_ADD_PARTICLES:
+            add_particles(sim->particles, command->count, command->x, command->y,
+                          command->vx, command->vy, command->mass, NULL);
+            break;
+        case SIM_COMMAND_RESET: {
+            // The current state is kept if the new one cannot be created
+            InitialConditionParams params;
+            default_initial_conditions(&params, command->count, get_random_seed() + ++sim->resetCount);
+            ParticleSystem* particles = generate_particles(&params);
+            if (particles) {
+                free_particles(sim->particles);
+                sim->particles = particles;
+                sim->step = 0;
+                sim->time = 0.0;
+            }
+            break;
+        }
+        case SIM_COMMAND_SET_SOLVER:
+            set_gravity_solver(command->solver);
+            break;
+        case SIM_COMMAND_SET_PAUSED:
+            sim->paused = command->paused;
+            break;
+        case SIM_COMMAND_SET_TIME_SCALE:
+            sim->timeScale = command->timeScale;
+            break;
+        case SIM_COMMAND_SAVE: {
+            CheckpointInfo info;
+            get_checkpoint_info(&info, sim->step, sim->time);
+            if (save_checkpoint(command->path, sim->particles, &info) == 0) {
+                printf("Saved checkpoint to %s\n", command->path);
+            }
+            break;
+        }
+        case SIM_COMMAND_LOAD: {
+            // The current state is kept if loading fails
+            CheckpointInfo info;
+            ParticleSystem* loaded = load_checkpoint(command->path, &info);
+            if (loaded) {
+                free_particles(sim->particles);
+                sim->particles = loaded;
+                apply_checkpoint_info(&info);
+                sim->step = info.step;
+                sim->time = info.time;
+                printf("Loaded checkpoint from %s (step %llu)\n",
+                       command->path, (unsigned long long)sim->step);
+            }
+            break;
+        }
+    }
+}
+
+// Run every queued command. Returns how many there were
+static int run_commands(Simulation* sim) {
+    SDL_LockMutex(sim->queueLock);
+    int count = sim->queueCount;
+    for (int c = 0; c < count; c++) {
+        sim->pending[c] = sim->queue[(sim->queueHead + c) % SIM_COMMAND_QUEUE_SIZE];
+    }
+    sim->queueHead = (sim->queueHead + count) % SIM_COMMAND_QUEUE_SIZE;
+    sim->queueCount = 0;
+    SDL_UnlockMutex(sim->queueLock);
+
+    for (int c = 0; c < count; c++) {
+        run_command(sim, &sim->pending[c]);
+    }
+    return count;
+}
+
+// Simulation thread: apply commands, take as many fixed steps as the elapsed
+// (scaled) wall-clock time calls for, publish a snapshot
+static int simulation_main(void* arg) {
+    Simulation* sim = (Simulation*)arg;
+    double lastTime = get_time_seconds();
+    double backlog = 0.0;
+
+    while (SDL_AtomicGet(&sim->running)) {
+        int changed = run_commands(sim);
+
+        double now = get_time_seconds();
+        if (!sim->paused) {
+            backlog += (now - lastTime) * sim->timeScale;
+        }
+        lastTime = now;
+
+        int steps = 0;
+        while (backlog >= SIM_TIMESTEP && steps < SIM_MAX_CATCHUP_STEPS) {
+            update_particles(sim->particles, SIM_TIMESTEP);
+            telemetry_record_step(&sim->telemetry, get_step_stats());
+            sim->step++;
+            sim->time += SIM_TIMESTEP;
+            backlog -= SIM_TIMESTEP;
+            steps++;
+        }
+
+        // Too slow to keep up: run behind real time instead of piling up steps
+        if (backlog >= SIM_TIMESTEP) {
+            backlog = 0.0;
+        }
+
+        if (steps > 0 || changed > 0) {
+            publish_snapshot(sim);
+        } else {
+            SDL_Delay(1);
+        }
+    }
+
+    return 0;
+}
+
+// Create the simulation and start its thread
+Simulation* create_simulation(int count) {
+    Simulation* sim = (Simulation*)calloc(1, sizeof(Simulation));
+    if (sim == NULL) {
+        fprintf(stderr, "Failed to allocate memory for simulation\n");
+        return NULL;
+    }
+
+    sim->particles = create_particles(count);
+    sim->timeScale = 1.0f;
+    init_telemetry(&sim->telemetry);
+    sim->queueLock = SDL_CreateMutex();
+    sim->queue = (SimulationCommand*)malloc(SIM_COMMAND_QUEUE_SIZE * sizeof(SimulationCommand));
+    sim->pending = (SimulationCommand*)malloc(SIM_COMMAND_QUEUE_SIZE * sizeof(SimulationCommand));
+    for (int s = 0; s < 3; s++) {
+        sim->snapshots[s].particles = create_particles(0);
+    }
+
+    if (!sim->particles || !sim->queueLock || !sim->queue || !sim->pending ||
+        !sim->snapshots[0].particles || !sim->snapshots[1].particles || !sim->snapshots[2].particles) {
+        fprintf(stderr, "Failed to create simulation\n");
+        destroy_simulation(sim);
+        return NULL;
+    }
+
+    // Publish the initial state so the first frame has something to draw
+    sim->front = 0;
+    sim->back = 1;
+    SDL_AtomicSet(&sim->latest, 2);
+    publish_snapshot(sim);
+
+    SDL_AtomicSet(&sim->running, 1);
+    sim->thread = SDL_CreateThread(simulation_main, "simulation", sim);
+    if (!sim->thread) {
+        fprintf(stderr, "Failed to start simulation thread: %s\n", SDL_GetError());
+        destroy_simulation(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+// Stop the simulation thread and free everything
+void destroy_simulation(Simulation* sim) {
+    if (sim == NULL) return;
+
+    if (sim->thread) {
+        SDL_AtomicSet(&sim->running, 0);
+        SDL_WaitThread(sim->thread, NULL);
+    }
+
+    for (int s = 0; s < 3; s++) {
+        free_particles(sim->snapshots[s].particles);
+    }
+    free_particles(sim->particles);
+    free(sim->queue);
+    free(sim->pending);
+    if (sim->queueLock) {
+        SDL_DestroyMutex(sim->queueLock);
+    }
+    free(sim);
+}
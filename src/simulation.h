@@ -0,0 +1,90 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "particle.h"
+#include "grid.h"
+#include "telemetry.h"
+
+// Physics runs on its own thread with a fixed timestep, independent of the
+// frame rate:
+//
+//   UI thread  --commands-->  simulation thread  --snapshots-->  UI thread
+//
+// The UI never touches the live particle system. Edits (placing particles,
+// reset, solver switch, checkpoints, ...) are queued as commands and applied by
+// the simulation thread between steps. After stepping, the simulation thread
+// copies what the renderer needs into a snapshot and publishes it through a
+// lock-free triple buffer: the writer always has a free buffer to fill and the
+// reader always has a complete one to draw, so neither waits for the other.
+
+// Simulated seconds per step
+#define SIM_TIMESTEP 0.01f
+
+// Most steps taken to catch up after falling behind; older backlog is dropped
+#define SIM_MAX_CATCHUP_STEPS 8
+
+// Commands that fit in the queue at once
+#define SIM_COMMAND_QUEUE_SIZE 256
+
+// Particles carried by one add command
+#define SIM_COMMAND_MAX_PARTICLES 32
+
+// Immutable copy of the simulation for rendering
+typedef struct {
+    ParticleSystem* particles;  // Live particles only, packed
+    uint64_t step;              // Steps taken since the run started
+    double time;                // Simulated time since the run started
+    GravitySolver solver;
+    Telemetry telemetry;        // Step timings (rolling) and counters of the most recent step
+
+    // Grid of the most recent step (geometry and occupancy only)
+    float gridOriginX;
+    float gridOriginY;
+    int gridCellsX;
+    int gridCellsY;
+    GridStats gridStats;
+} SimulationSnapshot;
+
+typedef enum {
+    SIM_COMMAND_ADD_PARTICLES,  // Append particles
+    SIM_COMMAND_RESET,          // Replace everything with `count` random particles
+    SIM_COMMAND_SET_SOLVER,
+    SIM_COMMAND_SET_PAUSED,
+    SIM_COMMAND_SET_TIME_SCALE, // Simulated seconds per wall-clock second
+    SIM_COMMAND_SAVE,           // Write a checkpoint to `path`
+    SIM_COMMAND_LOAD            // Replace everything with the checkpoint at `path`
+} SimulationCommandType;
+
+// Edit requested by the UI
+typedef struct {
+    SimulationCommandType type;
+    int count;                  // Particles to add, or to create on reset
+    Real x[SIM_COMMAND_MAX_PARTICLES];
+    Real y[SIM_COMMAND_MAX_PARTICLES];
+    Real vx[SIM_COMMAND_MAX_PARTICLES];
+    Real vy[SIM_COMMAND_MAX_PARTICLES];
+    float mass[SIM_COMMAND_MAX_PARTICLES];
+    GravitySolver solver;
+    int paused;
+    float timeScale;
+    const char* path;           // Must stay valid until the command runs
+} SimulationCommand;
+
+typedef struct Simulation Simulation;
+
+// Create the simulation with `count` random particles and start its thread
+Simulation* create_simulation(int count);
+
+// Queue a command for the simulation thread. Returns 0 on success, -1 if the queue is full
+int send_simulation_command(Simulation* sim, const SimulationCommand* command);
+
+// Latest published snapshot. It stays valid and unchanged until the next call,
+// so call this once per frame from the render thread only
+const SimulationSnapshot* acquire_snapshot(Simulation* sim);
+
+// Stop the simulation thread and free everything
+void destroy_simulation(Simulation* sim);
+
+#endif // SIMULATION_H
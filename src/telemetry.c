@@ -0,0 +1,158 @@
+#include <string.h>
+#include <math.h>
+#include "telemetry.h"
+
+static const char* phaseNames[TELEMETRY_PHASE_COUNT] = {
+    "events", "grid", "force", "collision", "integration", "step", "render", "frame"
+};
+
+// Start with empty histograms and zero counters
+void init_telemetry(Telemetry* telemetry) {
+    memset(telemetry, 0, sizeof(*telemetry));
+}
+
+// Histogram bucket of a duration
+static int bucket_of(double seconds) {
+    if (seconds <= TELEMETRY_MIN_SECONDS) return 0;
+    int bucket = (int)(log2(seconds / TELEMETRY_MIN_SECONDS) * TELEMETRY_BUCKETS_PER_OCTAVE) + 1;
+    return bucket < TELEMETRY_BUCKETS ? bucket : TELEMETRY_BUCKETS - 1;
+}
+
+// Upper edge of a bucket, in seconds
+static double bucket_limit(int bucket) {
+    return TELEMETRY_MIN_SECONDS * exp2((double)bucket / TELEMETRY_BUCKETS_PER_OCTAVE);
+}
+
+// Add a sample to a phase, dropping the oldest one once the window is full
+void telemetry_record(Telemetry* telemetry, TelemetryPhase phase, double seconds) {
+    PhaseHistogram* histogram = &telemetry->phases[phase];
+    int bucket = bucket_of(seconds);
+
+    if (histogram->count == TELEMETRY_WINDOW) {
+        histogram->buckets[histogram->samples[histogram->next]]--;
+    } else {
+        histogram->count++;
+    }
+    histogram->samples[histogram->next] = (uint8_t)bucket;
+    histogram->buckets[bucket]++;
+    histogram->next = (histogram->next + 1) % TELEMETRY_WINDOW;
+
+    histogram->last = seconds;
+    histogram->total += seconds;
+    histogram->totalCount++;
+}
+
+// Add the timings and counters of one update_particles call
+void telemetry_record_step(Telemetry* telemetry, const StepStats* stats) {
+    telemetry_record(telemetry, TELEMETRY_PHASE_GRID, stats->gridSeconds);
+    telemetry_record(telemetry, TELEMETRY_PHASE_FORCE, stats->forceSeconds);
+    telemetry_record(telemetry, TELEMETRY_PHASE_COLLISION, stats->collisionSeconds);
+    telemetry_record(telemetry, TELEMETRY_PHASE_INTEGRATION, stats->integrationSeconds);
+    telemetry_record(telemetry, TELEMETRY_PHASE_STEP,
+                     stats->gridSeconds + stats->forceSeconds + stats->collisionSeconds + stats->integrationSeconds);
+
+    telemetry->interactions = stats->interactions;
+    telemetry->forceEvaluations = stats->forceEvaluations;
+    telemetry->substeps = stats->substeps;
+    telemetry->mergedParticles = stats->mergedParticles;
+    telemetry->oversizedParticles = stats->oversizedParticles;
+    telemetry->neighborListRebuilt = stats->neighborListRebuilt;
+    telemetry->activeParticles = stats->activeParticles;
+
+    telemetry->steps++;
+    telemetry->totalInteractions += stats->interactions;
+    telemetry->totalMerged += stats->mergedParticles;
+    telemetry->totalNeighborRebuilds += stats->neighborListRebuilt;
+}
+
+// Time below which `fraction` of the window falls
+double telemetry_percentile(const Telemetry* telemetry, TelemetryPhase phase, double fraction) {
+    const PhaseHistogram* histogram = &telemetry->phases[phase];
+    if (histogram->count == 0) return 0.0;
+
+    // Rank of the sample we are after, 1-based
+    int rank = (int)ceil(fraction * histogram->count);
+    if (rank < 1) rank = 1;
+
+    int seen = 0;
+    for (int b = 0; b < TELEMETRY_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) return bucket_limit(b);
+    }
+    return bucket_limit(TELEMETRY_BUCKETS - 1);
+}
+
+// Short lowercase name of a phase
+const char* telemetry_phase_name(TelemetryPhase phase) {
+    return phase >= 0 && phase < TELEMETRY_PHASE_COUNT ? phaseNames[phase] : "unknown";
+}
+
+// Open `path` for streaming
+int open_telemetry_stream(TelemetryStream* stream, const char* path) {
+    size_t length = strlen(path);
+    stream->format = length >= 5 && strcmp(path + length - 5, ".json") == 0 ? TELEMETRY_JSON : TELEMETRY_CSV;
+    stream->file = fopen(path, "w");
+    if (!stream->file) {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return -1;
+    }
+
+    if (stream->format == TELEMETRY_CSV) {
+        fprintf(stream->file, "step,time");
+        for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+            const char* name = phaseNames[p];
+            fprintf(stream->file, ",%s_ms,%s_p50_ms,%s_p99_ms", name, name, name);
+        }
+        fprintf(stream->file, ",interactions,force_evaluations,substeps,merged,oversized,neighbor_rebuilt,active\n");
+    }
+    return 0;
+}
+
+// Append one record
+void write_telemetry_record(TelemetryStream* stream, const Telemetry* telemetry, uint64_t step, double time) {
+    FILE* file = stream->file;
+    if (!file) return;
+
+    if (stream->format == TELEMETRY_CSV) {
+        fprintf(file, "%llu,%.6f", (unsigned long long)step, time);
+        for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+            fprintf(file, ",%.4f,%.4f,%.4f",
+                    telemetry->phases[p].last * 1e3,
+                    telemetry_percentile(telemetry, (TelemetryPhase)p, 0.50) * 1e3,
+                    telemetry_percentile(telemetry, (TelemetryPhase)p, 0.99) * 1e3);
+        }
+        fprintf(file, ",%lld,%lld,%d,%d,%d,%d,%d\n",
+                telemetry->interactions, telemetry->forceEvaluations, telemetry->substeps,
+                telemetry->mergedParticles, telemetry->oversizedParticles, telemetry->neighborListRebuilt,
+                telemetry->activeParticles);
+        return;
+    }
+
+    fprintf(file, "{\"step\": %llu, \"time\": %.6f, \"phases\": {", (unsigned long long)step, time);
+    for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+        fprintf(file, "%s\"%s\": {\"ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f}",
+                p > 0 ? ", " : "", phaseNames[p],
+                telemetry->phases[p].last * 1e3,
+                telemetry_percentile(telemetry, (TelemetryPhase)p, 0.50) * 1e3,
+                telemetry_percentile(telemetry, (TelemetryPhase)p, 0.99) * 1e3);
+    }
+    fprintf(file, "}, \"interactions\": %lld, \"force_evaluations\": %lld, \"substeps\": %d, "
+                  "\"merged\": %d, \"oversized\": %d, \"neighbor_rebuilt\": %d, \"active\": %d}\n",
+            telemetry->interactions, telemetry->forceEvaluations, telemetry->substeps,
+            telemetry->mergedParticles, telemetry->oversizedParticles, telemetry->neighborListRebuilt,
+            telemetry->activeParticles);
+}
+
+// Flush and close the stream
+int close_telemetry_stream(TelemetryStream* stream) {
+    if (!stream->file) return 0;
+
+    int failed = ferror(stream->file) != 0;
+    failed |= fclose(stream->file) != 0;
+    stream->file = NULL;
+    if (failed) {
+        fprintf(stderr, "Failed to write telemetry stream\n");
+        return -1;
+    }
+    return 0;
+}
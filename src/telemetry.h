@@ -0,0 +1,103 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "particle.h"
+
+// Per-phase timings and physics counters with rolling percentiles.
+//
+// Each phase keeps its last TELEMETRY_WINDOW samples in a log-scale histogram
+// (TELEMETRY_BUCKETS_PER_OCTAVE buckets per doubling, starting at
+// TELEMETRY_MIN_SECONDS), so p50/p99 cost O(buckets) and no sorting. A
+// percentile is reported as the upper edge of its bucket, i.e. to within 19%.
+
+// Samples per phase that the percentiles cover
+#define TELEMETRY_WINDOW 512
+
+// Histogram resolution: 4 buckets per octave from 0.1 us up to about 20 s
+#define TELEMETRY_BUCKETS_PER_OCTAVE 4
+#define TELEMETRY_MIN_SECONDS 1e-7
+#define TELEMETRY_BUCKETS 112
+
+// Timed phases. Grid through step come from update_particles; events, render
+// and frame are timed by the interactive demo
+typedef enum {
+    TELEMETRY_PHASE_EVENTS,       // Input handling
+    TELEMETRY_PHASE_GRID,         // Grid rebuilds
+    TELEMETRY_PHASE_FORCE,        // Tree build and force evaluation
+    TELEMETRY_PHASE_COLLISION,    // Collision detection and merging
+    TELEMETRY_PHASE_INTEGRATION,  // Kicks, drifts, timestep selection
+    TELEMETRY_PHASE_STEP,         // Whole update_particles call
+    TELEMETRY_PHASE_RENDER,       // Drawing and presenting a frame
+    TELEMETRY_PHASE_FRAME,        // Whole frame of the demo's main loop
+    TELEMETRY_PHASE_COUNT
+} TelemetryPhase;
+
+// Rolling histogram of one phase
+typedef struct {
+    uint8_t samples[TELEMETRY_WINDOW]; // Bucket of each sample in the window, as a ring
+    int next;                         // Ring position of the next sample
+    int count;                        // Samples in the window
+    int buckets[TELEMETRY_BUCKETS];   // Samples per bucket in the window
+    double last;                      // Most recent sample, in seconds
+    double total;                     // Sum of all samples ever recorded
+    long long totalCount;
+} PhaseHistogram;
+
+typedef struct {
+    PhaseHistogram phases[TELEMETRY_PHASE_COUNT];
+
+    // Counters of the most recent step
+    long long interactions;       // Source/target pairs evaluated by the force kernels
+    long long forceEvaluations;   // Particles that got fresh forces
+    int substeps;
+    int mergedParticles;
+    int oversizedParticles;       // Grid overflows: particles searched beyond the 3x3 cells
+    int neighborListRebuilt;      // 1 if the collision neighbor list was rebuilt
+    int activeParticles;
+
+    // Totals since init_telemetry
+    uint64_t steps;
+    long long totalInteractions;
+    long long totalMerged;
+    long long totalNeighborRebuilds;
+} Telemetry;
+
+// Output format of a telemetry stream
+typedef enum {
+    TELEMETRY_CSV,      // Header line, then one row per record
+    TELEMETRY_JSON      // One JSON object per line
+} TelemetryFormat;
+
+typedef struct {
+    FILE* file;
+    TelemetryFormat format;
+} TelemetryStream;
+
+// Start with empty histograms and zero counters
+void init_telemetry(Telemetry* telemetry);
+
+// Add a sample to a phase
+void telemetry_record(Telemetry* telemetry, TelemetryPhase phase, double seconds);
+
+// Add the timings and counters of one update_particles call
+void telemetry_record_step(Telemetry* telemetry, const StepStats* stats);
+
+// Time below which `fraction` (0..1) of the phase's window falls, in seconds; 0 if empty
+double telemetry_percentile(const Telemetry* telemetry, TelemetryPhase phase, double fraction);
+
+// Short lowercase name of a phase, as used in the stream's keys and columns
+const char* telemetry_phase_name(TelemetryPhase phase);
+
+// Open `path` for streaming; a ".json" extension selects JSON lines, anything
+// else CSV. Returns 0 on success, -1 on failure
+int open_telemetry_stream(TelemetryStream* stream, const char* path);
+
+// Append one record: every phase's last, p50 and p99 time plus the counters
+void write_telemetry_record(TelemetryStream* stream, const Telemetry* telemetry, uint64_t step, double time);
+
+// Flush and close the stream. Returns 0 on success, -1 if writing failed
+int close_telemetry_stream(TelemetryStream* stream);
+
+#endif // TELEMETRY_H
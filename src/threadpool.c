@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L // For sysconf and pthreads under -std=c99
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "threadpool.h"
+
+struct ThreadPool {
+    pthread_t* threads;        // Background workers (workerCount - 1 of them)
+    int workerCount;           // Including the calling thread
+
+    pthread_mutex_t lock;
+    pthread_cond_t startCond;  // Signals a new job (or shutdown) to the workers
+    pthread_cond_t doneCond;   // Signals the caller that all workers finished
+
+    // Current job, guarded by `lock`
+    ThreadTask task;
+    void* context;
+    int count;
+    int chunk;
+    int next;                  // First item not yet handed out
+    int busy;                  // Background workers still running the job
+    unsigned int generation;   // Incremented for every job
+    int shutdown;
+};
+
+typedef struct {
+    ThreadPool* pool;
+    int worker;
+} WorkerArgs;
+
+// Number of logical CPUs available to this process
+int get_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// Take chunks until the job runs out of items
+static void run_chunks(ThreadPool* pool, int worker) {
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        int start = pool->next;
+        int chunk = pool->chunk;
+        pool->next += chunk;
+        ThreadTask task = pool->task;
+        void* context = pool->context;
+        int count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (start >= count) break;
+
+        int end = start + chunk;
+        if (end > count) end = count;
+        task(context, start, end, worker);
+    }
+}
+
+// Background worker: wait for a job, help run it, report back
+static void* worker_main(void* arg) {
+    WorkerArgs args = *(WorkerArgs*)arg;
+    ThreadPool* pool = args.pool;
+    free(arg);
+
+    // Workers start before any job can be issued, so generation 0 is "seen"
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->startCond, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool, args.worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->doneCond);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Start a pool with `threadCount` workers in total
+ThreadPool* create_thread_pool(int threadCount) {
+    if (threadCount <= 0) threadCount = get_cpu_count();
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        fprintf(stderr, "Failed to allocate memory for thread pool\n");
+        return NULL;
+    }
+
+    pool->workerCount = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->startCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+
+    if (threadCount > 1) {
+        pool->threads = (pthread_t*)malloc((threadCount - 1) * sizeof(pthread_t));
+        if (pool->threads == NULL) {
+            fprintf(stderr, "Failed to allocate memory for worker threads\n");
+            return pool;
+        }
+    }
+
+    // A failed thread start simply leaves the pool smaller
+    for (int i = 1; i < threadCount; i++) {
+        WorkerArgs* args = (WorkerArgs*)malloc(sizeof(WorkerArgs));
+        if (args == NULL) break;
+        args->pool = pool;
+        args->worker = i;
+
+        if (pthread_create(&pool->threads[i - 1], NULL, worker_main, args) != 0) {
+            fprintf(stderr, "Failed to start worker thread %d\n", i);
+            free(args);
+            break;
+        }
+        pool->workerCount++;
+    }
+
+    return pool;
+}
+
+// Total number of workers, including the calling thread
+int thread_pool_size(const ThreadPool* pool) {
+    return pool ? pool->workerCount : 1;
+}
+
+// Run `task` over items [0, count) and wait for it to finish
+void thread_pool_run(ThreadPool* pool, ThreadTask task, void* context, int count, int chunk) {
+    if (count <= 0) return;
+    if (chunk < 1) chunk = 1;
+
+    // Not worth waking anybody up
+    if (pool == NULL || pool->workerCount == 1 || count <= chunk) {
+        task(context, 0, count, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->count = count;
+    pool->chunk = chunk;
+    pool->next = 0;
+    pool->busy = pool->workerCount - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->doneCond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Stop and join all workers
+void destroy_thread_pool(ThreadPool* pool) {
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->workerCount - 1; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->startCond);
+    pthread_cond_destroy(&pool->doneCond);
+    free(pool->threads);
+    free(pool);
+}
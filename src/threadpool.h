@@ -0,0 +1,32 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Persistent pool of worker threads for data-parallel loops.
+//
+// Work is handed out in chunks of consecutive items. Which worker runs a chunk
+// varies between runs, so tasks must write only to per-item outputs (or to
+// per-worker scratch selected by `worker`) to stay deterministic.
+
+// Body of a parallel loop: process items [start, end) on the given worker
+typedef void (*ThreadTask)(void* context, int start, int end, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+// Number of logical CPUs available to this process
+int get_cpu_count(void);
+
+// Start a pool with `threadCount` workers in total (including the calling
+// thread); 0 uses one worker per logical CPU
+ThreadPool* create_thread_pool(int threadCount);
+
+// Total number of workers, including the calling thread
+int thread_pool_size(const ThreadPool* pool);
+
+// Run `task` over items [0, count) in chunks of `chunk` items and wait for it to finish.
+// The calling thread works as worker 0. A NULL pool runs everything on the caller
+void thread_pool_run(ThreadPool* pool, ThreadTask task, void* context, int count, int chunk);
+
+// Stop and join all workers
+void destroy_thread_pool(ThreadPool* pool);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,575 @@
+#define _POSIX_C_SOURCE 200809L // For fork, socketpair and process-shared pthreads under -std=c99
+#define _DEFAULT_SOURCE         // For MAP_ANONYMOUS
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#ifdef NBODY_MPI
+#include <mpi.h>
+#endif
+#include "transport.h"
+
+// Bytes buffered per direction between two ranks of the shm backend
+#define SHM_CHANNEL_BYTES (256 * 1024)
+
+// How often a blocked shm rank checks whether the others are still alive
+#define SHM_POLL_SECONDS 1
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Short name of a transport
+const char* transport_name(TransportType type) {
+    switch (type) {
+    case TRANSPORT_SHM: return "shm";
+    case TRANSPORT_MPI: return "mpi";
+    default: return "socket";
+    }
+}
+
+// Transport with the given short name
+int parse_transport(const char* name, TransportType* type) {
+    if (strcmp(name, "socket") == 0) {
+        *type = TRANSPORT_SOCKET;
+    } else if (strcmp(name, "shm") == 0) {
+        *type = TRANSPORT_SHM;
+    } else if (strcmp(name, "mpi") == 0) {
+        *type = TRANSPORT_MPI;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+
+// Ranks forked on this machine: rank 0 is the original process
+typedef struct {
+    pid_t* children;    // Process of every rank, on rank 0 only (entry 0 unused)
+    pid_t parent;       // Process of rank 0
+} LocalRanks;
+
+// Fork ranks - 1 children. Returns the caller's rank, or -1 if not a single fork succeeded
+static int fork_ranks(LocalRanks* local, int ranks) {
+    local->children = (pid_t*)calloc(ranks, sizeof(pid_t));
+    local->parent = getpid();
+    if (local->children == NULL) {
+        fprintf(stderr, "Failed to allocate memory for ranks\n");
+        return -1;
+    }
+
+    // Anything still buffered would otherwise be written once per rank
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int r = 1; r < ranks; r++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            free(local->children);
+            local->children = NULL;
+            return r;
+        }
+        if (pid < 0) {
+            // The ranks already started find their peer gone and fail on their own
+            fprintf(stderr, "Failed to start rank %d\n", r);
+            return -1;
+        }
+        local->children[r] = pid;
+    }
+    return 0;
+}
+
+// Wait for the children of rank 0. Returns 0 if all of them exited cleanly
+static int wait_ranks(LocalRanks* local, int ranks) {
+    int failed = 0;
+    if (local->children) {
+        for (int r = 1; r < ranks; r++) {
+            int status;
+            if (local->children[r] <= 0) continue;
+            if (waitpid(local->children[r], &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "Rank %d failed\n", r);
+                failed = 1;
+            }
+        }
+    }
+    free(local->children);
+    local->children = NULL;
+    return failed ? -1 : 0;
+}
+
+// ---- Unix domain sockets ----
+
+typedef struct {
+    LocalRanks local;
+    int* sockets;       // Socket to every peer, -1 for the rank itself
+} SocketTransport;
+
+static int socket_send(Transport* transport, int peer, const void* data, size_t bytes) {
+    SocketTransport* impl = (SocketTransport*)transport->impl;
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t n = send(impl->sockets[peer], p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Failed to send to rank %d\n", peer);
+            return -1;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return 0;
+}
+
+static int socket_recv(Transport* transport, int peer, void* data, size_t bytes) {
+    SocketTransport* impl = (SocketTransport*)transport->impl;
+    char* p = (char*)data;
+    while (bytes > 0) {
+        ssize_t n = recv(impl->sockets[peer], p, bytes, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Failed to receive from rank %d\n", peer);
+            return -1;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return 0;
+}
+
+static int socket_close(Transport* transport) {
+    SocketTransport* impl = (SocketTransport*)transport->impl;
+    for (int r = 0; r < transport->size; r++) {
+        if (impl->sockets[r] >= 0) close(impl->sockets[r]);
+    }
+    // Closing first lets children blocked on rank 0 see it is gone
+    int status = wait_ranks(&impl->local, transport->size);
+    free(impl->sockets);
+    free(impl);
+    return status;
+}
+
+// One connected socket pair per pair of ranks, created before forking so
+// every rank inherits its ends
+static Transport* create_socket_transport(Transport* transport, int ranks) {
+    SocketTransport* impl = (SocketTransport*)calloc(1, sizeof(SocketTransport));
+    int* ends = (int*)malloc((size_t)ranks * ranks * sizeof(int));
+    if (!impl || !ends) {
+        fprintf(stderr, "Failed to allocate memory for the socket transport\n");
+        free(impl);
+        free(ends);
+        return NULL;
+    }
+
+    // ends[a * ranks + b] is the end rank a uses to talk to rank b
+    for (int k = 0; k < ranks * ranks; k++) ends[k] = -1;
+    for (int a = 0; a < ranks; a++) {
+        for (int b = a + 1; b < ranks; b++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                fprintf(stderr, "Failed to create a socket pair\n");
+                for (int k = 0; k < ranks * ranks; k++) {
+                    if (ends[k] >= 0) close(ends[k]);
+                }
+                free(ends);
+                free(impl);
+                return NULL;
+            }
+            ends[a * ranks + b] = pair[0];
+            ends[b * ranks + a] = pair[1];
+        }
+    }
+
+    int rank = fork_ranks(&impl->local, ranks);
+
+    // Keep this rank's ends only, so a rank that dies closes its sockets for good
+    impl->sockets = (int*)malloc((size_t)ranks * sizeof(int));
+    for (int k = 0; k < ranks * ranks; k++) {
+        if (k / ranks == rank && impl->sockets) {
+            impl->sockets[k % ranks] = ends[k];
+        } else if (ends[k] >= 0) {
+            close(ends[k]);
+        }
+    }
+    free(ends);
+
+    if (rank < 0 || impl->sockets == NULL) {
+        if (impl->sockets) {
+            for (int r = 0; r < ranks; r++) {
+                if (impl->sockets[r] >= 0) close(impl->sockets[r]);
+            }
+        }
+        wait_ranks(&impl->local, ranks);
+        free(impl->sockets);
+        free(impl);
+        return NULL;
+    }
+
+    transport->rank = rank;
+    transport->send = socket_send;
+    transport->recv = socket_recv;
+    transport->close = socket_close;
+    transport->impl = impl;
+    return transport;
+}
+
+// ---- Shared memory ----
+
+// One direction between two ranks: a ring buffer guarded by a process-shared mutex
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // Bytes were written or read
+    uint64_t written;           // Total bytes ever written
+    uint64_t read;              // Total bytes ever read
+    char data[SHM_CHANNEL_BYTES];
+} ShmChannel;
+
+// Start of the shared mapping, followed by ranks * ranks channels
+typedef struct {
+    volatile sig_atomic_t failed;   // Set by any rank that gives up, so the others stop waiting
+} ShmHeader;
+
+typedef struct {
+    LocalRanks local;
+    void* mapping;
+    size_t mappingSize;
+    ShmHeader* header;
+    ShmChannel* channels;       // Channel from rank a to rank b at a * ranks + b
+} ShmTransport;
+
+// Whether the other ranks may still show up: rank 0 checks its children,
+// the others check that rank 0 is still their parent
+static int shm_peers_alive(ShmTransport* impl, int ranks) {
+    if (impl->header->failed) return 0;
+
+    if (impl->local.children) {
+        for (int r = 1; r < ranks; r++) {
+            int status;
+            if (impl->local.children[r] > 0 &&
+                waitpid(impl->local.children[r], &status, WNOHANG) == impl->local.children[r]) {
+                impl->local.children[r] = 0;
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 0;
+            }
+        }
+        return 1;
+    }
+    return getppid() == impl->local.parent;
+}
+
+// Wait for the channel to change, giving up if the other ranks are gone
+static int shm_wait(ShmTransport* impl, ShmChannel* channel, int ranks) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SHM_POLL_SECONDS;
+
+    int result = pthread_cond_timedwait(&channel->changed, &channel->lock, &deadline);
+    if (result == ETIMEDOUT && !shm_peers_alive(impl, ranks)) {
+        impl->header->failed = 1;
+        return -1;
+    }
+    return impl->header->failed ? -1 : 0;
+}
+
+static int shm_send(Transport* transport, int peer, const void* data, size_t bytes) {
+    ShmTransport* impl = (ShmTransport*)transport->impl;
+    ShmChannel* channel = &impl->channels[transport->rank * transport->size + peer];
+    const char* p = (const char*)data;
+    int status = 0;
+
+    pthread_mutex_lock(&channel->lock);
+    while (bytes > 0) {
+        size_t space = SHM_CHANNEL_BYTES - (size_t)(channel->written - channel->read);
+        if (space == 0) {
+            if (shm_wait(impl, channel, transport->size) != 0) {
+                status = -1;
+                break;
+            }
+            continue;
+        }
+
+        // Copy up to the free space, split where the ring wraps around
+        size_t offset = (size_t)(channel->written % SHM_CHANNEL_BYTES);
+        size_t n = bytes < space ? bytes : space;
+        if (n > SHM_CHANNEL_BYTES - offset) n = SHM_CHANNEL_BYTES - offset;
+        memcpy(channel->data + offset, p, n);
+        channel->written += n;
+        p += n;
+        bytes -= n;
+        pthread_cond_broadcast(&channel->changed);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    if (status != 0) fprintf(stderr, "Failed to send to rank %d\n", peer);
+    return status;
+}
+
+static int shm_recv(Transport* transport, int peer, void* data, size_t bytes) {
+    ShmTransport* impl = (ShmTransport*)transport->impl;
+    ShmChannel* channel = &impl->channels[peer * transport->size + transport->rank];
+    char* p = (char*)data;
+    int status = 0;
+
+    pthread_mutex_lock(&channel->lock);
+    while (bytes > 0) {
+        size_t available = (size_t)(channel->written - channel->read);
+        if (available == 0) {
+            if (shm_wait(impl, channel, transport->size) != 0) {
+                status = -1;
+                break;
+            }
+            continue;
+        }
+
+        size_t offset = (size_t)(channel->read % SHM_CHANNEL_BYTES);
+        size_t n = bytes < available ? bytes : available;
+        if (n > SHM_CHANNEL_BYTES - offset) n = SHM_CHANNEL_BYTES - offset;
+        memcpy(p, channel->data + offset, n);
+        channel->read += n;
+        p += n;
+        bytes -= n;
+        pthread_cond_broadcast(&channel->changed);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    if (status != 0) fprintf(stderr, "Failed to receive from rank %d\n", peer);
+    return status;
+}
+
+static int shm_close(Transport* transport) {
+    ShmTransport* impl = (ShmTransport*)transport->impl;
+    int status = wait_ranks(&impl->local, transport->size);
+    if (impl->header->failed) status = -1;
+    munmap(impl->mapping, impl->mappingSize);
+    free(impl);
+    return status;
+}
+
+// Map the channels of every pair of ranks, shared with the children forked after it
+static Transport* create_shm_transport(Transport* transport, int ranks) {
+    ShmTransport* impl = (ShmTransport*)calloc(1, sizeof(ShmTransport));
+    if (impl == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the shared memory transport\n");
+        return NULL;
+    }
+
+    // Channels start on a cache line so neighboring ones do not share one
+    size_t headerSize = (sizeof(ShmHeader) + 63) / 64 * 64;
+    impl->mappingSize = headerSize + (size_t)ranks * ranks * sizeof(ShmChannel);
+    impl->mapping = mmap(NULL, impl->mappingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (impl->mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shared memory for %d ranks\n", ranks);
+        free(impl);
+        return NULL;
+    }
+    impl->header = (ShmHeader*)impl->mapping;
+    impl->channels = (ShmChannel*)((char*)impl->mapping + headerSize);
+
+    pthread_mutexattr_t mutexAttr;
+    pthread_condattr_t condAttr;
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+    for (int k = 0; k < ranks * ranks; k++) {
+        pthread_mutex_init(&impl->channels[k].lock, &mutexAttr);
+        pthread_cond_init(&impl->channels[k].changed, &condAttr);
+    }
+    pthread_mutexattr_destroy(&mutexAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    int rank = fork_ranks(&impl->local, ranks);
+    if (rank < 0) {
+        impl->header->failed = 1;
+        wait_ranks(&impl->local, ranks);
+        munmap(impl->mapping, impl->mappingSize);
+        free(impl);
+        return NULL;
+    }
+
+    transport->rank = rank;
+    transport->send = shm_send;
+    transport->recv = shm_recv;
+    transport->close = shm_close;
+    transport->impl = impl;
+    return transport;
+}
+
+#endif // !_WIN32
+
+#ifdef NBODY_MPI
+
+// ---- MPI ----
+
+// MPI counts are ints, so large messages go in pieces
+#define MPI_CHUNK_BYTES (1 << 30)
+
+static int mpi_send(Transport* transport, int peer, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    (void)transport;
+    while (bytes > 0) {
+        int n = bytes > MPI_CHUNK_BYTES ? MPI_CHUNK_BYTES : (int)bytes;
+        if (MPI_Send((void*)p, n, MPI_BYTE, peer, 0, MPI_COMM_WORLD) != MPI_SUCCESS) {
+            fprintf(stderr, "Failed to send to rank %d\n", peer);
+            return -1;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return 0;
+}
+
+static int mpi_recv(Transport* transport, int peer, void* data, size_t bytes) {
+    char* p = (char*)data;
+    (void)transport;
+    while (bytes > 0) {
+        int n = bytes > MPI_CHUNK_BYTES ? MPI_CHUNK_BYTES : (int)bytes;
+        if (MPI_Recv(p, n, MPI_BYTE, peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+            fprintf(stderr, "Failed to receive from rank %d\n", peer);
+            return -1;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return 0;
+}
+
+static int mpi_close(Transport* transport) {
+    (void)transport;
+    return MPI_Finalize() == MPI_SUCCESS ? 0 : -1;
+}
+
+// Ranks come from the MPI launcher
+static Transport* create_mpi_transport(Transport* transport) {
+    int initialized = 0;
+    MPI_Initialized(&initialized);
+    if (!initialized && MPI_Init(NULL, NULL) != MPI_SUCCESS) {
+        fprintf(stderr, "Failed to initialize MPI\n");
+        return NULL;
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &transport->rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &transport->size);
+    transport->send = mpi_send;
+    transport->recv = mpi_recv;
+    transport->close = mpi_close;
+    transport->impl = NULL;
+    return transport;
+}
+
+#endif // NBODY_MPI
+
+// Start a run of `ranks` processes and return the calling process's end
+Transport* create_transport(TransportType type, int ranks) {
+    Transport* transport = (Transport*)calloc(1, sizeof(Transport));
+    if (transport == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the transport\n");
+        return NULL;
+    }
+    transport->type = type;
+    transport->size = ranks > 0 ? ranks : 1;
+
+    Transport* created = NULL;
+    if (type == TRANSPORT_MPI) {
+#ifdef NBODY_MPI
+        created = create_mpi_transport(transport);
+#else
+        fprintf(stderr, "Failed to start MPI: this build has no MPI support (build with NBODY_MPI)\n");
+#endif
+    } else {
+#ifndef _WIN32
+        created = type == TRANSPORT_SHM ? create_shm_transport(transport, transport->size)
+                                        : create_socket_transport(transport, transport->size);
+#else
+        fprintf(stderr, "Failed to start ranks: the %s transport needs a POSIX system\n",
+                transport_name(type));
+#endif
+    }
+
+    if (created == NULL) free(transport);
+    return created;
+}
+
+// Shut down a transport
+int close_transport(Transport* transport) {
+    if (transport == NULL) return 0;
+    int status = transport->close(transport);
+    free(transport);
+    return status;
+}
+
+// Swap a variable-size message with `peer`; the lower rank sends first
+long long transport_exchange(Transport* transport, int peer, const void* data, size_t bytes,
+                             void** buffer, size_t* capacity) {
+    uint64_t sendSize = bytes;
+    uint64_t recvSize = 0;
+    int sendFirst = transport->rank < peer;
+
+    if (sendFirst && (transport->send(transport, peer, &sendSize, sizeof(sendSize)) != 0 ||
+                      transport->send(transport, peer, data, bytes) != 0)) {
+        return -1;
+    }
+
+    if (transport->recv(transport, peer, &recvSize, sizeof(recvSize)) != 0) return -1;
+    if (recvSize > *capacity) {
+        void* grown = realloc(*buffer, (size_t)recvSize);
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate memory for a message from rank %d\n", peer);
+            return -1;
+        }
+        *buffer = grown;
+        *capacity = (size_t)recvSize;
+    }
+    if (transport->recv(transport, peer, *buffer, (size_t)recvSize) != 0) return -1;
+
+    if (!sendFirst && (transport->send(transport, peer, &sendSize, sizeof(sendSize)) != 0 ||
+                       transport->send(transport, peer, data, bytes) != 0)) {
+        return -1;
+    }
+    return (long long)recvSize;
+}
+
+// Sum values over all ranks: rank 0 adds them up in rank order and sends the total back
+int transport_allreduce_sum(Transport* transport, double* values, int count) {
+    size_t bytes = (size_t)count * sizeof(double);
+
+    if (transport->rank != 0) {
+        return transport->send(transport, 0, values, bytes) != 0 ||
+               transport->recv(transport, 0, values, bytes) != 0 ? -1 : 0;
+    }
+
+    double* incoming = (double*)malloc(bytes > 0 ? bytes : 1);
+    if (incoming == NULL) {
+        fprintf(stderr, "Failed to allocate memory for a reduction\n");
+        return -1;
+    }
+    int status = 0;
+    for (int r = 1; r < transport->size && status == 0; r++) {
+        status = transport->recv(transport, r, incoming, bytes);
+        for (int k = 0; k < count && status == 0; k++) {
+            values[k] += incoming[k];
+        }
+    }
+    for (int r = 1; r < transport->size && status == 0; r++) {
+        status = transport->send(transport, r, values, bytes);
+    }
+    free(incoming);
+    return status;
+}
@@ -0,0 +1,74 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+
+// Point-to-point byte transport between the ranks (processes) of a decomposed
+// run (see domain.h).
+//
+// Every backend offers the same blocking send and receive, so the
+// decomposition code does not care how bytes travel:
+//
+//   socket  Unix domain socket pairs between processes forked on this machine
+//   shm     Ring buffers in a shared memory mapping, also between forked processes
+//   mpi     MPI point-to-point messages; ranks are started by mpirun, possibly on
+//           several machines. Only available in builds with NBODY_MPI defined
+//
+// Sends may block until the peer receives, so every exchange is done in an
+// order that cannot deadlock: ranks go through the pairs (a, b), a < b, in one
+// fixed order, and in each pair the lower rank sends first.
+
+typedef enum {
+    TRANSPORT_SOCKET,
+    TRANSPORT_SHM,
+    TRANSPORT_MPI,
+    TRANSPORT_COUNT
+} TransportType;
+
+typedef struct Transport Transport;
+
+struct Transport {
+    TransportType type;
+    int rank;           // This process, 0 .. size - 1
+    int size;           // Number of ranks
+
+    // Send `bytes` bytes to `peer`. Returns 0 on success, -1 on failure
+    int (*send)(Transport* transport, int peer, const void* data, size_t bytes);
+
+    // Receive exactly `bytes` bytes from `peer`. Returns 0 on success, -1 on failure
+    int (*recv)(Transport* transport, int peer, void* data, size_t bytes);
+
+    // Release the backend (and, on rank 0 of a forked run, wait for the other ranks)
+    int (*close)(Transport* transport);
+
+    void* impl;         // Backend state
+};
+
+// Short name of a transport ("socket", "shm", "mpi")
+const char* transport_name(TransportType type);
+
+// Transport with the given short name. Returns 0 on success, -1 if the name is unknown
+int parse_transport(const char* name, TransportType* type);
+
+// Start a run of `ranks` processes and return the calling process's end.
+// The socket and shm backends fork ranks - 1 children, which continue from
+// this call with their own rank; call it before any threads are started. The
+// mpi backend takes its ranks from the MPI launcher and ignores `ranks`.
+// Returns NULL on failure or if the backend is not available in this build
+Transport* create_transport(TransportType type, int ranks);
+
+// Shut down a transport. Rank 0 of a forked run waits for the other ranks.
+// Returns 0 if every rank finished cleanly, -1 otherwise
+int close_transport(Transport* transport);
+
+// Swap a variable-size message with `peer`: send `bytes` bytes of `data` and
+// receive the peer's message into `*buffer`, grown with realloc as needed
+// (`*capacity` tracks its size). Returns the received size, or -1 on failure
+long long transport_exchange(Transport* transport, int peer, const void* data, size_t bytes,
+                             void** buffer, size_t* capacity);
+
+// Sum `count` values over all ranks; every rank gets the total. The sum is
+// taken in rank order, so every rank sees the same bits. Returns 0 on success, -1 on failure
+int transport_allreduce_sum(Transport* transport, double* values, int count);
+
+#endif // TRANSPORT_H
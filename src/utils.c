@@ -1,15 +1,62 @@
+#define _POSIX_C_SOURCE 200112L // For posix_memalign and clock_gettime
+
 #include <stdlib.h>
 #include <time.h>
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#endif
 #include "utils.h"
 
+// Last seed given to init_random or seed_random
+static uint64_t randomSeed = 0;
+
 void init_random() {
-    srand((unsigned int)time(NULL));
+    randomSeed = (uint64_t)time(NULL);
+    srand((unsigned int)randomSeed);
+}
+
+void seed_random(unsigned int seed) {
+    randomSeed = seed;
+    srand(seed);
+}
+
+uint64_t get_random_seed(void) {
+    return randomSeed;
 }
 
 float random_float(float min, float max) {
     return min + (float)rand() / ((float)RAND_MAX / (max - min));
 }
 
-Uint32 get_current_time() {
-    return SDL_GetTicks();
-}
\ No newline at end of file
+double get_time_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1e-9 * (double)now.tv_nsec;
+#endif
+}
+
+void* aligned_malloc(size_t size, size_t alignment) {
+    if (size == 0) size = alignment;
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, alignment, size) != 0) return NULL;
+    return ptr;
+#endif
+}
+
+void aligned_free(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
@@ -1,15 +1,28 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <SDL2/SDL.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Initialize random number generator
 void init_random();
 
+// Seed the random number generator for reproducible runs
+void seed_random(unsigned int seed);
+
+// Seed of the current run, for the counter-based generators in rng.h
+uint64_t get_random_seed(void);
+
 // Function to generate a random float between min and max
 float random_float(float min, float max);
 
-// Function to get the current time in milliseconds
-Uint32 get_current_time();
+// Monotonic high-resolution time in seconds, for measuring intervals
+double get_time_seconds(void);
+
+// Allocate memory aligned to `alignment` bytes (a power of two); release with aligned_free
+void* aligned_malloc(size_t size, size_t alignment);
+
+// Free memory returned by aligned_malloc
+void aligned_free(void* ptr);
 
-#endif // UTILS_H
\ No newline at end of file
+#endif // UTILS_H
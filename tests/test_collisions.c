@@ -0,0 +1,120 @@
+// Checks that the collision phase pairs every touching pair, including pairs
+// of bodies too large for the regular grid search, and that a touching chain
+// merges pair by pair at the center of mass. Exits non-zero on failure.
+#include <stdio.h>
+#include <math.h>
+#include "particle.h"
+#include "collision.h"
+
+#define SMALL_COUNT 1600
+
+// Two mass-10000 bodies (radius about 202) overlapping by about 54, next to
+// many small particles that keep the grid cells small. They must merge, with
+// and without the neighbor list, on any thread count
+static int check_oversized_pair(float skin, int threads) {
+    static Real x[SMALL_COUNT + 2], y[SMALL_COUNT + 2], vx[SMALL_COUNT + 2], vy[SMALL_COUNT + 2];
+    static float mass[SMALL_COUNT + 2];
+    for (int i = 0; i < SMALL_COUNT; i++) {
+        x[i] = REAL(20.0) + (Real)(i % 40) * REAL(10.0);
+        y[i] = REAL(20.0) + (Real)(i / 40) * REAL(10.0);
+        vx[i] = vy[i] = REAL(0.0);
+        mass[i] = 0.001f;
+    }
+    x[SMALL_COUNT] = REAL(825.0);
+    x[SMALL_COUNT + 1] = REAL(1175.0);
+    y[SMALL_COUNT] = y[SMALL_COUNT + 1] = REAL(1000.0);
+    vx[SMALL_COUNT] = vy[SMALL_COUNT] = vx[SMALL_COUNT + 1] = vy[SMALL_COUNT + 1] = REAL(0.0);
+    mass[SMALL_COUNT] = mass[SMALL_COUNT + 1] = 10000.0f;
+
+    set_world_bounds(2000.0f, 2000.0f);
+    set_gravity_solver(SOLVER_GRID);
+    set_reorder_interval(0);
+    set_collision_skin(skin);
+    set_thread_count(threads);
+
+    ParticleSystem* ps = create_particles(0);
+    ParticleHandle handles[2];
+    if (ps == NULL || add_particles(ps, SMALL_COUNT + 2, x, y, vx, vy, mass, NULL) < 0) {
+        fprintf(stderr, "Failed to create particles\n");
+        free_particles(ps);
+        return 1;
+    }
+    handles[0] = get_particle_handle(ps, SMALL_COUNT);
+    handles[1] = get_particle_handle(ps, SMALL_COUNT + 1);
+
+    update_particles(ps, 0.016f);
+    int alive = (find_particle(ps, handles[0]) >= 0) + (find_particle(ps, handles[1]) >= 0);
+    int merged = get_step_stats()->mergedParticles;
+    free_particles(ps);
+
+    if (alive != 1 || merged != 1) {
+        fprintf(stderr, "oversized pair, skin %g, %d threads: %d of 2 bodies left, %d merged\n",
+                skin, threads, alive, merged);
+        return 1;
+    }
+    return 0;
+}
+
+// A chain A-B-C of masses 1, 4 and 9 where A and C do not touch. B merges
+// into C at their center of mass with their momentum; A waits, since the body
+// it touches is absorbed elsewhere this step
+static int check_chain(float skin, int threads) {
+    Real x[3] = { REAL(100.0), REAL(109.0), REAL(122.0) };
+    Real y[3] = { REAL(100.0), REAL(100.0), REAL(100.0) };
+    Real vx[3] = { REAL(1.0), REAL(0.0), REAL(-1.0) };
+    Real vy[3] = { REAL(0.0), REAL(2.0), REAL(0.0) };
+    float mass[3] = { 1.0f, 4.0f, 9.0f };
+
+    set_world_bounds(1000.0f, 1000.0f);
+    set_gravity_solver(SOLVER_GRID);
+    set_reorder_interval(0);
+    set_collision_skin(skin);
+    set_thread_count(threads);
+
+    ParticleSystem* ps = create_particles(0);
+    ParticleHandle handles[3];
+    if (ps == NULL || add_particles(ps, 3, x, y, vx, vy, mass, handles) < 0) {
+        fprintf(stderr, "Failed to create particles\n");
+        free_particles(ps);
+        return 1;
+    }
+
+    update_particles(ps, 1e-6f);
+    int a = find_particle(ps, handles[0]);
+    int b = find_particle(ps, handles[1]);
+    int c = find_particle(ps, handles[2]);
+    int merged = get_step_stats()->mergedParticles;
+    int failed = a < 0 || b >= 0 || c < 0 || merged != 1;
+    if (!failed) {
+        // Center of mass (4 * 109 + 9 * 122) / 13 = 118, momentum (-9, 8) / 13
+        failed = ps->mass[a] != 1.0f || ps->mass[c] != 13.0f ||
+                 fabs((double)ps->x[c] - 118.0) > 1e-3 || fabs((double)ps->y[c] - 100.0) > 1e-3 ||
+                 fabs((double)ps->vx[c] + 9.0 / 13.0) > 1e-3 || fabs((double)ps->vy[c] - 8.0 / 13.0) > 1e-3;
+    }
+    free_particles(ps);
+
+    if (failed) {
+        fprintf(stderr, "chain, skin %g, %d threads: slots %d %d %d, %d merged\n",
+                skin, threads, a, b, c, merged);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const float skins[] = { 0.0f, COLLISION_DEFAULT_SKIN };
+    int failures = 0;
+    for (int s = 0; s < 2; s++) {
+        failures += check_oversized_pair(skins[s], 1);
+        failures += check_oversized_pair(skins[s], 4);
+        failures += check_chain(skins[s], 1);
+        failures += check_chain(skins[s], 4);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%d collision checks failed\n", failures);
+        return 1;
+    }
+    printf("collisions ok\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+// Checks every force kernel this build and CPU can run against the scalar
+// reference, the reference against a double-precision sum, and the reference
+// against the original pairwise force it replaced. Exits non-zero on any
+// mismatch.
+#include <stdio.h>
+#include <math.h>
+#include "force_kernel.h"
+#include "particle.h"
+
+// Largest error accepted, relative to the sum of the magnitudes of all
+// contributions (so cancelling forces do not turn rounding into failures)
+#define TEST_TOLERANCE 1e-5
+
+#define MAX_SOURCES 1031
+
+static float sx[MAX_SOURCES], sy[MAX_SOURCES], sm[MAX_SOURCES];
+
+// Small LCG, so the batch is the same on every run and platform
+static unsigned int state = 12345u;
+
+static float next_float(float min, float max) {
+    state = state * 1664525u + 1013904223u;
+    return min + (float)(state >> 8) / 16777216.0f * (max - min);
+}
+
+// Double-precision acceleration and the sum of the contributions' magnitudes
+static void reference_double(float px, float py, int n, float eps_sq, double* ax, double* ay, double* scale) {
+    *ax = *ay = *scale = 0.0;
+    for (int j = 0; j < n; j++) {
+        double dx = (double)sx[j] - px;
+        double dy = (double)sy[j] - py;
+        double r2 = dx * dx + dy * dy + eps_sq;
+        double s = sm[j] / (r2 * sqrt(r2));
+        *ax += s * dx;
+        *ay += s * dy;
+        *scale += s * sqrt(dx * dx + dy * dy);
+    }
+    *ax *= G;
+    *ay *= G;
+    *scale *= G;
+}
+
+// The simulator's original pairwise force (apply_gravity), turned into the
+// acceleration of a target at (px, py) from the first n sources. Squared
+// distances below 1 were clamped to 1 instead of softened
+static void original_pairwise(float px, float py, int n, float* ax, float* ay) {
+    *ax = *ay = 0.0f;
+    for (int j = 0; j < n; j++) {
+        float dx = sx[j] - px;
+        float dy = sy[j] - py;
+        float distance_sq = dx * dx + dy * dy;
+        if (distance_sq < 1.0f) distance_sq = 1.0f;
+
+        float distance = sqrtf(distance_sq);
+        float magnitude = G * sm[j] / distance_sq;
+        *ax += magnitude * dx / distance;
+        *ay += magnitude * dy / distance;
+    }
+}
+
+// Error of (ax, ay) against (ref_x, ref_y), relative to `scale`
+static double relative_error(double ax, double ay, double ref_x, double ref_y, double scale) {
+    double diff = sqrt((ax - ref_x) * (ax - ref_x) + (ay - ref_y) * (ay - ref_y));
+    return scale > 0.0 ? diff / scale : diff;
+}
+
+// Compare the scalar reference at the smallest softening with the original
+// pairwise force. Outside the clamp radius the two laws differ by about
+// 1.5 * eps^2 / r^2, far below the tolerance
+static int check_original(float px, float py, int n) {
+    float ref_x, ref_y, ax, ay;
+    double exact_x, exact_y, scale;
+    float eps_sq = MIN_SOFTENING * MIN_SOFTENING;
+    force_kernel_scalar(px, py, sx, sy, sm, n, eps_sq, &ref_x, &ref_y);
+    original_pairwise(px, py, n, &ax, &ay);
+    reference_double(px, py, n, eps_sq, &exact_x, &exact_y, &scale);
+
+    double error = relative_error(ax, ay, ref_x, ref_y, scale);
+    if (!(error <= TEST_TOLERANCE)) {
+        fprintf(stderr, "original pairwise force: n %d: error %g against scalar\n", n, error);
+        return 1;
+    }
+    return 0;
+}
+
+// Compare `kernel` with the scalar reference on the first n sources, from a target at (px, py)
+static int check(const char* name, ForceKernel kernel, float px, float py, int n, float eps_sq, double* worst) {
+    float ref_x, ref_y, ax, ay;
+    double exact_x, exact_y, scale;
+    force_kernel_scalar(px, py, sx, sy, sm, n, eps_sq, &ref_x, &ref_y);
+    kernel(px, py, sx, sy, sm, n, eps_sq, &ax, &ay);
+    reference_double(px, py, n, eps_sq, &exact_x, &exact_y, &scale);
+
+    double error = relative_error(ax, ay, ref_x, ref_y, scale);
+    double referenceError = relative_error(ref_x, ref_y, exact_x, exact_y, scale);
+    if (error > *worst) *worst = error;
+    if (!(error <= TEST_TOLERANCE) || !(referenceError <= TEST_TOLERANCE)) {
+        fprintf(stderr, "%s: n %d, eps^2 %g: error %g against scalar, scalar error %g\n",
+                name, n, eps_sq, error, referenceError);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const float softenings[] = { MIN_SOFTENING, 0.1f, 1.0f, 5.0f };
+    static const int counts[] = { 0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 33, 63, 65, 203, 1000, MAX_SOURCES };
+    const int softeningCount = (int)(sizeof(softenings) / sizeof(softenings[0]));
+    const int countCount = (int)(sizeof(counts) / sizeof(counts[0]));
+    int failures = 0;
+
+    for (int isa = FORCE_ISA_SCALAR; isa <= FORCE_ISA_AVX512; isa++) {
+        const char* name = force_kernel_isa_name((ForceKernelIsa)isa);
+        if (set_force_kernel_isa((ForceKernelIsa)isa) != 0) {
+            printf("%-7s skipped (not built or not supported by this CPU)\n", name);
+            continue;
+        }
+        ForceKernel kernel = get_force_kernel();
+        double worst = 0.0;
+
+        for (int s = 0; s < softeningCount; s++) {
+            float eps_sq = softenings[s] * softenings[s];
+
+            // Sources spread over the world, target among them
+            state = 12345u;
+            for (int j = 0; j < MAX_SOURCES; j++) {
+                sx[j] = next_float(0.0f, 800.0f);
+                sy[j] = next_float(0.0f, 600.0f);
+                sm[j] = next_float(1.0f, 100.0f);
+            }
+            for (int c = 0; c < countCount; c++) {
+                int n = counts[c];
+                failures += check(name, kernel, 400.5f, 299.75f, n, eps_sq, &worst);
+                if (n > 0) failures += check(name, kernel, sx[n - 1] + 0.5f, sy[n - 1] - 0.25f, n, eps_sq, &worst);
+            }
+
+            // Coincident points: sources stacked on the target and on each other,
+            // as in a particle's own entry of a gathered list
+            for (int j = 0; j < MAX_SOURCES; j++) {
+                if (j % 3 == 0) {
+                    sx[j] = 100.0f;
+                    sy[j] = 200.0f;
+                } else if (j % 3 == 2) {
+                    sx[j] = sx[j - 1];
+                    sy[j] = sy[j - 1];
+                }
+            }
+            for (int c = 0; c < countCount; c++) {
+                failures += check(name, kernel, 100.0f, 200.0f, counts[c], eps_sq, &worst);
+            }
+        }
+        printf("%-7s largest error %.3g\n", name, worst);
+    }
+
+    // The scalar reference against the original pairwise force: one source at
+    // a range of distances from 1 (the clamp radius) out, then a whole batch
+    // seen from outside the world
+    static const float distances[] = { 1.0f, 1.5f, 2.0f, 3.0f, 5.0f, 10.0f, 100.0f };
+    const int distanceCount = (int)(sizeof(distances) / sizeof(distances[0]));
+    state = 54321u;
+    for (int d = 0; d < distanceCount; d++) {
+        float angle = next_float(0.0f, 6.2831853f);
+        sx[0] = 400.0f + distances[d] * cosf(angle);
+        sy[0] = 300.0f + distances[d] * sinf(angle);
+        sm[0] = next_float(1.0f, 100.0f);
+        failures += check_original(400.0f, 300.0f, 1);
+    }
+    for (int j = 0; j < MAX_SOURCES; j++) {
+        sx[j] = next_float(0.0f, 800.0f);
+        sy[j] = next_float(0.0f, 600.0f);
+        sm[j] = next_float(1.0f, 100.0f);
+    }
+    for (int c = 0; c < countCount; c++) {
+        failures += check_original(-10.0f, -10.0f, counts[c]);
+    }
+    printf("scalar  matches the original pairwise force\n");
+
+    if (failures > 0) {
+        fprintf(stderr, "%d kernel checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
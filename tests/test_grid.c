@@ -0,0 +1,132 @@
+// Checks that the grid solver's gravity range does not depend on the particles'
+// sizes or count, and that non-finite positions cannot stall a grid build.
+// Exits non-zero on failure.
+#include <stdio.h>
+#include <math.h>
+#include "particle.h"
+#include "grid.h"
+#include "quadtree.h"
+
+#define SMALL_SIDE 21
+
+// Largest relative error accepted against the two-body acceleration
+#define TEST_TOLERANCE 1e-5
+
+// Acceleration of body A from body B 50 apart, optionally next to a block of
+// tiny particles far from both. The tiny particles shrink the collision cells
+// to a few pixels; the grid solver must still see B and only B
+static int check_force_range(int withSmall) {
+    static Real x[SMALL_SIDE * SMALL_SIDE + 2], y[SMALL_SIDE * SMALL_SIDE + 2];
+    static Real vx[SMALL_SIDE * SMALL_SIDE + 2], vy[SMALL_SIDE * SMALL_SIDE + 2];
+    static float mass[SMALL_SIDE * SMALL_SIDE + 2];
+    int count = 0;
+
+    x[count] = REAL(400.0);
+    y[count] = REAL(300.0);
+    mass[count++] = 1.0f;
+    x[count] = REAL(450.0);
+    y[count] = REAL(300.0);
+    mass[count++] = 1.0f;
+    if (withSmall) {
+        for (int k = 0; k < SMALL_SIDE * SMALL_SIDE; k++) {
+            x[count] = REAL(1500.0) + (Real)(k % SMALL_SIDE) * REAL(10.0);
+            y[count] = REAL(1500.0) + (Real)(k / SMALL_SIDE) * REAL(10.0);
+            mass[count++] = 0.001f;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        vx[i] = vy[i] = REAL(0.0);
+    }
+
+    set_world_bounds(2000.0f, 2000.0f);
+    set_gravity_solver(SOLVER_GRID);
+    set_barnes_hut_params(BH_DEFAULT_THETA, BH_DEFAULT_SOFTENING);
+    set_block_timestep_params(BLOCK_DEFAULT_ETA, 0);
+    set_reorder_interval(0);
+    set_thread_count(1);
+
+    ParticleSystem* ps = create_particles(0);
+    if (ps == NULL || add_particles(ps, count, x, y, vx, vy, mass, NULL) < 0) {
+        fprintf(stderr, "Failed to create particles\n");
+        free_particles(ps);
+        return 1;
+    }
+    ParticleHandle a = get_particle_handle(ps, 0);
+    update_particles(ps, 1e-6f);
+
+    int slot = find_particle(ps, a);
+    double eps_sq = (double)BH_DEFAULT_SOFTENING * BH_DEFAULT_SOFTENING;
+    double expected = G * 1.0 * 50.0 / pow(50.0 * 50.0 + eps_sq, 1.5);
+    double error = slot >= 0 ? hypot(ps->ax[slot] - expected, ps->ay[slot]) / expected : 1.0;
+    free_particles(ps);
+
+    if (!(error <= TEST_TOLERANCE)) {
+        fprintf(stderr, "grid force range, %s small particles: error %g against the two-body force\n",
+                withSmall ? "with" : "without", error);
+        return 1;
+    }
+    return 0;
+}
+
+// Build both kinds of grid over positions that include NaN, infinities and a
+// box spanning most of the float range; every particle must land in a cell
+static int check_non_finite(void) {
+    static const float positions[][2] = {
+        { 10.0f, 20.0f }, { NAN, 5.0f }, { 30.0f, INFINITY }, { -INFINITY, -INFINITY },
+        { 1e30f, -1e30f }, { -1e30f, 1e30f }, { 40.0f, 40.0f }, { NAN, NAN },
+    };
+    const int count = (int)(sizeof(positions) / sizeof(positions[0]));
+    Real x[8], y[8], v[8];
+    float mass[8];
+    for (int i = 0; i < count; i++) {
+        x[i] = (Real)positions[i][0];
+        y[i] = (Real)positions[i][1];
+        v[i] = REAL(0.0);
+        mass[i] = 1.0f;
+    }
+
+    ParticleSystem* ps = create_particles(0);
+    if (ps == NULL || add_particles(ps, count, x, y, v, v, mass, NULL) < 0) {
+        fprintf(stderr, "Failed to create particles\n");
+        free_particles(ps);
+        return 1;
+    }
+
+    int failures = 0;
+    SpatialGrid grid;
+    init_grid(&grid);
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 0) {
+            build_grid(&grid, ps);
+        } else {
+            build_grid_with_cell_size(&grid, ps, GRID_FORCE_CELL_SIZE);
+        }
+
+        int binned = 0;
+        for (int i = 0; i < count; i++) {
+            binned += grid.particleCell[i] >= 0 && grid.particleCell[i] < grid.cellCount;
+        }
+        if (grid.indexedCount != count || binned != count) {
+            fprintf(stderr, "non-finite positions, %s grid: %d of %d particles indexed, %d binned\n",
+                    pass == 0 ? "collision" : "force", grid.indexedCount, count, binned);
+            failures++;
+        }
+    }
+    free_grid(&grid);
+    free_particles(ps);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    failures += check_force_range(0);
+    failures += check_force_range(1);
+    failures += check_non_finite();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d grid checks failed\n", failures);
+        return 1;
+    }
+    printf("grid ok\n");
+    return 0;
+}